@@ -0,0 +1,131 @@
+/**
+ * \file bounded_queue.h
+ *
+ * Fixed-capacity queue handing work from one thread to another.
+ * When the queue is full the oldest or the newest item is dropped,
+ * so the producer never blocks and the latency of queued work stays bounded.
+ *
+ * \date 10/14/2026
+ */
+#ifndef NATURE_BOUNDED_QUEUE_H
+#define NATURE_BOUNDED_QUEUE_H
+
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include "nature/common/replay_clock.h"
+
+namespace nature {
+namespace common {
+
+template <typename T>
+class BoundedQueue {
+  public:
+    /**
+     * Create a queue
+     * \param capacity Maximum number of queued items
+     * \param drop_oldest If true a push to a full queue drops the oldest item, otherwise the pushed item is dropped
+     */
+    BoundedQueue(int capacity = 2, bool drop_oldest = true){
+      SetCapacity(capacity, drop_oldest);
+    }
+
+    /// Resize the queue, items already queued are discarded
+    void SetCapacity(int capacity, bool drop_oldest){
+      std::lock_guard<std::mutex> lock(mutex_);
+      items_.assign(capacity > 0 ? capacity : 1, T());
+      head_ = 0;
+      size_ = 0;
+      drop_oldest_ = drop_oldest;
+    }
+
+    /**
+     * Add an item, never blocks.
+     * Returns false if an item was dropped to respect the capacity.
+     * \param item The item to add
+     */
+    bool Push(const T &item){
+      bool dropped = false;
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        int capacity = (int)items_.size();
+        if (size_ == capacity){
+          dropped = true;
+          num_dropped_++;
+          if (!drop_oldest_) return false;
+          items_[head_] = T();
+          head_ = (head_ + 1) % capacity;
+          size_--;
+        }
+        items_[(head_ + size_) % capacity] = item;
+        size_++;
+      }
+      cond_.notify_one();
+      return !dropped;
+    }
+
+    /**
+     * Take the oldest item, waiting up to timeout for one to arrive.
+     * Returns false if the queue is still empty or was closed.
+     * On an active replay clock the wait is in replayed time.
+     * \param item The item taken
+     * \param timeout Maximum time to wait
+     */
+    template <typename Rep, typename Period>
+    bool Pop(T &item, const std::chrono::duration<Rep, Period> &timeout){
+      ReplayClock *clock = ReplayClock::Active();
+      if (clock && clock->Participating()){
+        double wait = std::chrono::duration<double>(timeout).count();
+        clock->SleepUntil(clock->Now() + wait, [this]{
+          std::lock_guard<std::mutex> lock(mutex_);
+          return size_ > 0 || closed_;
+        });
+        std::lock_guard<std::mutex> lock(mutex_);
+        return Take(item);
+      }
+      std::unique_lock<std::mutex> lock(mutex_);
+      if (!cond_.wait_for(lock, timeout, [this]{ return size_ > 0 || closed_; })) return false;
+      return Take(item);
+    }
+
+    /// Wake up all waiting consumers, Pop no longer waits
+    void Close(){
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        closed_ = true;
+      }
+      cond_.notify_all();
+    }
+
+    /// Number of items dropped since the queue was created
+    long NumDropped(){
+      std::lock_guard<std::mutex> lock(mutex_);
+      return num_dropped_;
+    }
+
+  private:
+    /// Take the oldest item if there is one, with the queue locked
+    bool Take(T &item){
+      if (size_ == 0) return false;
+      item = items_[head_];
+      items_[head_] = T();
+      head_ = (head_ + 1) % (int)items_.size();
+      size_--;
+      return true;
+    }
+
+    std::vector<T> items_;
+    int head_ = 0;
+    int size_ = 0;
+    bool drop_oldest_ = true;
+    bool closed_ = false;
+    long num_dropped_ = 0;
+    std::mutex mutex_;
+    std::condition_variable cond_;
+};
+
+} // namespace common
+} // namespace nature
+
+#endif //NATURE_BOUNDED_QUEUE_H
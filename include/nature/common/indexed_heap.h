@@ -0,0 +1,146 @@
+/**
+ * \file indexed_heap.h
+ *
+ * 4-ary min-heap of cell indices with decrease-key.
+ * Each index is in the heap at most once, so a search never pops stale
+ * duplicates, and the storage is kept between searches.
+ *
+ * \date 10/14/2026
+ */
+#ifndef NATURE_INDEXED_HEAP_H
+#define NATURE_INDEXED_HEAP_H
+
+#include <vector>
+
+namespace nature {
+namespace common {
+
+template <typename Key>
+class IndexedHeap {
+  public:
+    /// Make room for indices [0,n), empties the heap
+    void Resize(int n){
+      Clear();
+      pos_.assign(n, -1);
+    }
+
+    int NumIndices() const { return (int)pos_.size(); }
+
+    bool Empty() const { return heap_.empty(); }
+
+    int Size() const { return (int)heap_.size(); }
+
+    /// True if index n is in the heap
+    bool Contains(int n) const { return pos_[n] >= 0; }
+
+    /// Index with the smallest key
+    int Top() const { return heap_[0].index; }
+
+    /// Smallest key
+    Key TopKey() const { return heap_[0].key; }
+
+    /// Key of index n, which must be in the heap
+    Key GetKey(int n) const { return heap_[pos_[n]].key; }
+
+    /**
+     * Insert index n, or move it to a new key if it is already in the heap
+     * \param n The index
+     * \param key Its key
+     */
+    void Push(int n, Key key){
+      int p = pos_[n];
+      if (p < 0){
+        p = (int)heap_.size();
+        heap_.push_back(Entry{key, n});
+        pos_[n] = p;
+        SiftUp(p);
+      }
+      else if (key < heap_[p].key){
+        heap_[p].key = key;
+        SiftUp(p);
+      }
+      else{
+        heap_[p].key = key;
+        SiftDown(p);
+      }
+    }
+
+    /// Remove and return the index with the smallest key
+    int Pop(){
+      int n = heap_[0].index;
+      Remove(n);
+      return n;
+    }
+
+    /// Remove index n if it is in the heap
+    void Remove(int n){
+      int p = pos_[n];
+      if (p < 0) return;
+      pos_[n] = -1;
+      int last = (int)heap_.size() - 1;
+      if (p != last){
+        heap_[p] = heap_[last];
+        pos_[heap_[p].index] = p;
+        heap_.pop_back();
+        if (p > 0 && heap_[p].key < heap_[(p - 1)/4].key) SiftUp(p);
+        else SiftDown(p);
+      }
+      else{
+        heap_.pop_back();
+      }
+    }
+
+    /// Empty the heap, in the number of queued indices
+    void Clear(){
+      for (const Entry & e : heap_) pos_[e.index] = -1;
+      heap_.clear();
+    }
+
+  private:
+    struct Entry {
+      Key key;
+      int index;
+    };
+
+    void SiftUp(int p){
+      Entry e = heap_[p];
+      while (p > 0){
+        int parent = (p - 1)/4;
+        if (!(e.key < heap_[parent].key)) break;
+        heap_[p] = heap_[parent];
+        pos_[heap_[p].index] = p;
+        p = parent;
+      }
+      heap_[p] = e;
+      pos_[e.index] = p;
+    }
+
+    void SiftDown(int p){
+      int size = (int)heap_.size();
+      Entry e = heap_[p];
+      while (true){
+        int first = 4*p + 1;
+        if (first >= size) break;
+        int best = first;
+        int end = first + 4 < size ? first + 4 : size;
+        for (int c=first+1;c<end;c++){
+          if (heap_[c].key < heap_[best].key) best = c;
+        }
+        if (!(heap_[best].key < e.key)) break;
+        heap_[p] = heap_[best];
+        pos_[heap_[p].index] = p;
+        p = best;
+      }
+      heap_[p] = e;
+      pos_[e.index] = p;
+    }
+
+    std::vector<Entry> heap_;
+    /// position of each index in heap_, -1 if it isn't queued
+    std::vector<int> pos_;
+};
+
+} // namespace common
+} // namespace nature
+
+#endif //NATURE_INDEXED_HEAP_H
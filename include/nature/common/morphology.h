@@ -0,0 +1,100 @@
+/**
+ * \file morphology.h
+ *
+ * Grid morphology shared by the perception and planning algorithms.
+ * All grids are flat and column-major, cell (i,j) is at i*ny+j,
+ * matching the layout of the nature/occupancy_grid message.
+ *
+ * \date 10/14/2026
+ */
+#ifndef NATURE_MORPHOLOGY_H
+#define NATURE_MORPHOLOGY_H
+
+#include <stdint.h>
+#include <vector>
+
+namespace nature {
+namespace common {
+
+/// Cell index bounds [imin,imax) x [jmin,jmax)
+struct GridRoi {
+    GridRoi(){
+        imin = 0;
+        jmin = 0;
+        imax = 0;
+        jmax = 0;
+    }
+    GridRoi(int imin_, int jmin_, int imax_, int jmax_){
+        imin = imin_;
+        jmin = jmin_;
+        imax = imax_;
+        jmax = jmax_;
+    }
+    /// Clamp the bounds to an nx by ny grid
+    GridRoi Clamp(int nx, int ny) const;
+    /// Smallest roi holding both, an empty roi adds nothing
+    GridRoi Union(const GridRoi &roi) const;
+    /// True if the rois share a cell
+    bool Intersects(const GridRoi &roi) const {
+        return !Empty() && !roi.Empty() && imin < roi.imax && roi.imin < imax && jmin < roi.jmax && roi.jmin < jmax;
+    }
+    bool Empty() const { return imin >= imax || jmin >= jmax; }
+    int imin;
+    int jmin;
+    int imax;
+    int jmax;
+};
+
+/**
+ * Grayscale dilation (max filter) with a (2*rx+1) x (2*ry+1) box.
+ * Uses the separable van Herk/Gil-Werman filter, so the cost per cell
+ * does not depend on the radius. Only cells inside roi are written,
+ * cells within the radius of roi are read. The window is clipped at the grid edge.
+ * src and dst may be the same buffer.
+ * \param src Input grid
+ * \param dst Output grid
+ * \param nx Number of cells in i
+ * \param ny Number of cells in j
+ * \param rx Radius of the box in i
+ * \param ry Radius of the box in j
+ * \param roi Cells to write
+ */
+template <typename T>
+void DilateBox(const T *src, T *dst, int nx, int ny, int rx, int ry, GridRoi roi);
+
+/**
+ * Squared Euclidean distance, in cells, from every cell in roi to the
+ * nearest cell of src with a value above thresh (Felzenszwalb-Huttenlocher,
+ * linear in the number of cells). Only obstacle cells inside roi are seen.
+ * Cells with no obstacle in roi get a very large distance.
+ * \param src Input grid
+ * \param nx Number of cells in i
+ * \param ny Number of cells in j
+ * \param thresh Cells with a value greater than this are obstacles
+ * \param roi Cells to process
+ * \param dist_sqr Output, resized to the roi and stored column-major in roi coordinates
+ */
+template <typename T>
+void DistanceTransform(const T *src, int nx, int ny, T thresh, GridRoi roi, std::vector<float> &dist_sqr);
+
+/**
+ * Binary disk dilation. Cells of roi within radius cells of a cell above
+ * thresh are set to value, the others are copied from src.
+ * Built on DistanceTransform so the cost per cell does not depend on the radius.
+ * src and dst may be the same buffer.
+ * \param src Input grid
+ * \param dst Output grid
+ * \param nx Number of cells in i
+ * \param ny Number of cells in j
+ * \param radius Disk radius in cells
+ * \param thresh Cells with a value greater than this are obstacles
+ * \param value Value written to dilated cells
+ * \param roi Cells to write
+ */
+template <typename T>
+void DilateDisk(const T *src, T *dst, int nx, int ny, float radius, T thresh, T value, GridRoi roi);
+
+} // namespace common
+} // namespace nature
+
+#endif //NATURE_MORPHOLOGY_H
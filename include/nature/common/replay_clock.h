@@ -0,0 +1,136 @@
+/**
+ * \file replay_clock.h
+ *
+ * Simulated time for replaying recorded data through the pipeline stages.
+ * While a clock is active the threads of the stages take turns, only one of them
+ * runs at a time and it runs until it waits for time or for work. The next to run
+ * is the one whose wait ends first, ties go to the thread started first, so a
+ * replay does the same work in the same order on every run however fast the
+ * machine is. Without an active clock the stages run on the wall clock as usual.
+ *
+ * \date 10/14/2026
+ */
+#ifndef NATURE_REPLAY_CLOCK_H
+#define NATURE_REPLAY_CLOCK_H
+
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <thread>
+
+namespace nature {
+namespace common {
+
+class ReplayClock {
+  public:
+    /**
+     * Create the clock and make it the active one, before the stages are started
+     * \param start Time of the clock in seconds
+     */
+    explicit ReplayClock(double start);
+
+    /// Deactivate the clock, after every stage thread left it
+    ~ReplayClock();
+
+    /// The active clock, null when the stages run on the wall clock
+    static ReplayClock *Active();
+
+    /// Time of the clock in seconds
+    double Now();
+
+    /**
+     * Add a thread taking turns, called before the thread is started.
+     * Returns its id, the order of the calls decides the ties.
+     */
+    int Reserve();
+
+    /// First call of a reserved thread, waits for its turn
+    void Enter(int id);
+
+    /// Last call of a thread, passes on its turn
+    void Leave();
+
+    /**
+     * Pass on the turn of the calling thread until the time comes or ready returns true.
+     * ready is called with the clock locked while other threads wait, it must only
+     * take locks the waiting threads do not hold.
+     * \param time Time in seconds to wait for
+     * \param ready Predicate ending the wait early, null to wait for the time
+     */
+    void SleepUntil(double time, std::function<bool()> ready = nullptr);
+
+    /**
+     * Pass on the turn of the calling thread until the thread with the given id left
+     * \param id The id returned by Reserve
+     */
+    void Join(int id);
+
+    /// True when called from a thread taking turns, false from the driver of the replay
+    bool Participating();
+
+    /**
+     * Run the threads until all of them wait past the given time, then set the clock to it.
+     * Called by the driver of the replay, between feeding recorded messages.
+     * \param time Time in seconds to run to
+     */
+    void RunUntil(double time);
+
+    /**
+     * Run the threads until all of them left.
+     * Returns false if the remaining ones wait for work that never comes.
+     */
+    bool RunUntilLeft();
+
+  private:
+    struct Participant {
+      double wake = 0.0;
+      std::function<bool()> ready;
+      int joining = -1;
+      bool left = false;
+    };
+
+    /// Give the turn to the thread whose wait ends first, or to the driver past the limit
+    void PassTurn();
+
+    /// Wait until the given id has the turn
+    void WaitTurn(std::unique_lock<std::mutex> &lock, int id);
+
+    static const int DRIVER = -1;
+    std::vector<Participant> participants_;
+    int running_ = DRIVER;
+    double now_;
+    double limit_;
+    std::mutex mutex_;
+    std::condition_variable cond_;
+};
+
+/**
+ * A thread of a pipeline stage. It takes turns on the active replay clock, when
+ * there is one at its start, otherwise it is a plain std::thread.
+ */
+class ReplayThread {
+  public:
+    ReplayThread() = default;
+
+    /**
+     * Start the thread
+     * \param run Function run by the thread
+     */
+    explicit ReplayThread(std::function<void()> run);
+
+    bool joinable() const { return thread_.joinable(); }
+
+    /// Wait for the thread to finish, a thread taking turns passes on its turn meanwhile
+    void join();
+
+  private:
+    std::thread thread_;
+    ReplayClock *clock_ = nullptr;
+    int id_ = -1;
+};
+
+} // namespace common
+} // namespace nature
+
+#endif //NATURE_REPLAY_CLOCK_H
@@ -0,0 +1,71 @@
+/**
+ * \file triple_buffer.h
+ *
+ * Hands the latest value from one writer thread to one reader thread without a lock.
+ * The writer fills a back buffer and publishes it, the reader takes the newest
+ * published buffer. Neither ever waits for the other and values are not copied
+ * between buffers, only their indices are exchanged. Intermediate values the
+ * reader did not take are overwritten.
+ *
+ * \date 10/14/2026
+ */
+#ifndef NATURE_TRIPLE_BUFFER_H
+#define NATURE_TRIPLE_BUFFER_H
+
+#include <atomic>
+
+namespace nature {
+namespace common {
+
+template <typename T>
+class TripleBuffer {
+  public:
+    TripleBuffer() : back_(0), middle_(1), front_(2) {}
+
+    /**
+     * Apply a function to each of the three buffers, e.g. to reserve their storage.
+     * Not thread safe, call before the writer and the reader start.
+     * \param init Called with a T& for each buffer
+     */
+    template <typename F>
+    void ForEach(F init){
+      for (int k = 0; k < 3; k++) init(buffers_[k]);
+    }
+
+    /// The buffer the writer fills, only used by the writer thread
+    T &Back(){ return buffers_[back_]; }
+
+    /// Publish the back buffer, the writer gets the previously published one to fill next
+    void Publish(){
+      back_ = middle_.exchange(back_ | FRESH, std::memory_order_acq_rel) & INDEX;
+    }
+
+    /**
+     * Take the newest published buffer, only used by the reader thread.
+     * Returns false if nothing was published since the last call, Front is unchanged then.
+     */
+    bool Update(){
+      if (!(middle_.load(std::memory_order_acquire) & FRESH)) return false;
+      front_ = middle_.exchange(front_, std::memory_order_acq_rel) & INDEX;
+      return true;
+    }
+
+    /// The buffer the reader took last, only used by the reader thread
+    const T &Front() const { return buffers_[front_]; }
+
+  private:
+    static const int INDEX = 3;
+    static const int FRESH = 4;
+    T buffers_[3];
+    /// owned by the writer
+    int back_;
+    /// index of the published buffer, with FRESH until the reader takes it
+    std::atomic<int> middle_;
+    /// owned by the reader
+    int front_;
+};
+
+} // namespace common
+} // namespace nature
+
+#endif //NATURE_TRIPLE_BUFFER_H
@@ -0,0 +1,97 @@
+/**
+ * \file fixed_matrix.h
+ *
+ * Small dense matrices with their dimensions fixed at compile time.
+ * They live on the stack, loops over them have constant bounds,
+ * and nothing allocates, so they fit inside the real-time control loop.
+ *
+ * \date 10/14/2026
+ */
+#ifndef NATURE_FIXED_MATRIX_H
+#define NATURE_FIXED_MATRIX_H
+
+#include <cmath>
+
+namespace nature {
+namespace control {
+
+template <int R, int C>
+struct FixedMatrix {
+  double m[R][C];
+
+  static FixedMatrix Zero(){
+    FixedMatrix a;
+    for (int i = 0; i < R; i++) for (int j = 0; j < C; j++) a.m[i][j] = 0.0;
+    return a;
+  }
+
+  static FixedMatrix Identity(){
+    FixedMatrix a = Zero();
+    for (int i = 0; i < R && i < C; i++) a.m[i][i] = 1.0;
+    return a;
+  }
+
+  double &operator()(int i, int j){ return m[i][j]; }
+  double operator()(int i, int j) const { return m[i][j]; }
+  /// Element of a column vector
+  double &operator[](int i){ return m[i][0]; }
+  double operator[](int i) const { return m[i][0]; }
+
+  FixedMatrix operator+(const FixedMatrix &b) const {
+    FixedMatrix a;
+    for (int i = 0; i < R; i++) for (int j = 0; j < C; j++) a.m[i][j] = m[i][j] + b.m[i][j];
+    return a;
+  }
+
+  FixedMatrix operator-(const FixedMatrix &b) const {
+    FixedMatrix a;
+    for (int i = 0; i < R; i++) for (int j = 0; j < C; j++) a.m[i][j] = m[i][j] - b.m[i][j];
+    return a;
+  }
+
+  FixedMatrix operator*(double s) const {
+    FixedMatrix a;
+    for (int i = 0; i < R; i++) for (int j = 0; j < C; j++) a.m[i][j] = s*m[i][j];
+    return a;
+  }
+
+  template <int K>
+  FixedMatrix<R, K> operator*(const FixedMatrix<C, K> &b) const {
+    FixedMatrix<R, K> a;
+    for (int i = 0; i < R; i++){
+      for (int j = 0; j < K; j++){
+        double sum = 0.0;
+        for (int k = 0; k < C; k++) sum += m[i][k]*b.m[k][j];
+        a.m[i][j] = sum;
+      }
+    }
+    return a;
+  }
+
+  FixedMatrix<C, R> Transpose() const {
+    FixedMatrix<C, R> a;
+    for (int i = 0; i < R; i++) for (int j = 0; j < C; j++) a.m[j][i] = m[i][j];
+    return a;
+  }
+};
+
+/**
+ * Invert a 2x2 matrix in closed form.
+ * \param a The matrix to invert
+ * \param inv Set to the inverse
+ * \return False if a is singular
+ */
+inline bool Invert(const FixedMatrix<2, 2> &a, FixedMatrix<2, 2> &inv){
+  double det = a.m[0][0]*a.m[1][1] - a.m[0][1]*a.m[1][0];
+  if (std::fabs(det) < 1.0e-12) return false;
+  inv.m[0][0] = a.m[1][1]/det;
+  inv.m[0][1] = -a.m[0][1]/det;
+  inv.m[1][0] = -a.m[1][0]/det;
+  inv.m[1][1] = a.m[0][0]/det;
+  return true;
+}
+
+} // namespace control
+} // namespace nature
+
+#endif //NATURE_FIXED_MATRIX_H
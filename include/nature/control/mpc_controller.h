@@ -0,0 +1,169 @@
+/**
+* \class MpcController
+*
+* Model-predictive steering and speed control of an Ackermann vehicle.
+* A kinematic bicycle model is optimized over a fixed horizon with
+* iterative LQR (iLQR), the steering and acceleration limits are applied
+* by clamping the controls in the forward pass.
+* The horizon and the matrices are sized at compile time and each solve
+* is warm-started from the previous solution shifted by one step, so a
+* solve allocates nothing and usually converges in one or two iterations.
+*
+* See "Synthesis and stabilization of complex behaviors through online
+* trajectory optimization" by Tassa, Erez and Todorov, IROS 2012
+*
+* \date 10/14/2026
+*/
+#ifndef MPC_CONTROLLER_H
+#define MPC_CONTROLLER_H
+
+#include "nature/control/fixed_matrix.h"
+
+namespace nature {
+namespace control{
+
+class MpcController {
+public:
+	/// Number of steps of the horizon
+	static const int HORIZON = 20;
+	/// State x, y, heading, speed
+	static const int NX = 4;
+	/// Control steering angle, acceleration
+	static const int NU = 2;
+	typedef FixedMatrix<NX, 1> State;
+	typedef FixedMatrix<NU, 1> Control;
+
+	/// Create a controller
+	MpcController();
+
+	/**
+	* Set the wheelbase of the vehicle in meters
+	* \param wb Wheelbase to set
+	*/
+	void SetWheelbase(float wb) { wheelbase_ = wb; }
+
+	/**
+	* Set the max steering angle of the vehicle in radians
+	* \param st Max steering angle
+	*/
+	void SetMaxSteering(float st) { max_steering_angle_ = st; }
+
+	/**
+	* Set the acceleration limits in m/s^2
+	* \param max_accel Largest acceleration
+	* \param max_decel Largest deceleration, positive
+	*/
+	void SetAccelerationLimits(float max_accel, float max_decel) {
+		max_accel_ = max_accel;
+		max_decel_ = max_decel;
+	}
+
+	/// Get the acceleration limits in m/s^2, the deceleration positive
+	void GetAccelerationLimits(float &max_accel, float &max_decel) const {
+		max_accel = max_accel_;
+		max_decel = max_decel_;
+	}
+
+	/**
+	* Set the duration of a step of the horizon in seconds
+	* \param dt The step duration
+	*/
+	void SetTimeStep(float dt) { dt_ = dt; }
+
+	/// Get the duration of a step of the horizon in seconds
+	float GetTimeStep() const { return dt_; }
+
+	/**
+	* Set the cost weights
+	* \param lateral Squared lateral distance to the reference, per m^2
+	* \param heading Squared heading error, per rad^2
+	* \param speed Squared speed error, per (m/s)^2
+	* \param steering Squared steering angle, per rad^2
+	* \param accel Squared acceleration, per (m/s^2)^2
+	*/
+	void SetWeights(float lateral, float heading, float speed, float steering, float accel);
+
+	/**
+	* Set the time after which Solve gives up, in seconds
+	* \param deadline The solve time budget
+	*/
+	void SetDeadline(float deadline) { deadline_ = deadline; }
+
+	/// Set the most iLQR iterations of a solve
+	void SetMaxIterations(int iterations) { max_iterations_ = iterations; }
+
+	/**
+	* Set the reference of step k of the horizon
+	* \param k The step, 1 to HORIZON
+	* \param x Reference x-coordinate in ENU
+	* \param y Reference y-coordinate in ENU
+	* \param heading Reference heading in radians, continuous with the current heading
+	* \param speed Reference speed in m/s
+	*/
+	void SetReference(int k, float x, float y, float heading, float speed);
+
+	/**
+	* Optimize the controls over the horizon from the current state.
+	* \param x0 The current state
+	* \return False if no solution was found within the deadline,
+	* the next solve then starts cold
+	*/
+	bool Solve(const State &x0);
+
+	/// Control of step k of the last solve, 0 to HORIZON-1
+	const Control &GetControl(int k) const { return u_[k]; }
+
+	/// Predicted state of step k of the last solve, 0 to HORIZON
+	const State &GetState(int k) const { return x_[k]; }
+
+	/// Seconds the last solve took
+	float GetSolveTime() const { return solve_time_; }
+
+	/// Forget the previous solution, the next solve starts from zero controls
+	void Reset() { warm_ = false; }
+
+private:
+	/// Next state of the bicycle model
+	State Step(const State &x, const Control &u) const;
+	/// Clamp a control to the steering and acceleration limits
+	void Clamp(Control &u) const;
+	/// Cost of the trajectory x_ under the controls u_
+	double Cost(const State *x, const Control *u) const;
+
+	float wheelbase_; //meters
+	float max_steering_angle_; //radians
+	float max_accel_; // m/s^2
+	float max_decel_; // m/s^2
+	float dt_; // seconds
+	float deadline_; // seconds
+	int max_iterations_;
+
+	double w_lateral_;
+	double w_heading_;
+	double w_speed_;
+	double w_steering_;
+	double w_accel_;
+
+	// reference of steps 1 to HORIZON, index 0 unused
+	double ref_x_[HORIZON + 1];
+	double ref_y_[HORIZON + 1];
+	double ref_heading_[HORIZON + 1];
+	double ref_speed_[HORIZON + 1];
+
+	// current solution and the trial of the line search
+	State x_[HORIZON + 1];
+	Control u_[HORIZON];
+	State x_trial_[HORIZON + 1];
+	Control u_trial_[HORIZON];
+	// feedforward and feedback gains of the backward pass
+	Control k_[HORIZON];
+	FixedMatrix<NU, NX> K_[HORIZON];
+
+	bool warm_;
+	float solve_time_;
+};
+
+} // namespace control
+} // namespace nature
+
+#endif
@@ -19,7 +19,9 @@
 #ifndef PURE_PURSUIT_CONTROLLER_H
 #define PURE_PURSUIT_CONTROLLER_H
 
+#include <vector>
 #include "nature/control/pid_controller.h"
+#include "nature/control/mpc_controller.h"
 #include "nature/node/ros_types.h"
 #include "nature/nature_utils.h"
 
@@ -35,21 +37,59 @@ public:
 	* Calculate a driving command based on a trajectory
 	* The first point on the trajectory must be the current
 	* vehicle state.
+	* Preprocesses the trajectory on each call, use SetPath and GetDcFromPath
+	* when the same trajectory is followed over several calls.
 	* \param traj The desired trajectory
+	* \param goal The look-ahead point steered to
 	*/
-	nature::msg::Twist GetDcFromTraj(nature::msg::Path traj, utils::vec2 & goal);
+	nature::msg::Twist GetDcFromTraj(const nature::msg::Path &traj, utils::vec2 & goal);
+
+	/**
+	* Set the trajectory to follow and preprocess it once: arc lengths,
+	* tangents and curvatures. The progress along it restarts, the MPC
+	* warm start is kept unless the trajectory is empty.
+	* Buffers are reused, so no allocation once they reached the path size.
+	* \param traj The desired trajectory
+	*/
+	void SetPath(const nature::msg::Path &traj);
+
+	/**
+	* Reserve the buffers of SetPath, so paths up to this size never allocate.
+	* \param max_points Largest expected number of path poses
+	*/
+	void ReservePath(int max_points);
+
+	/**
+	* Calculate a driving command along the trajectory of SetPath.
+	* The closest segment and the look-ahead point are tracked from the
+	* previous call, each call costs O(1) amortized and allocates nothing.
+	* \param goal The look-ahead point steered to
+	*/
+	nature::msg::Twist GetDcFromPath(utils::vec2 & goal);
+
+	/// Largest Menger curvature of the trajectory of SetPath, 1/m
+	float GetMaxCurvature() const { return max_curvature_; }
+
+	/// Menger curvature at each inner point of the trajectory of SetPath, 0 at the ends
+	const std::vector<float> &GetCurvatureProfile() const { return curvature_; }
 
 	/**
 	* Set the wheelbase of the vehicle in meters
 	* \param wb Wheelbase to set
 	*/
-	void SetWheelbase(float wb) { wheelbase_ = wb; }
+	void SetWheelbase(float wb) {
+		wheelbase_ = wb;
+		mpc_.SetWheelbase(wb);
+	}
 
 	/**
 	* Set the max steering angle of the vehicle in radians
 	* \param st Max steering angle
 	*/
-	void SetMaxSteering(float st) { max_steering_angle_ = st; }
+	void SetMaxSteering(float st) {
+		max_steering_angle_ = st;
+		mpc_.SetMaxSteering(st);
+	}
 
 	/** 
 	* Set the minimum look-ahead distance of the planner, in meters
@@ -125,7 +165,7 @@ public:
 	 *  Set the vehicle position, orientation and speed
 	 * \param state The vehicle state
 	 */
-	void SetVehicleState(nature::msg::Odometry state);
+	void SetVehicleState(const nature::msg::Odometry &state);
 
 	/**
 	* A scale factor for the output throttle.
@@ -140,6 +180,27 @@ public:
 	*/
 	void IsSkidSteered(bool skid_steered){ skid_steered_ = skid_steered; }
 
+	/**
+	* Call this to turn the model-predictive steering and speed control on or off.
+	* By default it is off and pure pursuit is used. It applies to ackerman
+	* steering only, and a command falls back to pure pursuit when the MPC
+	* solve misses its deadline.
+	*/
+	void UseMpc(bool use_mpc){ use_mpc_ = use_mpc; }
+
+	/**
+	* Set the lateral acceleration the MPC speed reference stays below
+	* along the curvature of the path ahead
+	* \param accel Maximum lateral acceleration in m/s^2
+	*/
+	void SetMaxLateralAccel(float accel){ max_lateral_accel_ = accel; }
+
+	/// Get a pointer to the MPC controller, to set its limits, weights and deadline
+	MpcController *GetMpcController(){ return &mpc_; }
+
+	/// Number of commands that fell back to pure pursuit because the MPC solve failed
+	int GetMpcFallbacks() const { return mpc_fallbacks_; }
+
 	/**
 	* Set the parameters for the skid steering control model.
 	* Kx = Ky = Kl
@@ -159,6 +220,12 @@ private:
 	bool skid_steered_;
 	nature::msg::Twist GetDcAckermann(float alpha, float lookahead, utils::vec2 curr_dir, float target_speed);
 	nature::msg::Twist GetDcSkid(float dx, float dy, float dtheta);
+	/// MPC command along the trajectory, false if the solve failed
+	bool GetDcMpc(nature::msg::Twist &dc, utils::vec2 &goal);
+	/// Throttle of the PID speed controller towards target_speed
+	void SetThrottle(nature::msg::Twist &dc, float target_speed);
+	/// Index of the segment closest to p, from the cursor of the previous call
+	int TrackClosestSegment(utils::vec2 p, float &closest);
 
 	// steering parameters for the skid steered model
 	float kx_;
@@ -175,6 +242,11 @@ private:
 	float throttle_coeff_;
 	PidController speed_controller_;
 
+	bool use_mpc_;
+	MpcController mpc_;
+	float max_lateral_accel_; // m/s^2
+	int mpc_fallbacks_;
+
 	//current vehicle state info
 	float veh_x_;
 	float veh_y_;
@@ -183,6 +255,20 @@ private:
 	float vx_;
 	float vy_;
 	float current_angular_velocity_;
+
+	// preprocessed trajectory
+	/// points of the trajectory
+	std::vector<utils::vec2> path_;
+	/// arc length at each point
+	std::vector<float> arc_length_;
+	/// unit direction of each segment
+	std::vector<utils::vec2> tangent_;
+	std::vector<float> curvature_;
+	float max_curvature_;
+	/// segment closest to the vehicle at the last call, -1 until the first call on a path
+	int closest_seg_;
+	/// segment of the look-ahead point at the last call
+	int lookahead_seg_;
 };
 
 } // namespace control
@@ -127,6 +127,97 @@ inline float GetHeadingFromOrientation(nature::msg::Quaternion orientation){
     return (float)yaw;
 }
 
+/**
+ * Apply a grid patch to a cached grid.
+ * The patch data follows the same column-major (or row-major) ordering as the grid.
+ * Returns false and leaves the grid untouched if the patch doesn't fit it
+ * or is older than the grid.
+ * \param grid The cached grid
+ * \param update The patch
+ * \param row_major True if both the grid and the patch are row-major
+ */
+inline bool ApplyGridUpdate(nature::msg::OccupancyGrid &grid, const nature::msg::OccupancyGridUpdate &update, bool row_major=false){
+	int nx = (int)grid.info.width;
+	int ny = (int)grid.info.height;
+	if (update.x<0 || update.y<0 || update.x + (int)update.width > nx || update.y + (int)update.height > ny ||
+	    update.data.size() != update.width*update.height || update.header.stamp.toSec() < grid.header.stamp.toSec()){
+		return false;
+	}
+	int c = 0;
+	if (row_major){
+		for (int j=update.y;j<update.y+(int)update.height;j++){
+			int8_t *row = &grid.data[j*nx];
+			for (int i=update.x;i<update.x+(int)update.width;i++){
+				row[i] = update.data[c++];
+			}
+		}
+	}
+	else{
+		for (int i=update.x;i<update.x+(int)update.width;i++){
+			int8_t *col = &grid.data[i*ny];
+			for (int j=update.y;j<update.y+(int)update.height;j++){
+				col[j] = update.data[c++];
+			}
+		}
+	}
+	grid.header.stamp = update.header.stamp;
+	return true;
+}
+
+/**
+ * Copy one int8 layer of a layered grid into an occupancy grid.
+ * The grid buffer is reused when the size is unchanged.
+ * Returns false if the layer is missing or the data is the wrong size.
+ * \param layered The layered grid
+ * \param layer Name of the layer
+ * \param grid The grid to fill
+ */
+inline bool LayerToOccupancyGrid(const nature::msg::LayeredGrid &layered, const std::string &layer, nature::msg::OccupancyGrid &grid){
+	size_t ncells = (size_t)layered.info.width*layered.info.height;
+	for (size_t k=0;k<layered.layers.size();k++){
+		if (layered.layers[k] != layer) continue;
+		if (layered.data.size() < (k+1)*ncells) return false;
+		grid.header = layered.header;
+		grid.info = layered.info;
+		grid.data.assign(layered.data.begin() + k*ncells, layered.data.begin() + (k+1)*ncells);
+		return true;
+	}
+	return false;
+}
+
+/**
+ * Latest grid received by a node. A grid message is kept by its pointer, shared
+ * with the subscription, and is only copied when a patch has to be written into it.
+ * The reference returned by Get stays valid until the grid is set or changed again.
+ */
+class ReceivedGrid {
+public:
+	/// Keep a grid message without copying it
+	void Set(const nature::msg::OccupancyGrid::ConstPtr &msg){ msg_ = msg; }
+
+	/// Fill the grid from one layer of a layered grid, false and unchanged if the layer is missing
+	bool SetLayer(const nature::msg::LayeredGrid &layered, const std::string &layer){
+		if (!LayerToOccupancyGrid(layered, layer, owned_)) return false;
+		msg_.reset();
+		return true;
+	}
+
+	/// Apply a patch, copying a shared message first
+	bool ApplyUpdate(const nature::msg::OccupancyGridUpdate &update){
+		if (msg_){
+			owned_ = *msg_;
+			msg_.reset();
+		}
+		return ApplyGridUpdate(owned_, update);
+	}
+
+	const nature::msg::OccupancyGrid &Get() const { return msg_ ? *msg_ : owned_; }
+
+private:
+	nature::msg::OccupancyGrid::ConstPtr msg_;
+	nature::msg::OccupancyGrid owned_;
+};
+
 /// Convert any type to a string with zero padding
 inline std::string ToString(int x, int zero_padding){
   std::stringstream ss;
@@ -0,0 +1,75 @@
+/**
+ * \file latency_trace.h
+ *
+ * Age of the sensor data behind the output of each stage of the pipeline.
+ * The grids, paths and local paths carry the stamp of the newest point cloud
+ * they derive from in their header, so the stamps of a topic never go back.
+ * Outputs that do not derive from a scan, like the repeated static map, carry
+ * a zero stamp and are left out of the totals. A stage keeps that source stamp for its newest
+ * input together with the time it received it, and when it publishes it records
+ * two ages in the stage histograms: "latency.<stage>.hop", from receiving the
+ * input to publishing, and "latency.<stage>.total", from the scan to publishing.
+ *
+ * \date 10/14/2026
+ */
+#ifndef NATURE_LATENCY_TRACE_H
+#define NATURE_LATENCY_TRACE_H
+
+#include "nature/node/node_proxy.h"
+#include "nature/node/stage_timer.h"
+
+namespace nature {
+namespace node {
+
+/// The source of the input of a stage, in seconds of the node clock
+struct TraceStamp {
+  /// stamp of the scan the input derives from, 0 when unknown
+  double source = 0.0;
+  /// when the stage received the input, 0 when unknown
+  double received = 0.0;
+
+  /// Take the source stamp of a received message
+  void Receive(const std_msgs::Header &header, double now){
+    source = seconds_from_header(header);
+    received = now;
+  }
+
+  /// Take the source stamp of an input merged with the older ones, unless it is older than them
+  void ReceiveNewer(const std_msgs::Header &header, double now){
+    double stamp = seconds_from_header(header);
+    if (stamp < source) return;
+    source = stamp;
+    received = now;
+  }
+};
+
+class LatencyTrace {
+ public:
+  /// \param stage The stage name, like "grid" for latency.grid.hop and latency.grid.total
+  explicit LatencyTrace(const std::string &stage)
+    : hop_(RegisterStage("latency." + stage + ".hop")), total_(RegisterStage("latency." + stage + ".total")) {}
+
+  /// Stamp of an output derived from the input, the source stamp or now when it is unknown
+  static ros::Time OutputStamp(const TraceStamp &input, const NodeProxy &node){
+    return input.source > 0.0 ? time_from_seconds(input.source) : node.get_stamp();
+  }
+
+  /**
+   * Record the ages of an output published now
+   * \param input The source of the output
+   * \param now The publish time
+   */
+  void Record(const TraceStamp &input, double now) const {
+    if (input.received > 0.0 && now >= input.received) RecordStage(hop_, (float)(now - input.received));
+    if (input.source > 0.0 && now >= input.source) RecordStage(total_, (float)(now - input.source));
+  }
+
+ private:
+  int hop_;
+  int total_;
+};
+
+} // namespace node
+} // namespace nature
+
+#endif //NATURE_LATENCY_TRACE_H
@@ -6,7 +6,13 @@
 #define AVT_341_NODE_PROXY_H
 
 #include "ros/ros.h"
+#include "ros/callback_queue.h"
 #include "std_msgs/Header.h"
+#include <boost/make_shared.hpp>
+#include <atomic>
+#include <functional>
+#include <memory>
+#include "nature/common/replay_clock.h"
 
 namespace nature {
     namespace node {
@@ -26,8 +32,11 @@ namespace nature {
         template<typename MessageT>
         class Publisher {
         public:
-            explicit Publisher(const std::string &topic_name, int qos, ros::NodeHandle & node) {
-                pub_ = node.advertise<MessageT>(topic_name, qos);
+            /**
+             * \param latch Keep the last message and send it to each subscriber that connects later
+             */
+            explicit Publisher(const std::string &topic_name, int qos, ros::NodeHandle & node, bool latch = false) {
+                pub_ = node.advertise<MessageT>(topic_name, qos, latch);
             }
             Publisher() = default;
 
@@ -35,23 +44,83 @@ namespace nature {
                 pub_.publish(msg);
             }
 
+            /**
+             * Publish without serializing for the subscribers in the same process, they get this message.
+             * It must not be changed after publishing, see reuse_message.
+             */
+            void publish(const boost::shared_ptr<MessageT> &msg) {
+                pub_.publish(msg);
+            }
+
         private:
             ros::Publisher pub_;
         };
 
+        /**
+         * A callback queue served by threads of its own.
+         * The callbacks of the subscriptions created with it run on these threads,
+         * in parallel with spin_some and with the callbacks of other groups,
+         * so they must guard the state they share with the rest of the node.
+         */
+        class CallbackGroup {
+
+        public:
+            /**
+             * Start the threads serving the queue
+             * \param num_threads Number of threads, 0 for one per core
+             */
+            explicit CallbackGroup(int num_threads) : spinner_(num_threads, &queue_) {
+                spinner_.start();
+            }
+
+            ~CallbackGroup() {
+                spinner_.stop();
+            }
+
+            ros::CallbackQueue *queue() { return &queue_; }
+
+        private:
+            ros::CallbackQueue queue_;
+            ros::AsyncSpinner spinner_;
+        };
+
         template<
                 typename MessageT>
         class Subscriber {
 
         public:
-            Subscriber(const std::string & topic_name, uint qos, void(*callback)(const boost::shared_ptr<MessageT const>&), ros::NodeHandle & node) {
-                sub_ptr_ = node.subscribe<MessageT>(topic_name, qos, callback);
+            using Callback = std::function<void(const boost::shared_ptr<MessageT const>&)>;
+
+            /**
+             * \param callback Function, functor or bound member called with each message
+             * \param group Group whose threads run the callback, null to run it in spin_some
+             */
+            Subscriber(const std::string & topic_name, uint qos, const Callback & callback, ros::NodeHandle & node,
+                       std::shared_ptr<CallbackGroup> group = nullptr) : group_(group) {
+                ros::SubscribeOptions options;
+                options.template init<MessageT>(topic_name, qos, boost::function<void(const boost::shared_ptr<MessageT const>&)>(callback));
+                // without a group the queue of the node handle is used
+                if (group_) options.callback_queue = group_->queue();
+                sub_ptr_ = node.subscribe(options);
             }
 
         private:
+            /// kept so the queue outlives the subscription, which is dropped first
+            std::shared_ptr<CallbackGroup> group_;
             ros::Subscriber sub_ptr_;
         };
 
+        /**
+         * The message to fill for the next shared publish. The last one published is reused
+         * once no subscriber holds it anymore, otherwise it is replaced by a new message.
+         * \param msg The message kept by the publishing side between publishes
+         */
+        template<typename MessageT>
+        MessageT &reuse_message(boost::shared_ptr<MessageT> &msg){
+            if (!msg || msg.use_count() > 1) msg = boost::make_shared<MessageT>();
+            return *msg;
+        }
+
         inline double seconds_from_header(std_msgs::Header header){
             return header.stamp.toSec();
         }
@@ -60,6 +129,12 @@ namespace nature {
             return ros::Time(sec);
         }
 
+        /// Now in seconds of the node clock, for code without a NodeProxy like the callbacks
+        inline double now_seconds(){
+            nature::common::ReplayClock *clock = nature::common::ReplayClock::Active();
+            return clock ? clock->Now() : ros::Time::now().toSec();
+        }
+
         inline void inc_seq(std_msgs::Header & header){
           header.seq++;
         }
@@ -76,6 +151,7 @@ namespace nature {
             ros::init(argc,argv,node_name);
         }
 
+        /// Loop rate in node time, in replayed time on an active replay clock
         class Rate {
 
         public:
@@ -83,6 +159,9 @@ namespace nature {
             void sleep();
         private:
             ros::Rate rate_;
+            double period_;
+            /// end of the current cycle on the replay clock
+            double next_;
         };
 
         class NodeProxy {
@@ -91,10 +170,24 @@ namespace nature {
 
             NodeProxy(const std::string &node_name);
 
+            /**
+             * A node running in a nodelet manager, next to other nodes of the process.
+             * Its callbacks go to a queue of its own, so they still run in spin_some on the
+             * thread of the node, as in a standalone node.
+             * \param node_name Name of the node
+             * \param node Handle of the node namespace
+             * \param private_node Handle of the private (~) namespace
+             */
+            NodeProxy(const std::string &node_name, const ros::NodeHandle &node, const ros::NodeHandle &private_node);
+
             template<typename ParameterT>
             bool get_parameter(const std::string &name, ParameterT &parameter_out, const ParameterT default_value) {
-                if (ros::param::has(name)){
-                    ros::param::get(name, parameter_out);
+                // private names are looked up in the namespace of this node, which is not the process one in a nodelet
+                bool is_private = !name.empty() && name[0] == '~';
+                ros::NodeHandle &handle = is_private ? private_node_ : node_;
+                std::string key = is_private ? name.substr(1) : name;
+                if (handle.hasParam(key)){
+                    handle.getParam(key, parameter_out);
                     return true;
                 }else{
                     parameter_out = default_value;
@@ -103,21 +196,64 @@ namespace nature {
             }
 
             template<typename MessageT>
-            std::shared_ptr<Publisher<MessageT>> create_publisher(const std::string &topic_name, int qos) {
-                return std::make_shared<Publisher<MessageT>>(topic_name, qos, node_);
+            std::shared_ptr<Publisher<MessageT>> create_publisher(const std::string &topic_name, int qos, bool latch = false) {
+                return std::make_shared<Publisher<MessageT>>(topic_name, qos, node_, latch);
             }
 
+            /**
+             * Subscribe to a topic
+             * \param callback Function or functor called with each message
+             * \param group Group whose threads run the callback, null to run it in spin_some
+             */
             template<typename MessageT>
-            std::shared_ptr<Subscriber<MessageT>> create_subscription(const std::string &topic_name, uint qos, void(*callback)(const boost::shared_ptr<MessageT const>&)) {
-                return std::make_shared<Subscriber<MessageT>>(topic_name, qos, callback, node_);
+            std::shared_ptr<Subscriber<MessageT>> create_subscription(const std::string &topic_name, uint qos,
+                                                                      const typename Subscriber<MessageT>::Callback &callback,
+                                                                      std::shared_ptr<CallbackGroup> group = nullptr) {
+                return std::make_shared<Subscriber<MessageT>>(topic_name, qos, callback, node_, group);
+            }
+
+            /**
+             * Subscribe to a topic with a member function, the object must outlive the subscription
+             * \param callback Member function called with each message
+             * \param object Object the member function is called on
+             * \param group Group whose threads run the callback, null to run it in spin_some
+             */
+            template<typename MessageT, typename T>
+            std::shared_ptr<Subscriber<MessageT>> create_subscription(const std::string &topic_name, uint qos,
+                                                                      void(T::*callback)(const boost::shared_ptr<MessageT const>&), T *object,
+                                                                      std::shared_ptr<CallbackGroup> group = nullptr) {
+                return create_subscription<MessageT>(topic_name, qos,
+                                                     [callback, object](const boost::shared_ptr<MessageT const> &msg){ (object->*callback)(msg); },
+                                                     group);
+            }
+
+            /**
+             * Create a callback queue with threads of its own, pass it to create_subscription
+             * to run those callbacks off the thread of spin_some.
+             * Null on an active replay clock, the callbacks then run in spin_some in turn with the stages.
+             * \param num_threads Number of threads, 0 for one per core
+             */
+            std::shared_ptr<CallbackGroup> create_callback_group(int num_threads = 1) {
+                if (nature::common::ReplayClock::Active()) return nullptr;
+                return std::make_shared<CallbackGroup>(num_threads);
             }
 
             ros::Time get_stamp() const;
             double get_now_seconds() const;
             void spin_some();
 
+            /// False once ROS shuts down or this node is asked to stop
+            bool ok() const { return ros::ok() && !shutdown_; }
+
+            /// Ask the loop of this node to stop, used when a nodelet is unloaded
+            void shutdown() { shutdown_ = true; }
+
         private:
             ros::NodeHandle node_;
+            ros::NodeHandle private_node_;
+            /// callbacks of a node sharing the process, null for a standalone node using the global queue
+            std::shared_ptr<ros::CallbackQueue> queue_;
+            std::atomic<bool> shutdown_;
         };
 
         inline std::shared_ptr<NodeProxy> make_shared(const std::string &name) {
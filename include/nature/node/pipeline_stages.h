@@ -0,0 +1,35 @@
+/**
+ * \file pipeline_stages.h
+ *
+ * Entry points of the pipeline stages, shared by the node executables and the nodelets.
+ * Each runs the loop of its stage on the calling thread until the node stops.
+ * The state of a stage is global to its translation unit, so a process runs
+ * each stage at most once.
+ *
+ * \date 10/14/2026
+ */
+#ifndef NATURE_PIPELINE_STAGES_H
+#define NATURE_PIPELINE_STAGES_H
+
+#include <memory>
+#include "nature/node/node_proxy.h"
+
+namespace nature {
+namespace node {
+
+/// Elevation grid from the point clouds, nature_perception_node.cpp
+int RunPerception(std::shared_ptr<NodeProxy> n);
+
+/// Global path to the waypoints, nature_global_path_node.cpp
+int RunGlobalPath(std::shared_ptr<NodeProxy> n);
+
+/// Local path along the global path, nature_local_planner_node.cpp
+int RunLocalPlanner(std::shared_ptr<NodeProxy> n);
+
+/// Driving commands along the local path, nature_control_node.cpp
+int RunControl(std::shared_ptr<NodeProxy> n);
+
+} // namespace node
+} // namespace nature
+
+#endif //NATURE_PIPELINE_STAGES_H
@@ -14,6 +14,7 @@
 #include "geometry_msgs/Twist.h"
 #include "geometry_msgs/Point32.h"
 #include "geometry_msgs/Quaternion.h"
+#include "geometry_msgs/Pose.h"
 #include "geometry_msgs/PoseStamped.h"
 #include "geometry_msgs/PointStamped.h"
 
@@ -21,6 +22,10 @@
 #include "nav_msgs/Path.h"
 #include "nav_msgs/Odometry.h"
 
+#include "map_msgs/OccupancyGridUpdate.h"
+
+#include "nature/LayeredGrid.h"
+
 #include "visualization_msgs/Marker.h"
 #include "visualization_msgs/MarkerArray.h"
 
@@ -56,6 +61,9 @@ namespace nature {
         using Point = geometry_msgs::Point;
         using PointPtr = const geometry_msgs::Point::ConstPtr &;
 
+        using Pose = geometry_msgs::Pose;
+        using PosePtr = const geometry_msgs::Pose::ConstPtr &;
+
         using PoseStamped = geometry_msgs::PoseStamped;
         using PoseStampedPtr = const geometry_msgs::PoseStamped::ConstPtr &;
 
@@ -65,6 +73,12 @@ namespace nature {
         using OccupancyGrid = nav_msgs::OccupancyGrid;
         using OccupancyGridPtr = const nav_msgs::OccupancyGrid::ConstPtr &;
 
+        using OccupancyGridUpdate = map_msgs::OccupancyGridUpdate;
+        using OccupancyGridUpdatePtr = const map_msgs::OccupancyGridUpdate::ConstPtr &;
+
+        using LayeredGrid = nature::LayeredGrid;
+        using LayeredGridPtr = const nature::LayeredGrid::ConstPtr &;
+
         using Path = nav_msgs::Path;
         using PathPtr = const nav_msgs::Path::ConstPtr &;
 
@@ -0,0 +1,40 @@
+#ifndef STAGE_DIAGNOSTICS_H
+#define STAGE_DIAGNOSTICS_H
+
+#include "nature/node/node_proxy.h"
+#include "nature/node/stage_timer.h"
+#include "diagnostic_msgs/DiagnosticArray.h"
+
+namespace nature {
+    namespace node {
+
+        /**
+         * Publishes the stage timings of the process on the diagnostics topic,
+         * one status per stage with its sample count and p50, p99 and max in milliseconds.
+         * The timings are those of the whole process, so when stages share a process as
+         * nodelets only the first StageDiagnostics created publishes them.
+         * The total sensor data ages of the latency traces, latency.<stage>.total, are reported
+         * as warnings when their p99 exceeds the /latency_budget parameter, 0.15 s by default.
+         */
+        class StageDiagnostics{
+            public:
+                static std::shared_ptr<StageDiagnostics> make_shared(const std::string & node_name, double period, std::shared_ptr<NodeProxy> node);
+                StageDiagnostics(const std::string & node_name, double period, std::shared_ptr<NodeProxy> node);
+                ~StageDiagnostics();
+                /// Publish the stages timed since the last publish once the period elapsed, a period of 0 never publishes
+                void update();
+            private:
+                std::string node_name_;
+                double period_;
+                double latency_budget_;
+                bool owner_;
+                double last_publish_;
+                std::shared_ptr<NodeProxy> node_;
+                std::shared_ptr<nature::node::Publisher<diagnostic_msgs::DiagnosticArray>> pub_;
+                std::vector<StageSummary> summaries_;
+                diagnostic_msgs::DiagnosticArray msg_;
+        };
+
+    }
+}
+#endif //STAGE_DIAGNOSTICS_H
@@ -0,0 +1,81 @@
+/**
+ * \file stage_timer.h
+ *
+ * Scoped timers for the stages of the processing pipelines.
+ * Each thread records its samples in its own fixed ring, so timing a stage
+ * takes no lock and no allocation. A collector drains the rings into
+ * log-scale histograms and reports p50, p99 and max per stage.
+ * Does not depend on ROS, the library code times its stages with it.
+ *
+ * \date 10/14/2026
+ */
+#ifndef NATURE_STAGE_TIMER_H
+#define NATURE_STAGE_TIMER_H
+
+#include <string>
+#include <vector>
+#include <chrono>
+
+namespace nature {
+namespace node {
+
+/// Most stages a process can register
+static const int MAX_STAGES = 64;
+
+/**
+ * Register a named stage, registering the same name again returns the same id.
+ * Call once, e.g. to initialize a static, not on the hot path.
+ * \param name The stage name, like "local.selection"
+ * \return The stage id, -1 when MAX_STAGES are already registered
+ */
+int RegisterStage(const std::string &name);
+
+/**
+ * Record one sample of a stage in the ring of the calling thread.
+ * The sample is dropped while the ring is full.
+ * \param stage The stage id, ignored when negative
+ * \param seconds The duration
+ */
+void RecordStage(int stage, float seconds);
+
+/// Times the scope it lives in, or until Stop, as one sample of a stage
+class ScopedTimer {
+ public:
+  explicit ScopedTimer(int stage) : stage_(stage), start_(std::chrono::steady_clock::now()) {}
+  ~ScopedTimer(){ Stop(); }
+
+  /// Record the sample now instead of at the end of the scope
+  void Stop(){
+    if (stage_ < 0) return;
+    RecordStage(stage_, std::chrono::duration<float>(std::chrono::steady_clock::now() - start_).count());
+    stage_ = -1;
+  }
+
+ private:
+  ScopedTimer(const ScopedTimer &);
+  ScopedTimer &operator=(const ScopedTimer &);
+  int stage_;
+  std::chrono::steady_clock::time_point start_;
+};
+
+/// Durations of a stage since the last collection, seconds
+struct StageSummary {
+  std::string name;
+  int count;
+  float p50;
+  float p99;
+  float max;
+};
+
+/**
+ * Drain the rings of all the threads and summarize the stages with samples.
+ * The histograms restart after each call, so every summary covers one period.
+ * \param summaries The stages timed since the last call, in registration order
+ * \return Number of samples dropped on full rings since the last call
+ */
+int CollectStages(std::vector<StageSummary> &summaries);
+
+} // namespace node
+} // namespace nature
+
+#endif //NATURE_STAGE_TIMER_H
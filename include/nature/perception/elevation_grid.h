@@ -12,26 +12,74 @@
  */
 #include <vector>
 #include <limits>
+#include <math.h>
 #include <string>
+#include <unordered_map>
 #include "nature/node/ros_types.h"
+#include "nature/perception/pose_buffer.h"
 
 namespace nature{
 namespace perception{
 
-struct Cell{
-    float low = std::numeric_limits<float>::max();
-    float high = std::numeric_limits<float>::lowest();
-    float highest = std::numeric_limits<float>::lowest();
-    float second_highest = std::numeric_limits<float>::lowest();
-    float height = 0.0f;
-    bool filled = false;
-    //float slope_x = 0.0f;
-    //float slope_y = 0.0f;
-    float slope = 0.0f;
-    bool obstacle = false;
-    bool has_dilated = false;
-    uint8_t dilated_val = 0;
-    float terrain = 0.0f;
+/// Per-cell state bits stored in the flags layer of the grid
+enum CellFlags : uint8_t {
+    CELL_FILLED = 1,
+    CELL_OBSTACLE = 2,
+    CELL_HAS_DILATED = 4,
+    CELL_DIRTY = 8
+};
+
+/**
+ * Transform and range gates applied to each point of a PointCloud2
+ * before it is binned. The defaults keep every point in place.
+ */
+struct ScanFilter {
+    /// row-major rotation from the cloud frame to the grid frame
+    float rot[9] = {1.0f, 0.0f, 0.0f, 0.0f, 1.0f, 0.0f, 0.0f, 0.0f, 1.0f};
+    /// translation from the cloud frame to the grid frame
+    float origin[3] = {0.0f, 0.0f, 0.0f};
+    /// row-major rotation and translation of the sensor mount, applied before rot/origin or the deskew poses
+    float sensor_rot[9] = {1.0f, 0.0f, 0.0f, 0.0f, 1.0f, 0.0f, 0.0f, 0.0f, 1.0f};
+    float sensor_origin[3] = {0.0f, 0.0f, 0.0f};
+    /// position the range gates are measured from, in the grid frame
+    float robot[3] = {0.0f, 0.0f, 0.0f};
+    /// points higher than this in the grid frame are dropped
+    float max_z = std::numeric_limits<float>::max();
+    /// squared range limits, points outside (min, max) are dropped
+    float min_range_sqr = 0.0f;
+    float max_range_sqr = std::numeric_limits<float>::max();
+    /// if set and the cloud has time_field, each point is transformed by the pose at its own time instead of rot/origin
+    const PoseBuffer *deskew_poses = nullptr;
+    /// per-point time field, time_scale*value is seconds relative to stamp
+    std::string time_field = "time";
+    double time_scale = 1.0;
+    /// cloud stamp in seconds
+    double stamp = 0.0;
+    /// points within the same bin share one interpolated pose
+    double deskew_bin = 0.001;
+};
+
+/**
+ * Running sums of the points binned in a cell, x and y relative to the cell center.
+ * A least squares plane and its residual come from the sums in O(1),
+ * so no points have to be stored.
+ */
+struct CellStats {
+    double n = 0.0;
+    double sx = 0.0, sy = 0.0, sz = 0.0;
+    double sxx = 0.0, sxy = 0.0, syy = 0.0;
+    double sxz = 0.0, syz = 0.0, szz = 0.0;
+
+    void Add(float x, float y, float z);
+
+    /**
+     * Fit z = dzdx*x + dzdy*y + c.
+     * Returns false with fewer than 3 points or when they are collinear.
+     * \param dzdx Slope along x
+     * \param dzdy Slope along y
+     * \param roughness RMS distance of the points to the plane in z
+     */
+    bool Fit(float &dzdx, float &dzdy, float &roughness) const;
 };
 
 class ElevationGrid{
@@ -48,6 +96,29 @@ class ElevationGrid{
      */
     std::vector<nature::msg::Point32> AddPoints(nature::msg::PointCloud &point_cloud);
 
+    /**
+     * Add points to be processed, writing only the requested outputs.
+     * The output vectors are cleared and refilled, so buffers kept by the
+     * caller are reused without reallocating. Pass nullptr to skip an output,
+     * with both nullptr the points are only binned.
+     * \param point_cloud PointCloud message
+     * \param obstacle_points Filled with the obstacle points, may be nullptr
+     * \param surface_points Filled with the surface points, may be nullptr
+     */
+    void AddPoints(const nature::msg::PointCloud &point_cloud, std::vector<nature::msg::Point32> *obstacle_points,
+                   std::vector<nature::msg::Point32> *surface_points);
+
+    /**
+     * Add points straight from a PointCloud2 buffer.
+     * x/y/z and the optional segmentation field are read by offset,
+     * transformed, filtered and binned in a single pass without
+     * building intermediate point containers.
+     * Returns false if the cloud has no usable x/y/z fields.
+     * \param cloud PointCloud2 message
+     * \param filter Transform and range gates applied to every point
+     */
+    bool AddPoints(const nature::msg::PointCloud2 &cloud, const ScanFilter &filter);
+
     bool has_segmentation() const { return has_segmentation_; }
 
     void SetSize(float s){
@@ -71,16 +142,57 @@ class ElevationGrid{
         thresh_ = tr;
     }
 
+    /**
+     * Number of threads used to ingest points.
+     * Points of a scan are transformed in parallel, then each thread bins the
+     * points that fall in its own block of cells.
+     * \param num_threads Thread count, 1 disables threading
+     */
+    void SetNumThreads(int num_threads){ num_threads_ = num_threads > 0 ? num_threads : 1; }
+
     void SetPersistentObstacles(bool persist){ persistent_obstacles_ = persist; }
 
+    /**
+     * Let persistent obstacles expire when none of their points was seen for
+     * decay seconds of scan time. Expired cells are dropped lazily, like a clear.
+     * Clears the grid.
+     * \param decay Expiry in seconds, 0 to keep obstacles forever
+     */
+    void SetObstacleDecay(double decay){
+        obstacle_decay_ = decay;
+        ResizeGrid();
+    }
+
     void SetStitchPoints(bool stitch_points){ stitch_points_ = stitch_points; }
 
     void SetFilterHighest(bool filter_high){ filter_highest_ = filter_high; }
 
+    /**
+     * Reduce each PointCloud2 scan to a few representatives per grid cell before binning.
+     * A cell only keeps its lowest and highest filtered points, plus the second
+     * highest when filter_highest is set, so the grid is unchanged while the
+     * binning work scales with the touched cells instead of the points.
+     * \param voxel_filter True to enable the reduction
+     */
+    void SetVoxelFilter(bool voxel_filter){ voxel_filter_ = voxel_filter; }
+
+    /**
+     * Keep running point sums (CellStats) in every cell, updated in O(1) per point while binning.
+     * GetLayeredGrid then also exports the plane-fit slope, the roughness and the step height.
+     * Disables SetVoxelFilter, which would drop points from the sums.
+     * \param terrain_stats True to keep the sums
+     */
+    void SetTerrainStats(bool terrain_stats);
+
     void SetUseElevation(bool use_elevation){
         use_elevation_ = use_elevation;
     }
 
+    /**
+     * Empty the grid. Advances the generation counter instead of touching the
+     * cells, each cell is reset on its first touch after the clear.
+     * Sparse grids without persistent obstacles drop their tiles instead.
+     */
     void ClearGrid();
 
     void UseDilation(bool use_dil){
@@ -89,11 +201,124 @@ class ElevationGrid{
 
     nature::msg::OccupancyGrid GetGrid(bool row_major=false, bool is_segmentation=false);
 
+    /**
+     * Fill an existing message with the grid, reusing its data buffer
+     * \param grid The message to fill
+     * \param row_major Store the data row-major instead of column-major
+     * \param is_segmentation Fill with the segmentation layer instead of occupancy
+     */
+    void GetGrid(nature::msg::OccupancyGrid &grid, bool row_major=false, bool is_segmentation=false);
+
+    /**
+     * Fill an existing message with any window of the grid.
+     * Cells of the window outside the grid (or never observed in a sparse grid) are 0.
+     * \param grid The message to fill
+     * \param llx Lower left x of the window
+     * \param lly Lower left y of the window
+     * \param width Width of the window
+     * \param height Height of the window
+     * \param row_major Store the data row-major instead of column-major
+     * \param is_segmentation Fill with the segmentation layer instead of occupancy
+     */
+    void GetGrid(nature::msg::OccupancyGrid &grid, float llx, float lly, float width, float height, bool row_major=false, bool is_segmentation=false);
+
+    /**
+     * Fill a patch with the bounding box of the cells changed since the last ResetChanges.
+     * x/y are the cell offsets of the patch in the grid, the data follows the same
+     * ordering as GetGrid with the same row_major flag.
+     * Returns false if no cell changed.
+     * \param update The patch to fill
+     * \param row_major Store the data row-major instead of column-major
+     * \param is_segmentation Fill with the segmentation layer instead of occupancy
+     */
+    bool GetGridUpdate(nature::msg::OccupancyGridUpdate &update, bool row_major=false, bool is_segmentation=false);
+
+    /**
+     * Fill a layered grid message with the occupancy layer, the segmentation
+     * layer when the clouds carry one and optionally the height and slope,
+     * all in one pass over the cells. Buffers are reused when the size is unchanged.
+     * \param grid The message to fill
+     * \param float_layers Also fill the height and slope float layers, plus plane_slope, roughness and step with SetTerrainStats
+     */
+    void GetLayeredGrid(nature::msg::LayeredGrid &grid, bool float_layers=false);
+
+    /// True if any cell changed since the last ResetChanges
+    bool HasChanges() const { return full_change_ || change_imin_ <= change_imax_; }
+
+    /// True if the whole grid changed (clear, resize or recenter) and a patch can't describe it
+    bool FullChange() const { return full_change_; }
+
+    /// Mark the current state as published
+    void ResetChanges();
+
     void SetCorner(float llx, float lly){
         llx_ = llx;
         lly_ = lly;
+        origin_x_ = (int)floor(llx_/res_);
+        origin_y_ = (int)floor(lly_/res_);
+        if (sparse_){
+            // sparse cells sit on the global cell lattice
+            llx_ = origin_x_*res_;
+            lly_ = origin_y_*res_;
+        }
     }
 
+    /**
+     * Use the grid as a rolling window that follows the vehicle.
+     * Storage is indexed toroidally so Recenter never reallocates or copies.
+     * \param scrolling True to enable the rolling window
+     */
+    void SetScrolling(bool scrolling){ scrolling_ = scrolling; }
+
+    bool scrolling() const { return scrolling_; }
+
+    /**
+     * Store the grid as fixed-size tiles allocated on first touch, so memory
+     * scales with the observed area instead of the grid bounds.
+     * Points are binned wherever they fall; the size and corner only set the
+     * window exported by GetGrid. Clears the grid.
+     * \param sparse True to use tiles
+     */
+    void SetSparse(bool sparse){
+        sparse_ = sparse;
+        ResizeGrid();
+    }
+
+    bool sparse() const { return sparse_; }
+
+    /// Number of allocated tiles in a sparse grid
+    int NumTiles() const { return (int)tile_x_.size(); }
+
+    /**
+     * Save the grid state to a versioned binary file that Load can map back.
+     * The file is written next to the target and renamed over it, so a
+     * reader never sees a partial file.
+     * Returns false on I/O errors.
+     * \param fname The file to write
+     */
+    bool Save(const std::string &fname) const;
+
+    /**
+     * Restore the grid state saved by Save.
+     * The file is memory-mapped and each layer is copied in one block.
+     * The grid must have the same resolution and mode (dense or sparse) as
+     * the saved one, a dense grid must also have the same size and, unless
+     * it scrolls, the same corner.
+     * Returns false, leaving the grid unchanged, if the file is missing,
+     * of another version, or doesn't match.
+     * \param fname The file to read
+     */
+    bool Load(const std::string &fname);
+
+    /**
+     * Move the rolling window so it is centered on (x,y).
+     * Only the rows/columns that scroll into the window are cleared.
+     * Does nothing if scrolling is disabled.
+     * \param x Vehicle x position in the grid frame
+     * \param y Vehicle y position in the grid frame
+     */
+    void Recenter(float x, float y);
+
     void SetDilation(bool grid_dilate, float grid_dilate_x, float grid_dilate_y, float grid_dilate_proportion){
         dilate_ = grid_dilate;
         grid_dilate_x_ = grid_dilate_x;
@@ -103,10 +328,112 @@ class ElevationGrid{
 
 
   private:
-    uint8_t GetGridCellValue(const Cell & cell) const;
+    uint8_t GetGridCellValue(int n) const;
+    /// value of cell n from its layers, ignoring the generation stamp
+    uint8_t CellValue(int n) const;
+    /// true if cell n is from before the last clear (or has expired) and reads as empty
+    bool Stale(int n) const;
+    /// reset cell n if it's stale and stamp it with the current generation
+    void Touch(int n);
+    /// set the stamp of the scan being added, the cells restored by Load age from the first one
+    void SetScanTime(double stamp);
     void ResizeGrid();
+    void ResetCell(int n);
     void FillImage();
-    std::vector< std::vector<Cell> > cells_;
+    int PointCell(float x, float y);
+    /// storage index of the cell at window index (i,j), -1 if it isn't stored
+    int CellAt(int i, int j) const;
+    /// like CellAt but allocates the tile of a sparse grid
+    int CellAtAlloc(int i, int j);
+    /// window index of storage cell n
+    void WindowIndex(int n, int &i, int &j) const;
+    int8_t ExportValue(int n, bool is_segmentation) const;
+    void ExportWindow(std::vector<int8_t> &data, int i0, int j0, int w, int h, bool row_major, bool is_segmentation) const;
+    /// call f(c, n) for the c-th cell of a window in column-major order, n is its storage index or -1
+    template <typename F>
+    void ForEachWindowCell(int i0, int j0, int w, int h, F f) const;
+    /// bin point k of the current scan into storage cell n
+    void BinCell(int n, int k, bool has_seg, std::vector<int> &dirty);
+    /// position of (x,y) relative to the center of its cell
+    void PointOffset(float x, float y, float &ox, float &oy) const;
+    void ResizeScanOffsets(int npoints);
+    void BinScanPoints(int npoints, bool has_seg);
+    int ReduceScanPoints(int npoints, bool has_seg);
+    void UpdateTouchedCells();
+    void MarkChanged(int imin, int imax, int jmin, int jmax);
+    void ResetColumn(int si);
+    void ResetRow(int sj);
+    int CellIndex(int i, int j) const { return i*ny_ + j; }
+    /// storage index of the cell at window index (i,j), wrapping on the ring offsets
+    int StorageIndex(int i, int j) const { return CellIndex(Wrap(i + ring_x_, nx_), Wrap(j + ring_y_, ny_)); }
+    static int Wrap(int i, int n) { int w = i % n; return w < 0 ? w + n : w; }
+
+    // Cell storage is structure-of-arrays, column-major (i*ny+j) to match GetGrid.
+    // Sparse grids store each tile column-major in its own slot instead, see CellAt.
+    // Storage indices are offset from window indices by ring_x_/ring_y_, see StorageIndex.
+    // When filter_highest_ is set, high_ holds the second highest point.
+    std::vector<float> low_;
+    std::vector<float> high_;
+    std::vector<float> highest_;
+    std::vector<float> slope_;
+    std::vector<float> terrain_;
+    std::vector<uint8_t> dilated_val_;
+    std::vector<uint8_t> flags_;
+    /// generation of the last write to each cell, cells from older generations are empty
+    std::vector<uint32_t> stamp_;
+    uint32_t generation_ = 0;
+    /// scan time each cell was last hit, only with obstacle_decay_
+    std::vector<double> seen_;
+    /// true while the cells restored by Load wait for the time of the first scan
+    bool restored_unseen_ = false;
+    double obstacle_decay_ = 0.0;
+    /// stamp of the scan being added
+    double scan_time_ = 0.0;
+    /// cells touched since the last slope pass
+    std::vector<int> dirty_cells_;
+    /// cells that crossed the slope threshold in the last slope pass
+    std::vector<int> cells_to_dilate_;
+    /// storage cell (-1 if dropped), height and segmentation of each point of the current scan
+    std::vector<int> scan_cells_;
+    std::vector<float> scan_z_;
+    std::vector<float> scan_seg_;
+    /// offsets of each point of the current scan from its cell center, only with terrain_stats_
+    std::vector<float> scan_ox_;
+    std::vector<float> scan_oy_;
+    bool terrain_stats_ = false;
+    /// per-cell running sums, empty unless terrain_stats_
+    std::vector<CellStats> stats_;
+    /// kept points of the batch kernel, per chunk of the scan, and the chunk offsets
+    std::vector<float> batch_x_;
+    std::vector<float> batch_y_;
+    std::vector<float> batch_z_;
+    std::vector<int> batch_index_;
+    std::vector<int> chunk_count_;
+    /// ReduceScanPoints state: slot of each storage cell (-1 if untouched) and per-slot extremes
+    bool voxel_filter_ = false;
+    std::vector<int> voxel_slot_;
+    std::vector<int> voxel_cells_;
+    std::vector<int> voxel_count_;
+    std::vector<float> voxel_min_;
+    std::vector<float> voxel_max_;
+    std::vector<float> voxel_second_;
+    std::vector<float> voxel_seg_;
+    /// per-thread dirty lists, merged after binning
+    std::vector<std::vector<int>> thread_dirty_;
+    /// points of each (chunk, cell block) and the scan points sorted by cell block, for threaded binning
+    std::vector<int> block_counts_;
+    std::vector<int> block_points_;
+    int num_threads_ = 1;
+    /// window-index bounding box of the cells changed since the last ResetChanges
+    int change_imin_ = std::numeric_limits<int>::max();
+    int change_imax_ = std::numeric_limits<int>::lowest();
+    int change_jmin_ = std::numeric_limits<int>::max();
+    int change_jmax_ = std::numeric_limits<int>::lowest();
+    bool full_change_ = true;
+    /// scratch patch for dilation
+    std::vector<uint8_t> dilate_patch_;
+    /// per-bin rotation (9) and origin (3) used when deskewing a scan
+    std::vector<float> deskew_table_;
     float width_;
     float height_;
     float res_;
@@ -126,6 +453,20 @@ class ElevationGrid{
     const uint8_t GRID_MAX_VALUE = 100;
     const float GRID_SLOPE_MULT = 50.0f;
     bool has_segmentation_ = false;
+    bool scrolling_ = false;
+    bool sparse_ = false;
+    static const int TILE_SIZE = 64;
+    /// tile coordinates -> tile slot, the cells of slot k are stored at [k*TILE_SIZE^2, (k+1)*TILE_SIZE^2)
+    std::unordered_map<int64_t, int> tiles_;
+    /// tile coordinates of each slot
+    std::vector<int> tile_x_;
+    std::vector<int> tile_y_;
+    /// lower-left corner of the window in global cell units (scrolling mode)
+    int origin_x_ = 0;
+    int origin_y_ = 0;
+    /// storage column/row currently holding window column/row 0
+    int ring_x_ = 0;
+    int ring_y_ = 0;
 };
 
 } // namespace perception
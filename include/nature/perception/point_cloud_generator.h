@@ -1,14 +1,40 @@
 #ifndef NATURE_POINT_CLOUD_GENERATOR_H
 #define NATURE_POINT_CLOUD_GENERATOR_H
 
+#include <stdint.h>
 #include "nature/nature_utils.h"
 
 namespace  nature {
   namespace perception {
+    /**
+    * Packs points into PointCloud2 messages.
+    * The fields are written straight into the data of the message, which is resized
+    * in place, so converting clouds of the same size into the same message reuses its
+    * buffer. The header is left to the caller.
+    */
     class PointCloudGenerator {
       public:
+        /// Optional fields of each point, null vectors are left out of the message
+        struct PointChannels {
+          /// "segmentation" label, written as FLOAT32
+          const std::vector<int> *segmentation = nullptr;
+          /// "intensity", FLOAT32
+          const std::vector<float> *intensity = nullptr;
+          /// "time" in seconds from the cloud stamp, FLOAT32
+          const std::vector<float> *time = nullptr;
+          /// "ring", the beam of the point, UINT16
+          const std::vector<uint16_t> *ring = nullptr;
+        };
+
         static void toROSMsg(const std::vector<nature::utils::vec3> & points, nature::msg::PointCloud2 & out_point_cloud);
         static void toROSMsg(const std::vector<nature::utils::vec3> & points, const std::vector<int> & seg_values, nature::msg::PointCloud2 & out_point_cloud);
+        /**
+        * Pack x, y, z and the given channels, in that order, each channel must have one value per point
+        * \param points The point positions
+        * \param channels The optional fields, a channel of the wrong size is left out with a warning
+        * \param out_point_cloud The message to fill
+        */
+        static void toROSMsg(const std::vector<nature::utils::vec3> & points, const PointChannels & channels, nature::msg::PointCloud2 & out_point_cloud);
     };
   }
 }
@@ -0,0 +1,44 @@
+/**
+ * \file point_kernels.h
+ *
+ * Batch kernels for lidar points stored in PointCloud2 buffers.
+ * Vectorized with AVX2, SSE2 or NEON when the compiler targets them,
+ * with a scalar fallback giving the same results.
+ *
+ * \date 10/14/2026
+ */
+#ifndef NATURE_POINT_KERNELS_H
+#define NATURE_POINT_KERNELS_H
+
+#include <stdint.h>
+
+namespace nature{
+namespace perception{
+
+/**
+ * Transform a batch of points by a pose and apply the point gates in one pass.
+ * A point is dropped if x and y are both 0, x is NaN, the transformed z is at or
+ * above max_z, or its squared distance to robot is outside (min_range_sqr, max_range_sqr).
+ * Kept points are written compacted and in order, without a branch per point.
+ * Returns the number of kept points.
+ * \param data Address of the x field of the first point, y and z follow as floats
+ * \param point_step Bytes between consecutive points
+ * \param n Number of points
+ * \param T Transform, 9 row-major rotation then 3 origin
+ * \param robot Position the range gates are measured from
+ * \param max_z Points at or above this height are dropped
+ * \param min_range_sqr Squared blanking distance
+ * \param max_range_sqr Squared culling distance
+ * \param out_x Transformed x of the kept points, room for n
+ * \param out_y Transformed y of the kept points, room for n
+ * \param out_z Transformed z of the kept points, room for n
+ * \param out_index Index in the batch of each kept point, room for n
+ */
+int TransformFilterPoints(const uint8_t *data, int point_step, int n, const float T[12], const float robot[3],
+                          float max_z, float min_range_sqr, float max_range_sqr,
+                          float *out_x, float *out_y, float *out_z, int *out_index);
+
+} // namespace perception
+} // namespace nature
+
+#endif //NATURE_POINT_KERNELS_H
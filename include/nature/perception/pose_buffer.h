@@ -0,0 +1,75 @@
+/**
+ * \class PoseBuffer
+ *
+ * Fixed-capacity ring buffer of timestamped odometry poses.
+ * Poses are looked up by time with a binary search and
+ * interpolated (linear position, SLERP orientation).
+ *
+ * \date 10/14/2026
+ */
+#ifndef NATURE_POSE_BUFFER_H
+#define NATURE_POSE_BUFFER_H
+
+#include <vector>
+#include "nature/node/ros_types.h"
+
+namespace nature{
+namespace perception{
+
+/// A pose at a time, orientation is a unit quaternion (x,y,z,w)
+struct PoseSample {
+    double t = 0.0;
+    float pos[3] = {0.0f, 0.0f, 0.0f};
+    float quat[4] = {0.0f, 0.0f, 0.0f, 1.0f};
+
+    /// Fill a row-major rotation matrix from the orientation
+    void GetRotation(float rot[9]) const;
+};
+
+class PoseBuffer{
+  public:
+    /**
+     * Create a buffer
+     * \param capacity Number of poses kept before the oldest is overwritten
+     */
+    PoseBuffer(int capacity = 200);
+
+    /**
+     * Add a pose to the buffer.
+     * Poses older than the newest one in the buffer are ignored.
+     * \param t Time of the pose in seconds
+     * \param pose The pose
+     */
+    void Add(double t, const nature::msg::Pose &pose);
+
+    /**
+     * Get the pose at time t.
+     * Inside the buffered time span the two bracketing poses are interpolated.
+     * Outside of it the nearest end pose is returned.
+     * Returns the time from t to the buffered span (0 when inside), or a negative value if the buffer is empty.
+     * \param t Time in seconds
+     * \param sample The interpolated pose
+     */
+    double Interpolate(double t, PoseSample &sample) const;
+
+    bool empty() const { return size_ == 0; }
+
+    int size() const { return size_; }
+
+    void Clear(){ size_ = 0; head_ = 0; }
+
+  private:
+    /// i-th oldest sample
+    const PoseSample & At(int i) const { return samples_[(head_ + i) % capacity_]; }
+
+    std::vector<PoseSample> samples_;
+    int capacity_;
+    /// index of the oldest sample
+    int head_;
+    int size_;
+};
+
+} // namespace perception
+} // namespace nature
+
+#endif //NATURE_POSE_BUFFER_H
@@ -2,8 +2,14 @@
 #define ASTAR_H
 
 #include <vector>
+#include <cmath>
+#include <functional>
+#include <stdint.h>
 #include <nature/visualization/base_visualizer.h>
 #include "nature/node/ros_types.h"
+#include "nature/common/indexed_heap.h"
+#include "nature/common/grid_view.h"
+#include "nature/common/morphology.h"
 
 namespace nature {
 namespace planning{
@@ -14,6 +20,20 @@ namespace planning{
  */
 class Astar {
  public:
+  /// Moves considered by Solve
+  enum Connectivity {
+    /// up, down, left and right, moves cost the value of the cell entered
+    FOUR_CONNECTED,
+    /// also diagonals, moves cost their length plus the value of the cell entered
+    EIGHT_CONNECTED,
+    /// 8-connected with jump point search, cells with a value are blocked.
+    /// Only used without segmentation, otherwise EIGHT_CONNECTED
+    JUMP_POINT,
+    /// Lazy Theta*, 8-connected with any-angle shortcuts across cells without a value.
+    /// The path comes out smooth, without PostSmoothing
+    ANY_ANGLE
+  };
+
   /// Constructor
   Astar(std::shared_ptr<nature::visualization::VisualizerBase> visualizer);
 
@@ -29,12 +49,12 @@ class Astar {
 	/// Inherited from base class, return path in world coordinates
 	std::vector<std::vector<float> > *GetCurrentPath() { return &path_world_; }
 
-	/// Inherited from base class, return the current map
-	std::vector<std::vector<float> > *GetCurrentMap() { return &map_; }
+	/// Return the current map, column-major (cell (i,j) at i*height+j), valid until the next PlanPath
+	const int8_t *GetCurrentMap() { return map_view_; }
 
 	/// Inherited from base class, return goal in world coordinates
 	std::vector<float> GetCurrentGoal() {
-		std::vector<int> gi = FoldIndex(goal_);
+		std::vector<int> gi = {goal_i_, goal_j_};
 		std::vector<float> goal_world = IndexToPoint(gi);
 		return goal_world;
 	}
@@ -57,6 +77,20 @@ class Astar {
 	/// Inherited from planner base class.
 	std::vector<std::vector<float> > PlanPath(nature::msg::OccupancyGrid *grid, nature::msg::OccupancyGrid *segmentation_grid, std::vector<float> goal, std::vector<float> position);
 
+  /**
+   * Run one Dijkstra search from the goal over the whole grid, giving the cost
+   * to reach the goal from every cell. Moves are 4-connected and cost the resolution
+   * times 1 plus the value of the cell entered, like the incremental search.
+   * Returns false if the grid is empty.
+   * \param grid Occupancy grid, column-major
+   * \param segmentation_grid Segmentation grid added to the move costs, may be empty
+   * \param goal Goal in world coordinates
+   */
+  bool ComputeCostToGo(nature::msg::OccupancyGrid *grid, nature::msg::OccupancyGrid *segmentation_grid, std::vector<float> goal);
+
+  /// Cost to go of each cell from the last ComputeCostToGo, column-major, infinity where the goal can't be reached
+  const std::vector<float> &GetCostToGo() const { return cost_to_go_; }
+
   /**
    * Allocate memory for the map and initialize
    * \param height Height of the map, in cells
@@ -65,6 +99,17 @@ class Astar {
    */
   void AllocateMap(int height, int width, int init_val);
 
+  /**
+   * Plan on grid data owned by the caller, without copying it.
+   * The data are column-major, like the OccupancyGrid messages, and must
+   * stay valid while the planner uses them. Only the move costs are cached.
+   * \param height Height of the map, in cells
+   * \param width Width of the map, in cells
+   * \param height_data Obstacle values from 0 to 100
+   * \param seg_data Segmentation values added to the move costs, or nullptr
+   */
+  void SetMapView(int height, int width, const int8_t *height_data, const int8_t *seg_data);
+
   /**
    * Set the value of cell (i,j).
    * \param i Vertical index of the cell to set
@@ -85,14 +130,22 @@ class Astar {
    * \param i Vertical index of goal cell
    * \param j Horizontal index of goal cell
    */
-  void SetGoal(int i, int j){goal_ = FlattenIndex(i,j);}
+  void SetGoal(int i, int j){
+    goal_ = FlattenIndex(i,j);
+    goal_i_ = i;
+    goal_j_ = j;
+  }
 
   /**
    * Sets cell (i,j) as the current location of the vehicle
    * \param i Vertical index of the vehicle location
    * \param j Horizontal index of the vehicle location
    */
-  void SetStart(int i, int j){start_ = FlattenIndex(i,j);}
+  void SetStart(int i, int j){
+    start_ = FlattenIndex(i,j);
+    start_i_ = i;
+    start_j_ = j;
+  }
 
   /**
    * Solve the A* map. Returns true if a path was found.
@@ -165,21 +218,192 @@ class Astar {
    * Set the factor by which to dilate the map
    * \param dfac The dilation factor 
    */
-  void SetDilationFactor(int dfac){dfac_ = dfac;}
+  void SetDilationFactor(int dfac){
+    dfac_ = dfac;
+    view_valid_ = false;
+  }
+
+  /**
+   * Set the moves considered by Solve. The 8-connected modes use the octile
+   * heuristic and never cut the corner of an obstacle. SetIncremental stays 4-connected.
+   * \param connectivity The search mode
+   */
+  void SetConnectivity(Connectivity connectivity){connectivity_ = connectivity;}
+
+  /**
+   * Set the layout of the search state and of the copy of the map searched on.
+   * TILED keeps the neighbors of a cell in its cache line for the expansions,
+   * jumps and line of sight checks, at the cost of copying the map on each plan.
+   * The grids passed in and GetCostToGo stay column-major.
+   * \param layout COLUMN_MAJOR or TILED, ROW_MAJOR is searched like COLUMN_MAJOR
+   */
+  void SetLayout(nature::common::GridLayout layout){
+    layout_ = layout == nature::common::GridLayout::TILED ? layout : nature::common::GridLayout::COLUMN_MAJOR;
+    dstar_valid_ = false;
+    view_valid_ = false;
+  }
+
+  /**
+   * Replan with D* Lite instead of solving from scratch.
+   * The search tree is kept between PlanPath calls and only the part affected by
+   * the cells whose value changed, or by the move of the start, is repaired.
+   * Only the cells given to AddChangedRegion are compared with the previous grid.
+   * It is rebuilt when the goal, the grid size or the grid corner changes.
+   * Moves cost 1 plus the cell value so the heuristic stays consistent.
+   * \param incremental True to replan incrementally
+   */
+  void SetIncremental(bool incremental){
+    incremental_ = incremental;
+    dstar_valid_ = false;
+  }
+
+  /**
+   * Set a check polled during the searches, a search stops without a path when it returns true.
+   * An interrupted incremental search resumes on the next call.
+   * \param cancel The check, empty to never stop
+   */
+  void SetCancelCheck(std::function<bool()> cancel){ cancel_ = cancel; }
+
+  /// True if the last search was stopped by the cancel check
+  bool WasCancelled() const { return cancelled_; }
+
+  /**
+   * Add cells that changed since the grid of the last PlanPath or ComputeCostToGo, the
+   * next one then only reads these from a grid of the same size and corner. Regions add
+   * up until then, without any the whole grid is read.
+   * \param roi The changed cells, i along the width and j along the height of the grid
+   */
+  void AddChangedRegion(const nature::common::GridRoi &roi){
+    changed_ = changed_.Union(roi);
+    changes_given_ = true;
+  }
+
+  /// The whole grid may have changed since the last PlanPath or ComputeCostToGo
+  void SetAllChanged(){ all_changed_ = true; }
+
+  /**
+   * Solve the map with D* Lite, repairing the previous solution when possible.
+   * Returns true if a path was found.
+   */
+  bool SolveIncremental();
 
  private:
   std::vector<int> FoldIndex(int n);
+
+  /// set the geometry and the map view from the grids, dilating when dfac_ is set
+  void SetGridView(nature::msg::OccupancyGrid *grid, nature::msg::OccupancyGrid *segmentation_grid);
+  /// read the cells of roi from the map view into the move costs
+  void RefreshMapView(const nature::common::GridRoi &roi);
+
+  /// result of ComputeCostToGo, column-major
+  std::vector<float> cost_to_go_;
+
+  /// poll cancel_ every CANCEL_POLL calls, sets cancelled_
+  bool Cancelled(){
+    if (!cancel_ || ++cancel_count_ % CANCEL_POLL != 0) return false;
+    cancelled_ = cancel_();
+    return cancelled_;
+  }
+  std::function<bool()> cancel_;
+  bool cancelled_ = false;
+  unsigned int cancel_count_ = 0;
+  static const unsigned int CANCEL_POLL = 1024;
   
-  int FlattenIndex(int i, int j){return j*width_+i;}
+  /// index of cell (i,j) in the search state
+  int FlattenIndex(int i, int j) const {return (int)nodes_.Index(i,j);}
+
+  /// cell of index n of the search state
+  void Coords(int n, int &i, int &j) const { nodes_.Coords((size_t)n, i, j); }
+
+  /// set the grid size and the index of the search state
+  void SetSize(int height, int width){
+    height_ = height;
+    width_ = width;
+    nodes_ = nature::common::GridIndex(width, height, layout_);
+  }
   
   /// Heuristic
   float Heuristic(int i0, int j0, int i1, int j1);
 
-  /// Flattened occupancy grid
+  /// octile distance between cells (x0,y0) and (x1,y1)
+  float Octile(int x0, int y0, int x1, int y1);
+
+  /// lower the cost of nb through cur and queue it, with the octile heuristic
+  void Relax(int cur, int nb, float move_cost);
+
+  /// expand the 8 neighbors of cur
+  void ExpandEight(int cur);
+
+  /// expand the jump points reachable from cur
+  void ExpandJumpPoints(int cur);
+
+  /// first jump point from (x,y) in direction (dx,dy), -1 if there is none
+  int Jump(int x, int y, int dx, int dy);
+
+  /// link the cells between the jump points of the solution
+  void FillJumpPath();
+
+  /// Lazy Theta* (Nash, Koenig and Tovey 2010), called by Solve
+  bool SolveAnyAngle();
+
+  /// check the parent of s on expansion and fall back to its best closed neighbor if it isn't visible
+  void SetVertex(int s);
+
+  /// true if every cell the segment between the centers of a and b touches has no value
+  bool ClearLine(int a, int b) const;
+
+  /// straight line distance between cells a and b
+  float Distance(int a, int b) const {
+    int ax, ay, bx, by;
+    Coords(a, ax, ay);
+    Coords(b, bx, by);
+    float dx = (float)(ax - bx);
+    float dy = (float)(ay - by);
+    return std::sqrt(dx*dx + dy*dy);
+  }
+
+  /// path_world_ from the any-angle parent chain, points map_res_ apart
+  bool ExtractAnyAnglePath();
+
+  /// cells expanded by the any-angle search
+  std::vector<uint32_t> closed_;
+
+  /// true if (x,y) is in the grid and not an obstacle
+  bool Free(int x, int y) const {
+    return x>=0 && x<width_ && y>=0 && y<height_ && cells_[nodes_.Index(x, y)]<=0;
+  }
+
+  Connectivity connectivity_ = FOUR_CONNECTED;
+  const float SQRT2 = 1.41421356f;
+  /// jump points of the last solution, goal first
+  std::vector<int> jump_chain_;
+
+  /// layout of the search state, see SetLayout
+  nature::common::GridLayout layout_ = nature::common::GridLayout::COLUMN_MAJOR;
+  nature::common::GridIndex nodes_;
+
+  /// move costs, the obstacle plus the segmentation value of each cell, in the layout of nodes_
   std::vector<int> weights_;
 
-	/// unflattened occupancy grid
-	std::vector<std::vector<float> > map_;
+  /// obstacle values in the layout of nodes_, map_view_ itself when column-major
+  const int8_t *cells_ = nullptr;
+  /// copy of the obstacle values when tiled
+  std::vector<int8_t> tiled_cells_;
+
+  /// obstacle values of the grid being planned on, column-major, not owned
+  const int8_t *map_view_ = nullptr;
+
+  /// segmentation values of the grid being planned on, nullptr without segmentation
+  const int8_t *seg_view_ = nullptr;
+
+  /// map storage when the planner owns it (AllocateMap or dilation)
+  std::vector<int8_t> map_buffer_;
+
+  /// obstacle value of cell (i,j), 0 outside the grid
+  int MapValue(int i, int j) const {
+    if (i<0 || i>=width_ || j<0 || j>=height_) return 0;
+    return cells_[nodes_.Index(i, j)];
+  }
 
 
   ///height of the grid
@@ -190,16 +414,77 @@ class Astar {
 
   ///flattened index of the goal point
   int goal_;
+  int goal_i_ = 0;
+  int goal_j_ = 0;
 
   ///flattened index of the start point
   int start_;
+  int start_i_ = 0;
+  int start_j_ = 0;
 
   /// map dilation factor
   int dfac_;
 
-  /// calculated path
+  /// parent of each cell in the search tree
   std::vector<int> paths_;
 
+  /// cost from the start of each cell
+  std::vector<float> costs_;
+
+  /// search that last reached each cell, the search state persists across Solve calls
+  std::vector<uint32_t> visited_;
+  uint32_t search_ = 0;
+
+  /// open list, each cell is queued at most once
+  nature::common::IndexedHeap<float> open_;
+
+  /// D* Lite priority, compared lexicographically
+  struct DStarKey {
+    float k1;
+    float k2;
+    bool operator<(const DStarKey &k) const { return k1 < k.k1 || (k1 == k.k1 && k2 < k.k2); }
+  };
+  DStarKey CalculateKey(int n);
+  void UpdateVertex(int n);
+  void ComputeShortestPath();
+  void InitializeIncremental();
+  /// cost of moving into cell n in the incremental search
+  float MoveCost(int n){ return 1.0f + weights_[n]; }
+  /// up to four neighbors of n, -1 where outside the grid
+  void Neighbors(int n, int nbrs[4]);
+
+  bool incremental_ = false;
+  /// true if the D* Lite state below matches the current goal and grid
+  bool dstar_valid_ = false;
+  /// cost to the goal and one-step lookahead of each cell
+  std::vector<float> dstar_g_;
+  std::vector<float> dstar_rhs_;
+  nature::common::IndexedHeap<DStarKey> dstar_open_;
+  /// key modifier, grows with the distance the start has moved
+  float dstar_km_ = 0.0f;
+  int dstar_last_start_ = -1;
+  int dstar_goal_ = -1;
+  float dstar_llx_ = 0.0f;
+  float dstar_lly_ = 0.0f;
+  /// cell values of the previous call, compared to find the changed cells
+  std::vector<int> prev_weights_;
+  /// cells read from the map since the last incremental search, only these can differ from prev_weights_
+  nature::common::GridRoi dstar_changes_;
+  bool dstar_all_changed_ = true;
+
+  /// cells changed since the last grid view, see AddChangedRegion
+  nature::common::GridRoi changed_;
+  bool changes_given_ = false;
+  bool all_changed_ = false;
+  /// the grid the move costs were last read from, a grid in the same place is read in place
+  bool view_valid_ = false;
+  int view_width_ = 0;
+  int view_height_ = 0;
+  float view_llx_ = 0.0f;
+  float view_lly_ = 0.0f;
+  float view_res_ = 0.0f;
+  bool view_seg_ = false;
+
   //std::vector<MapIndex> path_;
 	std::vector<std::vector<int> > path_;
 	std::vector<std::vector<float> > path_world_;
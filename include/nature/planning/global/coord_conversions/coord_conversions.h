@@ -19,7 +19,7 @@
 #include <string> 
 
 #include <nature/planning/global/coord_conversions/ellipsoid.h>
-#include <nature/planning/global/coord_conversions/matrix.h>
+#include <nature/planning/global/coord_conversions/mat3.h>
 
 namespace nature{
   
@@ -65,29 +65,51 @@ class CoordinateConverter{
   /// Set the reference ellipsoid using codes defined in ellipsoid.h
   void SetReferenceEllipsoid(int ellips);
 
-  coordinate_system::ECEF LLA2ECEF(coordinate_system::LLA lla);
+  coordinate_system::ECEF LLA2ECEF(coordinate_system::LLA lla) const;
   
-  coordinate_system::LLA ECEF2LLA(coordinate_system::ECEF ecef);
+  coordinate_system::LLA ECEF2LLA(coordinate_system::ECEF ecef) const;
   
-  coordinate_system::LLA UTM2LLA(coordinate_system::UTM utm);
+  coordinate_system::LLA UTM2LLA(coordinate_system::UTM utm) const;
  
-  coordinate_system::UTM LLA2UTM(coordinate_system::LLA lla);
+  coordinate_system::UTM LLA2UTM(coordinate_system::LLA lla) const;
 
-  coordinate_system::ECEF UTM2ECEF(coordinate_system::UTM utm);
+  coordinate_system::ECEF UTM2ECEF(coordinate_system::UTM utm) const;
   
-  coordinate_system::UTM ECEF2UTM(coordinate_system::ECEF ecef);
+  coordinate_system::UTM ECEF2UTM(coordinate_system::ECEF ecef) const;
   
-  coordinate_system::ECEF ENU2ECEF(coordinate_system::ENU enu);
+  coordinate_system::ECEF ENU2ECEF(coordinate_system::ENU enu) const;
   
-  coordinate_system::ENU ECEF2ENU(coordinate_system::ECEF ecef);
+  coordinate_system::ENU ECEF2ENU(coordinate_system::ECEF ecef) const;
 
-  coordinate_system::LLA ENU2LLA(coordinate_system::ENU enu);
+  coordinate_system::LLA ENU2LLA(coordinate_system::ENU enu) const;
 
-  coordinate_system::ENU LLA2ENU(coordinate_system::LLA lla);
+  coordinate_system::ENU LLA2ENU(coordinate_system::LLA lla) const;
 
-  coordinate_system::UTM ENU2UTM(coordinate_system::ENU enu);
+  coordinate_system::UTM ENU2UTM(coordinate_system::ENU enu) const;
 
-  coordinate_system::ENU UTM2ENU(coordinate_system::UTM utm);
+  coordinate_system::ENU UTM2ENU(coordinate_system::UTM utm) const;
+
+  /**
+   * Batch conversions of n coordinates, for logs and surveys of many points.
+   * They give the same results as the single conversions, which share
+   * the ellipsoid constants. With num_threads > 1, large batches are
+   * split across OpenMP threads.
+   * \param in The n input coordinates
+   * \param out The n converted coordinates, must not overlap in
+   * \param n Number of coordinates
+   * \param num_threads Threads to split the batch across
+   */
+  void LLA2UTM(const coordinate_system::LLA *in, coordinate_system::UTM *out, int n, int num_threads = 1) const;
+
+  void UTM2LLA(const coordinate_system::UTM *in, coordinate_system::LLA *out, int n, int num_threads = 1) const;
+
+  void LLA2ENU(const coordinate_system::LLA *in, coordinate_system::ENU *out, int n, int num_threads = 1) const;
+
+  void ENU2LLA(const coordinate_system::ENU *in, coordinate_system::LLA *out, int n, int num_threads = 1) const;
+
+  void UTM2ENU(const coordinate_system::UTM *in, coordinate_system::ENU *out, int n, int num_threads = 1) const;
+
+  void ENU2UTM(const coordinate_system::ENU *in, coordinate_system::UTM *out, int n, int num_threads = 1) const;
 
   /// Set the local origin in UTM coordinates.
   void SetLocalOrigin(coordinate_system::UTM utm);
@@ -105,16 +127,24 @@ class CoordinateConverter{
   int ref_ellips_;
   coordinate_system::ECEF local_origin_ecef_;
   coordinate_system::LLA  local_origin_lla_;
-  math::Matrix rot_transpose_;
-  math::Matrix rot_transpose_inverse_;
-  math::Matrix reference_position_;
+  /// rotation from ECEF to the local north-east-down frame, its transpose rotates back
+  math::Mat3 rot_transpose_;
+  math::Vec3 reference_position_;
   Ellipsoid ellipsoid_;
   double a_; 
   double e_; 
   double e2_; 
   double one_minus_e2; 
-
-  char UTMLetterDesignator(double lat);
+  // series coefficients set with the ellipsoid
+  double ecc_prime_squared_;
+  /// meridian arc in the latitude and its sines of 2, 4 and 6 times the latitude
+  double meridian_[4];
+  /// footpoint latitude in the sines of 2, 4 and 6 times mu
+  double footpoint_[3];
+  double b_;
+  double ep2_;
+
+  char UTMLetterDesignator(double lat) const;
   void SetMatrices();
 };
 
@@ -0,0 +1,61 @@
+/**
+ * \file mat3.h
+ *
+ * 3-vectors and 3x3 matrices for the geodetic conversions.
+ * They are plain values on the stack with inline, constexpr operations,
+ * and the transpose stands in for the inverse of the orthonormal rotations.
+ *
+ * \date 10/14/2026
+ */
+#ifndef NATURE_MAT3_H
+#define NATURE_MAT3_H
+
+namespace nature{
+namespace math{
+
+struct Vec3 {
+  double x;
+  double y;
+  double z;
+
+  constexpr Vec3() : x(0.0), y(0.0), z(0.0) {}
+  constexpr Vec3(double x_, double y_, double z_) : x(x_), y(y_), z(z_) {}
+
+  constexpr Vec3 operator+(const Vec3 &b) const { return Vec3(x + b.x, y + b.y, z + b.z); }
+  constexpr Vec3 operator-(const Vec3 &b) const { return Vec3(x - b.x, y - b.y, z - b.z); }
+  constexpr Vec3 operator*(double s) const { return Vec3(s*x, s*y, s*z); }
+};
+
+constexpr double Dot(const Vec3 &a, const Vec3 &b) { return a.x*b.x + a.y*b.y + a.z*b.z; }
+
+/// A 3x3 matrix stored as its rows
+struct Mat3 {
+  Vec3 r0;
+  Vec3 r1;
+  Vec3 r2;
+
+  /// The identity
+  constexpr Mat3() : r0(1.0, 0.0, 0.0), r1(0.0, 1.0, 0.0), r2(0.0, 0.0, 1.0) {}
+  constexpr Mat3(const Vec3 &row0, const Vec3 &row1, const Vec3 &row2) : r0(row0), r1(row1), r2(row2) {}
+  constexpr Mat3(double a00, double a01, double a02,
+                 double a10, double a11, double a12,
+                 double a20, double a21, double a22)
+    : r0(a00, a01, a02), r1(a10, a11, a12), r2(a20, a21, a22) {}
+
+  /// Return the transpose, the inverse of a rotation
+  constexpr Mat3 Transpose() const {
+    return Mat3(r0.x, r1.x, r2.x,
+                r0.y, r1.y, r2.y,
+                r0.z, r1.z, r2.z);
+  }
+
+  constexpr Vec3 operator*(const Vec3 &v) const { return Vec3(Dot(r0, v), Dot(r1, v), Dot(r2, v)); }
+
+  /// Multiply by the transpose of the matrix without forming it
+  constexpr Vec3 TransposeTimes(const Vec3 &v) const { return r0*v.x + r1*v.y + r2*v.z; }
+};
+
+} //namespace math
+} //namespace nature
+
+#endif //NATURE_MAT3_H
@@ -0,0 +1,193 @@
+/**
+ * \file hpa_star.h
+ *
+ * Hierarchical path-finding A* (Botea, Mueller and Schaeffer 2004) for long-range global planning.
+ * The grid is split in square clusters joined by portals on their borders. The portal
+ * graph is kept between calls and only the clusters whose cells changed are rebuilt,
+ * the search runs on the portal graph and only the first few clusters of the
+ * path are refined at full resolution. The clusters are aligned with the world, so when
+ * a scrolling grid moves the clusters still inside it are kept and only those it
+ * uncovers are built.
+ *
+ * \date 10/14/2026
+ */
+#ifndef HPA_STAR_H
+#define HPA_STAR_H
+
+#include <vector>
+#include <functional>
+#include <stdint.h>
+#include "nature/node/ros_types.h"
+#include "nature/common/indexed_heap.h"
+#include "nature/common/morphology.h"
+
+namespace nature {
+namespace planning{
+
+/**
+ * Hierarchical planner with the PlanPath interface of Astar.
+ * Moves are 4-connected and cost 1 plus the value of the cell entered, the value
+ * being the occupancy plus the segmentation. Portals are only placed between
+ * cells that are both free of obstacles.
+ */
+class HpaStar {
+ public:
+  HpaStar();
+
+  /**
+   * Set the side of the clusters, rebuilds the portal graph on the next call
+   * \param cells Cluster side in cells
+   */
+  void SetClusterSize(int cells){
+    cluster_size_ = cells > 4 ? cells : 4;
+    num_clusters_x_ = 0;
+  }
+
+  /**
+   * Set how many clusters along the path are refined to cells,
+   * the rest of the path follows straight lines between portals
+   * \param num_clusters Number of clusters to refine
+   */
+  void SetRefineClusters(int num_clusters){ refine_clusters_ = num_clusters; }
+
+  /**
+   * Set a check polled between cluster rebuilds and during the portal search,
+   * PlanPath stops and keeps the last path when it returns true.
+   * Clusters not rebuilt yet stay dirty for the next call.
+   * \param cancel The check, empty to never stop
+   */
+  void SetCancelCheck(std::function<bool()> cancel){ cancel_ = cancel; }
+
+  /// True if the last PlanPath was stopped by the cancel check
+  bool WasCancelled() const { return cancelled_; }
+
+  /// Return the last path in world coordinates
+  std::vector<std::vector<float> > *GetCurrentPath() { return &path_world_; }
+
+  /// Number of portals in the abstract graph
+  int NumPortals() const { return num_nodes_; }
+
+  /// Number of clusters rebuilt by the last PlanPath
+  int NumRebuiltClusters() const { return num_rebuilt_; }
+
+  /**
+   * Add cells that changed since the grid of the last PlanPath, the next one then only
+   * compares these with the grid. Regions add up until a PlanPath, without any the
+   * whole grid is compared.
+   * \param roi The changed cells, i along the width and j along the height of the grid
+   */
+  void AddChangedRegion(const nature::common::GridRoi &roi){
+    changed_ = changed_.Union(roi);
+    changes_given_ = true;
+  }
+
+  /// The whole grid may have changed since the last PlanPath, e.g. a full grid replaced it
+  void SetAllChanged(){ all_changed_ = true; }
+
+  /**
+   * Plan from position to goal, with the same arguments and result as Astar::PlanPath.
+   * \param grid Occupancy grid, column-major
+   * \param segmentation_grid Segmentation grid added to the move costs, may be empty
+   * \param goal Goal in world coordinates
+   * \param position Start in world coordinates
+   */
+  std::vector<std::vector<float> > PlanPath(nature::msg::OccupancyGrid *grid, nature::msg::OccupancyGrid *segmentation_grid, std::vector<float> goal, std::vector<float> position);
+
+ private:
+  struct Cluster {
+    /// cell bounds [x0,x1) x [y0,y1)
+    int x0, y0, x1, y1;
+    /// portal cells of the cluster and the cell across the border from each
+    std::vector<int> cells;
+    std::vector<int> partners;
+    /// cost from portal a to portal b inside the cluster at a*n+b
+    std::vector<float> dist;
+    bool dirty;
+  };
+
+  int CellIndex(int x, int y) const { return y*width_ + x; }
+  int ClusterOf(int n) const { return (n / width_ + phase_y_)/cluster_size_*num_clusters_x_ + (n % width_ + phase_x_)/cluster_size_; }
+  bool Free(int x, int y) const { return x>=0 && x<width_ && y>=0 && y<height_ && free_[CellIndex(x,y)]; }
+
+  /// copy the move costs from the grids, marking the clusters whose cells changed
+  void UpdateCosts(nature::msg::OccupancyGrid *grid, nature::msg::OccupancyGrid *segmentation_grid);
+  /**
+   * Lay the clusters out on a grid of w by h cells with its corner at cell (ox,oy) of the world.
+   * With keep, the costs of the cells in both grids and the clusters that stay whole inside
+   * both move with the world, everything else is read from the grid and rebuilt.
+   */
+  void Relayout(int w, int h, int ox, int oy, bool keep, const int8_t *height_data, const int8_t *seg_data);
+  /// rebuild the portals and the inner edges of the dirty clusters and their neighbors, false if cancelled
+  bool RefreshClusters();
+  void FindPortals(Cluster &c);
+  void AddBorderPortals(Cluster &c, int x, int y, int step_x, int step_y, int out_x, int out_y, int len);
+  void ComputeInnerEdges(Cluster &c);
+  /**
+   * Dijkstra restricted to a cluster, filling local_cost_ and local_parent_.
+   * In reverse the costs are to the source instead of from it.
+   * Stops at target, or once all portals are settled with PORTAL_TARGETS, or runs to the end with -1.
+   */
+  void ClusterSearch(const Cluster &c, int source, bool reverse, int target);
+  float LocalCost(const Cluster &c, int n) const { return local_cost_[(n % width_ - c.x0)*(c.y1 - c.y0) + (n / width_ - c.y0)]; }
+  /// search the portal graph, the node chain goes in abstract_path_
+  bool SearchAbstract(int start, int goal);
+  /// turn abstract_path_ into path_world_, refining the first clusters
+  void BuildPath(int start, int goal);
+  void AppendCell(int n);
+
+  int width_ = 0;
+  int height_ = 0;
+  float llx_ = 0.0f;
+  float lly_ = 0.0f;
+  float res_ = 1.0f;
+  int cluster_size_ = 32;
+  int refine_clusters_ = 3;
+  int num_clusters_x_ = 0;
+  int num_clusters_y_ = 0;
+  /// world cell of the grid corner, the world cluster of cluster 0 and the cells of that cluster left of the grid
+  int origin_x_ = 0;
+  int origin_y_ = 0;
+  int first_cluster_x_ = 0;
+  int first_cluster_y_ = 0;
+  int phase_x_ = 0;
+  int phase_y_ = 0;
+  int num_nodes_ = 0;
+  int num_rebuilt_ = 0;
+
+  /// move cost into each cell and whether it is free of obstacles
+  std::vector<int> costs_;
+  std::vector<uint8_t> free_;
+  /// the next layout of costs_ and free_ while the grid moves, reused between moves
+  std::vector<int> next_costs_;
+  std::vector<uint8_t> next_free_;
+  /// cells changed since the last PlanPath, see AddChangedRegion
+  nature::common::GridRoi changed_;
+  bool changes_given_ = false;
+  bool all_changed_ = false;
+  std::vector<Cluster> clusters_;
+  /// first abstract node of each cluster
+  std::vector<int> node_base_;
+
+  /// scratch of the searches, reused between calls
+  std::vector<float> local_cost_;
+  std::vector<int> local_parent_;
+  std::vector<uint8_t> local_target_;
+  static const int PORTAL_TARGETS = -2;
+  nature::common::IndexedHeap<float> local_open_;
+  std::vector<float> start_cost_;
+  std::vector<float> goal_cost_;
+  std::vector<float> node_cost_;
+  std::vector<int> node_parent_;
+  nature::common::IndexedHeap<float> node_open_;
+  std::vector<int> abstract_path_;
+
+  std::vector<std::vector<float> > path_world_;
+
+  std::function<bool()> cancel_;
+  bool cancelled_ = false;
+};
+
+} // namespace planning
+} // namespace nature
+
+#endif
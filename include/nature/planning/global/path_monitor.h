@@ -0,0 +1,84 @@
+/**
+ * \file path_monitor.h
+ *
+ * Decides when a cached global path has to be solved again.
+ * The path is kept with the grid values it was planned on, and later grids
+ * are compared only along the part of the path ahead of the vehicle.
+ *
+ * \date 10/14/2026
+ */
+#ifndef PATH_MONITOR_H
+#define PATH_MONITOR_H
+
+#include <vector>
+#include <stdint.h>
+#include "nature/node/ros_types.h"
+
+namespace nature {
+namespace planning{
+
+/**
+ * Keeps the last solved path and checks it against new grids.
+ * The grid values along the path are sampled in world coordinates,
+ * so the check also works when the grid origin moves with the vehicle.
+ */
+class PathMonitor {
+ public:
+  PathMonitor();
+
+  /**
+   * Set the largest distance from the path before it is solved again
+   * \param meters Corridor half width in meters
+   */
+  void SetCorridor(float meters){ corridor_ = meters; }
+
+  /**
+   * Set the length of path ahead of the vehicle compared to new grids
+   * \param meters Distance along the path in meters
+   */
+  void SetCheckDistance(float meters){ check_distance_ = meters; }
+
+  /**
+   * Store a path just solved and the values of the cells it crosses
+   * \param grid Occupancy grid the path was solved on, column-major
+   * \param path Path in world coordinates
+   * \param goal Goal the path was solved for
+   */
+  void SetPath(nature::msg::OccupancyGrid *grid, const std::vector<std::vector<float> > &path, std::vector<float> goal);
+
+  /// The stored path in world coordinates
+  const std::vector<std::vector<float> > &GetPath() const { return path_; }
+
+  /**
+   * Return true if the stored path can be used again. It can't if the goal changed,
+   * if position is farther than the corridor from the path, or if a cell crossed by the
+   * path within the check distance ahead now holds a higher occupancy than when solved.
+   * \param grid Current occupancy grid, column-major
+   * \param goal Current goal
+   * \param position Vehicle position in world coordinates
+   */
+  bool Valid(nature::msg::OccupancyGrid *grid, std::vector<float> goal, std::vector<float> position) const;
+
+ private:
+  struct Sample {
+    float x, y;
+    /// distance along the path
+    float s;
+    int8_t value;
+  };
+
+  static int8_t GridValue(nature::msg::OccupancyGrid *grid, float x, float y);
+
+  float corridor_ = 5.0f;
+  float check_distance_ = 50.0f;
+  std::vector<std::vector<float> > path_;
+  /// distance along the path of each vertex
+  std::vector<float> path_s_;
+  std::vector<Sample> samples_;
+  std::vector<float> goal_;
+};
+
+} // namespace planning
+} // namespace nature
+
+#endif
@@ -2,6 +2,7 @@
  * \class Candidate
  *
  * Class for candidate paths generated by the local planner.
+ * Trivially copyable, so candidate sets copy as flat arrays.
  *
  * \author Chris Goodin
  *
@@ -11,6 +12,7 @@
 #ifndef SPLINE_CANDIDATE_H
 #define SPLINE_CANDIDATE_H
 #include <vector>
+#include <type_traits>
 #include "nature/planning/local/polynomial.h"
 
 namespace nature {
@@ -27,7 +29,7 @@ public:
 	 * Create a candidate path and initialize with a polynomial.
 	 * \param p The cubic polynomial to initialize the path to.
 	 */ 
-	Candidate(Polynomial p) {
+	Candidate(Polynomial<3> p) {
 		Initialize(p);
 	}
 
@@ -35,66 +37,58 @@ public:
 	 * Initialize a candidate path with a polynomial.
 	 * \param p The cubic polynomial to initialize the path to.
 	 */ 
-	void Initialize(Polynomial p) {
+	void Initialize(Polynomial<3> p) {
 		curve_ = p;
 		first_deriv_ = curve_.Derivative();
 		second_deriv_ = first_deriv_.Derivative();
 		out_of_bounds_ = false;
 		hits_obstacle_ = false;
 		rank_ = -1;
+		cost_ = 0.0f;
+		comfortability_ = 0.0f;
+		static_safety_ = 0.0f;
+		dynamic_safety_ = 0.0f;
+		rho_final_ = 0.0f;
 		max_curvature_ = 0.0f;
 		max_length_ = 100.0f;
 		s0_ = 0.0f;
         segmentation_cost_ = 0.0f;
 	}
 
-	/**
-	 * Assignment operator for a candidate path.
-	 */ 
-	void operator = (const Candidate &c) {
-		curve_ = c.curve_;
-		first_deriv_ = c.first_deriv_;
-		second_deriv_ = c.second_deriv_;
-		out_of_bounds_ = c.out_of_bounds_;
-		hits_obstacle_ = c.hits_obstacle_;
-		cost_ = c.cost_;
-		comfortability_ = c.comfortability_;
-		static_safety_ = c.static_safety_;
-		dynamic_safety_ = c.dynamic_safety_;
-		segmentation_cost_ = c.segmentation_cost_;
-		rank_ = c.rank_;
-		max_length_ = c.max_length_;
-		max_curvature_ = c.max_curvature_;
-		s0_ = c.s0_;
-	}
-
 	/**
 	 * Get the signed rho value of the candidate path at arc length s.
 	 * \param s The arc length along the path.
 	 */ 
-	float At(float s) { return curve_.At(s); }
+	float At(float s) const { return curve_.At(s); }
 
 	/**
 	 * Get the signed rho value of the first derivative of the candidate path at arc length s.
 	 * \param s The arc length along the path.
 	 */ 
-	float DerivativeAt(float s) { return first_deriv_.At(s); }
+	float DerivativeAt(float s) const { return first_deriv_.At(s); }
 
 	/**
 	 * Get the signed rho value of the second derivative of the candidate path at arc length s.
 	 * \param s The arc length along the path.
 	 */ 
-	float SecondDerivativeAt(float s) { return second_deriv_.At(s); }
+	float SecondDerivativeAt(float s) const { return second_deriv_.At(s); }
+
+	/**
+	 * Get the polynomials of rho and of its first and second derivatives.
+	 */
+	const Polynomial<3> &GetCurve() const { return curve_; }
+	const Polynomial<2> &GetFirstDerivative() const { return first_deriv_; }
+	const Polynomial<1> &GetSecondDerivative() const { return second_deriv_; }
 
 	/**
 	 * Return true if the candidate goes out of bounds.
 	 */ 
-	bool IsOutOfBounds() { return out_of_bounds_; }
+	bool IsOutOfBounds() const { return out_of_bounds_; }
 
 		/**
 	 * Return true if the candidate hits an obstacle.
 	 */ 
-	bool HitsObstacle() { return hits_obstacle_; }
+	bool HitsObstacle() const { return hits_obstacle_; }
 
 	/**
 	 * Set to true if the candidate goes out of bounds.
@@ -117,7 +111,7 @@ public:
 	/**
 	 * Get the cumulative cost of the path. 
 	 */
-	float GetCost() { return cost_; }
+	float GetCost() const { return cost_; }
 
 	/**
 	 * Set the rank of the path.
@@ -128,7 +122,7 @@ public:
 	/**
 	 * Get the rank of the path. 
 	 */
-	int GetRank() { return rank_; }
+	int GetRank() const { return rank_; }
 
 	/**
 	 * Set the max curvature of the path.
@@ -139,7 +133,7 @@ public:
 	/**
 	 * Get the max curvature of the path.
 	 */ 
-	float GetMaxCurvature() { return max_curvature_; }
+	float GetMaxCurvature() const { return max_curvature_; }
 
 	/**
 	 * Set the comfortability of the path.
@@ -150,7 +144,7 @@ public:
 	/**
 	 * Get the comfortability of the path.
 	 */ 
-	float GetComfortability() { return comfortability_; }
+	float GetComfortability() const { return comfortability_; }
 
 	/**
 	 * Set the static safety of the path.
@@ -161,7 +155,7 @@ public:
 	/**
 	 * Get the static safety of the path.
 	 */ 
-	float GetStaticSafety() { return static_safety_; }
+	float GetStaticSafety() const { return static_safety_; }
 
 	/**
 	 * Set the dynamic safety of the path.
@@ -172,7 +166,7 @@ public:
 	/**
 	 * Get the dynamic safety of the path.
 	 */ 
-	float GetDynamicSafety() { return dynamic_safety_; }
+	float GetDynamicSafety() const { return dynamic_safety_; }
 
 	/**
 	 * Set the path deviation cost of the path.
@@ -183,7 +177,7 @@ public:
 	/**
 	 * Get the path deviation cost of the path.
 	 */ 
-	float GetRhoCost() { return rho_final_; }
+	float GetRhoCost() const { return rho_final_; }
 
 	/**
 	 * Set the max length of the path.
@@ -194,7 +188,7 @@ public:
 	/**
 	 * Get the max length of the path
 	 */ 
-	float GetMaxLength() { return max_length_; }
+	float GetMaxLength() const { return max_length_; }
 
 	/**
 	 * Set the initial s-value of the path, with respect to the centerline s.
@@ -205,7 +199,7 @@ public:
 	/**
 	 * Get the initial s-value of the path.
 	 */ 
-	float GetS0() { return s0_; }
+	float GetS0() const { return s0_; }
 
     /**
     * Sets the terrain segmentation cost based on labeled terrain traversed
@@ -218,9 +212,9 @@ public:
     float GetSegmentationCost() const { return segmentation_cost_; }
 
 private:
-	Polynomial curve_;
-	Polynomial first_deriv_;
-	Polynomial second_deriv_;
+	Polynomial<3> curve_;
+	Polynomial<2> first_deriv_;
+	Polynomial<1> second_deriv_;
 	bool out_of_bounds_;
 	bool hits_obstacle_;
 	float cost_;
@@ -235,6 +229,8 @@ private:
 	int rank_;
 };
 
+static_assert(std::is_trivially_copyable<Candidate>::value, "Candidate is copied as plain memory");
+
 } // namespace planning
 } // namespace nature
 
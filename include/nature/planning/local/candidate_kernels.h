@@ -0,0 +1,55 @@
+/**
+ * \file candidate_kernels.h
+ *
+ * Batch kernels evaluating all the local planner candidates at one arc length.
+ * The candidates are lanes, stored as planar arrays. Vectorized with AVX, SSE2
+ * or NEON when the compiler targets them, with a scalar fallback giving the same results.
+ *
+ * \date 10/14/2026
+ */
+#ifndef NATURE_CANDIDATE_KERNELS_H
+#define NATURE_CANDIDATE_KERNELS_H
+
+namespace nature{
+namespace planning{
+
+/**
+ * Evaluate n cubics c0 + c1*s + c2*s^2 + c3*s^3 at the same s.
+ * \param n Number of cubics
+ * \param c Coefficients, 4 planar arrays of n, lowest power first
+ * \param s The argument
+ * \param out The values, room for n
+ */
+void EvalCubics(int n, const float *const c[4], float s, float *out);
+
+/**
+ * Curvature of n curves at offsets rho from a centerline of curvature k0,
+ * and their heading relative to the centerline heading.
+ * \param n Number of curves
+ * \param rho Offsets
+ * \param drho First derivatives of the offsets along the centerline
+ * \param ddrho Second derivatives of the offsets along the centerline
+ * \param k0 Curvature of the centerline
+ * \param curvature The curvatures, room for n
+ * \param turn The relative headings, room for n
+ */
+void OffsetCurvatures(int n, const float *rho, const float *drho, const float *ddrho, float k0,
+                      float *curvature, float *turn);
+
+/**
+ * Points at offsets rho along the normal of a centerline point.
+ * \param n Number of points
+ * \param rho Offsets
+ * \param bx Centerline point x
+ * \param by Centerline point y
+ * \param nx Unit normal x
+ * \param ny Unit normal y
+ * \param x The point x, room for n
+ * \param y The point y, room for n
+ */
+void OffsetPoints(int n, const float *rho, float bx, float by, float nx, float ny, float *x, float *y);
+
+} // namespace planning
+} // namespace nature
+
+#endif //NATURE_CANDIDATE_KERNELS_H
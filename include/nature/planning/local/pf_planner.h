@@ -20,6 +20,8 @@
 #define PF_PLANNER_H
 // c++ includes
 #include <vector>
+#include <complex>
+#include <stdint.h>
 // ROS INCLUDES
 #include "nature/node/ros_types.h"
 
@@ -38,10 +40,10 @@ public:
 	 * \param grid ROS occupancy grid.
 	 * \param odom ROS odometry of the current vehicle.
 	 */ 
-	nature::msg::Path Plan(nature::msg::OccupancyGrid grid, nature::msg::Odometry odom);
+	nature::msg::Path Plan(const nature::msg::OccupancyGrid &grid, const nature::msg::Odometry &odom);
 
-	/// Set the segmentation grid to use
-	void SetSegGrid(nature::msg::OccupancyGrid seg_grid){ seg_grid_ = seg_grid; seg_grid_set_ = true; }
+	/// Set the segmentation grid to use, it is not copied and must stay alive while Plan is called
+	void SetSegGrid(const nature::msg::OccupancyGrid &seg_grid){ seg_grid_ = &seg_grid; seg_grid_set_ = true; }
 
 	/**
 	 * Set the goal point in the local ENU coordinate frame
@@ -62,17 +64,44 @@ public:
 
 	/// Set the threshold over which something would be considered an obstacle. Ranges from 0-100
 	void SetObstacleCostThreshold(int oct){ obs_cost_thresh_ = oct; }
+
+	/**
+	 * Follow the gradient of the potential with a line search instead of the 8 grid moves.
+	 * The path is resampled to the spacing of the grid moves.
+	 */
+	void SetGradientDescent(bool gradient_descent){ gradient_descent_ = gradient_descent; }
 	
 private:
 	float Hypot(float x, float y);
     
 	float CalcAttractivePotential(float x, float y, float gx, float gy);
 
-	float CalcRepulsivePotential(float x, float y, std::vector<float> ox, std::vector<float> oy);
+	/// Bilinear lookup of the repulsive field, less the obstacles inside the inner cutoff
+	float CalcRepulsivePotential(float x, float y);
+
+	/// Field at cell (i,j) of the field less the inner obstacles, 0 outside of it
+	float FieldAt(int i, int j) const;
+
+	/// Take the obstacles inside the inner cutoff out of a copy of the field, once per plan
+	void RemoveInnerObstacles();
+
+	/// Gradient of the attractive and repulsive potentials at (x,y)
+	void CalcPotentialGradient(float x, float y, float gx, float gy, float &dudx, float &dudy);
+
+	/// Gradient descent from (sx,sy) to (gx,gy), the path spacing is step
+	void GradientDescentPlanning(float step, float sx, float sy, float gx, float gy, int max_steps);
+
+	/**
+	 * Recompute the repulsive field when the obstacles or the grid geometry changed.
+	 * The field sums eta/(d*d+0.1) over the obstacles within the cutoff distance,
+	 * as one FFT convolution of the obstacle mask with that kernel.
+	 * It covers the grid and a cutoff distance around it, at the grid resolution.
+	 */
+	void UpdateRepulsiveField(const nature::msg::OccupancyGrid &grid);
 
 	std::vector<std::vector<float> > GetMotionModel(float step);
 
-	void PotentialFieldPlanning(float minx, float miny, float reso, float sx, float sy, float gx, float gy, std::vector<float> ox, std::vector<float> oy);
+	void PotentialFieldPlanning(float minx, float miny, float reso, float sx, float sy, float gx, float gy);
 
 	float goal_x_;
 	float goal_y_;
@@ -84,9 +113,39 @@ private:
 	std::vector<float> ry_;
 	std::vector<float> old_rx_;
 	std::vector<float> old_ry_;
-	nature::msg::OccupancyGrid seg_grid_;
+	const nature::msg::OccupancyGrid *seg_grid_;
 	bool seg_grid_set_;
 	int obs_cost_thresh_;
+	bool gradient_descent_;
+	/// cells over the cost threshold, column-major as the grid
+	std::vector<uint8_t> obstacle_mask_;
+	std::vector<uint8_t> field_mask_;
+	/// field cells of the obstacles inside the inner cutoff of the vehicle, taken out of the field
+	std::vector<int> inner_i_;
+	std::vector<int> inner_j_;
+	/// the field less the inner obstacles, only filled when there are some
+	std::vector<float> plan_field_;
+	/// cutoff distance of the field in cells
+	int field_radius_;
+	/// repulsive field at cell centers, column-major, cell 0 centered at (field_x0_, field_y0_)
+	std::vector<float> field_;
+	int field_width_;
+	int field_height_;
+	float field_x0_;
+	float field_y0_;
+	float field_res_;
+	float field_eta_;
+	float field_cutoff_;
+	int field_grid_width_;
+	int field_grid_height_;
+	/// transform of the kernel, kept while the transform size, resolution, cutoff and eta stay the same
+	std::vector<std::complex<double> > kernel_fft_;
+	int kernel_nx_;
+	int kernel_ny_;
+	float kernel_res_;
+	float kernel_eta_;
+	float kernel_cutoff_;
+	std::vector<std::complex<double> > fft_buffer_;
 };
 
 } // namespace planning
@@ -2,6 +2,8 @@
  * \class Polynomial
  *
  * Polynomial class for defining polynomial with coefficients.
+ * The degree N is fixed at compile time, the coefficients are held in place,
+ * so polynomials and the candidates holding them copy as plain memory.
  *
  * \author Chris Goodin
  *
@@ -10,57 +12,64 @@
 #ifndef SPLINE_POLYNOMIAL_H
 #define SPLINE_POLYNOMIAL_H
 #include <vector>
-#include <algorithm>
+#include <array>
 
 namespace nature {
 namespace planning {
+template <int N>
 class Polynomial {
 public:
+	/// Degree of the derivative, a constant stays a constant
+	static const int DERIVATIVE_DEGREE = N > 0 ? N - 1 : 0;
 
 	/**
-	 * Create an uninitialized polynomial.
+	 * Create a zero polynomial.
 	 */ 
-	Polynomial() {}
+	Polynomial() { coeffs_.fill(0.0f); }
 
 	/**
 	 * Create an initialized polynomial.
-	 * The rank will be the size of the coefficient list less one.
 	 * p(x) = c[0]x^n + c[1]x^n-1 + ... c[n-2]x + c[n-1]
-	 * \param coeffs The coefficients of the polynomial.
+	 * Missing higher powers are zero, extra coefficients are ignored.
+	 * \param coeffs The coefficients of the polynomial, highest power first.
 	 */
-	Polynomial(std::vector<float> coeffs) {
-		coeffs_ = coeffs;
-		std::reverse(coeffs_.begin(), coeffs_.end());
+	Polynomial(const std::vector<float> &coeffs) {
+		coeffs_.fill(0.0f);
+		int n = (int)coeffs.size();
+		for (int i = 0; i <= N && i < n; i++) coeffs_[i] = coeffs[n - 1 - i];
 	}
 
 	/**
 	 * Get a polynomial representing the derivative of the current polynomial. 
 	 */
-	Polynomial Derivative() {
-		std::vector<float> coeffs;
-		for (int i = 0; i < coeffs_.size(); i++) {
-			float c = i * coeffs_[i];
-			coeffs.push_back(c);
-		}
-		Polynomial poly(coeffs);
-		return poly;
+	Polynomial<DERIVATIVE_DEGREE> Derivative() const {
+		Polynomial<DERIVATIVE_DEGREE> d;
+		for (int i = 1; i <= N; i++) d.SetCoefficient(i - 1, i * coeffs_[i]);
+		return d;
 	}
 
 	/**
-	 * Get the value of the polynomial at x
+	 * Get the value of the polynomial at x, by Horner's rule
 	 * \param x Evaluate the polynomial at p(x)
 	 */ 
-	float At(float x) {
-		float y = 0.0f;
-		for (int i = 0; i < coeffs_.size(); i++) {
-
-			y += coeffs_[i] * (float)pow(x, i);
-		}
+	float At(float x) const {
+		float y = coeffs_[N];
+		for (int i = N - 1; i >= 0; i--) y = coeffs_[i] + x * y;
 		return y;
 	}
 
+	/**
+	 * Get the coefficients, lowest power first.
+	 */
+	const std::array<float, N + 1> &GetCoefficients() const { return coeffs_; }
+
+	/**
+	 * Set the coefficient of x^i.
+	 */
+	void SetCoefficient(int i, float c) { coeffs_[i] = c; }
+
 private:
-	std::vector<float> coeffs_;
+	std::array<float, N + 1> coeffs_;
 
 };
 
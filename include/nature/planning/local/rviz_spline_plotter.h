@@ -9,18 +9,39 @@
 #include "nature/visualization/base_visualizer.h"
 #include "nature/node/ros_types.h"
 #include "nature/node/node_proxy.h"
+#include <chrono>
 
 namespace nature {
   namespace planning{
 
+    /**
+    * Publishes the candidate paths and their costs as rviz markers on nature/candidate_paths.
+    * Publishing is limited to a rate, the paths are sampled at a display spacing and a cost
+    * text is only sent again when its values changed by more than a threshold.
+    * The markers are kept between publishes so their storage is reused.
+    */
     class RVIZPlotter : public Plotter {
     public:
+      /**
+      * \param publish_rate Most marker publishes a second, 0 publishes every Display
+      * \param path_step Spacing of the path samples in meters, at least the grid resolution
+      * \param text_threshold Change of a displayed cost that sends its text again
+      */
       RVIZPlotter(std::shared_ptr<nature::visualization::VisualizerBase> visualizer, const std::string & cos_vis,
-                  std::shared_ptr<nature::node::NodeProxy> node, float w_c, float w_s, float w_r, float w_d, float w_t, float cost_vis_text_size_);
+                  std::shared_ptr<nature::node::NodeProxy> node, float w_c, float w_s, float w_r, float w_d, float w_t, float cost_vis_text_size_,
+                  float publish_rate, float path_step, float text_threshold);
+      virtual bool ReadyToDisplay() override;
       virtual void Display(bool save, const std::string & ofname, int nx, int ny) override;
 
     private:
+      /// costs shown in the text of a candidate: final, s, c, r, d, t
+      static const int NUM_TEXT_VALUES = 6;
+
       nature::msg::Marker get_marker_msg(int type, int id, bool is_blocked = false) const;
+      /// Fill the text values of candidate j, false if cost_vis_ shows none
+      bool GetTextValues(int j, float *values) const;
+      /// Text of candidate j from its values
+      std::string GetText(const float *values) const;
       std::shared_ptr<nature::node::NodeProxy> node_;
       std::string cost_vis_;
       float cost_vis_text_size_;
@@ -30,6 +51,18 @@ namespace nature {
       float w_r_;
       float w_s_;
       float w_t_;
+
+      std::chrono::steady_clock::duration publish_period_;
+      std::chrono::steady_clock::time_point last_publish_;
+      float path_step_;
+      float text_threshold_;
+      /// line markers and the text markers sent in the next publish
+      nature::msg::MarkerArray marker_array_;
+      /// text markers as last sent, one per candidate
+      std::vector<nature::msg::Marker> text_markers_;
+      /// values shown by text_markers_, NUM_TEXT_VALUES per candidate
+      std::vector<float> text_values_;
+      std::vector<nature::utils::vec2> paths_last_points_;
     };
   } // namespace planning
 } // namespace nature
@@ -84,6 +84,26 @@ public:
 	 */
 	utils::vec2 ToCartesian(float s, float rho);
 
+	/**
+	 * ToCartesian for sweeps of increasing s. The segment found is kept in segment
+	 * and the next lookup starts from it, so a sweep costs O(1) per point.
+	 * A lookup behind the cursor falls back to the binary search.
+	 * \param s The arc length parameter.
+	 * \param rho The offset parameter.
+	 * \param segment Cursor, 0 to start a sweep.
+	 */
+	utils::vec2 ToCartesian(float s, float rho, int &segment);
+
+	/**
+	 * Get the centerline point and unit normal at arc length s, with a cursor as in ToCartesian.
+	 * ToCartesian(s, rho) is point + normal*rho.
+	 * \param s The arc length parameter.
+	 * \param segment Cursor, 0 to start a sweep.
+	 * \param point The centerline point at s.
+	 * \param normal The unit normal to the left of the path.
+	 */
+	void GetFrame(float s, int &segment, utils::vec2 &point, utils::vec2 &normal);
+
 	/**
 	 * Convert a point from Cartesian coordinates to the s-rho system.
 	 * \param x The x-coordinate in local ENU.
@@ -97,6 +117,13 @@ public:
 	 */ 
 	CurveInfo GetCurvatureAndAngle(float s);
 
+	/**
+	 * GetCurvatureAndAngle with a cursor, see ToCartesian.
+	 * \param s The arc length and which to measure the curvature.
+	 * \param segment Cursor, 0 to start a sweep.
+	 */
+	CurveInfo GetCurvatureAndAngle(float s, int &segment);
+
 	/**
 	 * Get the last point on the path. 
 	 */
@@ -127,6 +154,13 @@ public:
 	 */
 	float GetTheta(float s);
 
+	/**
+	 * GetTheta with a cursor, see ToCartesian.
+	 * \param s The arc length along the path at which to find the angle.
+	 * \param segment Cursor, 0 to start a sweep.
+	 */
+	float GetTheta(float s, int &segment);
+
 	/**
 	* Extend the road centerline behind the vehicle start position
 	* \param x Vehicle start X in local ENU
@@ -145,6 +179,8 @@ private:
 	std::vector<float> theta_;
 	std::vector<float> arc_length_;
 	std::vector<float> discrete_lengths_;
+	/// running sum of discrete_lengths_, the arc length at each point
+	std::vector<float> cumulative_lengths_;
 	float max_lookahead_;
 	void CalcAnglesAndCurvature();
 
@@ -153,6 +189,15 @@ private:
 
 	PointSegDist PointToSegmentDistance(utils::vec2 P, utils::vec2 Q, utils::vec2 X);
 	SegmentInfo FindSegment(float s);
+	SegmentInfo FindSegment(float s, int &segment);
+	SegmentInfo SegmentAt(int id, float s);
+	/// segment of ToCartesian, the first one that ends past s or starts at or past it
+	bool CartesianStop(int k, float s) const {
+		return cumulative_lengths_[k] >= s || cumulative_lengths_[k+1] > s;
+	}
+	int CartesianSegment(float s, int hint);
+	/// segment of FindSegment, the first one whose end arc length is past s
+	int ArcSegment(float s, int hint);
 
 };
 
@@ -18,6 +18,7 @@
 #include <vector>
 #include "nature/planning/local/spline_path.h"
 #include "nature/planning/local/candidate.h"
+#include "nature/common/morphology.h"
 // ROS INCLUDES
 #include "nature/node/ros_types.h"
 
@@ -35,7 +36,7 @@ public:
 	 * Set the desired centerline for the planner.
 	 * \param path A tang_planner::Path object. 
 	 */
-	void SetCenterline(Path path) { path_ = path; }
+	void SetCenterline(Path path) { path_ = path; generation_++; }
 
 	/**
 	 * Generate a set of candidate paths.
@@ -50,17 +51,33 @@ public:
 	void GeneratePaths(int npaths, float s_start, float rho_start, float theta_start, float s_look_ahead, 
 	float max_steer_angle, float vehicle_width);
 
+	/**
+	 * Generate a lattice of candidate paths, a fan of npaths end offsets for each look ahead.
+	 * Each fan spans the lane width reached at its look ahead, and a candidate is costed
+	 * over its own length. The static safety is blended within a fan.
+	 * GeneratePaths is the lattice of a single look ahead.
+	 * \param npaths The number of paths in each fan.
+	 * \param s_start The arc length along the centerline at which to start.
+	 * \param rho_start The offset from the path in the initial configuration.
+	 * \param theta_start The angle of the vehicle relative to east in the initial configuration.
+	 * \param s_look_aheads The path lengths of the fans, in the forward direction.
+	 * \param max_steer_angle The maximum steering angle of the vehicle, radians
+	 * \param vehicle_width The width of the vehicle, in meters.
+	 */
+	void GenerateLattice(int npaths, float s_start, float rho_start, float theta_start, const std::vector<float> &s_look_aheads,
+	float max_steer_angle, float vehicle_width);
+
 	/**
 	 * Get a list of the candidate paths.
 	 */ 
-	std::vector<Candidate> GetCandidates() { return candidates_; }
+	const std::vector<Candidate> &GetCandidates() const { return candidates_; }
 
 	/**
 	 * Calculate a list of candidate costs given an occupancy grid and vehicle odometry.
 	 * \param grid ROS occupancy grid.
 	 * \param odom ROS odometry of the current vehicle.
 	 */ 
-	bool CalculateCandidateCosts(nature::msg::OccupancyGrid grid, nature::msg::OccupancyGrid segmentation_grid, nature::msg::Odometry odom);
+	bool CalculateCandidateCosts(const nature::msg::OccupancyGrid &grid, const nature::msg::OccupancyGrid &segmentation_grid, const nature::msg::Odometry &odom);
 
 	/**
 	 * Dilate the map with a mask of given size.
@@ -69,6 +86,44 @@ public:
 	 */
 	void DilateGrid(nature::msg::OccupancyGrid &grid, int x, float llx, float lly, float urx, float ury);
 
+	/**
+	 * Dilate the map into another grid, which keeps its buffer between calls.
+	 * Every cell of dilated is written once, the cells outside the bounds are copied from grid.
+	 * \param grid The occupancy grid to dilate.
+	 * \param dilated The dilated grid.
+	 * \param x The dilation mask size is (x+1)*(x+1).
+	 */
+	void DilateGrid(const nature::msg::OccupancyGrid &grid, nature::msg::OccupancyGrid &dilated, int x, float llx, float lly, float urx, float ury);
+
+	/**
+	 * Compute the clearance, the distance to the nearest occupied cell, in the bounds.
+	 * Call once per grid update, the candidates then look it up instead of reading the grid.
+	 * The vehicle width is the one of the last GeneratePaths.
+	 * \param grid The occupancy grid, cells above 0 are obstacles.
+	 */
+	void SetClearanceGrid(const nature::msg::OccupancyGrid &grid, float llx, float lly, float urx, float ury);
+
+	/**
+	 * Cost static safety by clearance instead of the cells under the candidates.
+	 * A candidate hits an obstacle where its clearance is within half the vehicle width,
+	 * and its static safety falls from 1 to 0 across the margin beyond that.
+	 * Dilating the grid is not needed in this mode.
+	 * \param use_clearance Whether to use the clearance.
+	 * \param margin Width of the graded safety margin, meters.
+	 */
+	void SetUseClearance(bool use_clearance, float margin){ use_clearance_ = use_clearance; clearance_margin_ = margin; generation_++; }
+
+	/**
+	 * Tell the next CalculateCandidateCosts that only the cells in roi changed since the last one,
+	 * may be called several times. The grid geometry must be the same as in the last call.
+	 * Without a call the whole grid is taken as changed.
+	 * \param roi The changed cells.
+	 */
+	void MarkGridChanged(const nature::common::GridRoi &roi);
+
+	/// Tell the next CalculateCandidateCosts that the grids did not change since the last one
+	void MarkGridUnchanged();
+
 	/**
 	 * Get a point along the optimal path at an arc length s_step from the current position. 
 	 */
@@ -128,6 +183,26 @@ public:
 	 */ 
   	void SetUseBlend(bool use_blend){ use_blend_ = use_blend; }
 
+	/**
+	 * Set the number of threads evaluating the candidate costs.
+	 * Each thread takes blocks of candidates, the costs are the same for any number of threads.
+	 * Default is 1, no threads.
+	 * \param num_threads Number of threads.
+	 */
+	void SetNumThreads(int num_threads){ num_threads_ = num_threads > 1 ? num_threads : 1; }
+
+	/**
+	 * Set the cost to go field of the global planner. While it is set, the path adherence
+	 * cost of a candidate is the cost to go at its end point, scaled to [0,1] over the
+	 * candidates, instead of its offset from the centerline.
+	 * Falls back to the offset when an end point has no cost to go.
+	 * \param cost_to_go Grid with a "cost_to_go" float layer, NaN where the goal can't be reached
+	 */
+	void SetCostToGo(const nature::msg::LayeredGrid &cost_to_go);
+
+	/// Go back to the centerline offset for path adherence
+	void ClearCostToGo(){ cost_to_go_.clear(); cost_to_go_version_++; }
+
 	float GetComfortabilityWeight() const { return w_c_; }
 	float GetStaticSafetyWeight() const { return w_s_; }
 	float GetDynamicSafetyWeight() const { return w_d_; }
@@ -139,7 +214,7 @@ public:
 	 * Default is b = 2.0
 	 * \param w Desired weight.
 	 */ 
-	void SetConsistencyFactorWeight(float w){ b_= w; }
+	void SetConsistencyFactorWeight(float w){ b_= w; generation_++; }
 
     /**
     * Set the weight on the terrain segmentation cost.
@@ -153,21 +228,24 @@ public:
 	 * Default is a = 0.01
 	 * \param w Desired weight.
 	 */ 
-	void SetCurvatureFactorWeight(float w){ a_ = w; }
+	void SetCurvatureFactorWeight(float w){ a_ = w; generation_++; }
 
 	/**
 	 * Set the size of the averaging window for static safety, in number of paths.
 	 * Default is calculated by the vehicle width
 	 * \param np Number of paths.
 	 */ 
-	void SetAveragingWindowSize(int np){ averaging_window_size_ = np; }
+	void SetAveragingWindowSize(int np){
+		averaging_window_size_ = np;
+		for (int l = 0; l < layers_.size(); l++) layers_[l].window = np;
+	}
 
 	/**
 	 * Set the integration step size for curvature calcuations and other integrations.
 	 * Default is ds = 0.1 meters
 	 * \param ds The integration step size. 
 	 */
-	void SetArcLengthIntegrationStep(float ds){ ds_ = ds; }
+	void SetArcLengthIntegrationStep(float ds){ ds_ = ds; generation_++; }
 
 	/**
 	 * Set the dynamic safety factors. See equations 19-20 of 
@@ -186,12 +264,45 @@ public:
 private:
 	// private methods
 	std::vector<float> CalcCoeffs(float rho_start, float theta_start, float s_end, float rho_end);
-	void CalculateComfortability();
-	void CalculateStaticSafetyAndSegCost(const nature::msg::OccupancyGrid & grid,const nature::msg::OccupancyGrid & segmentation_grid);
-	void CalculateRhoCost();
-	void CalculateDynamicSafety(nature::msg::Odometry odom);
+	// the cost passes of candidates [i0,i1)
+	void CalculateComfortability(int i0, int i1);
+	void CalculateStaticSafetyAndSegCost(const nature::msg::OccupancyGrid & grid,const nature::msg::OccupancyGrid & segmentation_grid, int i0, int i1);
+	/// record a cell swept by candidate i, runs of the same cell are counted once
+	void AddCandidateCell(int i, int ix, int iy, int ndx);
+	/// sum the grids again over the cached cells of the candidates crossing changed cells
+	void RescoreStaticSafety(const nature::msg::OccupancyGrid & grid, const nature::msg::OccupancyGrid & segmentation_grid, int i0, int i1);
+	/// set the candidate safety and segmentation costs and flags from the sums
+	void FinishStaticSafety();
+	void CalculateRhoCost(int i0, int i1);
+	void CalculateDynamicSafety(const nature::msg::Odometry &odom, int i0, int i1);
+	/// all the per-candidate passes of one block, run in parallel
+	void CalculateCandidateBlock(const nature::msg::OccupancyGrid & grid, const nature::msg::OccupancyGrid & segmentation_grid, int i0, int i1);
+	/// the passes mixing candidates, after all the blocks are done
+	void BlendStaticSafety();
+	void NormalizeCostToGo();
 	float GetTotalCostOfCandidate(int pathnum);
-	CurveInfo InfoOfCurve(Candidate candidate, float s, CurveInfo base_ca);
+	CurveInfo InfoOfCurve(const Candidate &candidate, float s, CurveInfo base_ca, int &theta_segment);
+	/// cost to go at p, NaN outside the field
+	float CostToGoAt(utils::vec2 p) const;
+	/// clearance at (x,y), false outside the clearance grid
+	bool ClearanceAt(float x, float y, float &clearance) const;
+
+	/// centerline sampled once per cycle at the arc lengths of a sweep over the candidates
+	struct CenterlineFrames {
+		/// arc length of each sample, relative to s_start_
+		std::vector<float> s;
+		std::vector<float> x, y;
+		std::vector<float> nx, ny;
+		std::vector<float> curvature;
+	};
+	/// sample the centerline from s_begin to s_max_ every ds_
+	void SampleCenterline(float s_begin, CenterlineFrames &frames);
+	/// copy the candidate polynomials into batch_coeffs_, with last_selected_ in the extra last lane
+	void PackCandidates();
+	/// planar coefficients of polynomial 0 (rho), 1 (rho') or 2 (rho'') of all the lanes
+	void BatchCoeffs(int poly, const float *c[4]) const;
+	/// heading of last_selected_ relative to the centerline at each comfort sample
+	void CalculateLastTurn();
 
 	// centerline
 	Path path_;
@@ -199,6 +310,13 @@ private:
 	// candidates
 	std::vector<Candidate> candidates_;
 
+	/// candidates [begin,end) of one look ahead of the lattice and their blend window
+	struct LatticeLayer {
+		int begin, end;
+		int window;
+	};
+	std::vector<LatticeLayer> layers_;
+
 	// optimal path
 	Candidate last_selected_;
 
@@ -206,6 +324,8 @@ private:
 	bool first_iter_;
 	float s_max_;
 	float rho_max_;
+	/// offset reached per meter of look ahead at the largest steering angle, the width of a fan over its length
+	float rho_per_length_;
 	float s_start_;
 
 	// Planner parameters
@@ -223,6 +343,56 @@ private:
 	float s_no_coll_before_;
 	int averaging_window_size_;
 	bool use_blend_;
+
+	// candidates evaluated as a batch, one lane per candidate
+	CenterlineFrames comfort_frames_;
+	CenterlineFrames safety_frames_;
+	int num_lanes_;
+	std::vector<float> batch_coeffs_;
+	/// length of each candidate, the samples beyond it are skipped
+	std::vector<float> batch_length_;
+	std::vector<float> batch_rho_, batch_drho_, batch_ddrho_;
+	std::vector<float> batch_x_, batch_y_;
+	std::vector<float> batch_curvature_, batch_turn_;
+	std::vector<float> batch_last_turn_;
+	std::vector<float> batch_comfort_, batch_consistent_, batch_max_curvature_;
+	std::vector<float> batch_safety_, batch_seg_cost_;
+	std::vector<float> batch_cost_to_go_;
+	/// candidates per parallel task, a multiple of the kernel lanes
+	static const int CANDIDATE_BLOCK = 32;
+	int num_threads_;
+
+	// terms kept between cycles, recomputed when their inputs change
+	int generation_;
+	int selected_generation_, selected_index_;
+	int cost_to_go_version_;
+	int cache_generation_, cache_num_candidates_;
+	unsigned int cache_grid_width_, cache_grid_height_;
+	float cache_grid_llx_, cache_grid_lly_, cache_grid_res_;
+	float cache_s_no_coll_before_;
+	bool cache_use_clearance_;
+	int cache_selected_generation_, cache_selected_index_;
+	int cache_cost_to_go_version_;
+	bool sweep_static_, rescore_static_, comfort_valid_, rho_valid_;
+	/// cells swept by each candidate as (index, samples) pairs, and their bounds
+	std::vector<std::vector<int> > candidate_cells_;
+	std::vector<nature::common::GridRoi> candidate_cell_bounds_;
+	/// cells changed since the last cycle
+	bool grid_change_known_, grid_all_changed_;
+	nature::common::GridRoi grid_changed_;
+
+	// clearance in meters, column-major, empty when not used
+	bool use_clearance_;
+	float clearance_margin_;
+	float vehicle_width_;
+	std::vector<float> clearance_;
+	float clr_llx_, clr_lly_, clr_res_;
+	int clr_width_, clr_height_;
+
+	// cost to go field, column-major, empty when not used
+	std::vector<float> cost_to_go_;
+	float ctg_llx_, ctg_lly_, ctg_res_;
+	int ctg_width_, ctg_height_;
 };
 
 } // namespace planning
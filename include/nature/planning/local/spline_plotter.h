@@ -39,13 +39,14 @@ public:
 	 * Add the candidate paths to be plotted.
 	 * \param curves A list of candidate paths to be plotted. 
 	 */
-	void AddCurves(std::vector<Candidate> curves);
+	void AddCurves(const std::vector<Candidate> &curves);
 
 	/**
-	 * Add the occupancy grid that will be plotted
+	 * Add the occupancy grid that will be plotted.
+	 * The grid is not copied and must stay alive until Display.
 	 * \param grid The occupancy grid to be plotted. 
 	 */
-	void AddMap(nature::msg::OccupancyGrid grid);
+	void AddMap(const nature::msg::OccupancyGrid &grid);
 
 	/**
 	 * Add a list of global waypoints to be plotted
@@ -53,6 +54,11 @@ public:
 	 */
 	void AddWaypoints(nature::msg::Path waypoints);
 
+	/**
+	 * Whether the next Display would be shown, the inputs need not be added otherwise.
+	 */
+	virtual bool ReadyToDisplay() { return true; }
+
 	/**
 	 * Display the graph. 
 	 */
@@ -78,7 +84,7 @@ protected:
 	std::vector<utils::vec2> waypoints_;
 	std::vector<Candidate> curves_;
   std::shared_ptr<nature::visualization::VisualizerBase> visualizer_;
-  nature::msg::OccupancyGrid grid_;
+  const nature::msg::OccupancyGrid *grid_;
 
 	float x_lo_;
 	float x_hi_;
@@ -0,0 +1,173 @@
+/**
+ * \file lidar_simulator.h
+ *
+ * Synthetic lidar for the headless simulator. The world is a heightmap of the
+ * ground with vertical cylinder obstacles standing on it, flat ground at a base
+ * height outside the heightmap.
+ * Rays cross the heightmap block by block through a grid of the highest ground
+ * of each block, the blocks the ray passes over are skipped and the cells of the
+ * others are searched for the ground crossing. The cylinders are binned in a
+ * uniform grid and a ray only tests those of the bins it crosses, nearest first.
+ *
+ * \date 10/14/2026
+ */
+#ifndef NATURE_LIDAR_SIMULATOR_H
+#define NATURE_LIDAR_SIMULATOR_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "nature/nature_utils.h"
+
+namespace nature {
+namespace simulation {
+
+class SimulatedWorld {
+ public:
+  /// Create a world of flat ground at height 0 without obstacles
+  SimulatedWorld();
+
+  /**
+   * Set the height of the ground outside the heightmap, all of it if there is none
+   * \param z The ground height in meters
+   */
+  void SetBaseHeight(float z) { base_height_ = z; }
+
+  /**
+   * Set the ground heights, sample (i,j) at i*ny+j is the height at (llx + i*res, lly + j*res)
+   * \param heights The nx*ny heights in meters
+   * \param res Meters between samples
+   * \param llx Lower-left x-coordinate in meters
+   * \param lly Lower-left y-coordinate in meters
+   */
+  void SetHeightmap(const std::vector<float> &heights, int nx, int ny, float res, float llx, float lly);
+
+  /**
+   * Load the ground heights from a grayscale image, north up
+   * \param file The image file
+   * \param res Meters between pixels
+   * \param llx Lower-left x-coordinate in meters
+   * \param lly Lower-left y-coordinate in meters
+   * \param scale Meters per gray level, added to the base height
+   * \return False if the image could not be read
+   */
+  bool LoadHeightmap(const std::string &file, float res, float llx, float lly, float scale);
+
+  /**
+   * Add a vertical cylinder standing on the ground
+   * \param x Center x-coordinate in meters
+   * \param y Center y-coordinate in meters
+   * \param radius Radius in meters
+   * \param height Height above the ground at the center in meters
+   */
+  void AddCylinder(float x, float y, float radius, float height);
+
+  /**
+   * Build the block and bin grids, call after changing the world and before Raycast
+   * \param bin_size Size of the obstacle bins in meters
+   */
+  void Build(float bin_size = 4.0f);
+
+  /// Height of the ground at (x,y), bilinear in the heightmap
+  float GroundHeight(float x, float y) const;
+
+  /**
+   * Find the first surface along a ray
+   * \param o The ray origin
+   * \param d The unit ray direction
+   * \param max_range Farthest distance to look
+   * \param t The distance to the hit
+   * \return False if nothing is hit within max_range
+   */
+  bool Raycast(const nature::utils::vec3 &o, const nature::utils::vec3 &d, float max_range, float &t) const;
+
+  int NumCylinders() const { return (int)cylinders_.size(); }
+
+ private:
+  struct Cylinder {
+    float x;
+    float y;
+    float radius;
+    float height;
+    float top;
+  };
+
+  /// Nearest ground crossing within [0, t_max], updates t_max
+  bool RaycastGround(const nature::utils::vec3 &o, const nature::utils::vec3 &d, float &t_max) const;
+  /// Ground crossing within the heightmap segment [t0, t1]
+  bool RaycastHeightmap(const nature::utils::vec3 &o, const nature::utils::vec3 &d, float t0, float t1, float &t) const;
+  /// Nearest cylinder within [0, t_max], updates t_max
+  bool RaycastCylinders(const nature::utils::vec3 &o, const nature::utils::vec3 &d, float &t_max) const;
+  /// Height of the heightmap at grid coordinates (u,v), clamped to the map
+  float SampleHeight(float u, float v) const;
+
+  float base_height_;
+
+  // heightmap samples, column-major
+  std::vector<float> heights_;
+  int nx_;
+  int ny_;
+  float res_;
+  float llx_;
+  float lly_;
+  // highest sample of each block of BLOCK x BLOCK cells, column-major
+  std::vector<float> block_max_;
+  int nbx_;
+  int nby_;
+
+  std::vector<Cylinder> cylinders_;
+  // cylinders of bin b are bin_items_[bin_start_[b]] to bin_items_[bin_start_[b+1]-1]
+  std::vector<int> bin_start_;
+  std::vector<int> bin_items_;
+  int bins_x_;
+  int bins_y_;
+  float bin_size_;
+  float bin_llx_;
+  float bin_lly_;
+};
+
+/**
+ * A spinning multi-beam lidar, the beams are evenly spaced in elevation
+ * and fired at evenly spaced azimuths over a full turn.
+ */
+class SimulatedLidar {
+ public:
+  /**
+   * Create the lidar
+   * \param channels Number of beams
+   * \param min_elevation Elevation of the lowest beam in degrees
+   * \param max_elevation Elevation of the highest beam in degrees
+   * \param horizontal_steps Azimuths of a turn
+   * \param max_range Farthest return in meters
+   */
+  SimulatedLidar(int channels, float min_elevation, float max_elevation, int horizontal_steps, float max_range);
+
+  /**
+   * Scan the world from a pose
+   * \param world The world to scan, built
+   * \param origin Position of the lidar
+   * \param yaw Heading of the lidar in radians
+   * \param points The returns in world coordinates, replaced
+   * \param num_threads Threads to cast the rays with
+   * \param rings The beam of each return, replaced, if not null
+   */
+  void Scan(const SimulatedWorld &world, const nature::utils::vec3 &origin, float yaw,
+            std::vector<nature::utils::vec3> &points, int num_threads = 1, std::vector<uint16_t> *rings = nullptr);
+
+  /// Number of rays of a scan
+  int NumRays() const { return (int)beam_dirs_.size(); }
+
+ private:
+  int channels_;
+  int horizontal_steps_;
+  float max_range_;
+  // ray directions in the lidar frame, azimuth major
+  std::vector<nature::utils::vec3> beam_dirs_;
+  // distance of the return of each ray of the last scan, negative for none
+  std::vector<float> ranges_;
+};
+
+} // namespace simulation
+} // namespace nature
+
+#endif //NATURE_LIDAR_SIMULATOR_H
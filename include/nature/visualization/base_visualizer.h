@@ -17,6 +17,20 @@ namespace nature{
       virtual void draw_point(const int x0, const int y0, const nature::utils::vec3 & color){}
       virtual void draw_circle(const int x0, const int y0, int radius, const nature::utils::vec3 & color){}
       virtual void draw_line(const int x0, const int y0, const int x1, const int y1, const nature::utils::vec3 & color){}
+      /**
+      * Paint every occupied cell of a grid in one call
+      * \param cells The grid values, cell (i,j) at cells[i*ny + j]
+      * \param nx Number of cells along x
+      * \param ny Number of cells along y
+      * \param color Color of the cells with a value above 0
+      */
+      virtual void draw_grid(const int8_t *cells, int nx, int ny, const nature::utils::vec3 & color){}
+      /**
+      * Paint a list of points in one call
+      * \param points The pixel coordinates, those outside the image are skipped
+      * \param color Color of the points
+      */
+      virtual void draw_points(const std::vector<nature::utils::ivec2> & points, const nature::utils::vec3 & color){}
       virtual void display(){}
       virtual void save(const std::string & file_name){}
       virtual void save(const std::string & file_name, int nx, int ny){}
@@ -3,25 +3,61 @@
 
 #include "nature/visualization/base_visualizer.h"
 #include "nature/CImg.h"
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <memory>
 
 namespace nature {
   namespace visualization {
 
+    /**
+    * Draws into an image and shows it in a window.
+    * The planner thread draws a frame and hands it over with display, a render
+    * thread mirrors and shows the newest frame at most max_fps times a second.
+    * A frame is not changed once it is handed over, so the render thread reads it without a lock
+    * and display never waits for the window.
+    */
     class ImageVisualizer : public VisualizerBase {
 
     public:
-      ImageVisualizer() = default;
+      /**
+      * Create the visualizer, the window and the render thread are created on the first frame
+      * \param max_fps Most frames shown a second, 0 shows every frame as fast as the window allows
+      */
+      explicit ImageVisualizer(float max_fps = 10.0f);
+      ~ImageVisualizer();
       bool initialize_display(int nx, int ny) override;
       void draw_circle(const int x0, const int y0, int radius, const nature::utils::vec3 &color) override;
       void draw_point(const int x0, const int y0, const nature::utils::vec3 &color) override;
       void draw_line(const int x0, const int y0, const int x1, const int y1, const nature::utils::vec3 &color) override;
+      void draw_grid(const int8_t *cells, int nx, int ny, const nature::utils::vec3 &color) override;
+      void draw_points(const std::vector<nature::utils::ivec2> &points, const nature::utils::vec3 &color) override;
       void display() override;
+      /// Save the last displayed frame, or the frame being drawn if none was displayed
       void save(const std::string &file_name) override;
       void save(const std::string &file_name, int nx, int ny) override;
 
     private:
+      typedef cimg_library::CImg<float> Image;
+
+      /// Show the handed over frames until stop_
+      void RenderLoop();
+      /// The last displayed frame or the one being drawn
+      std::shared_ptr<const Image> SavedFrame();
+
+      float max_fps_;
+      /// the frame being drawn, only used by the drawing thread
+      std::shared_ptr<Image> image_;
+      /// the last frame handed over, guarded by mutex_
+      std::shared_ptr<Image> frame_;
+      bool fresh_ = false;
+      bool stop_ = false;
+      std::mutex mutex_;
+      std::condition_variable frame_ready_;
+      std::thread render_thread_;
+      /// only used by the render thread
       cimg_library::CImgDisplay disp_;
-      cimg_library::CImg<float> image_;
     };
 
   }
@@ -9,16 +9,19 @@ namespace nature{
   namespace visualization{
 
     const std::string default_display = "x11";    // x11, opencv, rviz, none
+    const float default_display_fps = 10.0f;      // most frames shown a second by the image display
 
-    inline std::shared_ptr<nature::visualization::VisualizerBase> create_visualizer(const std::string & display_type){
-      return display_type == "image" ? std::make_shared<nature::visualization::ImageVisualizer>()
+    inline std::shared_ptr<nature::visualization::VisualizerBase> create_visualizer(const std::string & display_type, float max_fps = default_display_fps){
+      return display_type == "image" ? std::make_shared<nature::visualization::ImageVisualizer>(max_fps)
                                      : std::make_shared<nature::visualization::VisualizerBase>();
     }
 
     inline std::shared_ptr<nature::planning::Plotter> create_local_path_plotter(const std::string & display_type, const std::string & cost_vis,
-                                                                                 std::shared_ptr<nature::node::NodeProxy> node, float w_c, float w_s, float w_r, float w_d, float w_t, float cost_vis_text_size){
-      auto visualizer = create_visualizer(display_type);
-      return display_type == "rviz" ? std::make_shared<nature::planning::RVIZPlotter>(visualizer, cost_vis, node, w_c, w_s, w_r, w_d, w_t, cost_vis_text_size)
+                                                                                 std::shared_ptr<nature::node::NodeProxy> node, float w_c, float w_s, float w_r, float w_d, float w_t, float cost_vis_text_size,
+                                                                                 float cost_vis_rate, float cost_vis_step, float cost_vis_threshold, float max_fps = default_display_fps){
+      auto visualizer = create_visualizer(display_type, max_fps);
+      return display_type == "rviz" ? std::make_shared<nature::planning::RVIZPlotter>(visualizer, cost_vis, node, w_c, w_s, w_r, w_d, w_t, cost_vis_text_size,
+                                                                                                           cost_vis_rate, cost_vis_step, cost_vis_threshold)
                                     : std::make_shared<nature::planning::Plotter>(visualizer);
     }
 
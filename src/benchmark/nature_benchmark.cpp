@@ -0,0 +1,457 @@
+/**
+ * \file nature_benchmark.cpp
+ *
+ * Times the core algorithms outside of their nodes, no ROS master is needed.
+ * Each algorithm runs on synthetic grids, clouds and paths swept over grid
+ * sizes, resolutions, obstacle densities and numbers of candidates, or on
+ * recorded ones loaded from files. Results are written as CSV, one row per
+ * case plus one row per pipeline stage timed inside the algorithms.
+ *
+ * Usage: nature_benchmark [options]
+ *   --sizes 50,100,200      grid sizes in meters
+ *   --res 0.5,1.0           grid resolutions in meters
+ *   --densities 0,0.05,0.15 fraction of the grid covered by obstacles
+ *   --num_paths 11,21,41    local planner candidates
+ *   --points 100000         points of the synthetic clouds
+ *   --threads 1             threads of the grid and the local planner
+ *   --repeats 20            timed runs of each case, after one warm up run
+ *   --grid map.pgm          recorded occupancy grid, dark is occupied, replaces the size and density sweep
+ *   --cloud scan.txt        recorded cloud, one "x y z" per line, replaces the synthetic clouds
+ *   --path path.txt         recorded path, one "x y" per line, replaces the synthetic path
+ *   --only name             run only the benchmarks starting with name, e.g. global
+ *   --out results.csv       write the results to a file instead of stdout
+ */
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <random>
+#include <chrono>
+#include <algorithm>
+#include <functional>
+#include <math.h>
+#include "nature/node/ros_types.h"
+#include "nature/node/stage_timer.h"
+#include "nature/perception/elevation_grid.h"
+#include "nature/planning/global/astar.h"
+#include "nature/planning/local/spline_planner.h"
+#include "nature/planning/local/pf_planner.h"
+#include "nature/control/pure_pursuit_controller.h"
+
+struct Options {
+  std::vector<float> sizes = {50.0f, 100.0f, 200.0f};
+  std::vector<float> res = {0.5f, 1.0f};
+  std::vector<float> densities = {0.0f, 0.05f, 0.15f};
+  std::vector<float> num_paths = {11.0f, 21.0f, 41.0f};
+  int points = 100000;
+  int threads = 1;
+  int repeats = 20;
+  std::string grid_file;
+  std::string cloud_file;
+  std::string path_file;
+  std::string only;
+  std::string out_file;
+};
+
+/// one benchmark case, the parameters not used by a benchmark are written as -1
+struct Case {
+  std::string name;
+  float size;
+  float res;
+  float density;
+  int num_paths;
+};
+
+std::vector<float> ParseList(const std::string &s){
+  std::vector<float> list;
+  std::stringstream ss(s);
+  std::string item;
+  while (std::getline(ss, item, ',')) list.push_back((float)atof(item.c_str()));
+  return list;
+}
+
+bool ParseOptions(int argc, char *argv[], Options &opt){
+  for (int i = 1; i < argc; i++){
+    std::string arg = argv[i];
+    if (i + 1 >= argc){
+      std::cerr << "WARNING: missing value for " << arg << std::endl;
+      return false;
+    }
+    std::string val = argv[++i];
+    if (arg == "--sizes") opt.sizes = ParseList(val);
+    else if (arg == "--res") opt.res = ParseList(val);
+    else if (arg == "--densities") opt.densities = ParseList(val);
+    else if (arg == "--num_paths") opt.num_paths = ParseList(val);
+    else if (arg == "--points") opt.points = atoi(val.c_str());
+    else if (arg == "--threads") opt.threads = atoi(val.c_str());
+    else if (arg == "--repeats") opt.repeats = std::max(1, atoi(val.c_str()));
+    else if (arg == "--grid") opt.grid_file = val;
+    else if (arg == "--cloud") opt.cloud_file = val;
+    else if (arg == "--path") opt.path_file = val;
+    else if (arg == "--only") opt.only = val;
+    else if (arg == "--out") opt.out_file = val;
+    else {
+      std::cerr << "WARNING: unknown option " << arg << std::endl;
+      return false;
+    }
+  }
+  return true;
+}
+
+/// grid of size x size meters centered on the origin, with discs of obstacles covering about density of it
+nature::msg::OccupancyGrid MakeGrid(float size, float res, float density, std::mt19937 &rng){
+  nature::msg::OccupancyGrid grid;
+  int n = (int)(size / res);
+  grid.info.resolution = res;
+  grid.info.width = n;
+  grid.info.height = n;
+  grid.info.origin.position.x = -0.5f * size;
+  grid.info.origin.position.y = -0.5f * size;
+  grid.info.origin.orientation.w = 1.0;
+  grid.data.assign(n * n, 0);
+  const float radius = 1.0f;
+  int nobs = (int)(density * size * size / (M_PI * radius * radius));
+  std::uniform_real_distribution<float> coord(-0.5f * size, 0.5f * size);
+  int r = (int)ceil(radius / res);
+  for (int k = 0; k < nobs; k++){
+    float ox = coord(rng), oy = coord(rng);
+    int ci = (int)((ox - grid.info.origin.position.x) / res);
+    int cj = (int)((oy - grid.info.origin.position.y) / res);
+    for (int i = std::max(0, ci - r); i <= std::min(n - 1, ci + r); i++){
+      for (int j = std::max(0, cj - r); j <= std::min(n - 1, cj + r); j++){
+        float dx = grid.info.origin.position.x + (i + 0.5f) * res - ox;
+        float dy = grid.info.origin.position.y + (j + 0.5f) * res - oy;
+        if (dx * dx + dy * dy < radius * radius) grid.data[i * n + j] = 100;
+      }
+    }
+  }
+  return grid;
+}
+
+/// binary PGM (P5) as a column-major occupancy grid centered on the origin, like map_server dark cells are occupied
+bool LoadGrid(const std::string &fname, float res, nature::msg::OccupancyGrid &grid){
+  std::ifstream in(fname.c_str(), std::ios::binary);
+  std::string magic;
+  int w, h, maxval;
+  in >> magic;
+  // skip comment lines between the header fields
+  std::vector<int> header;
+  while (in && header.size() < 3){
+    in >> std::ws;
+    if (in.peek() == '#'){
+      std::string comment;
+      std::getline(in, comment);
+      continue;
+    }
+    int v;
+    in >> v;
+    header.push_back(v);
+  }
+  in.get();
+  if (!in || magic != "P5" || header.size() < 3 || header[2] > 255){
+    std::cerr << "WARNING: " << fname << " is not an 8 bit binary PGM" << std::endl;
+    return false;
+  }
+  w = header[0];
+  h = header[1];
+  maxval = header[2];
+  std::vector<unsigned char> pixels(w * h);
+  in.read((char *)pixels.data(), pixels.size());
+  if (!in){
+    std::cerr << "WARNING: " << fname << " is truncated" << std::endl;
+    return false;
+  }
+  grid.info.resolution = res;
+  grid.info.width = w;
+  grid.info.height = h;
+  grid.info.origin.position.x = -0.5f * w * res;
+  grid.info.origin.position.y = -0.5f * h * res;
+  grid.info.origin.orientation.w = 1.0;
+  grid.data.resize(w * h);
+  // the first image row is the top of the map
+  for (int i = 0; i < w; i++){
+    for (int j = 0; j < h; j++){
+      grid.data[i * h + j] = (int8_t)(100 * (maxval - pixels[(h - 1 - j) * w + i]) / maxval);
+    }
+  }
+  return true;
+}
+
+/// lines of whitespace separated floats, only the first ncols of each line are kept
+bool LoadColumns(const std::string &fname, int ncols, std::vector<float> &values){
+  std::ifstream in(fname.c_str());
+  if (!in){
+    std::cerr << "WARNING: could not open " << fname << std::endl;
+    return false;
+  }
+  values.clear();
+  std::string line;
+  while (std::getline(in, line)){
+    std::stringstream ss(line);
+    std::vector<float> row(ncols);
+    int c = 0;
+    while (c < ncols && ss >> row[c]) c++;
+    if (c == ncols) values.insert(values.end(), row.begin(), row.end());
+  }
+  return !values.empty();
+}
+
+/// PointCloud2 with float x, y, z fields
+nature::msg::PointCloud2 MakeCloud(const std::vector<float> &xyz){
+  nature::msg::PointCloud2 cloud;
+  const char *names[3] = {"x", "y", "z"};
+  cloud.fields.resize(3);
+  for (int f = 0; f < 3; f++){
+    cloud.fields[f].name = names[f];
+    cloud.fields[f].offset = 4 * f;
+    cloud.fields[f].datatype = nature::msg::PointField::FLOAT32;
+    cloud.fields[f].count = 1;
+  }
+  cloud.height = 1;
+  cloud.width = (uint32_t)(xyz.size() / 3);
+  cloud.point_step = 12;
+  cloud.row_step = cloud.point_step * cloud.width;
+  cloud.is_dense = true;
+  cloud.data.resize(xyz.size() * sizeof(float));
+  std::copy((const uint8_t *)xyz.data(), (const uint8_t *)xyz.data() + cloud.data.size(), cloud.data.begin());
+  return cloud;
+}
+
+/// ground points over the grid plus points on the obstacles of the grid, up to 1.5 m high
+std::vector<float> SyntheticPoints(const nature::msg::OccupancyGrid &grid, int npoints, std::mt19937 &rng){
+  std::vector<float> xyz;
+  xyz.reserve(3 * npoints);
+  float res = grid.info.resolution;
+  float llx = grid.info.origin.position.x, lly = grid.info.origin.position.y;
+  std::uniform_real_distribution<float> ux(llx, llx + grid.info.width * res);
+  std::uniform_real_distribution<float> uy(lly, lly + grid.info.height * res);
+  std::uniform_real_distribution<float> uz(0.0f, 1.5f);
+  std::normal_distribution<float> noise(0.0f, 0.02f);
+  for (int k = 0; k < npoints; k++){
+    float x = ux(rng), y = uy(rng);
+    int i = std::min((int)((x - llx) / res), (int)grid.info.width - 1);
+    int j = std::min((int)((y - lly) / res), (int)grid.info.height - 1);
+    bool obstacle = grid.data[i * grid.info.height + j] > 0;
+    xyz.push_back(x);
+    xyz.push_back(y);
+    xyz.push_back(obstacle ? uz(rng) : noise(rng));
+  }
+  return xyz;
+}
+
+/// straight path across the grid along x, 1 m between points
+std::vector<nature::utils::vec2> SyntheticPath(float size){
+  std::vector<nature::utils::vec2> path;
+  for (float x = -0.4f * size; x <= 0.4f * size; x += 1.0f) path.push_back(nature::utils::vec2(x, 0.0f));
+  return path;
+}
+
+nature::msg::Path ToPathMsg(const std::vector<nature::utils::vec2> &points){
+  nature::msg::Path path;
+  path.poses.resize(points.size());
+  for (int i = 0; i < points.size(); i++){
+    path.poses[i].pose.position.x = points[i].x;
+    path.poses[i].pose.position.y = points[i].y;
+    path.poses[i].pose.orientation.w = 1.0;
+  }
+  return path;
+}
+
+nature::msg::Odometry MakeOdometry(nature::utils::vec2 p, float heading, float speed){
+  nature::msg::Odometry odom;
+  odom.pose.pose.position.x = p.x;
+  odom.pose.pose.position.y = p.y;
+  odom.pose.pose.orientation.w = cos(0.5f * heading);
+  odom.pose.pose.orientation.z = sin(0.5f * heading);
+  odom.twist.twist.linear.x = speed * cos(heading);
+  odom.twist.twist.linear.y = speed * sin(heading);
+  return odom;
+}
+
+class Reporter {
+ public:
+  explicit Reporter(std::ostream &out) : out_(out) {
+    out_ << "benchmark,stage,size_m,res_m,density,num_paths,count,mean_ms,p50_ms,p99_ms,max_ms" << std::endl;
+  }
+
+  /// run setup then fn once to warm up and repeats more times timing fn, write the case and the stages it went through
+  void Run(const Case &c, int repeats, std::function<void()> setup, std::function<void()> fn){
+    std::vector<nature::node::StageSummary> stages;
+    setup();
+    fn();
+    nature::node::CollectStages(stages);
+    std::vector<double> ms(repeats);
+    for (int r = 0; r < repeats; r++){
+      setup();
+      auto t0 = std::chrono::steady_clock::now();
+      fn();
+      ms[r] = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count();
+    }
+    int dropped = nature::node::CollectStages(stages);
+    if (dropped > 0) std::cerr << "WARNING: " << dropped << " stage samples of " << c.name << " were dropped" << std::endl;
+    double mean = 0.0;
+    for (int r = 0; r < repeats; r++) mean += ms[r];
+    mean /= repeats;
+    std::sort(ms.begin(), ms.end());
+    Row(c, "total", repeats, mean, ms[(repeats - 1) / 2], ms[(int)ceil(0.99 * repeats) - 1], ms.back());
+    for (int s = 0; s < stages.size(); s++){
+      Row(c, stages[s].name, stages[s].count, -1.0, 1000.0 * stages[s].p50, 1000.0 * stages[s].p99, 1000.0 * stages[s].max);
+    }
+  }
+
+ private:
+  void Row(const Case &c, const std::string &stage, int count, double mean, double p50, double p99, double max){
+    out_ << c.name << "," << stage << "," << c.size << "," << c.res << "," << c.density << "," << c.num_paths << ","
+         << count << "," << mean << "," << p50 << "," << p99 << "," << max << std::endl;
+  }
+  std::ostream &out_;
+};
+
+/// the grids of the cases, synthetic over sizes and densities or the recorded one
+struct GridCase {
+  float size;
+  float density;
+  nature::msg::OccupancyGrid grid;
+};
+
+bool Selected(const Options &opt, const std::string &name){
+  return opt.only.empty() || name.compare(0, opt.only.size(), opt.only) == 0;
+}
+
+int main(int argc, char *argv[]){
+  Options opt;
+  if (!ParseOptions(argc, argv, opt)) return 1;
+
+  std::ofstream out_file;
+  if (!opt.out_file.empty()){
+    out_file.open(opt.out_file.c_str());
+    if (!out_file){
+      std::cerr << "WARNING: could not open " << opt.out_file << std::endl;
+      return 1;
+    }
+  }
+  Reporter reporter(opt.out_file.empty() ? std::cout : out_file);
+
+  std::vector<float> recorded_points;
+  if (!opt.cloud_file.empty() && !LoadColumns(opt.cloud_file, 3, recorded_points)) return 1;
+  std::vector<float> recorded_path;
+  if (!opt.path_file.empty() && !LoadColumns(opt.path_file, 2, recorded_path)) return 1;
+
+  std::mt19937 rng(42);
+  for (int r = 0; r < opt.res.size(); r++){
+    float res = opt.res[r];
+    std::vector<GridCase> grids;
+    if (!opt.grid_file.empty()){
+      GridCase g;
+      if (!LoadGrid(opt.grid_file, res, g.grid)) return 1;
+      g.size = g.grid.info.width * res;
+      g.density = -1.0f;
+      grids.push_back(g);
+    }
+    else {
+      for (int s = 0; s < opt.sizes.size(); s++){
+        for (int d = 0; d < opt.densities.size(); d++){
+          GridCase g;
+          g.size = opt.sizes[s];
+          g.density = opt.densities[d];
+          g.grid = MakeGrid(g.size, res, g.density, rng);
+          grids.push_back(g);
+        }
+      }
+    }
+
+    for (int g = 0; g < grids.size(); g++){
+      const nature::msg::OccupancyGrid &grid = grids[g].grid;
+      float size = grids[g].size;
+      float llx = grid.info.origin.position.x, lly = grid.info.origin.position.y;
+      nature::msg::OccupancyGrid no_segmentation;
+      std::vector<nature::utils::vec2> path_points;
+      if (!recorded_path.empty()){
+        for (int k = 0; k + 1 < recorded_path.size(); k += 2) path_points.push_back(nature::utils::vec2(recorded_path[k], recorded_path[k + 1]));
+      }
+      else {
+        path_points = SyntheticPath(size);
+      }
+      if (path_points.size() < 2){
+        std::cerr << "WARNING: the path needs at least 2 points" << std::endl;
+        return 1;
+      }
+      nature::utils::vec2 start = path_points.front();
+      nature::utils::vec2 goal = path_points.back();
+      float heading = atan2(path_points[1].y - start.y, path_points[1].x - start.x);
+      nature::msg::Odometry odom = MakeOdometry(start, heading, 5.0f);
+      Case c = {"", size, res, grids[g].density, -1};
+
+      if (Selected(opt, "perception")){
+        nature::msg::PointCloud2 cloud = MakeCloud(recorded_points.empty() ? SyntheticPoints(grid, opt.points, rng) : recorded_points);
+        nature::perception::ElevationGrid egrid;
+        egrid.SetRes(res);
+        egrid.SetSize(grid.info.width * res, grid.info.height * res);
+        egrid.SetCorner(llx, lly);
+        egrid.SetNumThreads(opt.threads);
+        nature::perception::ScanFilter filter;
+        nature::msg::OccupancyGrid out;
+        c.name = "perception.add_points";
+        reporter.Run(c, opt.repeats, [&](){ egrid.ClearGrid(); }, [&](){ egrid.AddPoints(cloud, filter); });
+        c.name = "perception.get_grid";
+        reporter.Run(c, opt.repeats, [](){}, [&](){ egrid.GetGrid(out); });
+      }
+
+      if (Selected(opt, "global")){
+        nature::msg::OccupancyGrid grid_copy = grid;
+        nature::planning::Astar astar(std::make_shared<nature::visualization::VisualizerBase>());
+        std::vector<float> g_goal = {goal.x, goal.y}, g_start = {start.x, start.y};
+        c.name = "global.plan_path";
+        reporter.Run(c, opt.repeats, [](){}, [&](){ astar.PlanPath(&grid_copy, &no_segmentation, g_goal, g_start); });
+        c.name = "global.cost_to_go";
+        reporter.Run(c, opt.repeats, [](){}, [&](){ astar.ComputeCostToGo(&grid_copy, &no_segmentation, g_goal); });
+      }
+
+      if (Selected(opt, "local")){
+        nature::planning::Path path;
+        path.Init(path_points);
+        path.FixBeginning(start.x, start.y);
+        path.FixEnd();
+        nature::utils::vec2 srho = path.ToSRho(start.x, start.y);
+        float s_lookahead = std::min(30.0f, path.GetTotalLength() - srho.x);
+        nature::planning::CurveInfo ci = path.GetCurvatureAndAngle(srho.x);
+        for (int p = 0; p < opt.num_paths.size(); p++){
+          nature::planning::Planner planner;
+          planner.SetNumThreads(opt.threads);
+          c.num_paths = (int)opt.num_paths[p];
+          c.name = "local.candidate_costs";
+          // new candidates each run, so the costs are computed in full as on a replan
+          reporter.Run(c, opt.repeats,
+                       [&](){
+                         planner.GeneratePaths(c.num_paths, srho.x, srho.y, heading - ci.theta, s_lookahead, 0.5f, 2.0f);
+                         planner.SetCenterline(path);
+                       },
+                       [&](){ planner.CalculateCandidateCosts(grid, no_segmentation, odom); });
+        }
+        c.num_paths = -1;
+      }
+
+      if (Selected(opt, "pf")){
+        nature::planning::PfPlanner pf;
+        pf.SetGoal(goal.x, goal.y);
+        c.name = "pf.plan";
+        reporter.Run(c, opt.repeats, [](){}, [&](){ pf.Plan(grid, odom); });
+      }
+
+      if (Selected(opt, "control")){
+        nature::control::PurePursuitController controller;
+        controller.SetVehicleState(odom);
+        nature::msg::Path traj = ToPathMsg(path_points);
+        nature::utils::vec2 pp_goal;
+        c.name = "control.pure_pursuit";
+        reporter.Run(c, opt.repeats, [](){}, [&](){ controller.GetDcFromTraj(traj, pp_goal); });
+        // the control node preprocesses each path once and tracks progress along it on each tick
+        controller.SetPath(traj);
+        c.name = "control.pure_pursuit_tracked";
+        reporter.Run(c, opt.repeats, [](){}, [&](){ controller.GetDcFromPath(pp_goal); });
+      }
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,183 @@
+#include "nature/common/morphology.h"
+#include <algorithm>
+#include <limits>
+
+namespace nature {
+namespace common {
+
+GridRoi GridRoi::Clamp(int nx, int ny) const{
+  return GridRoi(std::max(0, imin), std::max(0, jmin), std::min(nx, imax), std::min(ny, jmax));
+}
+
+GridRoi GridRoi::Union(const GridRoi &roi) const{
+  if (roi.Empty()) return *this;
+  if (Empty()) return roi;
+  return GridRoi(std::min(imin, roi.imin), std::min(jmin, roi.jmin), std::max(imax, roi.imax), std::max(jmax, roi.jmax));
+}
+
+/**
+ * Running max of width 2r+1 along one line of n values.
+ * Writes out[(x-lo)*out_stride] for x in [lo,hi).
+ * g and h are scratch buffers.
+ */
+template <typename T>
+static void MaxFilterLine(const T *in, int in_stride, int n, int r, int lo, int hi,
+                          T *out, int out_stride, std::vector<T> &g, std::vector<T> &h){
+  int s = std::max(0, lo - r);
+  int e = std::min(n - 1, hi - 1 + r);
+  int len = e - s + 1;
+  int k = 2*r + 1;
+  g.resize(len);
+  h.resize(len);
+  // g is the max from the start of each block of k, h the max to its end
+  for (int x=0;x<len;x++){
+    T v = in[(s + x)*in_stride];
+    g[x] = (x % k == 0) ? v : std::max(g[x-1], v);
+  }
+  for (int x=len-1;x>=0;x--){
+    T v = in[(s + x)*in_stride];
+    h[x] = (x == len-1 || (x+1) % k == 0) ? v : std::max(h[x+1], v);
+  }
+  for (int x=lo;x<hi;x++){
+    int a = std::max(0, x - r) - s;
+    int b = std::min(n - 1, x + r) - s;
+    T val;
+    if (a/k != b/k){
+      val = std::max(h[a], g[b]);
+    }
+    else if (a % k == 0){
+      val = g[b];
+    }
+    else if (b == len-1 || (b+1) % k == 0){
+      val = h[a];
+    }
+    else{
+      // window clipped on both sides, only when the line is shorter than k
+      val = in[(s + a)*in_stride];
+      for (int y=a+1;y<=b;y++) val = std::max(val, in[(s + y)*in_stride]);
+    }
+    out[(x - lo)*out_stride] = val;
+  }
+}
+
+template <typename T>
+void DilateBox(const T *src, T *dst, int nx, int ny, int rx, int ry, GridRoi roi){
+  roi = roi.Clamp(nx, ny);
+  if (roi.Empty()) return;
+  rx = std::max(0, rx);
+  ry = std::max(0, ry);
+
+  // columns read by the pass along i
+  int ci0 = std::max(0, roi.imin - rx);
+  int ci1 = std::min(nx, roi.imax + rx);
+  int rh = roi.jmax - roi.jmin;
+  std::vector<T> tmp((ci1 - ci0)*rh);
+  std::vector<T> g, h;
+
+  // pass along j, contiguous in memory, all reads of src happen here
+  for (int i=ci0;i<ci1;i++){
+    MaxFilterLine(src + i*ny, 1, ny, ry, roi.jmin, roi.jmax, &tmp[(i - ci0)*rh], 1, g, h);
+  }
+  // pass along i
+  for (int j=roi.jmin;j<roi.jmax;j++){
+    MaxFilterLine(&tmp[j - roi.jmin], rh, ci1 - ci0, rx, roi.imin - ci0, roi.imax - ci0, dst + roi.imin*ny + j, ny, g, h);
+  }
+}
+
+/// 1D squared distance of the lower envelope of parabolas rooted at f
+static void DistanceLine(const float *f, int n, float *d, std::vector<int> &v, std::vector<float> &z){
+  const float inf = std::numeric_limits<float>::max();
+  v.resize(n);
+  z.resize(n+1);
+  int k = -1;
+  for (int q=0;q<n;q++){
+    if (f[q] >= inf) continue;
+    if (k < 0){
+      k = 0;
+      v[0] = q;
+      z[0] = -inf;
+      z[1] = inf;
+      continue;
+    }
+    float sq;
+    while (true){
+      int p = v[k];
+      sq = ((f[q] + q*q) - (f[p] + p*p)) / (2.0f*q - 2.0f*p);
+      if (k > 0 && sq <= z[k]) k--;
+      else break;
+    }
+    k++;
+    v[k] = q;
+    z[k] = sq;
+    z[k+1] = inf;
+  }
+  if (k < 0){
+    for (int q=0;q<n;q++) d[q] = inf;
+    return;
+  }
+  k = 0;
+  for (int q=0;q<n;q++){
+    while (z[k+1] < q) k++;
+    float dq = (float)(q - v[k]);
+    d[q] = dq*dq + f[v[k]];
+  }
+}
+
+template <typename T>
+void DistanceTransform(const T *src, int nx, int ny, T thresh, GridRoi roi, std::vector<float> &dist_sqr){
+  roi = roi.Clamp(nx, ny);
+  dist_sqr.clear();
+  if (roi.Empty()) return;
+  const float inf = std::numeric_limits<float>::max();
+  int w = roi.imax - roi.imin;
+  int hgt = roi.jmax - roi.jmin;
+  dist_sqr.resize(w*hgt);
+  std::vector<float> f(std::max(w, hgt));
+  std::vector<float> d(std::max(w, hgt));
+  std::vector<int> v;
+  std::vector<float> z;
+
+  // columns
+  for (int i=0;i<w;i++){
+    const T *col = src + (roi.imin + i)*ny + roi.jmin;
+    for (int j=0;j<hgt;j++) f[j] = col[j] > thresh ? 0.0f : inf;
+    DistanceLine(f.data(), hgt, &dist_sqr[i*hgt], v, z);
+  }
+  // rows
+  for (int j=0;j<hgt;j++){
+    for (int i=0;i<w;i++) f[i] = dist_sqr[i*hgt + j];
+    DistanceLine(f.data(), w, d.data(), v, z);
+    for (int i=0;i<w;i++) dist_sqr[i*hgt + j] = d[i];
+  }
+}
+
+template <typename T>
+void DilateDisk(const T *src, T *dst, int nx, int ny, float radius, T thresh, T value, GridRoi roi){
+  roi = roi.Clamp(nx, ny);
+  if (roi.Empty()) return;
+  int r = (int)radius + 1;
+  GridRoi padded = GridRoi(roi.imin - r, roi.jmin - r, roi.imax + r, roi.jmax + r).Clamp(nx, ny);
+  std::vector<float> dist_sqr;
+  DistanceTransform(src, nx, ny, thresh, padded, dist_sqr);
+  int hgt = padded.jmax - padded.jmin;
+  float r2 = radius*radius;
+  for (int i=roi.imin;i<roi.imax;i++){
+    for (int j=roi.jmin;j<roi.jmax;j++){
+      int n = i*ny + j;
+      dst[n] = dist_sqr[(i - padded.imin)*hgt + (j - padded.jmin)] <= r2 ? value : src[n];
+    }
+  }
+}
+
+template void DilateBox<int8_t>(const int8_t*, int8_t*, int, int, int, int, GridRoi);
+template void DilateBox<uint8_t>(const uint8_t*, uint8_t*, int, int, int, int, GridRoi);
+template void DilateBox<float>(const float*, float*, int, int, int, int, GridRoi);
+template void DistanceTransform<int8_t>(const int8_t*, int, int, int8_t, GridRoi, std::vector<float>&);
+template void DistanceTransform<uint8_t>(const uint8_t*, int, int, uint8_t, GridRoi, std::vector<float>&);
+template void DistanceTransform<float>(const float*, int, int, float, GridRoi, std::vector<float>&);
+template void DilateDisk<int8_t>(const int8_t*, int8_t*, int, int, float, int8_t, int8_t, GridRoi);
+template void DilateDisk<uint8_t>(const uint8_t*, uint8_t*, int, int, float, uint8_t, uint8_t, GridRoi);
+template void DilateDisk<float>(const float*, float*, int, int, float, float, float, GridRoi);
+
+} // namespace common
+} // namespace nature
@@ -0,0 +1,137 @@
+#include "nature/common/replay_clock.h"
+#include <atomic>
+#include <limits>
+
+namespace nature {
+namespace common {
+
+static std::atomic<ReplayClock *> active_clock(nullptr);
+
+ReplayClock::ReplayClock(double start) : now_(start), limit_(start){
+  active_clock = this;
+}
+
+ReplayClock::~ReplayClock(){
+  active_clock = nullptr;
+}
+
+ReplayClock *ReplayClock::Active(){
+  return active_clock;
+}
+
+double ReplayClock::Now(){
+  std::lock_guard<std::mutex> lock(mutex_);
+  return now_;
+}
+
+int ReplayClock::Reserve(){
+  std::lock_guard<std::mutex> lock(mutex_);
+  Participant participant;
+  // runnable right away, it gets the turn once it reaches Enter
+  participant.wake = now_;
+  participants_.push_back(participant);
+  return (int)participants_.size() - 1;
+}
+
+void ReplayClock::Enter(int id){
+  std::unique_lock<std::mutex> lock(mutex_);
+  WaitTurn(lock, id);
+}
+
+void ReplayClock::Leave(){
+  std::lock_guard<std::mutex> lock(mutex_);
+  participants_[running_].left = true;
+  PassTurn();
+}
+
+void ReplayClock::SleepUntil(double time, std::function<bool()> ready){
+  std::unique_lock<std::mutex> lock(mutex_);
+  int id = running_;
+  participants_[id].wake = time;
+  participants_[id].ready = ready;
+  PassTurn();
+  WaitTurn(lock, id);
+  participants_[id].ready = nullptr;
+}
+
+void ReplayClock::Join(int id){
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    participants_[running_].joining = id;
+  }
+  SleepUntil(std::numeric_limits<double>::infinity());
+  std::lock_guard<std::mutex> lock(mutex_);
+  participants_[running_].joining = -1;
+}
+
+bool ReplayClock::Participating(){
+  // only the thread with the turn runs, so the turn tells who is calling
+  std::lock_guard<std::mutex> lock(mutex_);
+  return running_ != DRIVER;
+}
+
+void ReplayClock::RunUntil(double time){
+  std::unique_lock<std::mutex> lock(mutex_);
+  limit_ = time;
+  PassTurn();
+  WaitTurn(lock, DRIVER);
+  if (now_ < time) now_ = time;
+}
+
+bool ReplayClock::RunUntilLeft(){
+  std::unique_lock<std::mutex> lock(mutex_);
+  limit_ = std::numeric_limits<double>::infinity();
+  PassTurn();
+  WaitTurn(lock, DRIVER);
+  for (size_t k = 0; k < participants_.size(); k++){
+    if (!participants_[k].left) return false;
+  }
+  return true;
+}
+
+void ReplayClock::PassTurn(){
+  int next = DRIVER;
+  double next_time = std::numeric_limits<double>::infinity();
+  for (size_t k = 0; k < participants_.size(); k++){
+    const Participant &p = participants_[k];
+    if (p.left) continue;
+    bool ready = (p.joining >= 0 && participants_[p.joining].left) || (p.ready && p.ready());
+    double time = ready ? now_ : p.wake;
+    // strictly earlier, so the thread started first wins a tie
+    if (time < next_time){
+      next = (int)k;
+      next_time = time;
+    }
+  }
+  if (next != DRIVER && (next_time > limit_ || next_time == std::numeric_limits<double>::infinity())) next = DRIVER;
+  if (next != DRIVER && next_time > now_) now_ = next_time;
+  running_ = next;
+  cond_.notify_all();
+}
+
+void ReplayClock::WaitTurn(std::unique_lock<std::mutex> &lock, int id){
+  cond_.wait(lock, [this, id]{ return running_ == id; });
+}
+
+ReplayThread::ReplayThread(std::function<void()> run) : clock_(ReplayClock::Active()){
+  if (!clock_){
+    thread_ = std::thread(run);
+    return;
+  }
+  id_ = clock_->Reserve();
+  ReplayClock *clock = clock_;
+  int id = id_;
+  thread_ = std::thread([clock, id, run](){
+    clock->Enter(id);
+    run();
+    clock->Leave();
+  });
+}
+
+void ReplayThread::join(){
+  if (clock_ && clock_->Participating()) clock_->Join(id_);
+  thread_.join();
+}
+
+} // namespace common
+} // namespace nature
@@ -0,0 +1,218 @@
+#include "nature/control/mpc_controller.h"
+#include "nature/node/stage_timer.h"
+#include <chrono>
+#include <algorithm>
+
+namespace nature {
+namespace control{
+
+static const int STAGE_MPC = nature::node::RegisterStage("control.mpc");
+
+MpcController::MpcController() {
+	// set to MRZR values, like the pure pursuit controller
+	wheelbase_ = 2.731f; // meters
+	max_steering_angle_ = 0.69f; //39.5 degrees
+	max_accel_ = 2.0f;
+	max_decel_ = 4.0f;
+	dt_ = 0.1f;
+	deadline_ = 0.0008f;
+	max_iterations_ = 10;
+
+	w_lateral_ = 1.0;
+	w_heading_ = 2.0;
+	w_speed_ = 0.5;
+	w_steering_ = 1.0;
+	w_accel_ = 0.1;
+
+	for (int k = 0; k <= HORIZON; k++) {
+		ref_x_[k] = 0.0;
+		ref_y_[k] = 0.0;
+		ref_heading_[k] = 0.0;
+		ref_speed_[k] = 0.0;
+		x_[k] = State::Zero();
+	}
+	for (int k = 0; k < HORIZON; k++) u_[k] = Control::Zero();
+	warm_ = false;
+	solve_time_ = 0.0f;
+}
+
+void MpcController::SetWeights(float lateral, float heading, float speed, float steering, float accel) {
+	w_lateral_ = lateral;
+	w_heading_ = heading;
+	w_speed_ = speed;
+	w_steering_ = steering;
+	w_accel_ = accel;
+}
+
+void MpcController::SetReference(int k, float x, float y, float heading, float speed) {
+	ref_x_[k] = x;
+	ref_y_[k] = y;
+	ref_heading_[k] = heading;
+	ref_speed_[k] = speed;
+}
+
+MpcController::State MpcController::Step(const State &x, const Control &u) const {
+	State next;
+	next[0] = x[0] + dt_*x[3]*cos(x[2]);
+	next[1] = x[1] + dt_*x[3]*sin(x[2]);
+	next[2] = x[2] + dt_*x[3]*tan(u[0])/wheelbase_;
+	next[3] = x[3] + dt_*u[1];
+	return next;
+}
+
+void MpcController::Clamp(Control &u) const {
+	u[0] = std::max(-(double)max_steering_angle_, std::min((double)max_steering_angle_, u[0]));
+	u[1] = std::max(-(double)max_decel_, std::min((double)max_accel_, u[1]));
+}
+
+double MpcController::Cost(const State *x, const Control *u) const {
+	double cost = 0.0;
+	for (int k = 0; k < HORIZON; k++) {
+		cost += w_steering_*u[k][0]*u[k][0] + w_accel_*u[k][1]*u[k][1];
+	}
+	for (int k = 1; k <= HORIZON; k++) {
+		// only the distance across the reference direction, the speed term sets the progress along it
+		double lateral = -(x[k][0] - ref_x_[k])*sin(ref_heading_[k]) + (x[k][1] - ref_y_[k])*cos(ref_heading_[k]);
+		double heading = x[k][2] - ref_heading_[k];
+		double speed = x[k][3] - ref_speed_[k];
+		cost += w_lateral_*lateral*lateral + w_heading_*heading*heading + w_speed_*speed*speed;
+	}
+	return cost;
+}
+
+bool MpcController::Solve(const State &x0) {
+	nature::node::ScopedTimer timer(STAGE_MPC);
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+	// warm start from the previous solution, one step later
+	if (warm_) {
+		for (int k = 0; k < HORIZON - 1; k++) u_[k] = u_[k + 1];
+	}
+	else {
+		for (int k = 0; k < HORIZON; k++) u_[k] = Control::Zero();
+	}
+	x_[0] = x0;
+	for (int k = 0; k < HORIZON; k++) {
+		Clamp(u_[k]);
+		x_[k + 1] = Step(x_[k], u_[k]);
+	}
+	double cost = Cost(x_, u_);
+
+	FixedMatrix<NU, NU> luu = FixedMatrix<NU, NU>::Zero();
+	luu(0, 0) = 2.0*w_steering_;
+	luu(1, 1) = 2.0*w_accel_;
+	static const double alphas[] = { 1.0, 0.5, 0.25, 0.1 };
+	double mu = 1.0e-6;
+	int iterations = 0;
+	float elapsed = 0.0f;
+	float iteration_time = 0.0f;
+	while (iterations < max_iterations_ && elapsed + iteration_time <= deadline_) {
+		std::chrono::steady_clock::time_point iteration_start = std::chrono::steady_clock::now();
+
+		// backward pass, quadratic cost and linear dynamics around the current trajectory
+		State vx = State::Zero();
+		FixedMatrix<NX, NX> vxx = FixedMatrix<NX, NX>::Zero();
+		bool backward_ok = true;
+		for (int k = HORIZON; k >= 0 && backward_ok; k--) {
+			State lx = State::Zero();
+			FixedMatrix<NX, NX> lxx = FixedMatrix<NX, NX>::Zero();
+			if (k > 0) {
+				double s = sin(ref_heading_[k]);
+				double c = cos(ref_heading_[k]);
+				double lateral = -(x_[k][0] - ref_x_[k])*s + (x_[k][1] - ref_y_[k])*c;
+				lx[0] = -2.0*w_lateral_*lateral*s;
+				lx[1] = 2.0*w_lateral_*lateral*c;
+				lx[2] = 2.0*w_heading_*(x_[k][2] - ref_heading_[k]);
+				lx[3] = 2.0*w_speed_*(x_[k][3] - ref_speed_[k]);
+				lxx(0, 0) = 2.0*w_lateral_*s*s;
+				lxx(0, 1) = -2.0*w_lateral_*s*c;
+				lxx(1, 0) = lxx(0, 1);
+				lxx(1, 1) = 2.0*w_lateral_*c*c;
+				lxx(2, 2) = 2.0*w_heading_;
+				lxx(3, 3) = 2.0*w_speed_;
+			}
+			if (k == HORIZON) {
+				vx = lx;
+				vxx = lxx;
+				continue;
+			}
+			const State &x = x_[k];
+			const Control &u = u_[k];
+			double cp = cos(x[2]);
+			double sp = sin(x[2]);
+			double cd = cos(u[0]);
+			FixedMatrix<NX, NX> a = FixedMatrix<NX, NX>::Identity();
+			a(0, 2) = -dt_*x[3]*sp;
+			a(0, 3) = dt_*cp;
+			a(1, 2) = dt_*x[3]*cp;
+			a(1, 3) = dt_*sp;
+			a(2, 3) = dt_*tan(u[0])/wheelbase_;
+			FixedMatrix<NX, NU> b = FixedMatrix<NX, NU>::Zero();
+			b(2, 0) = dt_*x[3]/(wheelbase_*cd*cd);
+			b(3, 1) = dt_;
+			Control lu;
+			lu[0] = 2.0*w_steering_*u[0];
+			lu[1] = 2.0*w_accel_*u[1];
+
+			FixedMatrix<NX, NX> at = a.Transpose();
+			FixedMatrix<NU, NX> bt = b.Transpose();
+			State qx = lx + at*vx;
+			Control qu = lu + bt*vx;
+			FixedMatrix<NX, NX> qxx = lxx + at*vxx*a;
+			FixedMatrix<NU, NU> quu = luu + bt*vxx*b + FixedMatrix<NU, NU>::Identity()*mu;
+			FixedMatrix<NU, NX> qux = bt*vxx*a;
+			FixedMatrix<NU, NU> quu_inv;
+			if (quu(0, 0) <= 0.0 || !Invert(quu, quu_inv) || quu_inv(0, 0) <= 0.0) {
+				backward_ok = false;
+				break;
+			}
+			k_[k] = (quu_inv*qu)*-1.0;
+			K_[k] = (quu_inv*qux)*-1.0;
+			FixedMatrix<NX, NU> kt = K_[k].Transpose();
+			FixedMatrix<NX, NU> quxt = qux.Transpose();
+			vx = qx + kt*quu*k_[k] + kt*qu + quxt*k_[k];
+			vxx = qxx + kt*quu*K_[k] + kt*qux + quxt*K_[k];
+			vxx = (vxx + vxx.Transpose())*0.5;
+		}
+
+		// forward pass with a backtracking line search on the feedforward step
+		bool improved = false;
+		double new_cost = cost;
+		if (backward_ok) {
+			for (int ls = 0; ls < 4 && !improved; ls++) {
+				x_trial_[0] = x0;
+				for (int k = 0; k < HORIZON; k++) {
+					u_trial_[k] = u_[k] + k_[k]*alphas[ls] + K_[k]*(x_trial_[k] - x_[k]);
+					Clamp(u_trial_[k]);
+					x_trial_[k + 1] = Step(x_trial_[k], u_trial_[k]);
+				}
+				new_cost = Cost(x_trial_, u_trial_);
+				improved = new_cost < cost;
+			}
+		}
+		iterations++;
+		if (improved) {
+			for (int k = 0; k < HORIZON; k++) u_[k] = u_trial_[k];
+			for (int k = 0; k <= HORIZON; k++) x_[k] = x_trial_[k];
+			bool converged = cost - new_cost < 1.0e-4*cost;
+			cost = new_cost;
+			mu = std::max(1.0e-6, mu*0.1);
+			if (converged) break;
+		}
+		else {
+			// no descent, regularize more and retry, give up once the steps vanish
+			mu *= 10.0;
+			if (mu > 1.0e3) break;
+		}
+		std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+		iteration_time = std::chrono::duration<float>(now - iteration_start).count();
+		elapsed = std::chrono::duration<float>(now - start).count();
+	}
+
+	solve_time_ = std::chrono::duration<float>(std::chrono::steady_clock::now() - start).count();
+	warm_ = std::isfinite(cost) && solve_time_ <= deadline_;
+	return warm_;
+}
+
+} // namespace control
+} // namespace nature
@@ -11,23 +11,51 @@
  * \date 7/13/2018
  */
 #include <iostream>
+#include <atomic>
+#include <chrono>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
 #include "nature/node/ros_types.h"
 #include "nature/node/node_proxy.h"
+#include "nature/node/stage_diagnostics.h"
+#include "nature/node/pipeline_stages.h"
+#include "nature/node/latency_trace.h"
 //nature includes
 #include "nature/control/pure_pursuit_controller.h"
 #include "nature/control/tinyfiledialogs.h"
-
-nature::msg::Path control_msg;
-nature::msg::Odometry state;
-int current_run_state = -1;   // startup state
-bool shutdown_condition = false;
-double mrzr_speedometer = 0.0;
-bool speedometer_rcvd = false;
-double mrzr_steering = 0.0;
-bool path_rcvd = false;
+#include "nature/common/triple_buffer.h"
+#include "nature/common/replay_clock.h"
+
+namespace {
+
+/// a local path and when it was received
+struct ReceivedPath {
+  nature::msg::Path path;
+  double received = 0.0;
+};
+
+// filled by the callbacks on the ROS thread, read by the control thread
+nature::common::TripleBuffer<ReceivedPath> path_buffer;
+nature::common::TripleBuffer<nature::msg::Odometry> odometry_buffer;
+std::atomic<int> current_run_state(-1);   // startup state
+std::atomic<bool> shutdown_condition(false);
+std::atomic<double> mrzr_speedometer(0.0);
+std::atomic<bool> speedometer_rcvd(false);
+std::atomic<double> mrzr_steering(0.0);
+/// set by the control thread when it reached an end state
+std::atomic<bool> control_done(false);
+
+static const int STAGE_CYCLE = nature::node::RegisterStage("control.cycle");
+// period of the control loop and its deviation from the nominal period
+static const int STAGE_PERIOD = nature::node::RegisterStage("control.period");
+static const int STAGE_JITTER = nature::node::RegisterStage("control.jitter");
+// age of the path behind each command, the total is the one of the whole pipeline from the scan
+static const nature::node::LatencyTrace COMMAND_LATENCY("command");
 
 void OdometryCallback(nature::msg::OdometryPtr rcv_state) {
-	state = *rcv_state; 
+  odometry_buffer.Back() = *rcv_state;
+  odometry_buffer.Publish();
 }
 
 void SpeedCallback(nature::msg::Float64Ptr rcv_speed) {
@@ -40,9 +68,12 @@ void SteeringCallback(nature::msg::Float64Ptr rcv_steering) {
 }
 
 void PathCallback(nature::msg::PathPtr rcv_control){
-  control_msg.poses = rcv_control->poses;
-  control_msg.header = rcv_control->header;
-  path_rcvd = true;
+  // assign keeps the capacity reserved for the poses
+  ReceivedPath &received = path_buffer.Back();
+  received.path.poses.assign(rcv_control->poses.begin(), rcv_control->poses.end());
+  received.path.header = rcv_control->header;
+  received.received = nature::node::now_seconds();
+  path_buffer.Publish();
 }
 
 void StateCallback(nature::msg::Int32Ptr rcv_state){
@@ -50,45 +81,39 @@ void StateCallback(nature::msg::Int32Ptr rcv_state){
   if (current_run_state==2)shutdown_condition = true;
 }
 
-double length(nature::msg::Point a, nature::msg::Point b){
-  double dx = a.x - b.x;
-  double dy = a.y - b.y;
-  double dz = a.z - b.z;
-  return sqrt(dx*dx + dy*dy + dz*dz);
-}
-
-float TriangleArea(nature::msg::Point a, nature::msg::Point b, nature::msg::Point c) {
-	float area = (float)fabs(a.x*(b.y - c.y) + b.x*(c.y - a.y) + c.x*(a.y - b.y));
-	return area;
-}
-
-float MengerCurvature(nature::msg::Point a, nature::msg::Point b, nature::msg::Point c) {
-	float curv = 0.0f;
-	float denom = length(a, b)*length(b, c)*length(c, b);
-	if (denom == 0.0f) {
-		curv = std::numeric_limits<float>::max();
-	}
-	else {
-		float area = TriangleArea(a, b, c);
-		curv = 4.0f*area / denom;
-	}
-	return curv;
-}
-
-double GetMaxCurvature(nature::msg::Path path){
-  double max_curvature = 0.0;
-  if (path.poses.size() > 2) {
-		for (int i = 1; i < path.poses.size() - 1; i++){
-		  double curvature = MengerCurvature(path.poses[i - 1].pose.position, path.poses[i].pose.position, path.poses[i + 1].pose.position);
-      if (curvature>max_curvature)max_curvature = curvature;
-		}
-	}
-  return max_curvature;
+/**
+ * Give the calling thread a SCHED_FIFO priority and pin it to a cpu.
+ * Failures, like missing privileges, only warn and the thread runs as before.
+ * \param priority SCHED_FIFO priority, 0 keeps the default scheduling
+ * \param cpu The cpu to run on, -1 for any
+ */
+void SetRealTimeScheduling(int priority, int cpu){
+  if (priority > 0){
+    // page faults of the heap and the stack would stall the loop
+    if (mlockall(MCL_CURRENT | MCL_FUTURE) != 0){
+      std::cerr << "WARNING: control thread could not lock its memory, page faults may add jitter" << std::endl;
+    }
+    sched_param param;
+    param.sched_priority = priority;
+    int err = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+    if (err != 0){
+      std::cerr << "WARNING: control thread could not get SCHED_FIFO priority " << priority << " (error " << err << "), running with default scheduling" << std::endl;
+    }
+  }
+  if (cpu >= 0){
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(cpu, &cpus);
+    int err = pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+    if (err != 0){
+      std::cerr << "WARNING: control thread could not be pinned to cpu " << cpu << " (error " << err << ")" << std::endl;
+    }
+  }
 }
 
+} // namespace
 
-int main(int argc, char *argv[]){
-  auto n = nature::node::init_node(argc,argv,"nature_control_node");
+int nature::node::RunControl(std::shared_ptr<nature::node::NodeProxy> n){
 
   auto dc_pub = n->create_publisher<nature::msg::Twist>("nature/cmd_vel",1);
 
@@ -102,8 +127,15 @@ int main(int argc, char *argv[]){
 
   auto steering_sub = n->create_subscription<nature::msg::Float64>("mrzr_steering",1,SteeringCallback);
 
+  // the control loop runs on its own thread, so callbacks and diagnostics do not delay the commands
+  int control_thread_priority, control_thread_cpu, max_path_points;
+  n->get_parameter("~control_thread_priority", control_thread_priority, 0);
+  n->get_parameter("~control_thread_cpu", control_thread_cpu, -1);
+  n->get_parameter("~max_path_points", max_path_points, 1000);
+  path_buffer.ForEach([max_path_points](ReceivedPath &received){ received.path.poses.reserve(max_path_points); });
 
   nature::control::PurePursuitController controller;
+  controller.ReservePath(max_path_points);
 
   // added by CTG, 1/26/22
   // The PID params are tuned with this value in mind
@@ -144,6 +176,21 @@ int main(int argc, char *argv[]){
   float skid_kl, skid_kt;
   n->get_parameter("~skid_kl", skid_kl, 1.0f);
   n->get_parameter("~skid_kt", skid_kt, 1.0f);
+
+  // Get the parameters of the model-predictive controller, falls back to pure pursuit past mpc_deadline
+  bool use_mpc;
+  n->get_parameter("~use_mpc", use_mpc, false);
+  float mpc_deadline, mpc_time_step, mpc_max_accel, mpc_max_decel;
+  n->get_parameter("~mpc_deadline", mpc_deadline, 0.0008f);
+  n->get_parameter("~mpc_time_step", mpc_time_step, 0.1f);
+  n->get_parameter("~mpc_max_accel", mpc_max_accel, 2.0f);
+  n->get_parameter("~mpc_max_decel", mpc_max_decel, 4.0f);
+  float mpc_lateral_weight, mpc_heading_weight, mpc_speed_weight, mpc_steering_weight, mpc_accel_weight;
+  n->get_parameter("~mpc_lateral_weight", mpc_lateral_weight, 1.0f);
+  n->get_parameter("~mpc_heading_weight", mpc_heading_weight, 2.0f);
+  n->get_parameter("~mpc_speed_weight", mpc_speed_weight, 0.5f);
+  n->get_parameter("~mpc_steering_weight", mpc_steering_weight, 1.0f);
+  n->get_parameter("~mpc_accel_weight", mpc_accel_weight, 0.1f);
   
 
   if (skid_steered){
@@ -156,6 +203,15 @@ int main(int argc, char *argv[]){
     controller.SetWheelbase(wheelbase);
 	  controller.SetMaxSteering(steer_angle*3.14159 / 180.0);
     controller.SetSpeedControllerParams(throttle_kp, throttle_ki, throttle_kd);
+    if (use_mpc){
+      controller.UseMpc(true);
+      controller.SetMaxLateralAccel(max_desired_lateral_g*9.806f);
+      nature::control::MpcController *mpc = controller.GetMpcController();
+      mpc->SetDeadline(mpc_deadline);
+      mpc->SetTimeStep(mpc_time_step);
+      mpc->SetAccelerationLimits(mpc_max_accel, mpc_max_decel);
+      mpc->SetWeights(mpc_lateral_weight, mpc_heading_weight, mpc_speed_weight, mpc_steering_weight, mpc_accel_weight);
+    }
   }
 
   if (use_feed_forward && !skid_steered){
@@ -180,124 +236,170 @@ int main(int argc, char *argv[]){
   float current_throttle_value = 0.0f;
   float current_steering_value = 0.0f;
   bool user_approved = false;
-  nature::node::Rate r(rate);
   nature::utils::vec2 goal;
-
-  while (nature::node::ok()){
-    nature::msg::Twist dc;
-    bool time_to_quit = false;
-
-    // tell the controller the current vehicle state
-    float vel = 0.0f;
-    if (speedometer_rcvd){
-      vel = mrzr_speedometer;
-      current_steering_value = mrzr_steering;
-    }
-    else{
-      vel = sqrtf(state.twist.twist.linear.x*state.twist.twist.linear.x + state.twist.twist.linear.y*state.twist.twist.linear.y);
-    }
+  double diagnostics_period;
+  n->get_parameter("~diagnostics_period", diagnostics_period, 1.0);
+  auto diagnostics = nature::node::StageDiagnostics::make_shared("control", diagnostics_period, n);
+  std::atomic<bool> control_running(true);
+
+  auto control_loop = [&](){
+    SetRealTimeScheduling(control_thread_priority, control_thread_cpu);
+    nature::node::Rate r(rate);
+    bool path_rcvd = false;
+    nature::node::TraceStamp path_trace;
+    bool first_cycle = true;
+    std::chrono::steady_clock::time_point last_cycle;
+    while (n->ok() && control_running){
+      std::chrono::steady_clock::time_point cycle_start = std::chrono::steady_clock::now();
+      if (!first_cycle){
+        float period = std::chrono::duration<float>(cycle_start - last_cycle).count();
+        nature::node::RecordStage(STAGE_PERIOD, period);
+        nature::node::RecordStage(STAGE_JITTER, fabs(period - dt));
+      }
+      last_cycle = cycle_start;
+      first_cycle = false;
+      nature::node::ScopedTimer cycle_timer(STAGE_CYCLE);
+      nature::msg::Twist dc;
+      bool time_to_quit = false;
+      // take the latest odometry and path the callbacks published, without waiting for them
+      odometry_buffer.Update();
+      const nature::msg::Odometry &state = odometry_buffer.Front();
+
+      // tell the controller the current vehicle state
+      float vel = 0.0f;
+      if (speedometer_rcvd){
+        vel = mrzr_speedometer;
+        current_steering_value = mrzr_steering;
+      }
+      else{
+        vel = sqrtf(state.twist.twist.linear.x*state.twist.twist.linear.x + state.twist.twist.linear.y*state.twist.twist.linear.y);
+      }
     
-    controller.SetVehicleState(state);
-    controller.SetVehicleSpeed(vel);
-
-    if (shutdown_condition){  // current_run_state = 2 
-      // bring to a smooth stop and shut down
-      controller.SetDesiredSpeed(0.0f);
-      if (vel<0.5f)time_to_quit = true;
-      dc = controller.GetDcFromTraj(control_msg, goal);
-      dc.linear.x = 0.0f;
-      dc.angular.z = 0.0f;
-      dc.linear.y = -1.0f;
-    }
-    else if (current_run_state==0){    // active running state
-      double max_curvature = GetMaxCurvature(control_msg);
-      double lateral_g_force = ((vel*vel)*max_curvature)/9.806;
-      float desired_velocity = vehicle_speed;
-      if (lateral_g_force>max_desired_lateral_g){
-        desired_velocity = sqrt(9.806*max_desired_lateral_g/max_curvature);
-        if (desired_velocity>vehicle_speed)desired_velocity=vehicle_speed;
+      controller.SetVehicleState(state);
+      controller.SetVehicleSpeed(vel);
+      // the path is preprocessed once, the commands until the next one only track progress along it
+      if (path_buffer.Update()){
+        controller.SetPath(path_buffer.Front().path);
+        path_trace.Receive(path_buffer.Front().path.header, path_buffer.Front().received);
+        path_rcvd = true;
       }
-      controller.SetDesiredSpeed(desired_velocity);
-      //controller.SetDesiredSpeed(vehicle_speed);
-      dc = controller.GetDcFromTraj(control_msg, goal);
-    }
-    else if (current_run_state==-1 || current_run_state==1){
-      // bring to a smooth stop and wait / idle
-      controller.SetDesiredSpeed(0.0f);
-      dc = controller.GetDcFromTraj(control_msg, goal);
-      if (current_run_state==-1)dc.linear.x = 0.0f;
-    }
-    else if (current_run_state==3){
-      // bring to a hard stop and shut down
-      dc.linear.x = 0.0f;
-      dc.linear.y = 1.0f;
-      dc.angular.z = 0.0f;
-      time_to_quit = true;
-    }
 
-    if (!skid_steered){
-      // check braking and throttle
-      if (dc.linear.y!=0.0){
-        // apply the ramp up to the brake
-        if (current_brake_value>dc.linear.y){
-          dc.linear.y = current_brake_value - brake_step;
-          if (dc.linear.y<-1.0)dc.linear.y = -1.0;
-          if (dc.linear.y>0.0)dc.linear.y = 0.0;
+      if (shutdown_condition){  // current_run_state = 2 
+        // bring to a smooth stop and shut down
+        controller.SetDesiredSpeed(0.0f);
+        if (vel<0.5f)time_to_quit = true;
+        dc = controller.GetDcFromPath(goal);
+        dc.linear.x = 0.0f;
+        dc.angular.z = 0.0f;
+        dc.linear.y = -1.0f;
+      }
+      else if (current_run_state==0){    // active running state
+        double max_curvature = controller.GetMaxCurvature();
+        double lateral_g_force = ((vel*vel)*max_curvature)/9.806;
+        float desired_velocity = vehicle_speed;
+        if (lateral_g_force>max_desired_lateral_g){
+          desired_velocity = sqrt(9.806*max_desired_lateral_g/max_curvature);
+          if (desired_velocity>vehicle_speed)desired_velocity=vehicle_speed;
         }
-        // make sure the throttle is zero when braking
+        controller.SetDesiredSpeed(desired_velocity);
+        //controller.SetDesiredSpeed(vehicle_speed);
+        dc = controller.GetDcFromPath(goal);
+      }
+      else if (current_run_state==-1 || current_run_state==1){
+        // bring to a smooth stop and wait / idle
+        controller.SetDesiredSpeed(0.0f);
+        dc = controller.GetDcFromPath(goal);
+        if (current_run_state==-1)dc.linear.x = 0.0f;
+      }
+      else if (current_run_state==3){
+        // bring to a hard stop and shut down
         dc.linear.x = 0.0f;
+        dc.linear.y = 1.0f;
+        dc.angular.z = 0.0f;
+        time_to_quit = true;
       }
-      // apply the throttle ramp up
-      if (dc.linear.x-current_throttle_value > max_throttle_step){
-        dc.linear.x = current_throttle_value + max_throttle_step;
+
+      if (!skid_steered){
+        // check braking and throttle
+        if (dc.linear.y!=0.0){
+          // apply the ramp up to the brake
+          if (current_brake_value>dc.linear.y){
+            dc.linear.y = current_brake_value - brake_step;
+            if (dc.linear.y<-1.0)dc.linear.y = -1.0;
+            if (dc.linear.y>0.0)dc.linear.y = 0.0;
+          }
+          // make sure the throttle is zero when braking
+          dc.linear.x = 0.0f;
+        }
+        // apply the throttle ramp up
+        if (dc.linear.x-current_throttle_value > max_throttle_step){
+          dc.linear.x = current_throttle_value + max_throttle_step;
+        }
+        // apply the steering ramp up
+        //if (fabs(dc.angular.z-current_steering_value)>max_steering_step){
+        //  dc.angular.z = current_steering_value + max_steering_step*(dc.angular.z-current_steering_value)/fabs(dc.angular.z-current_steering_value);
+        //}
+      }
+      else{
+        dc.linear.x = std::max(std::min(dc.linear.x, 1.0),0.0);
+        if (dc.linear.x>0.0f)dc.linear.y = 0.0f;
       }
-      // apply the steering ramp up
-      //if (fabs(dc.angular.z-current_steering_value)>max_steering_step){
-      //  dc.angular.z = current_steering_value + max_steering_step*(dc.angular.z-current_steering_value)/fabs(dc.angular.z-current_steering_value);
-      //}
-    }
-    else{
-      dc.linear.x = std::max(std::min(dc.linear.x, 1.0),0.0);
-      if (dc.linear.x>0.0f)dc.linear.y = 0.0f;
-    }
 
-    // publish the driving command
-    dc_pub->publish(dc);
-    current_brake_value = dc.linear.y;
-    current_throttle_value = dc.linear.x;
-    current_steering_value = dc.angular.z; 
+      // publish the driving command
+      dc_pub->publish(dc);
+      cycle_timer.Stop();
+      if (path_rcvd) COMMAND_LATENCY.Record(path_trace, n->get_now_seconds());
+      current_brake_value = dc.linear.y;
+      current_throttle_value = dc.linear.x;
+      current_steering_value = dc.angular.z; 
 
 
-    // break the loop when an end state is reached
-    if (time_to_quit)break;
+      // break the loop when an end state is reached
+      if (time_to_quit)break;
     
-    if(display_rviz){
-      nature::msg::PointStamped next_waypoint_msg;
-      next_waypoint_msg.point.x = goal.x;
-      next_waypoint_msg.point.y = goal.y;
-      next_waypoint_msg.point.z = state.pose.pose.position.z;
-      next_waypoint_msg.header.frame_id = "tracer"; // Modificado por JLV Airsim
-      next_waypoint_msg.header.stamp = n->get_stamp();
-      next_waypoint_pub->publish(next_waypoint_msg);
-    }
-
-    // ask the user if the path looks good and they would like to continue
-    if (!user_approved && current_run_state==0 && path_rcvd && request_approval){
-      std::string message_string("Do you approve the initial conditions? \n Click Yes to continue experiment.");
-		  bool approved = tinyfd_messageBox("Approve initial conditions", message_string.c_str(), "yesno", "question", 1);
-      if (approved){
-        user_approved = true;
+      if(display_rviz){
+        nature::msg::PointStamped next_waypoint_msg;
+        next_waypoint_msg.point.x = goal.x;
+        next_waypoint_msg.point.y = goal.y;
+        next_waypoint_msg.point.z = state.pose.pose.position.z;
+        next_waypoint_msg.header.frame_id = "tracer"; // Modificado por JLV Airsim
+        next_waypoint_msg.header.stamp = n->get_stamp();
+        next_waypoint_pub->publish(next_waypoint_msg);
       }
-      else{
-        break;
+
+      // ask the user if the path looks good and they would like to continue
+      if (!user_approved && current_run_state==0 && path_rcvd && request_approval){
+        std::string message_string("Do you approve the initial conditions? \n Click Yes to continue experiment.");
+        bool approved = tinyfd_messageBox("Approve initial conditions", message_string.c_str(), "yesno", "question", 1);
+        if (approved){
+          user_approved = true;
+        }
+        else{
+          break;
+        }
       }
-    }
 
+      r.sleep();
+    }
+    control_done = true;
+  };
+  nature::common::ReplayThread control_thread(control_loop);
 
+  // the callbacks fill the buffers the control thread reads
+  nature::node::Rate spin_rate(rate);
+  while (n->ok() && !control_done){
     n->spin_some();
-
-    r.sleep();
+    diagnostics->update();
+    spin_rate.sleep();
   }
+  control_running = false;
+  control_thread.join();
 
   return 0;
 }
+
+#ifndef NATURE_NODELET
+int main(int argc, char *argv[]){
+  return nature::node::RunControl(nature::node::init_node(argc, argv, "nature_control_node"));
+}
+#endif
@@ -1,8 +1,14 @@
 #include "nature/control/pure_pursuit_controller.h"
+#include "nature/node/stage_timer.h"
+#include <limits>
 
 namespace nature {
 namespace control{
 
+static const int STAGE_PURE_PURSUIT = nature::node::RegisterStage("control.pure_pursuit");
+// solve time of the MPC solves that fell back to pure pursuit
+static const int STAGE_MPC_FALLBACK = nature::node::RegisterStage("control.mpc_fallback");
+
 PurePursuitController::PurePursuitController() {
 	skid_steered_ = false;
 
@@ -28,9 +34,19 @@ PurePursuitController::PurePursuitController() {
 	k_theta_ = 1.0f;
 	kx_ = 1.0f;
 	ky_ = 1.0f;
+
+	max_curvature_ = 0.0f;
+	closest_seg_ = -1;
+	lookahead_seg_ = 0;
+
+	use_mpc_ = false;
+	mpc_.SetWheelbase(wheelbase_);
+	mpc_.SetMaxSteering(max_steering_angle_);
+	max_lateral_accel_ = 0.75f*9.806f;
+	mpc_fallbacks_ = 0;
 }
 
-void PurePursuitController::SetVehicleState(nature::msg::Odometry state){
+void PurePursuitController::SetVehicleState(const nature::msg::Odometry &state){
 // Set the current state of the vehicle, which should be the first pose in the path
 	veh_x_ = state.pose.pose.position.x;
 	veh_y_ = state.pose.pose.position.y;
@@ -47,27 +63,100 @@ void PurePursuitController::SetVehicleSpeed(float speed){
 	vy_ = sinf(veh_heading_)*veh_speed_;
 }
 
-nature::msg::Twist PurePursuitController::GetDcFromTraj(nature::msg::Path traj, utils::vec2 & goal) {
+nature::msg::Twist PurePursuitController::GetDcFromTraj(const nature::msg::Path &traj, utils::vec2 & goal) {
+	SetPath(traj);
+	return GetDcFromPath(goal);
+}
+
+/// Menger curvature of three points, as the control node computed it
+static float MengerCurvature(utils::vec2 a, utils::vec2 b, utils::vec2 c) {
+	double denom = (double)utils::length(a - b)*utils::length(b - c)*utils::length(c - b);
+	if (denom == 0.0) return std::numeric_limits<float>::max();
+	float area = (float)fabs(a.x*(b.y - c.y) + b.x*(c.y - a.y) + c.x*(a.y - b.y));
+	return 4.0f*area / denom;
+}
+
+void PurePursuitController::SetPath(const nature::msg::Path &traj) {
+	int np = traj.poses.size();
+	path_.resize(np);
+	arc_length_.resize(np);
+	tangent_.resize(std::max(0, np - 1));
+	curvature_.assign(np, 0.0f);
+	max_curvature_ = 0.0f;
+	for (int i = 0; i < np; i++) {
+		path_[i] = utils::vec2(traj.poses[i].pose.position.x, traj.poses[i].pose.position.y);
+	}
+	if (np > 0) arc_length_[0] = 0.0f;
+	for (int i = 0; i < np - 1; i++) {
+		utils::vec2 v = path_[i + 1] - path_[i];
+		float seg_dist = utils::length(v);
+		arc_length_[i + 1] = arc_length_[i] + seg_dist;
+		tangent_[i] = seg_dist > 0.0f ? v / seg_dist : utils::vec2(0.0f, 0.0f);
+	}
+	for (int i = 1; i < np - 1; i++) {
+		curvature_[i] = MengerCurvature(path_[i - 1], path_[i], path_[i + 1]);
+		if (curvature_[i] > max_curvature_) max_curvature_ = curvature_[i];
+	}
+	closest_seg_ = -1;
+	lookahead_seg_ = 0;
+	// the controls of the previous solution are per time step, not per path point, so they
+	// stay a good warm start for the new path, only the reference is rebuilt by GetDcMpc
+	if (np < 2) mpc_.Reset();
+}
+
+void PurePursuitController::ReservePath(int max_points) {
+	path_.reserve(max_points);
+	arc_length_.reserve(max_points);
+	tangent_.reserve(max_points);
+	curvature_.reserve(max_points);
+}
+
+int PurePursuitController::TrackClosestSegment(utils::vec2 p, float &closest) {
+	int nseg = (int)path_.size() - 1;
+	if (closest_seg_ < 0) {
+		// first call on this path, search all of it
+		closest = 1.0E9f;
+		for (int i = 0; i < nseg; i++) {
+			float d0 = PointToSegmentDistance(path_[i], path_[i + 1], p);
+			if (d0 < closest) {
+				closest = d0;
+				closest_seg_ = i;
+			}
+		}
+		return closest_seg_;
+	}
+	// the vehicle only moves forward along the path, so only the next few segments can get closer
+	static const int WINDOW = 3;
+	closest = PointToSegmentDistance(path_[closest_seg_], path_[closest_seg_ + 1], p);
+	for (int i = closest_seg_ + 1; i < nseg && i <= closest_seg_ + WINDOW; i++) {
+		float d0 = PointToSegmentDistance(path_[i], path_[i + 1], p);
+		if (d0 < closest) {
+			closest = d0;
+			closest_seg_ = i;
+		}
+	}
+	return closest_seg_;
+}
+
+nature::msg::Twist PurePursuitController::GetDcFromPath(utils::vec2 & goal) {
+	nature::node::ScopedTimer timer(STAGE_PURE_PURSUIT);
 	//initialize the driving command
   nature::msg::Twist dc;
 
 	//make sure the path contains some points
-	int np = traj.poses.size();
+	int np = path_.size();
 
 	if (np < 2) return dc;
 
-	// extract the path that the vehicle needs to follow
-	std::vector<utils::vec2> path;
-
-	//populate the desired path
-	path.resize(np);
-	for (int i = 0; i < np; i++) {
-		path[i] = utils::vec2(traj.poses[i].pose.position.x, traj.poses[i].pose.position.y);
+	if (use_mpc_ && !skid_steered_) {
+		if (GetDcMpc(dc, goal)) return dc;
+		mpc_fallbacks_++;
+		nature::node::RecordStage(STAGE_MPC_FALLBACK, mpc_.GetSolveTime());
 	}
 
 	//calculate the lookahead distance based on current speed
 	utils::vec2 currpos(veh_x_, veh_y_);
-	float path_length = utils::length(path[np - 1] - currpos);
+	float path_length = utils::length(path_[np - 1] - currpos);
 	float lookahead = k_ * veh_speed_;
 
 	if (lookahead > max_lookahead_)lookahead = max_lookahead_;
@@ -76,38 +165,25 @@ nature::msg::Twist PurePursuitController::GetDcFromTraj(nature::msg::Path traj,
 
 	//first find the closest segment on the path , and distance to it
 	float closest = 1.0E9f;
-	int start_seg = 0;
-	for (int i = 0; i < np - 1; i++) {
-		float d0 = PointToSegmentDistance(path[i], path[i + 1], currpos);
-		if (d0 < closest) {
-			closest = d0;
-			start_seg = i;
-		}
-	}
+	int start_seg = TrackClosestSegment(currpos, closest);
 
-	goal = path[start_seg];
+	goal = path_[start_seg];
 	float target_speed = desired_speed_;
 	utils::vec2 desired_direction;
 	if (closest < lookahead) {
-		//find point on path at lookahead distance away
-		float accum_dist = closest;
-
-		//for (int i=0;i<np-1;i++){
-		for (int i = start_seg; i < np - 1; i++) {
-			utils::vec2 v = path[i + 1] - path[i];
-			float seg_dist = length(v);
-			if ((accum_dist + seg_dist) > lookahead) {
-				utils::vec2 dir = v / seg_dist;
-				float t = lookahead - accum_dist;
-				goal = path[i] + dir*t;
-				desired_direction = v;
-				target_speed = desired_speed_; //traj.path[i + 1].speed;
-				if (target_speed > max_stable_speed_)target_speed = max_stable_speed_;
-				break;
-			}
-			else {
-				accum_dist += seg_dist;
-			}
+		//find point on path at lookahead distance away, the first segment ending past
+		//lookahead - closest from the start of the closest one
+		float s_target = arc_length_[start_seg] + lookahead - closest;
+		int i = std::max(lookahead_seg_, start_seg);
+		while (i > start_seg && arc_length_[i] > s_target) i--;
+		while (i < np - 1 && arc_length_[i + 1] <= s_target) i++;
+		if (i < np - 1) {
+			float t = s_target - arc_length_[i];
+			goal = path_[i] + tangent_[i]*t;
+			desired_direction = tangent_[i];
+			target_speed = desired_speed_; //traj.path[i + 1].speed;
+			if (target_speed > max_stable_speed_)target_speed = max_stable_speed_;
+			lookahead_seg_ = i;
 		}
 	}
 
@@ -177,8 +253,14 @@ nature::msg::Twist PurePursuitController::GetDcAckermann(float alpha, float look
 	//addjust the target speed so you back off during hard turns
 	//float adj_speed = target_speed * exp(-0.69*pow(fabs(dc.angular.z), 4.0f));
 	//speed_controller_.SetSetpoint(adj_speed);
+	//float vdot = vx_*curr_dir.x + vy_*curr_dir.y;
+	SetThrottle(dc, target_speed);
+
+	return dc;
+} // GetDcAcerman
+
+void PurePursuitController::SetThrottle(nature::msg::Twist &dc, float target_speed){
 	speed_controller_.SetSetpoint(target_speed);
-	float vdot = vx_*curr_dir.x + vy_*curr_dir.y;
 	float throttle = speed_controller_.GetControlVariable(veh_speed_, 0.01f);
 	//float throttle = speed_controller_.GetControlVariable(vdot, 0.01f);
 	if (throttle < 0.0f) { //braking
@@ -191,9 +273,62 @@ nature::msg::Twist PurePursuitController::GetDcAckermann(float alpha, float look
 	}
 
 	dc.linear.x = throttle_coeff_*dc.linear.x;
+}
 
-	return dc;
-} // GetDcAcerman
+bool PurePursuitController::GetDcMpc(nature::msg::Twist &dc, utils::vec2 &goal){
+	int np = path_.size();
+	utils::vec2 currpos(veh_x_, veh_y_);
+	float closest = 1.0E9f;
+	int seg = TrackClosestSegment(currpos, closest);
+
+	// reference of each step: the path point reached at a speed that approaches the
+	// desired one within the acceleration limits, and slows for the curvature ahead
+	float max_accel, max_decel;
+	mpc_.GetAccelerationLimits(max_accel, max_decel);
+	float dt = mpc_.GetTimeStep();
+	utils::vec2 to_veh = currpos - path_[seg];
+	float s_max = arc_length_[np - 1];
+	float s = arc_length_[seg] + std::max(0.0f, to_veh.x*tangent_[seg].x + to_veh.y*tangent_[seg].y);
+	float v = veh_speed_;
+	float heading = veh_heading_;
+	int i = seg;
+	for (int k = 1; k <= MpcController::HORIZON; k++) {
+		float target_speed = std::min(desired_speed_, max_stable_speed_);
+		// degenerate points have a huge curvature, they are not real turns
+		float curvature = std::max(curvature_[i], curvature_[std::min(i + 1, np - 1)]);
+		if (curvature > 1.0e-3f && curvature < 1.0e3f) {
+			target_speed = std::min(target_speed, sqrtf(max_lateral_accel_/curvature));
+		}
+		if (target_speed > v) v = std::min(target_speed, v + max_accel*dt);
+		else v = std::max(target_speed, v - max_decel*dt);
+		s = std::min(s_max, s + v*dt);
+		while (i < np - 2 && arc_length_[i + 1] <= s) i++;
+		utils::vec2 p = path_[i] + tangent_[i]*(s - arc_length_[i]);
+		// keep the heading continuous with the vehicle heading
+		float dir = atan2f(tangent_[i].y, tangent_[i].x);
+		heading += remainderf(dir - heading, 2.0f*(float)M_PI);
+		mpc_.SetReference(k, p.x, p.y, heading, v);
+		if (k == MpcController::HORIZON) goal = p;
+	}
+
+	// standing at a stop the previous solution still plans the braking, a failed solve resets itself
+	if (desired_speed_ <= 0.0f && veh_speed_ < 0.1f) mpc_.Reset();
+
+	MpcController::State x0;
+	x0[0] = veh_x_;
+	x0[1] = veh_y_;
+	x0[2] = veh_heading_;
+	x0[3] = veh_speed_;
+	if (!mpc_.Solve(x0)) return false;
+
+	dc.linear.x = 0.0;
+	dc.linear.y = 0.0;
+	float sangle = mpc_.GetControl(0)[0]/max_steering_angle_;
+	dc.angular.z = std::max(-1.0f, std::min(1.0f, sangle));
+	// the speed loop is tuned for a setpoint, so it tracks the speed planned at the end of the horizon
+	SetThrottle(dc, mpc_.GetState(MpcController::HORIZON)[3]);
+	return true;
+}
 
 } // namespace control
 } // namespace nature
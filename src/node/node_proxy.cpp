@@ -3,14 +3,29 @@
 namespace nature {
 namespace node {
 
-Rate::Rate(double hz) : rate_(hz) {
+Rate::Rate(double hz) : rate_(hz), period_(1.0 / hz), next_(now_seconds()) {
 }
 
 void Rate::sleep() {
-    rate_.sleep();
+    nature::common::ReplayClock *clock = nature::common::ReplayClock::Active();
+    if (!clock) {
+        rate_.sleep();
+        return;
+    }
+    // as ros::Rate, a late cycle starts the next one from now instead of catching up
+    double now = clock->Now();
+    next_ += period_;
+    if (next_ < now) next_ = now;
+    clock->SleepUntil(next_);
 }
 
-NodeProxy::NodeProxy(const std::string &node_name) {
+NodeProxy::NodeProxy(const std::string &node_name) : private_node_("~"), shutdown_(false) {
+}
+
+NodeProxy::NodeProxy(const std::string &node_name, const ros::NodeHandle &node, const ros::NodeHandle &private_node)
+    : node_(node), private_node_(private_node), queue_(std::make_shared<ros::CallbackQueue>()), shutdown_(false) {
+    node_.setCallbackQueue(queue_.get());
+    private_node_.setCallbackQueue(queue_.get());
 }
 
 double NodeProxy::get_now_seconds() const {
@@ -18,11 +33,13 @@ double NodeProxy::get_now_seconds() const {
 }
 
 ros::Time NodeProxy::get_stamp() const {
-    return ros::Time::now();
+    nature::common::ReplayClock *clock = nature::common::ReplayClock::Active();
+    return clock ? ros::Time(clock->Now()) : ros::Time::now();
 }
 
 void NodeProxy::spin_some() {
-    ros::spinOnce();
+    if (queue_) queue_->callAvailable();
+    else ros::spinOnce();
 }
 
 }
@@ -0,0 +1,45 @@
+#include <thread>
+#include <nodelet/nodelet.h>
+#include <pluginlib/class_list_macros.h>
+#include "nature/node/pipeline_stages.h"
+
+namespace nature {
+namespace node {
+
+/**
+ * Runs a pipeline stage in a nodelet manager. The manager expects onInit to return, so the
+ * loop of the stage runs on a thread of its own and serves the callbacks of the stage, as in
+ * the node executable. Messages published shared between stages of the manager are passed
+ * without serialization.
+ */
+template<int (*RUN)(std::shared_ptr<NodeProxy>)>
+class StageNodelet : public nodelet::Nodelet {
+ public:
+  ~StageNodelet(){
+    if (node_) node_->shutdown();
+    if (thread_.joinable()) thread_.join();
+  }
+
+ private:
+  void onInit() override {
+    node_ = std::make_shared<NodeProxy>(getName(), getNodeHandle(), getPrivateNodeHandle());
+    std::shared_ptr<NodeProxy> node = node_;
+    thread_ = std::thread([node](){ RUN(node); });
+  }
+
+  std::shared_ptr<NodeProxy> node_;
+  std::thread thread_;
+};
+
+class PerceptionNodelet : public StageNodelet<RunPerception> {};
+class GlobalPathNodelet : public StageNodelet<RunGlobalPath> {};
+class LocalPlannerNodelet : public StageNodelet<RunLocalPlanner> {};
+class ControlNodelet : public StageNodelet<RunControl> {};
+
+} // namespace node
+} // namespace nature
+
+PLUGINLIB_EXPORT_CLASS(nature::node::PerceptionNodelet, nodelet::Nodelet)
+PLUGINLIB_EXPORT_CLASS(nature::node::GlobalPathNodelet, nodelet::Nodelet)
+PLUGINLIB_EXPORT_CLASS(nature::node::LocalPlannerNodelet, nodelet::Nodelet)
+PLUGINLIB_EXPORT_CLASS(nature::node::ControlNodelet, nodelet::Nodelet)
@@ -0,0 +1,70 @@
+#include "nature/node/stage_diagnostics.h"
+#include <sstream>
+#include <atomic>
+
+namespace {
+/// true while a StageDiagnostics of the process publishes
+std::atomic<bool> publisher_claimed(false);
+}
+
+std::shared_ptr<nature::node::StageDiagnostics>
+nature::node::StageDiagnostics::make_shared(const std::string &node_name, double period, std::shared_ptr<nature::node::NodeProxy> node) {
+  return std::make_shared<nature::node::StageDiagnostics>(node_name, period, node);
+}
+
+nature::node::StageDiagnostics::StageDiagnostics(const std::string &node_name, double period, std::shared_ptr<nature::node::NodeProxy> node) {
+    node_name_ = node_name;
+    period_ = period;
+    node_ = node;
+    last_publish_ = node->get_now_seconds();
+    node->get_parameter("/latency_budget", latency_budget_, 0.15);
+    bool claimed = false;
+    owner_ = period_ > 0.0 && publisher_claimed.compare_exchange_strong(claimed, true);
+    if (owner_) pub_ = node->create_publisher<diagnostic_msgs::DiagnosticArray>("diagnostics", 1);
+}
+
+nature::node::StageDiagnostics::~StageDiagnostics() {
+    if (owner_) publisher_claimed = false;
+}
+
+namespace {
+diagnostic_msgs::KeyValue MakeValue(const std::string &key, double value) {
+    std::ostringstream ss;
+    ss << value;
+    diagnostic_msgs::KeyValue kv;
+    kv.key = key;
+    kv.value = ss.str();
+    return kv;
+}
+}
+
+void nature::node::StageDiagnostics::update() {
+    if (!owner_) return;
+    double now = node_->get_now_seconds();
+    if (now - last_publish_ < period_) return;
+    last_publish_ = now;
+    int dropped = nature::node::CollectStages(summaries_);
+    msg_.header.stamp = node_->get_stamp();
+    msg_.status.resize(summaries_.size());
+    for (size_t s = 0; s < summaries_.size(); s++) {
+        const nature::node::StageSummary &summary = summaries_[s];
+        diagnostic_msgs::DiagnosticStatus &status = msg_.status[s];
+        status.level = diagnostic_msgs::DiagnosticStatus::OK;
+        status.name = summary.name;
+        status.hardware_id = node_name_;
+        status.message = dropped > 0 ? "samples dropped" : "";
+        const std::string prefix = "latency.", suffix = ".total";
+        bool is_total_age = summary.name.compare(0, prefix.size(), prefix) == 0 && summary.name.size() > suffix.size() &&
+                            summary.name.compare(summary.name.size() - suffix.size(), suffix.size(), suffix) == 0;
+        if (is_total_age && latency_budget_ > 0.0 && summary.p99 > latency_budget_) {
+            status.level = diagnostic_msgs::DiagnosticStatus::WARN;
+            status.message = "p99 over the latency budget";
+        }
+        status.values.clear();
+        status.values.push_back(MakeValue("count", summary.count));
+        status.values.push_back(MakeValue("p50_ms", 1000.0*summary.p50));
+        status.values.push_back(MakeValue("p99_ms", 1000.0*summary.p99));
+        status.values.push_back(MakeValue("max_ms", 1000.0*summary.max));
+    }
+    if (!msg_.status.empty()) pub_->publish(msg_);
+}
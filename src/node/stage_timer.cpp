@@ -0,0 +1,163 @@
+#include "nature/node/stage_timer.h"
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <cmath>
+#include <algorithm>
+#include <stdint.h>
+
+namespace nature {
+namespace node {
+
+namespace {
+
+struct StageSample {
+  int stage;
+  float seconds;
+};
+
+/// single producer, single consumer ring of one thread
+struct StageRing {
+  static const unsigned int SIZE = 1024;
+  StageSample samples[SIZE];
+  std::atomic<unsigned int> head;
+  std::atomic<unsigned int> tail;
+  std::atomic<unsigned int> dropped;
+  StageRing() : head(0), tail(0), dropped(0) {}
+};
+
+/// log-scale bins, 4 per octave from 1 microsecond
+static const int NUM_BINS = 128;
+static const float BIN_BASE = 1.0e-6f;
+static const float BINS_PER_OCTAVE = 4.0f;
+
+struct Registry {
+  std::mutex mutex;
+  std::vector<std::string> names;
+  std::vector<std::shared_ptr<StageRing> > rings;
+  // histograms of the current period, only touched by the collector
+  uint32_t bins[MAX_STAGES][NUM_BINS];
+  int count[MAX_STAGES];
+  float max[MAX_STAGES];
+  Registry(){ Reset(); }
+  void Reset(){
+    for (int s = 0; s < MAX_STAGES; s++) {
+      for (int b = 0; b < NUM_BINS; b++) bins[s][b] = 0;
+      count[s] = 0;
+      max[s] = 0.0f;
+    }
+  }
+};
+
+/// constructed on first use so stages can be registered from static initializers
+Registry &GetRegistry(){
+  static Registry registry;
+  return registry;
+}
+
+/// the ring of the calling thread, registered with the collector on the first sample
+StageRing &ThreadRing(){
+  thread_local std::shared_ptr<StageRing> ring;
+  if (!ring) {
+    ring = std::make_shared<StageRing>();
+    Registry &registry = GetRegistry();
+    std::lock_guard<std::mutex> lock(registry.mutex);
+    registry.rings.push_back(ring);
+  }
+  return *ring;
+}
+
+int BinOf(float seconds){
+  if (!(seconds > BIN_BASE)) return 0;
+  int b = (int)(BINS_PER_OCTAVE*std::log2(seconds / BIN_BASE));
+  return b < NUM_BINS ? b : NUM_BINS - 1;
+}
+
+float BinUpperEdge(int b){
+  return BIN_BASE*std::pow(2.0f, (b + 1) / BINS_PER_OCTAVE);
+}
+
+/// smallest bin edge with at least fraction q of the samples below it, capped at the max
+float Percentile(const uint32_t *bins, int count, float max, float q){
+  int rank = (int)std::ceil(q*count);
+  if (rank < 1) rank = 1;
+  int cumulative = 0;
+  for (int b = 0; b < NUM_BINS; b++) {
+    cumulative += bins[b];
+    if (cumulative >= rank) return std::min(BinUpperEdge(b), max);
+  }
+  return max;
+}
+
+} // namespace
+
+int RegisterStage(const std::string &name){
+  Registry &registry = GetRegistry();
+  std::lock_guard<std::mutex> lock(registry.mutex);
+  for (int s = 0; s < (int)registry.names.size(); s++) {
+    if (registry.names[s] == name) return s;
+  }
+  if ((int)registry.names.size() >= MAX_STAGES) return -1;
+  registry.names.push_back(name);
+  return (int)registry.names.size() - 1;
+}
+
+void RecordStage(int stage, float seconds){
+  if (stage < 0) return;
+  StageRing &ring = ThreadRing();
+  unsigned int h = ring.head.load(std::memory_order_relaxed);
+  if (h - ring.tail.load(std::memory_order_acquire) >= StageRing::SIZE) {
+    ring.dropped.fetch_add(1, std::memory_order_relaxed);
+    return;
+  }
+  StageSample &sample = ring.samples[h % StageRing::SIZE];
+  sample.stage = stage;
+  sample.seconds = seconds;
+  ring.head.store(h + 1, std::memory_order_release);
+}
+
+int CollectStages(std::vector<StageSummary> &summaries){
+  Registry &registry = GetRegistry();
+  std::lock_guard<std::mutex> lock(registry.mutex);
+  int dropped = 0;
+  for (size_t r = 0; r < registry.rings.size();) {
+    // a ring only held here belongs to a thread that exited, it gets no more samples after this drain
+    bool orphan = registry.rings[r].use_count() == 1;
+    StageRing &ring = *registry.rings[r];
+    unsigned int t = ring.tail.load(std::memory_order_relaxed);
+    unsigned int h = ring.head.load(std::memory_order_acquire);
+    for (; t != h; t++) {
+      const StageSample &sample = ring.samples[t % StageRing::SIZE];
+      int s = sample.stage;
+      registry.bins[s][BinOf(sample.seconds)]++;
+      registry.count[s]++;
+      if (sample.seconds > registry.max[s]) registry.max[s] = sample.seconds;
+    }
+    ring.tail.store(h, std::memory_order_release);
+    dropped += (int)ring.dropped.exchange(0, std::memory_order_relaxed);
+    if (orphan) {
+      registry.rings[r] = registry.rings.back();
+      registry.rings.pop_back();
+    }
+    else {
+      r++;
+    }
+  }
+
+  summaries.clear();
+  for (int s = 0; s < (int)registry.names.size(); s++) {
+    if (registry.count[s] == 0) continue;
+    StageSummary summary;
+    summary.name = registry.names[s];
+    summary.count = registry.count[s];
+    summary.p50 = Percentile(registry.bins[s], registry.count[s], registry.max[s], 0.5f);
+    summary.p99 = Percentile(registry.bins[s], registry.count[s], registry.max[s], 0.99f);
+    summary.max = registry.max[s];
+    summaries.push_back(summary);
+  }
+  registry.Reset();
+  return dropped;
+}
+
+} // namespace node
+} // namespace nature
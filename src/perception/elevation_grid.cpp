@@ -1,10 +1,34 @@
 #include "nature/perception/elevation_grid.h"
+#include "nature/common/morphology.h"
+#include "nature/common/grid_view.h"
+#include "nature/perception/point_kernels.h"
+#include "nature/node/stage_timer.h"
 #include <iostream>
 #include <math.h>
+#include <algorithm>
+#include <stdlib.h>
+#include <string.h>
+#include <cmath>
+#include <fstream>
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 namespace nature{
 namespace perception{
 
+static const int STAGE_CONVERT = nature::node::RegisterStage("perception.convert");
+static const int STAGE_BIN = nature::node::RegisterStage("perception.bin");
+static const int STAGE_SLOPE = nature::node::RegisterStage("perception.slope");
+static const int STAGE_DILATE = nature::node::RegisterStage("perception.dilate");
+static const int STAGE_GET_GRID = nature::node::RegisterStage("perception.get_grid");
+static const int STAGE_GET_GRID_UPDATE = nature::node::RegisterStage("perception.get_grid_update");
+
 ElevationGrid::ElevationGrid(){
   width_ = 200.0f;
   height_ = 200.0f;
@@ -31,163 +55,785 @@ void ElevationGrid::ResizeGrid(){
   nx_ = (int)ceil(width_/res_);
   ny_ = (int)ceil(height_/res_);
   //if (n_%2!=0) n_ = n_+1;
-  cells_.clear();
-  std::vector<Cell> row;
-  row.resize(ny_);
-  cells_.resize(nx_,row);
+  // sparse grids allocate tiles on first touch
+  int ncells = sparse_ ? 0 : nx_*ny_;
+  tiles_.clear();
+  tile_x_.clear();
+  tile_y_.clear();
+  low_.assign(ncells, std::numeric_limits<float>::max());
+  high_.assign(ncells, std::numeric_limits<float>::lowest());
+  highest_.assign(ncells, std::numeric_limits<float>::lowest());
+  slope_.assign(ncells, 0.0f);
+  terrain_.assign(ncells, 0.0f);
+  dilated_val_.assign(ncells, 0);
+  flags_.assign(ncells, 0);
+  stats_.assign(terrain_stats_ ? ncells : 0, CellStats());
+  generation_ = 0;
+  stamp_.assign(ncells, 0);
+  seen_.assign(obstacle_decay_ > 0.0 ? ncells : 0, scan_time_);
+  dirty_cells_.clear();
+  cells_to_dilate_.clear();
+  origin_x_ = (int)floor(llx_/res_);
+  origin_y_ = (int)floor(lly_/res_);
+  if (sparse_){
+    llx_ = origin_x_*res_;
+    lly_ = origin_y_*res_;
+  }
+  ring_x_ = 0;
+  ring_y_ = 0;
+  full_change_ = true;
+}
+
+void ElevationGrid::ResetCell(int n){
+  low_[n] = std::numeric_limits<float>::max();
+  high_[n] = std::numeric_limits<float>::lowest();
+  highest_[n] = std::numeric_limits<float>::lowest();
+  slope_[n] = 0.0f;
+  terrain_[n] = 0.0f;
+  dilated_val_[n] = 0;
+  flags_[n] = 0;
+  if (terrain_stats_) stats_[n] = CellStats();
+}
+
+static inline int FloorDiv(int a, int b){
+  return a>=0 ? a/b : -((-a + b - 1)/b);
+}
+
+static inline int64_t TileKey(int tx, int ty){
+  return ((int64_t)tx << 32) | (uint32_t)ty;
+}
+
+int ElevationGrid::CellAt(int i, int j) const{
+  if (!sparse_){
+    if (i<0 || i>=nx_ || j<0 || j>=ny_) return -1;
+    return StorageIndex(i,j);
+  }
+  int gx = origin_x_ + i;
+  int gy = origin_y_ + j;
+  int tx = FloorDiv(gx, TILE_SIZE);
+  int ty = FloorDiv(gy, TILE_SIZE);
+  auto it = tiles_.find(TileKey(tx, ty));
+  if (it == tiles_.end()) return -1;
+  return it->second*TILE_SIZE*TILE_SIZE + (gx - tx*TILE_SIZE)*TILE_SIZE + (gy - ty*TILE_SIZE);
+}
+
+int ElevationGrid::CellAtAlloc(int i, int j){
+  int n = CellAt(i,j);
+  if (n>=0 || !sparse_) return n;
+  int gx = origin_x_ + i;
+  int gy = origin_y_ + j;
+  int tx = FloorDiv(gx, TILE_SIZE);
+  int ty = FloorDiv(gy, TILE_SIZE);
+  int slot = (int)tile_x_.size();
+  tiles_[TileKey(tx, ty)] = slot;
+  tile_x_.push_back(tx);
+  tile_y_.push_back(ty);
+  int ncells = (slot+1)*TILE_SIZE*TILE_SIZE;
+  low_.resize(ncells, std::numeric_limits<float>::max());
+  high_.resize(ncells, std::numeric_limits<float>::lowest());
+  highest_.resize(ncells, std::numeric_limits<float>::lowest());
+  slope_.resize(ncells, 0.0f);
+  terrain_.resize(ncells, 0.0f);
+  dilated_val_.resize(ncells, 0);
+  flags_.resize(ncells, 0);
+  if (terrain_stats_) stats_.resize(ncells);
+  stamp_.resize(ncells, generation_);
+  if (obstacle_decay_ > 0.0) seen_.resize(ncells, scan_time_);
+  return slot*TILE_SIZE*TILE_SIZE + (gx - tx*TILE_SIZE)*TILE_SIZE + (gy - ty*TILE_SIZE);
+}
+
+void ElevationGrid::WindowIndex(int n, int &i, int &j) const{
+  if (!sparse_){
+    i = Wrap(n / ny_ - ring_x_, nx_);
+    j = Wrap(n % ny_ - ring_y_, ny_);
+    return;
+  }
+  int slot = n / (TILE_SIZE*TILE_SIZE);
+  int local = n % (TILE_SIZE*TILE_SIZE);
+  i = tile_x_[slot]*TILE_SIZE + local / TILE_SIZE - origin_x_;
+  j = tile_y_[slot]*TILE_SIZE + local % TILE_SIZE - origin_y_;
+}
+
+void ElevationGrid::MarkChanged(int imin, int imax, int jmin, int jmax){
+  change_imin_ = std::min(change_imin_, imin);
+  change_imax_ = std::max(change_imax_, imax);
+  change_jmin_ = std::min(change_jmin_, jmin);
+  change_jmax_ = std::max(change_jmax_, jmax);
+}
+
+void ElevationGrid::ResetChanges(){
+  full_change_ = false;
+  change_imin_ = std::numeric_limits<int>::max();
+  change_imax_ = std::numeric_limits<int>::lowest();
+  change_jmin_ = std::numeric_limits<int>::max();
+  change_jmax_ = std::numeric_limits<int>::lowest();
+}
+
+void ElevationGrid::ResetColumn(int si){
+  for (int sj=0;sj<ny_;sj++){
+    ResetCell(CellIndex(si,sj));
+  }
+}
+
+void ElevationGrid::ResetRow(int sj){
+  for (int si=0;si<nx_;si++){
+    ResetCell(CellIndex(si,sj));
+  }
+}
+
+void ElevationGrid::Recenter(float x, float y){
+  if (!scrolling_) return;
+  int new_origin_x = (int)floor(x/res_) - nx_/2;
+  int new_origin_y = (int)floor(y/res_) - ny_/2;
+  int dx = new_origin_x - origin_x_;
+  int dy = new_origin_y - origin_y_;
+  if (dx==0 && dy==0) return;
+
+  if (sparse_){
+    // the map itself doesn't move, only the exported window
+  }
+  else if (abs(dx)>=nx_ || abs(dy)>=ny_){
+    // moved further than the window, nothing survives
+    std::fill(low_.begin(), low_.end(), std::numeric_limits<float>::max());
+    std::fill(high_.begin(), high_.end(), std::numeric_limits<float>::lowest());
+    std::fill(highest_.begin(), highest_.end(), std::numeric_limits<float>::lowest());
+    std::fill(slope_.begin(), slope_.end(), 0.0f);
+    std::fill(terrain_.begin(), terrain_.end(), 0.0f);
+    std::fill(dilated_val_.begin(), dilated_val_.end(), 0);
+    std::fill(flags_.begin(), flags_.end(), 0);
+    std::fill(stats_.begin(), stats_.end(), CellStats());
+    ring_x_ = 0;
+    ring_y_ = 0;
+  }
+  else{
+    // the storage columns that scroll out are reused for the ones scrolling in
+    if (dx>0){
+      for (int k=0;k<dx;k++) ResetColumn(Wrap(ring_x_ + k, nx_));
+    }
+    else{
+      for (int k=nx_+dx;k<nx_;k++) ResetColumn(Wrap(ring_x_ + k, nx_));
+    }
+    ring_x_ = Wrap(ring_x_ + dx, nx_);
+    if (dy>0){
+      for (int k=0;k<dy;k++) ResetRow(Wrap(ring_y_ + k, ny_));
+    }
+    else{
+      for (int k=ny_+dy;k<ny_;k++) ResetRow(Wrap(ring_y_ + k, ny_));
+    }
+    ring_y_ = Wrap(ring_y_ + dy, ny_);
+  }
+  dirty_cells_.clear();
+  full_change_ = true;
+  origin_x_ = new_origin_x;
+  origin_y_ = new_origin_y;
+  llx_ = origin_x_*res_;
+  lly_ = origin_y_*res_;
 }
 
 void ElevationGrid::ClearGrid(){
-  Cell empty_cell;
- for (int i=0;i<(nx_);i++){
-    for (int j=0;j<(ny_);j++){ 
-      if (persistent_obstacles_){
-        uint8_t cellval = GetGridCellValue(cells_[i][j]);
-        if (cellval<=0){
-          cells_[i][j] = empty_cell;  
+  if (!sparse_ || persistent_obstacles_){
+    // cells stamped with an older generation read as empty and are reset on their next touch
+    generation_++;
+    if (generation_ == 0){
+      // the counter wrapped and old stamps could look current again, clear eagerly once
+      for (int n=0;n<(int)flags_.size();n++){
+        if (!(persistent_obstacles_ && CellValue(n)>0)) ResetCell(n);
+        stamp_[n] = 0;
+      }
+    }
+  }
+  else{
+    // drop the tiles but keep the allocation for the next scan
+    low_.clear();
+    high_.clear();
+    highest_.clear();
+    slope_.clear();
+    terrain_.clear();
+    dilated_val_.clear();
+    flags_.clear();
+    stats_.clear();
+    stamp_.clear();
+    seen_.clear();
+    tiles_.clear();
+    tile_x_.clear();
+    tile_y_.clear();
+  }
+  dirty_cells_.clear();
+  full_change_ = true;
+}
+
+bool ElevationGrid::Stale(int n) const{
+  if (persistent_obstacles_ && CellValue(n)>0){
+    // persistent obstacles survive the clears until they expire
+    return obstacle_decay_ > 0.0 && scan_time_ - seen_[n] > obstacle_decay_;
+  }
+  return stamp_[n] != generation_;
+}
+
+void ElevationGrid::SetScanTime(double stamp){
+  scan_time_ = stamp;
+  if (!restored_unseen_) return;
+  for (size_t n=0;n<seen_.size();n++){
+    if (seen_[n] == std::numeric_limits<double>::infinity()) seen_[n] = scan_time_;
+  }
+  restored_unseen_ = false;
+}
+
+void ElevationGrid::Touch(int n){
+  if (stamp_[n] == generation_ && obstacle_decay_ <= 0.0) return;
+  if (Stale(n)) ResetCell(n);
+  stamp_[n] = generation_;
+}
+
+void CellStats::Add(float x, float y, float z){
+  n += 1.0;
+  sx += x;
+  sy += y;
+  sz += z;
+  sxx += (double)x*x;
+  sxy += (double)x*y;
+  syy += (double)y*y;
+  sxz += (double)x*z;
+  syz += (double)y*z;
+  szz += (double)z*z;
+}
+
+bool CellStats::Fit(float &dzdx, float &dzdy, float &roughness) const{
+  if (n < 3.0) return false;
+  double mx = sx/n, my = sy/n, mz = sz/n;
+  double cxx = sxx/n - mx*mx;
+  double cxy = sxy/n - mx*my;
+  double cyy = syy/n - my*my;
+  double cxz = sxz/n - mx*mz;
+  double cyz = syz/n - my*mz;
+  double czz = szz/n - mz*mz;
+  double det = cxx*cyy - cxy*cxy;
+  // points on a line (or a single spot) don't define a plane
+  if (det <= 1.0e-6*(cxx + cyy)*(cxx + cyy) || det <= 0.0) return false;
+  double a = (cyy*cxz - cxy*cyz)/det;
+  double b = (cxx*cyz - cxy*cxz)/det;
+  dzdx = (float)a;
+  dzdy = (float)b;
+  roughness = (float)sqrt(std::max(0.0, czz - a*cxz - b*cyz));
+  return true;
+}
+
+void ElevationGrid::SetTerrainStats(bool terrain_stats){
+  terrain_stats_ = terrain_stats;
+  stats_.assign(terrain_stats_ ? flags_.size() : 0, CellStats());
+}
+
+void ElevationGrid::PointOffset(float x, float y, float &ox, float &oy) const{
+  float fx = (x - llx_)/res_;
+  float fy = (y - lly_)/res_;
+  ox = (fx - floor(fx) - 0.5f)*res_;
+  oy = (fy - floor(fy) - 0.5f)*res_;
+}
+
+void ElevationGrid::ResizeScanOffsets(int npoints){
+  scan_ox_.resize(terrain_stats_ ? npoints : 0);
+  scan_oy_.resize(terrain_stats_ ? npoints : 0);
+}
+
+int ElevationGrid::PointCell(float x, float y){
+  if (sparse_){
+    return CellAtAlloc((int)floor(x/res_) - origin_x_, (int)floor(y/res_) - origin_y_);
+  }
+  int xi = (int)floor((x - llx_)/res_);
+  int yi = (int)floor((y - lly_)/res_);
+  if (xi>=0 && xi<nx_ && yi>=0 &&yi<ny_){
+    return StorageIndex(xi,yi);
+  }
+  return -1;
+}
+
+void ElevationGrid::BinCell(int n, int k, bool has_seg, std::vector<int> &dirty){
+  Touch(n);
+  if (obstacle_decay_ > 0.0) seen_[n] = scan_time_;
+  uint8_t current_val = CellValue(n);
+  if (!(persistent_obstacles_ && current_val>0)) {
+
+    float h = scan_z_[k];
+    flags_[n] |= CELL_FILLED;
+    if (!(flags_[n] & CELL_DIRTY)){
+      flags_[n] |= CELL_DIRTY;
+      dirty.push_back(n);
+    }
+    if (filter_highest_){
+      // high_ tracks the second highest point
+      if (h > highest_[n] ){
+        high_[n] = highest_[n];
+        highest_[n] = h;
+      }
+      else if (h  > high_[n]){
+        high_[n] = h;
+      }
+    }
+    else{
+      if (h > high_[n] ) high_[n] = h;
+    }
+    if (h < low_[n] ) low_[n] = h;
+
+    if (has_seg){
+      terrain_[n] = fmax(terrain_[n], scan_seg_[k]);
+    }
+    if (terrain_stats_){
+      stats_[n].Add(scan_ox_[k], scan_oy_[k], h);
+    }
+
+  }
+}
+
+void ElevationGrid::BinScanPoints(int npoints, bool has_seg){
+  int nthreads = std::max(1, num_threads_);
+  if (nthreads==1){
+    for (int k=0;k<npoints;k++){
+      if (scan_cells_[k]>=0) BinCell(scan_cells_[k], k, has_seg, dirty_cells_);
+    }
+    return;
+  }
+
+  // each thread owns a contiguous block of cells. The points are first sorted
+  // by block with a counting sort over chunks of the scan, stable so the cells
+  // still see their points in scan order, then each thread bins its block
+  // without locks. Every pass reads each point once.
+  thread_dirty_.resize(nthreads);
+  int ncells = (int)flags_.size();
+  int block_size = std::max(1, (ncells + nthreads - 1)/nthreads);
+  block_counts_.assign(nthreads*nthreads, 0);
+  block_points_.resize(npoints);
+#pragma omp parallel num_threads(nthreads)
+  {
+    int t = 0;
+#ifdef _OPENMP
+    t = omp_get_thread_num();
+#endif
+    int k_begin = (int)((long)npoints*t/nthreads);
+    int k_end = (int)((long)npoints*(t+1)/nthreads);
+    int *counts = &block_counts_[t*nthreads];
+    for (int k=k_begin;k<k_end;k++){
+      int n = scan_cells_[k];
+      if (n>=0) counts[n/block_size]++;
+    }
+#pragma omp barrier
+#pragma omp single
+    {
+      // offsets by block, then by chunk within a block
+      int offset = 0;
+      for (int b=0;b<nthreads;b++){
+        for (int c=0;c<nthreads;c++){
+          int count = block_counts_[c*nthreads + b];
+          block_counts_[c*nthreads + b] = offset;
+          offset += count;
         }
       }
-      else{
-        cells_[i][j] = empty_cell;
+    }
+    for (int k=k_begin;k<k_end;k++){
+      int n = scan_cells_[k];
+      if (n>=0) block_points_[counts[n/block_size]++] = k;
+    }
+#pragma omp barrier
+    // after the scatter the offset of the last chunk of a block is the end of the block
+    int p_begin = t>0 ? block_counts_[(nthreads-1)*nthreads + t-1] : 0;
+    int p_end = block_counts_[(nthreads-1)*nthreads + t];
+    std::vector<int> &dirty = thread_dirty_[t];
+    dirty.clear();
+    for (int p=p_begin;p<p_end;p++){
+      int k = block_points_[p];
+      BinCell(scan_cells_[k], k, has_seg, dirty);
+    }
+  }
+  for (const auto & dirty : thread_dirty_){
+    dirty_cells_.insert(dirty_cells_.end(), dirty.begin(), dirty.end());
+  }
+}
+
+int ElevationGrid::ReduceScanPoints(int npoints, bool has_seg){
+  // the storage index is a perfect hash of the (res x res) column of a point
+  voxel_slot_.resize(flags_.size(), -1);
+  voxel_cells_.clear();
+  voxel_count_.clear();
+  voxel_min_.clear();
+  voxel_max_.clear();
+  voxel_second_.clear();
+  voxel_seg_.clear();
+  for (int k=0;k<npoints;k++){
+    int n = scan_cells_[k];
+    if (n<0) continue;
+    float z = scan_z_[k];
+    int s = voxel_slot_[n];
+    if (s<0){
+      s = (int)voxel_cells_.size();
+      voxel_slot_[n] = s;
+      voxel_cells_.push_back(n);
+      voxel_count_.push_back(1);
+      voxel_min_.push_back(z);
+      voxel_max_.push_back(z);
+      voxel_second_.push_back(z);
+      voxel_seg_.push_back(has_seg ? scan_seg_[k] : 0.0f);
+      continue;
+    }
+    if (z < voxel_min_[s]) voxel_min_[s] = z;
+    if (z > voxel_max_[s]){
+      voxel_second_[s] = voxel_max_[s];
+      voxel_max_[s] = z;
+    }
+    else if (voxel_count_[s]==1 || z > voxel_second_[s]){
+      voxel_second_[s] = z;
+    }
+    voxel_count_[s]++;
+    if (has_seg) voxel_seg_[s] = fmax(voxel_seg_[s], scan_seg_[k]);
+  }
+
+  // rewrite the scan with the representatives, BinCell only needs the extremes
+  int m = 0;
+  for (size_t s=0;s<voxel_cells_.size();s++){
+    int n = voxel_cells_[s];
+    voxel_slot_[n] = -1;
+    int count = voxel_count_[s];
+    float zs[3] = {voxel_max_[s], voxel_second_[s], voxel_min_[s]};
+    int nz = 1;
+    if (count>=2) nz = filter_highest_ ? std::min(count, 3) : 2;
+    for (int q=0;q<nz;q++){
+      // without filter_highest the second slot is the lowest point
+      float z = (q==1 && !filter_highest_) ? zs[2] : zs[q];
+      scan_cells_[m] = n;
+      scan_z_[m] = z;
+      if (has_seg) scan_seg_[m] = voxel_seg_[s];
+      m++;
+    }
+  }
+  return m;
+}
+
+void ElevationGrid::UpdateTouchedCells(){
+  //find the slopes of the cells touched by this scan
+  nature::node::ScopedTimer slope_timer(STAGE_SLOPE);
+  int ndirty = (int)dirty_cells_.size();
+#pragma omp parallel for num_threads(std::max(1, num_threads_)) if(num_threads_>1)
+  for (int k=0;k<ndirty;k++){
+    int n = dirty_cells_[k];
+    flags_[n] &= ~CELL_DIRTY;
+    float height = high_[n] - low_[n];
+    //if (height/res_ > thresh_) flags_[n] |= CELL_OBSTACLE;
+    slope_[n] = height/res_;
+  }
+  cells_to_dilate_.clear();
+  for (const int & n : dirty_cells_){
+    int i, j;
+    WindowIndex(n, i, j);
+    MarkChanged(i, i, j, j);
+    if(!(flags_[n] & CELL_HAS_DILATED) && slope_[n] > thresh_){
+      flags_[n] |= CELL_HAS_DILATED;
+      cells_to_dilate_.push_back(n);
+    }
+  }
+  dirty_cells_.clear();
+  slope_timer.Stop();
+
+  //dilate the grid around the newly detected obstacle cells
+  if(dilate_ && !cells_to_dilate_.empty()){
+    nature::node::ScopedTimer timer(STAGE_DILATE);
+    int dsize_x = lround(grid_dilate_x_/res_);
+    int dsize_y = lround(grid_dilate_y_/res_);
+
+    // window-index box around the new obstacle cells
+    nature::common::GridRoi roi(std::numeric_limits<int>::max(), std::numeric_limits<int>::max(),
+                                std::numeric_limits<int>::lowest(), std::numeric_limits<int>::lowest());
+    for(const int & n : cells_to_dilate_){
+      int i, j;
+      WindowIndex(n, i, j);
+      roi.imin = std::min(roi.imin, i - dsize_x);
+      roi.imax = std::max(roi.imax, i + dsize_x + 1);
+      roi.jmin = std::min(roi.jmin, j - dsize_y);
+      roi.jmax = std::max(roi.jmax, j + dsize_y + 1);
+    }
+    if (!sparse_) roi = roi.Clamp(nx_, ny_);
+    int w = roi.imax - roi.imin;
+    int h = roi.jmax - roi.jmin;
+
+    // gather the obstacle values into a local column-major patch, filter it and merge it back
+    dilate_patch_.resize(w*h);
+    for (int i=0;i<w;i++){
+      for (int j=0;j<h;j++){
+        int n = CellAt(roi.imin + i, roi.jmin + j);
+        dilate_patch_[i*h + j] = (n>=0 && (flags_[n] & CELL_HAS_DILATED)) ? (uint8_t) (grid_dilate_proportion_ * GetGridCellValue(n)) : 0;
+      }
+    }
+    nature::common::DilateBox(dilate_patch_.data(), dilate_patch_.data(), w, h, dsize_x, dsize_y, nature::common::GridRoi(0, 0, w, h));
+    for (int i=0;i<w;i++){
+      for (int j=0;j<h;j++){
+        uint8_t val = dilate_patch_[i*h + j];
+        if (val==0) continue;
+        int n = CellAtAlloc(roi.imin + i, roi.jmin + j);
+        Touch(n);
+        dilated_val_[n] = std::max(val, dilated_val_[n]);
       }
     }
- }
+    MarkChanged(roi.imin, roi.imax - 1, roi.jmin, roi.jmax - 1);
+  }
 }
 
 std::vector<nature::msg::Point32> ElevationGrid::AddPoints(nature::msg::PointCloud &point_cloud){
+  std::vector<nature::msg::Point32> points;
+  std::vector<nature::msg::Point32> surface_points;
+  AddPoints(point_cloud, &points, &surface_points);
+  point_cloud.points.swap(points);
+  return surface_points;
+} // method AddPoints
+
+void ElevationGrid::AddPoints(const nature::msg::PointCloud &point_cloud, std::vector<nature::msg::Point32> *obstacle_points,
+                              std::vector<nature::msg::Point32> *surface_points){
 
   bool has_segmentation_local = !point_cloud.channels.empty() && point_cloud.channels[0].name == "segmentation";
   has_segmentation_ = has_segmentation_local || has_segmentation_;
 
+  SetScanTime(point_cloud.header.stamp.toSec());
   if (!stitch_points_)ClearGrid();
+  // find the cell of every point
+  int npoints = (int)point_cloud.points.size();
+  scan_cells_.resize(npoints);
+  scan_z_.resize(npoints);
+  scan_seg_.resize(has_segmentation_local ? npoints : 0);
+  ResizeScanOffsets(npoints);
+#pragma omp parallel for num_threads(std::max(1, num_threads_)) if(num_threads_>1 && !sparse_)
+  for (int i=0;i<npoints;i++){
+    const nature::msg::Point32 &pt = point_cloud.points[i];
+    scan_cells_[i] = (pt.x==0.0 && pt.y==0.0) ? -1 : PointCell(pt.x, pt.y);
+    scan_z_[i] = pt.z;
+    if (has_segmentation_local) scan_seg_[i] = point_cloud.channels[0].values[i];
+    if (terrain_stats_) PointOffset(pt.x, pt.y, scan_ox_[i], scan_oy_[i]);
+  }
+
   // fill the cells with highest and lowest points
-  for (int i=0;i<point_cloud.points.size();i++){
-    if (!(point_cloud.points[i].x==0.0 && point_cloud.points[i].y==0.0)){
-      int xi = (int)floor((point_cloud.points[i].x - llx_)/res_);
-      int yi = (int)floor((point_cloud.points[i].y - lly_)/res_);
-      if (xi>=0 && xi<nx_ && yi>=0 &&yi<ny_){
-
-        uint8_t current_val = GetGridCellValue(cells_[xi][yi]);
-        if (!(persistent_obstacles_ && current_val>0)) {
-
-          float h = point_cloud.points[i].z;
-          cells_[xi][yi].filled = true;
-          if (filter_highest_){
-            if (h > cells_[xi][yi].highest ){
-              cells_[xi][yi].second_highest = cells_[xi][yi].highest;
-              cells_[xi][yi].highest = h;
-              cells_[xi][yi].high = cells_[xi][yi].second_highest;
-            }
-            else if (h  > cells_[xi][yi].second_highest){
-              cells_[xi][yi].second_highest = h;
-              cells_[xi][yi].high = cells_[xi][yi].second_highest;
-            }
-          }
-          else{
-            if (h > cells_[xi][yi].high ) cells_[xi][yi].high = h;
-          }
-          if (h < cells_[xi][yi].low ) cells_[xi][yi].low = h;
-
-          if (has_segmentation_local){
-            float terr_val = point_cloud.channels[0].values[i];
-            cells_[xi][yi].terrain = fmax(cells_[xi][yi].terrain, terr_val);
-          }
+  BinScanPoints(npoints, has_segmentation_local);
 
-        }
+  UpdateTouchedCells();
 
-      }
+  if (obstacle_points) obstacle_points->clear();
+  if (surface_points) surface_points->clear();
+  if (!obstacle_points && !surface_points) return;
+
+  //loop back through the points and split obstacle and surface points,
+  //points outside the grid are dropped
+  float hscale = 0.2f;
+  for (int i=0;i<npoints;i++){
+    int n = scan_cells_[i];
+    if (n<0) continue;
+    const nature::msg::Point32 &pt = point_cloud.points[i];
+    if ((flags_[n] & CELL_OBSTACLE) && pt.z>(low_[n] + hscale*(high_[n] - low_[n]))){
+      if (obstacle_points) obstacle_points->push_back(pt);
+    }
+    else if (surface_points){
+      surface_points->push_back(pt);
     }
   }
+} // method AddPoints
 
-  std::vector<int> cells_to_dilate_x {};
-  std::vector<int> cells_to_dilate_y {};
+/// start of the k-th point of a cloud
+static inline const uint8_t * PointData(const nature::msg::PointCloud2 &cloud, int k){
+  return cloud.data.data() + (k/cloud.width)*cloud.row_step + (k%cloud.width)*cloud.point_step;
+}
 
-  //find the slopes
-  for (int i=0; i<nx_;i++){
-    for (int j=0; j<ny_; j++){
-      if (cells_[i][j].filled){
-        cells_[i][j].height = cells_[i][j].high - cells_[i][j].low;
-        //if (cells_[i][j].height/res_ > thresh_) cells_[i][j].obstacle = true;
-        cells_[i][j].slope = cells_[i][j].height/res_;
-        if(!cells_[i][j].has_dilated && cells_[i][j].slope > thresh_){
-          cells_[i][j].has_dilated = true;
-          cells_to_dilate_x.push_back(i);
-          cells_to_dilate_y.push_back(j);
-        }
-      } // if cell filled
-    } //over j
-  } //over i
+static double ReadField(const uint8_t *ptr, uint8_t datatype){
+  switch (datatype){
+    case nature::msg::PointField::INT8: return (double)(*(const int8_t*)ptr);
+    case nature::msg::PointField::UINT8: return (double)(*ptr);
+    case nature::msg::PointField::INT16: { int16_t v; memcpy(&v, ptr, sizeof(v)); return v; }
+    case nature::msg::PointField::UINT16: { uint16_t v; memcpy(&v, ptr, sizeof(v)); return v; }
+    case nature::msg::PointField::INT32: { int32_t v; memcpy(&v, ptr, sizeof(v)); return v; }
+    case nature::msg::PointField::UINT32: { uint32_t v; memcpy(&v, ptr, sizeof(v)); return v; }
+    case nature::msg::PointField::FLOAT64: { double v; memcpy(&v, ptr, sizeof(v)); return v; }
+    default: { float v; memcpy(&v, ptr, sizeof(v)); return v; }
+  }
+}
 
-  //dilate the grid
-  if(dilate_){
-    int dsize_x = lround(grid_dilate_x_/res_);
-    int dsize_y = lround(grid_dilate_y_/res_);
+/// Compose a pose (9 rotation + 3 origin) with the sensor mount of the filter
+static void MountTransform(const float pose[12], const ScanFilter &filter, float out[12]){
+  const float *R = pose;
+  const float *S = filter.sensor_rot;
+  for (int r=0;r<3;r++){
+    for (int c=0;c<3;c++){
+      out[3*r+c] = R[3*r]*S[c] + R[3*r+1]*S[3+c] + R[3*r+2]*S[6+c];
+    }
+    out[9+r] = R[3*r]*filter.sensor_origin[0] + R[3*r+1]*filter.sensor_origin[1] + R[3*r+2]*filter.sensor_origin[2] + pose[9+r];
+  }
+}
 
-    for(const int & i : cells_to_dilate_x){
-      if(i < dsize_x || i >= nx_-dsize_x){
-        continue;
-      }
+bool ElevationGrid::AddPoints(const nature::msg::PointCloud2 &cloud, const ScanFilter &filter){
+  int x_off = -1, y_off = -1, z_off = -1, seg_off = -1, t_off = -1;
+  uint8_t seg_type = nature::msg::PointField::FLOAT32;
+  uint8_t t_type = nature::msg::PointField::FLOAT32;
+  for (const auto & field : cloud.fields){
+    if (field.name == "x" && field.datatype == nature::msg::PointField::FLOAT32) x_off = field.offset;
+    else if (field.name == "y" && field.datatype == nature::msg::PointField::FLOAT32) y_off = field.offset;
+    else if (field.name == "z" && field.datatype == nature::msg::PointField::FLOAT32) z_off = field.offset;
+    else if (field.name == "segmentation"){
+      seg_off = field.offset;
+      seg_type = field.datatype;
+    }
+    else if (field.name == filter.time_field){
+      t_off = field.offset;
+      t_type = field.datatype;
+    }
+  }
+  if (x_off<0 || y_off<0 || z_off<0){
+    std::cerr<<"WARNING: ElevationGrid::AddPoints, PointCloud2 has no float32 x/y/z fields, ignoring cloud"<<std::endl;
+    return false;
+  }
 
-      for(const int & j : cells_to_dilate_y){
-        if(j < dsize_y || j >= ny_-dsize_y){
-          continue;
-        }
+  bool has_seg = seg_off >= 0;
+  has_segmentation_ = has_seg || has_segmentation_;
 
-        if(!cells_[i][j].has_dilated){
-          continue;
-        }
-        uint8_t grid_val = (uint8_t) (grid_dilate_proportion_ * GetGridCellValue( cells_[i][j]));
-        for (int id=-dsize_x; id<=dsize_x; id++){
-          for (int jd=-dsize_y; jd<=dsize_y; jd++){
-            Cell & cell = cells_[i + id][j + jd];
-            cell.dilated_val = std::max(grid_val, cell.dilated_val);
-          }
-        }
-      }
+  int npoints = (int)(cloud.width*cloud.height);
+  nature::node::ScopedTimer convert_timer(STAGE_CONVERT);
+
+  // fixed transform, 9 rotation + 3 origin
+  float pose[12];
+  float fixed[12];
+  for (int k=0;k<9;k++) pose[k] = filter.rot[k];
+  for (int k=0;k<3;k++) pose[9+k] = filter.origin[k];
+  MountTransform(pose, filter, fixed);
+
+  // build one transform per time bin when deskewing
+  bool deskew = t_off>=0 && filter.deskew_bin>0.0 && filter.deskew_poses != nullptr && !filter.deskew_poses->empty();
+  double t_min = 0.0;
+  int nbins = 0;
+  if (deskew){
+    double t_max = std::numeric_limits<double>::lowest();
+    t_min = std::numeric_limits<double>::max();
+#pragma omp parallel for num_threads(std::max(1, num_threads_)) if(num_threads_>1) reduction(min:t_min) reduction(max:t_max)
+    for (int k=0;k<npoints;k++){
+      double t = filter.time_scale*ReadField(PointData(cloud, k) + t_off, t_type);
+      t_min = std::min(t_min, t);
+      t_max = std::max(t_max, t);
+    }
+    nbins = std::min(1000, (int)((t_max - t_min)/filter.deskew_bin) + 1);
+    deskew = nbins > 0;
+  }
+  if (deskew){
+    deskew_table_.resize(12*nbins);
+    PoseSample sample;
+    for (int b=0;b<nbins;b++){
+      filter.deskew_poses->Interpolate(filter.stamp + t_min + (b + 0.5)*filter.deskew_bin, sample);
+      sample.GetRotation(pose);
+      for (int k=0;k<3;k++) pose[9+k] = sample.pos[k];
+      MountTransform(pose, filter, &deskew_table_[12*b]);
     }
   }
 
+  SetScanTime(filter.stamp);
+  if (!stitch_points_)ClearGrid();
+  int nthreads = std::max(1, num_threads_);
 
-  //loop back through the points and remove ground points
-  std::vector<nature::msg::Point32> points;
-  std::vector<nature::msg::Point32> surface_points;
-  float hscale = 0.2f;
-  for (int i=0;i<point_cloud.points.size();i++){
-    if (!(point_cloud.points[i].x==0.0 && point_cloud.points[i].y==0.0)){
-      int xi = (int)floor((point_cloud.points[i].x - llx_)/res_);
-      int yi = (int)floor((point_cloud.points[i].y - lly_)/res_); 
-      if (xi>=0 && xi<nx_ && yi>=0 &&yi<ny_){
-
-        if (cells_[xi][yi].obstacle){
-          if (point_cloud.points[i].z>(cells_[xi][yi].low + hscale*cells_[xi][yi].height)){
-            points.push_back(point_cloud.points[i]);
-          }
-          else{
-            surface_points.push_back(point_cloud.points[i]);
-          }
-        }
-        else{
-          surface_points.push_back(point_cloud.points[i]);
-        }
+  // packed xyz without deskew goes through the batch kernel, which writes the kept points compacted
+  bool packed = x_off + 4 == y_off && y_off + 4 == z_off &&
+                (cloud.height <= 1 || cloud.row_step == cloud.width*cloud.point_step);
+  if (packed && !deskew && cloud.point_step >= 12){
+    int nchunks = sparse_ ? 1 : nthreads;
+    batch_x_.resize(npoints);
+    batch_y_.resize(npoints);
+    batch_z_.resize(npoints);
+    batch_index_.resize(npoints);
+    chunk_count_.assign(nchunks + 1, 0);
+    const uint8_t *data = cloud.data.data() + x_off;
+#pragma omp parallel for num_threads(nchunks) if(nchunks>1)
+    for (int c=0;c<nchunks;c++){
+      int k0 = (int)((long)npoints*c/nchunks);
+      int k1 = (int)((long)npoints*(c+1)/nchunks);
+      chunk_count_[c+1] = TransformFilterPoints(data + (long)k0*cloud.point_step, cloud.point_step, k1 - k0, fixed, filter.robot,
+                                                filter.max_z, filter.min_range_sqr, filter.max_range_sqr,
+                                                &batch_x_[k0], &batch_y_[k0], &batch_z_[k0], &batch_index_[k0]);
+    }
+    // chunk c keeps output points [chunk_count_[c], chunk_count_[c+1])
+    for (int c=0;c<nchunks;c++) chunk_count_[c+1] += chunk_count_[c];
+    int nkept = chunk_count_[nchunks];
+    scan_cells_.resize(nkept);
+    scan_z_.resize(nkept);
+    scan_seg_.resize(has_seg ? nkept : 0);
+    ResizeScanOffsets(nkept);
+#pragma omp parallel for num_threads(nchunks) if(nchunks>1)
+    for (int c=0;c<nchunks;c++){
+      int k0 = (int)((long)npoints*c/nchunks);
+      for (int q=0;q<chunk_count_[c+1]-chunk_count_[c];q++){
+        int m = chunk_count_[c] + q;
+        int b = k0 + q;
+        scan_cells_[m] = PointCell(batch_x_[b], batch_y_[b]);
+        scan_z_[m] = batch_z_[b];
+        if (terrain_stats_) PointOffset(batch_x_[b], batch_y_[b], scan_ox_[m], scan_oy_[m]);
+        if (has_seg) scan_seg_[m] = (float)ReadField(PointData(cloud, k0 + batch_index_[b]) + seg_off, seg_type);
       }
     }
+    npoints = nkept;
+  }
+  else{
+    // transform and filter every point and find its cell
+    scan_cells_.resize(npoints);
+    scan_z_.resize(npoints);
+    scan_seg_.resize(has_seg ? npoints : 0);
+    ResizeScanOffsets(npoints);
+#pragma omp parallel for num_threads(nthreads) if(nthreads>1 && !sparse_)
+    for (int k=0;k<npoints;k++){
+      scan_cells_[k] = -1;
+      const uint8_t *ptr = PointData(cloud, k);
+      float px, py, pz;
+      memcpy(&px, ptr + x_off, sizeof(float));
+      memcpy(&py, ptr + y_off, sizeof(float));
+      memcpy(&pz, ptr + z_off, sizeof(float));
+      if ((px==0.0f && py==0.0f) || std::isnan(px)) continue;
+
+      const float *T = fixed;
+      if (deskew){
+        int b = (int)((filter.time_scale*ReadField(ptr + t_off, t_type) - t_min)/filter.deskew_bin);
+        b = std::max(0, std::min(nbins-1, b));
+        T = &deskew_table_[12*b];
+      }
+      float x = T[0]*px + T[1]*py + T[2]*pz + T[9];
+      float y = T[3]*px + T[4]*py + T[5]*pz + T[10];
+      float z = T[6]*px + T[7]*py + T[8]*pz + T[11];
+      if (z >= filter.max_z) continue;
+
+      float dx = filter.robot[0] - x;
+      float dy = filter.robot[1] - y;
+      float dz = filter.robot[2] - z;
+      float dr2 = dx*dx + dy*dy + dz*dz;
+      if (dr2 <= filter.min_range_sqr || dr2 >= filter.max_range_sqr) continue;
+
+      scan_cells_[k] = PointCell(x, y);
+      scan_z_[k] = z;
+      if (terrain_stats_) PointOffset(x, y, scan_ox_[k], scan_oy_[k]);
+      if (has_seg) scan_seg_[k] = (float)ReadField(ptr + seg_off, seg_type);
+    }
+  }
+  convert_timer.Stop();
+
+  {
+    nature::node::ScopedTimer timer(STAGE_BIN);
+    // the statistics need every point, so the reduction is skipped with them
+    if (voxel_filter_ && !terrain_stats_) npoints = ReduceScanPoints(npoints, has_seg);
+    BinScanPoints(npoints, has_seg);
   }
-  point_cloud.points = points;
-  return surface_points;
-} // method AddPoints
 
-uint8_t ElevationGrid::GetGridCellValue(const Cell & cell) const{
-  if(!cell.filled)
+  UpdateTouchedCells();
+  return true;
+}
+
+uint8_t ElevationGrid::GetGridCellValue(int n) const{
+  return Stale(n) ? 0 : CellValue(n);
+}
+
+uint8_t ElevationGrid::CellValue(int n) const{
+  if(!(flags_[n] & CELL_FILLED))
     return 0;
 
-  if(use_elevation_ && cell.high > thresh_)
+  if(use_elevation_ && high_[n] > thresh_)
     return GRID_MAX_VALUE;
 
   if(!use_elevation_){
-    uint8_t val = (uint8_t) (GRID_SLOPE_MULT*cell.slope);
+    uint8_t val = (uint8_t) (GRID_SLOPE_MULT*slope_[n]);
     if (val<0) val = 0;
     if (val>GRID_MAX_VALUE) val = GRID_MAX_VALUE;
-    if (cell.slope>thresh_){
+    if (slope_[n]>thresh_){
       return val;
     }
   }
@@ -196,6 +842,58 @@ uint8_t ElevationGrid::GetGridCellValue(const Cell & cell) const{
 
 nature::msg::OccupancyGrid ElevationGrid::GetGrid(bool row_major, bool is_segmentation){
   nature::msg::OccupancyGrid grid;
+  GetGrid(grid, row_major, is_segmentation);
+  return grid;
+}
+
+int8_t ElevationGrid::ExportValue(int n, bool is_segmentation) const{
+  if (n<0 || Stale(n)) return 0;
+  return is_segmentation ? (uint8_t)(terrain_[n]) : std::max(GetGridCellValue(n), dilated_val_[n]);
+}
+
+template <typename F>
+void ElevationGrid::ForEachWindowCell(int i0, int j0, int w, int h, F f) const{
+  int c = 0;
+  for (int i=i0;i<i0+w;i++){
+    // cells of a column are contiguous within a tile, so only look up the tile once per run
+    int run_start = 0;
+    int run_end = 0;
+    int run_base = -1;
+    for (int j=j0;j<j0+h;j++){
+      if (!sparse_){
+        f(c++, CellAt(i,j));
+        continue;
+      }
+      if (j>=run_end){
+        int gy = origin_y_ + j;
+        run_start = j;
+        run_end = j + TILE_SIZE - (gy - FloorDiv(gy, TILE_SIZE)*TILE_SIZE);
+        run_base = CellAt(i,j);
+      }
+      f(c++, run_base<0 ? -1 : run_base + (j - run_start));
+    }
+  }
+}
+
+void ElevationGrid::ExportWindow(std::vector<int8_t> &data, int i0, int j0, int w, int h, bool row_major, bool is_segmentation) const{
+  data.resize(w*h);
+  if (!sparse_ && !row_major && ring_x_==0 && ring_y_==0 && i0==0 && j0==0 && w==nx_ && h==ny_){
+    for (int n=0;n<nx_*ny_;n++){
+      data[n] = ExportValue(n, is_segmentation);
+    }
+    return;
+  }
+  if(row_major){
+    // the window is walked in storage order, the cells are transposed on the way out
+    nature::common::GridView<int8_t> out(data.data(), w, h, nature::common::GridLayout::ROW_MAJOR);
+    ForEachWindowCell(i0, j0, w, h, [&](int c, int n){ out(c / h, c % h) = ExportValue(n, is_segmentation); });
+  }
+  else{
+    ForEachWindowCell(i0, j0, w, h, [&](int c, int n){ data[c] = ExportValue(n, is_segmentation); });
+  }
+}
+
+void ElevationGrid::GetLayeredGrid(nature::msg::LayeredGrid &grid, bool float_layers){
   grid.header.frame_id = "world_ned";
   grid.info.resolution = res_;
   grid.info.width = nx_;
@@ -206,23 +904,259 @@ nature::msg::OccupancyGrid ElevationGrid::GetGrid(bool row_major, bool is_segmen
   grid.info.origin.orientation.x = 0.0;
   grid.info.origin.orientation.y = 0.0;
   grid.info.origin.orientation.z = 0.0;
-  grid.data.resize(nx_*ny_);
-  int c = 0;
-
-  if(row_major){
-    for (int j=0;j<ny_;j++){
-      for (int i=0;i<nx_;i++){
-        grid.data[c++] = is_segmentation ? (uint8_t)(cells_[i][j].terrain) : std::max(GetGridCellValue(cells_[i][j]), cells_[i][j].dilated_val);
-      }
+  int ncells = nx_*ny_;
+  bool seg = has_segmentation_;
+  grid.layers.resize(seg ? 2 : 1);
+  grid.layers[0] = "occupancy";
+  if (seg) grid.layers[1] = "segmentation";
+  grid.data.resize(grid.layers.size()*ncells);
+  if (float_layers){
+    grid.float_layers.resize(terrain_stats_ ? 5 : 2);
+    grid.float_layers[0] = "height";
+    grid.float_layers[1] = "slope";
+    if (terrain_stats_){
+      grid.float_layers[2] = "plane_slope";
+      grid.float_layers[3] = "roughness";
+      grid.float_layers[4] = "step";
     }
-  }else{
-    for (int i=0;i<nx_;i++){
-      for (int j=0;j<ny_;j++){
-        grid.data[c++] = is_segmentation ? (uint8_t)(cells_[i][j].terrain) : std::max(GetGridCellValue(cells_[i][j]), cells_[i][j].dilated_val);
-      }
+    grid.float_data.resize(grid.float_layers.size()*ncells);
+  }
+  else{
+    grid.float_layers.clear();
+    grid.float_data.clear();
+  }
+  // every layer is written in the same pass over the cells
+  int8_t *occupancy = grid.data.data();
+  int8_t *segmentation = seg ? occupancy + ncells : nullptr;
+  float *height = float_layers ? grid.float_data.data() : nullptr;
+  float *slope = float_layers ? height + ncells : nullptr;
+  float *plane_slope = float_layers && terrain_stats_ ? height + 2*ncells : nullptr;
+  float *roughness = plane_slope ? height + 3*ncells : nullptr;
+  float *step = plane_slope ? height + 4*ncells : nullptr;
+  const float nan = std::numeric_limits<float>::quiet_NaN();
+  ForEachWindowCell(0, 0, nx_, ny_, [&](int c, int n){
+    occupancy[c] = ExportValue(n, false);
+    if (segmentation) segmentation[c] = ExportValue(n, true);
+    bool live = n>=0 && !Stale(n);
+    if (height){
+      bool filled = live && (flags_[n] & CELL_FILLED);
+      height[c] = filled ? high_[n] : nan;
+      slope[c] = filled ? slope_[n] : nan;
     }
+    if (plane_slope){
+      // derived from the running sums at export, nothing is stored per point
+      float dzdx, dzdy, rough;
+      bool fit = live && (flags_[n] & CELL_FILLED) && stats_[n].Fit(dzdx, dzdy, rough);
+      plane_slope[c] = fit ? sqrt(dzdx*dzdx + dzdy*dzdy) : nan;
+      roughness[c] = fit ? rough : nan;
+      step[c] = live && (flags_[n] & CELL_FILLED) ? high_[n] - low_[n] : nan;
+    }
+  });
+}
+
+void ElevationGrid::GetGrid(nature::msg::OccupancyGrid &grid, bool row_major, bool is_segmentation){
+  nature::node::ScopedTimer timer(STAGE_GET_GRID);
+  grid.header.frame_id = "world_ned";
+  grid.info.resolution = res_;
+  grid.info.width = nx_;
+  grid.info.height = ny_;
+  grid.info.origin.position.x = llx_;
+  grid.info.origin.position.y = lly_;
+  grid.info.origin.orientation.w = 1.0;
+  grid.info.origin.orientation.x = 0.0;
+  grid.info.origin.orientation.y = 0.0;
+  grid.info.origin.orientation.z = 0.0;
+  // reuses the message buffer when the size is unchanged
+  ExportWindow(grid.data, 0, 0, nx_, ny_, row_major, is_segmentation);
+}
+
+void ElevationGrid::GetGrid(nature::msg::OccupancyGrid &grid, float llx, float lly, float width, float height, bool row_major, bool is_segmentation){
+  int i0 = sparse_ ? (int)floor(llx/res_) - origin_x_ : (int)floor((llx - llx_)/res_);
+  int j0 = sparse_ ? (int)floor(lly/res_) - origin_y_ : (int)floor((lly - lly_)/res_);
+  int w = std::max(0, (int)ceil(width/res_));
+  int h = std::max(0, (int)ceil(height/res_));
+  grid.header.frame_id = "world_ned";
+  grid.info.resolution = res_;
+  grid.info.width = w;
+  grid.info.height = h;
+  grid.info.origin.position.x = llx_ + i0*res_;
+  grid.info.origin.position.y = lly_ + j0*res_;
+  grid.info.origin.orientation.w = 1.0;
+  grid.info.origin.orientation.x = 0.0;
+  grid.info.origin.orientation.y = 0.0;
+  grid.info.origin.orientation.z = 0.0;
+  ExportWindow(grid.data, i0, j0, w, h, row_major, is_segmentation);
+}
+
+bool ElevationGrid::GetGridUpdate(nature::msg::OccupancyGridUpdate &update, bool row_major, bool is_segmentation){
+  int imin = std::max(0, change_imin_);
+  int imax = std::min(nx_-1, change_imax_);
+  int jmin = std::max(0, change_jmin_);
+  int jmax = std::min(ny_-1, change_jmax_);
+  if (imin>imax || jmin>jmax) return false;
+
+  nature::node::ScopedTimer timer(STAGE_GET_GRID_UPDATE);
+  update.header.frame_id = "world_ned";
+  update.x = imin;
+  update.y = jmin;
+  update.width = imax - imin + 1;
+  update.height = jmax - jmin + 1;
+  ExportWindow(update.data, imin, jmin, update.width, update.height, row_major, is_segmentation);
+  return true;
+}
+
+/// Header of a saved grid file, followed by the tile coordinates and the cell layers
+struct GridFileHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t sparse;
+  float res;
+  int32_t nx, ny;
+  int32_t origin_x, origin_y;
+  int32_t ring_x, ring_y;
+  int32_t tile_size;
+  int32_t num_tiles;
+  int32_t num_cells;
+  uint32_t has_segmentation;
+  uint32_t pad;
+};
+static const char GRID_FILE_MAGIC[8] = {'N','A','T','G','R','I','D','\0'};
+static const uint32_t GRID_FILE_VERSION = 1;
+
+bool ElevationGrid::Save(const std::string &fname) const{
+  GridFileHeader header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, GRID_FILE_MAGIC, sizeof(header.magic));
+  header.version = GRID_FILE_VERSION;
+  header.sparse = sparse_;
+  header.res = res_;
+  header.nx = nx_;
+  header.ny = ny_;
+  header.origin_x = origin_x_;
+  header.origin_y = origin_y_;
+  header.ring_x = ring_x_;
+  header.ring_y = ring_y_;
+  header.tile_size = TILE_SIZE;
+  header.num_tiles = (int32_t)tile_x_.size();
+  header.num_cells = (int32_t)flags_.size();
+  header.has_segmentation = has_segmentation_;
+
+  std::string tmp_name = fname + ".tmp";
+  std::ofstream fout(tmp_name.c_str(), std::ios::binary | std::ios::trunc);
+  if (!fout.is_open()){
+    std::cerr<<"WARNING: ElevationGrid::Save, could not open "<<tmp_name<<std::endl;
+    return false;
   }
-  return grid;
+  int nc = header.num_cells;
+  fout.write((const char*)&header, sizeof(header));
+  fout.write((const char*)tile_x_.data(), tile_x_.size()*sizeof(int));
+  fout.write((const char*)tile_y_.data(), tile_y_.size()*sizeof(int));
+  fout.write((const char*)low_.data(), nc*sizeof(float));
+  fout.write((const char*)high_.data(), nc*sizeof(float));
+  fout.write((const char*)highest_.data(), nc*sizeof(float));
+  fout.write((const char*)slope_.data(), nc*sizeof(float));
+  // stale cells are written empty, so the file doesn't depend on the generation stamps
+  std::vector<float> terrain(terrain_);
+  std::vector<uint8_t> dilated_val(dilated_val_);
+  std::vector<uint8_t> flags(flags_);
+  for (int n=0;n<nc;n++){
+    if (!Stale(n)) continue;
+    terrain[n] = 0.0f;
+    dilated_val[n] = 0;
+    flags[n] = 0;
+  }
+  fout.write((const char*)terrain.data(), nc*sizeof(float));
+  fout.write((const char*)dilated_val.data(), nc);
+  fout.write((const char*)flags.data(), nc);
+  fout.close();
+  if (!fout.good() || rename(tmp_name.c_str(), fname.c_str())!=0){
+    std::cerr<<"WARNING: ElevationGrid::Save, failed writing "<<fname<<std::endl;
+    return false;
+  }
+  return true;
+}
+
+bool ElevationGrid::Load(const std::string &fname){
+  int fd = open(fname.c_str(), O_RDONLY);
+  if (fd<0) return false;
+  struct stat st;
+  if (fstat(fd, &st)!=0 || st.st_size<(off_t)sizeof(GridFileHeader)){
+    close(fd);
+    std::cerr<<"WARNING: ElevationGrid::Load, "<<fname<<" is not a grid file"<<std::endl;
+    return false;
+  }
+  size_t size = st.st_size;
+  void *map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map==MAP_FAILED){
+    std::cerr<<"WARNING: ElevationGrid::Load, could not map "<<fname<<std::endl;
+    return false;
+  }
+
+  const char *ptr = (const char*)map;
+  GridFileHeader header;
+  memcpy(&header, ptr, sizeof(header));
+  size_t nt = header.num_tiles;
+  size_t nc = header.num_cells;
+  size_t expected = sizeof(header) + 2*nt*sizeof(int32_t) + nc*(5*sizeof(float) + 2);
+  std::string error;
+  if (memcmp(header.magic, GRID_FILE_MAGIC, sizeof(header.magic))!=0) error = "not a grid file";
+  else if (header.version!=GRID_FILE_VERSION) error = "unsupported version";
+  else if (size!=expected) error = "truncated or corrupt file";
+  else if ((bool)header.sparse!=sparse_) error = "dense/sparse mode doesn't match";
+  else if (header.res!=res_) error = "resolution doesn't match";
+  else if (sparse_ && (header.tile_size!=TILE_SIZE || nc!=nt*TILE_SIZE*TILE_SIZE)) error = "tile size doesn't match";
+  else if (!sparse_ && (header.nx!=nx_ || header.ny!=ny_ || (int)nc!=nx_*ny_)) error = "grid size doesn't match";
+  // a fixed dense grid can't move, its cells would be restored into the wrong place in the world
+  else if (!sparse_ && !scrolling_ && (header.origin_x!=origin_x_ || header.origin_y!=origin_y_ || header.ring_x!=0 || header.ring_y!=0)) error = "saved with a different grid corner";
+  if (!error.empty()){
+    munmap(map, size);
+    std::cerr<<"WARNING: ElevationGrid::Load, "<<fname<<": "<<error<<std::endl;
+    return false;
+  }
+
+  ptr += sizeof(header);
+  const int32_t *tx = (const int32_t*)ptr;
+  ptr += nt*sizeof(int32_t);
+  const int32_t *ty = (const int32_t*)ptr;
+  ptr += nt*sizeof(int32_t);
+  const float *layer = (const float*)ptr;
+  low_.assign(layer, layer + nc);
+  high_.assign(layer + nc, layer + 2*nc);
+  highest_.assign(layer + 2*nc, layer + 3*nc);
+  slope_.assign(layer + 3*nc, layer + 4*nc);
+  terrain_.assign(layer + 4*nc, layer + 5*nc);
+  const uint8_t *bytes = (const uint8_t*)(layer + 5*nc);
+  dilated_val_.assign(bytes, bytes + nc);
+  flags_.assign(bytes + nc, bytes + 2*nc);
+  tile_x_.assign(tx, tx + nt);
+  tile_y_.assign(ty, ty + nt);
+  munmap(map, size);
+  // statistics aren't saved, they restart from the restored cells
+  stats_.assign(terrain_stats_ ? nc : 0, CellStats());
+  stamp_.assign(nc, generation_);
+  // before any scan there is no time to age the restored obstacles from, they wait for the first one
+  restored_unseen_ = obstacle_decay_ > 0.0 && scan_time_ <= 0.0;
+  seen_.assign(obstacle_decay_ > 0.0 ? nc : 0, restored_unseen_ ? std::numeric_limits<double>::infinity() : scan_time_);
+
+  tiles_.clear();
+  for (size_t k=0;k<nt;k++){
+    tiles_[TileKey(tile_x_[k], tile_y_[k])] = (int)k;
+  }
+  for (auto & f : flags_) f &= ~CELL_DIRTY;
+  dirty_cells_.clear();
+  if (scrolling_ || sparse_){
+    // keep the saved map aligned with the world
+    origin_x_ = header.origin_x;
+    origin_y_ = header.origin_y;
+    ring_x_ = header.ring_x;
+    ring_y_ = header.ring_y;
+    llx_ = origin_x_*res_;
+    lly_ = origin_y_*res_;
+  }
+  has_segmentation_ = has_segmentation_ || header.has_segmentation;
+  full_change_ = true;
+  return true;
 }
 
 } // namespace perception
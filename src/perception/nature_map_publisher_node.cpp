@@ -7,17 +7,16 @@
 // ros includes
 #include "nature/node/ros_types.h"
 #include "nature/node/node_proxy.h"
+#include <algorithm>
+#include <cmath>
 
 std::vector<double> obs_x_list, obs_y_list, obs_r_list;
 float grid_res, grid_llx, grid_lly;
 float grid_width, grid_height;
 
-nature::msg::OccupancyGrid CreateGrid(bool row_major){
-	nature::msg::OccupancyGrid grid;
+void InitGrid(nature::msg::OccupancyGrid &grid, int nx, int ny){
   grid.header.frame_id = "world_ned";
   grid.info.resolution = grid_res;
-	int nx = (int)(grid_width/grid_res);
-	int ny = (int)(grid_height/grid_res);
   grid.info.width = nx;
   grid.info.height = ny;
   grid.info.origin.position.x = grid_llx;
@@ -26,48 +25,48 @@ nature::msg::OccupancyGrid CreateGrid(bool row_major){
   grid.info.origin.orientation.x = 0.0;
   grid.info.origin.orientation.y = 0.0;
   grid.info.origin.orientation.z = 0.0;
-  grid.data.resize(nx*ny);
-  int c = 0;
+  grid.data.assign(nx*ny, 0);
+}
 
-  if(row_major){
-    for (int j=0;j<ny;j++){
-			double y = grid_lly + (j+0.5)*grid_res;
-      for (int i=0;i<nx;i++){
-				double x = grid_llx + (i+0.5)*grid_res;
-				int cost = 0;
-				for (int k=0;k<obs_x_list.size();k++){
-					double dx = x - obs_x_list[k];
-					double dy = y - obs_y_list[k];
-					double d = sqrt(dx*dx + dy*dy);
-					if (d<obs_r_list[k]+grid_res) cost = 100;
-				}
-        grid.data[c++] = cost;
-      }
-    }
-  }
-	else {
-    for (int i=0;i<nx;i++){
-			double x = grid_llx + (i+0.5)*grid_res;
-      for (int j=0;j<ny;j++){
-				double y = grid_lly + (j+0.5)*grid_res;
-        int cost = 0;
-				for (int k=0;k<obs_x_list.size();k++){
-					double dx = x - obs_x_list[k];
-					double dy = y - obs_y_list[k];
-					double d = sqrt(dx*dx + dy*dy);
-					if (d<obs_r_list[k]+grid_res) cost = 100;
-				}
-        grid.data[c++] = cost;
+/**
+ * Rasterize the obstacles into both layouts at once.
+ * Each obstacle only visits the cells of its bounding box, a cell is occupied
+ * when its center is closer than the obstacle radius plus one cell.
+ * \param grid Column-major grid, index i*ny+j, for the planners
+ * \param grid_vis Row-major grid, index j*nx+i, for rviz
+ */
+void CreateGrids(nature::msg::OccupancyGrid &grid, nature::msg::OccupancyGrid &grid_vis){
+	int nx = (int)(grid_width/grid_res);
+	int ny = (int)(grid_height/grid_res);
+  InitGrid(grid, nx, ny);
+  InitGrid(grid_vis, nx, ny);
+
+  for (int k=0;k<obs_x_list.size();k++){
+    double r = obs_r_list[k]+grid_res;
+    double r2 = r*r;
+    // cells whose centers grid_llx + (i+0.5)*grid_res can lie within r of the obstacle
+    int i0 = std::max(0, (int)ceil((obs_x_list[k]-r-grid_llx)/grid_res-0.5));
+    int i1 = std::min(nx-1, (int)floor((obs_x_list[k]+r-grid_llx)/grid_res-0.5));
+    int j0 = std::max(0, (int)ceil((obs_y_list[k]-r-grid_lly)/grid_res-0.5));
+    int j1 = std::min(ny-1, (int)floor((obs_y_list[k]+r-grid_lly)/grid_res-0.5));
+    for (int i=i0;i<=i1;i++){
+			double dx = grid_llx + (i+0.5)*grid_res - obs_x_list[k];
+      for (int j=j0;j<=j1;j++){
+				double dy = grid_lly + (j+0.5)*grid_res - obs_y_list[k];
+				if (dx*dx + dy*dy < r2){
+          grid.data[i*ny+j] = 100;
+          grid_vis.data[j*nx+i] = 100;
+        }
       }
     }
   }
-  return grid;
 }
 
 int main(int argc, char *argv[]) {
 
 	auto n = nature::node::init_node(argc, argv, "nature_map_publisher_node");
-  auto grid_pub = n->create_publisher<nature::msg::OccupancyGrid>("nature/occupancy_grid", 1);
+  // the map never changes, so it is latched for late subscribers and only repeated at the heartbeat
+  auto grid_pub = n->create_publisher<nature::msg::OccupancyGrid>("nature/occupancy_grid", 1, true);
   
   n->get_parameter("~grid_width", grid_width, 200.0f);
   n->get_parameter("~grid_height", grid_height, 200.0f);
@@ -78,6 +77,10 @@ int main(int argc, char *argv[]) {
 	std::string display;
   n->get_parameter("~display", display, std::string("image"));
 
+  // seconds between republishing the map, 0 only publishes it once
+  double heartbeat_period;
+  n->get_parameter("~heartbeat_period", heartbeat_period, 1.0);
+
   n->get_parameter("/obstacles_x", obs_x_list, std::vector<double>(0));
   n->get_parameter("/obstacles_y", obs_y_list, std::vector<double>(0));
 	n->get_parameter("/obstacles_r", obs_r_list, std::vector<double>(0));
@@ -90,24 +93,28 @@ int main(int argc, char *argv[]) {
   bool use_rviz = display == "rviz";
   std::shared_ptr<nature::node::Publisher<nature::msg::OccupancyGrid>> grid_pub_vis;
   if(use_rviz){
-    grid_pub_vis = n->create_publisher<nature::msg::OccupancyGrid>("nature/occupancy_grid_vis", 1);
+    grid_pub_vis = n->create_publisher<nature::msg::OccupancyGrid>("nature/occupancy_grid_vis", 1, true);
   }
 
-	nature::msg::OccupancyGrid grd = CreateGrid(false);
-	nature::msg::OccupancyGrid grd_vis = CreateGrid( true);
+	nature::msg::OccupancyGrid grd, grd_vis;
+	CreateGrids(grd, grd_vis);
 
-	int nloops = 0;
-	nature::node::Rate rate(100.0);
+	double last_publish = -1.0e9;
+	bool published = false;
+	nature::node::Rate rate(10.0);
 	while (nature::node::ok()){
-
-    grd.header.stamp = n->get_stamp();
-		grid_pub->publish(grd);
-
-		if(use_rviz && nloops % 10 == 0){
-			grd_vis.header.stamp = n->get_stamp();
-			grid_pub_vis->publish(grd_vis);
+		double now = n->get_now_seconds();
+		if (!published || (heartbeat_period > 0.0 && now - last_publish >= heartbeat_period)){
+			// the map is not from a scan, a zero stamp keeps the repeats out of the latency totals
+			grd.header.stamp = nature::node::time_from_seconds(0.0);
+			grid_pub->publish(grd);
+			if(use_rviz){
+				grd_vis.header.stamp = n->get_stamp();
+				grid_pub_vis->publish(grd_vis);
+			}
+			last_publish = now;
+			published = true;
 		}
-		nloops++;
 		n->spin_some();
 		rate.sleep();
 	}
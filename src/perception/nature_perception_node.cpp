@@ -4,160 +4,183 @@
 #include <fstream>
 #include <vector>
 #include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <mutex>
 // ros includes
 #include "nature/node/ros_types.h"
 #include "nature/node/node_proxy.h"
+#include "nature/node/stage_diagnostics.h"
+#include "nature/node/pipeline_stages.h"
+#include "nature/node/latency_trace.h"
 // nature includes
+#include "nature/common/bounded_queue.h"
+#include "nature/common/replay_clock.h"
 #include "nature/perception/elevation_grid.h"
+#include "nature/perception/pose_buffer.h"
 
+namespace {
+
+// The node runs as a pipeline: the ROS callbacks only queue clouds and store
+// odometry, the integration thread adds queued clouds to the grid and the
+// publish thread exports and publishes snapshots of it.
 nature::perception::ElevationGrid grid;
+/// guards grid and scan_trace
+std::mutex grid_mutex;
+/// the newest cloud added to the grid, its stamp goes in the grid headers
+nature::node::TraceStamp scan_trace;
+static const nature::node::LatencyTrace GRID_LATENCY("grid");
 nature::msg::Odometry current_pose;
-bool grid_created = false;
+std::atomic<bool> grid_created(false);
 bool odom_rcvd = false;
-std::vector<nature::msg::Odometry> current_pose_list;
+bool recenter_pending = false;
+nature::perception::PoseBuffer pose_buffer(200);
+/// guards current_pose, odom_rcvd, recenter_pending and pose_buffer
+std::mutex pose_mutex;
+/// a lidar input, the mount is the transform from the lidar frame to the odometry child frame
+struct LidarInput {
+	std::string topic;
+	float rot[9] = {1.0f, 0.0f, 0.0f, 0.0f, 1.0f, 0.0f, 0.0f, 0.0f, 1.0f};
+	float origin[3] = {0.0f, 0.0f, 0.0f};
+	double time_register_window = 0.02;
+};
+std::vector<LidarInput> lidars;
+/// a received cloud and the index of its lidar
+struct QueuedCloud {
+	int lidar = 0;
+	nature::msg::PointCloud2::ConstPtr cloud;
+	/// node time the cloud was received
+	double received = 0.0;
+};
+/// shared by all lidars so they feed the one grid
+nature::common::BoundedQueue<QueuedCloud> cloud_queue;
+std::atomic<bool> pipeline_running(true);
+bool deskew = false;
+std::string deskew_time_field = "time";
+double deskew_time_scale = 1.0;
 bool use_registered = true;
 float overhead_clearance = 100.0f;
-double time_register_window = 0.02;
 bool cull_lidar_points = false;
 float cull_lidar_points_dist_sqr = 10000.0f;
 float blanking_distance = 0.0f;
 float blanking_distance_sqr = 0.0f;
 
-double CalcLidarPointToRobotDistanceSquared(const nature::msg::Point& odom_pose, const nature::msg::Point32& point){
-	double dx = odom_pose.x - point.x;
-	double dy = odom_pose.y - point.y;
-	double dz = odom_pose.z - point.z;
-	return (dx*dx + dy*dy + dz*dz);
+nature::perception::ScanFilter GetScanFilter(const nature::perception::PoseSample & pose_to_use){
+	nature::perception::ScanFilter filter;
+	for (int k=0;k<3;k++) filter.robot[k] = pose_to_use.pos[k];
+	filter.max_z = current_pose.pose.pose.position.z + overhead_clearance;
+	filter.min_range_sqr = blanking_distance_sqr;
+	if (cull_lidar_points) filter.max_range_sqr = cull_lidar_points_dist_sqr;
+	return filter;
 }
 
-double GetPoseToUse(nature::msg::Odometry & pose_to_use, nature::msg::PointCloud2Ptr rcv_cloud){
-  double dt = 1.0;
-  for (int i=0;i<current_pose_list.size();i++){
-    double dt_this = fabs(nature::node::seconds_from_header(current_pose_list[i].header) - nature::node::seconds_from_header(rcv_cloud->header));
-    if (dt_this<dt){
-      pose_to_use = current_pose_list[i];
-      dt = dt_this;
-    }
-  }
-	return dt;
+/**
+ * Build the filter used to add a cloud to the grid, from the odometry at the cloud stamp.
+ * Must be called with pose_mutex held.
+ * Returns false if the cloud can't be placed yet.
+ * \param rcv_cloud The cloud
+ * \param lidar The lidar the cloud came from
+ * \param filter The filter
+ * \param scan_poses Filled with a copy of the odometry when deskewing
+ */
+bool GetCloudFilter(const nature::msg::PointCloud2 &rcv_cloud, const LidarInput &lidar,
+                    nature::perception::ScanFilter &filter, nature::perception::PoseBuffer &scan_poses){
+	if (!odom_rcvd) return false;
+	nature::perception::PoseSample pose_to_use;
+	double stamp = nature::node::seconds_from_header(rcv_cloud.header);
+	double dt = pose_buffer.Interpolate(stamp, pose_to_use);
+	if (use_registered){
+		// assumes point cloud is already registered to odom frame
+		filter = GetScanFilter(pose_to_use);
+		return true;
+	}
+	if (dt<0.0 || dt>=lidar.time_register_window) return false;
+	filter = GetScanFilter(pose_to_use);
+	pose_to_use.GetRotation(filter.rot);
+	for (int k=0;k<3;k++) filter.origin[k] = pose_to_use.pos[k];
+	for (int k=0;k<9;k++) filter.sensor_rot[k] = lidar.rot[k];
+	for (int k=0;k<3;k++) filter.sensor_origin[k] = lidar.origin[k];
+	if (deskew){
+		// the buffer keeps changing while the cloud is added, so use a copy
+		scan_poses = pose_buffer;
+		filter.deskew_poses = &scan_poses;
+		filter.time_field = deskew_time_field;
+		filter.time_scale = deskew_time_scale;
+		filter.stamp = stamp;
+	}
+	return true;
 }
 
-void PointCloudCallbackRegistered(nature::msg::PointCloud2Ptr rcv_cloud){
-	// assumes point cloud is already registered to odom frame
-	nature::msg::PointCloud point_cloud;
-	
-  bool converted = sensor_msgs::convertPointCloud2ToPointCloud(*rcv_cloud,point_cloud);
-	if (converted && odom_rcvd){
-		std::vector<nature::msg::Point32> points;
-		std::vector<std::vector<float>> channel_values;
-		for(int c = 0; c < point_cloud.channels.size(); c++){
-			channel_values.push_back(std::vector<float>());
-		}
-		for (int p=0;p<point_cloud.points.size();p++){
-			nature::msg::Point32 tp;
-			tp.x = point_cloud.points[p].x;
-			tp.y = point_cloud.points[p].y;
-			tp.z = point_cloud.points[p].z;
-			if ( !(tp.x==0.0 && tp.y==0.0) && !std::isnan(tp.x) && (tp.z-current_pose.pose.pose.position.z)<overhead_clearance ){
-
-				bool add_point = true;
-				nature::msg::Odometry pose_to_use;
-				GetPoseToUse(pose_to_use, rcv_cloud);
-				double dr2 = CalcLidarPointToRobotDistanceSquared(pose_to_use.pose.pose.position, tp); 
-				if (cull_lidar_points){
-					add_point = dr2 < cull_lidar_points_dist_sqr;
-				}
-				if(add_point && dr2> blanking_distance_sqr){
-					points.push_back(tp);
-					for(int c = 0; c < point_cloud.channels.size(); c++){
-						channel_values[c].push_back(point_cloud.channels[c].values[p]);
-					}
-				}
+/// may run on the threads of the lidar callback group, only touches the queue
+void PointCloudCallback(int lidar, nature::msg::PointCloud2Ptr rcv_cloud){
+	QueuedCloud queued;
+	queued.lidar = lidar;
+	queued.cloud = rcv_cloud;
+	queued.received = nature::node::now_seconds();
+	cloud_queue.Push(queued);
+}
 
-			}
-		}
-		point_cloud.points.clear();
-		point_cloud.points = points;
-		for(int c = 0; c < point_cloud.channels.size(); c++){
-			point_cloud.channels[c].values = channel_values[c];
-		}
-		grid.AddPoints(point_cloud);
-		grid_created = true;
-	}
+/// row-major rotation of roll, pitch, yaw (radians) about fixed x, y, z
+void RotationFromRPY(double roll, double pitch, double yaw, float rot[9]){
+	double cr = cos(roll), sr = sin(roll);
+	double cp = cos(pitch), sp = sin(pitch);
+	double cy = cos(yaw), sy = sin(yaw);
+	rot[0] = (float)(cy*cp); rot[1] = (float)(cy*sp*sr - sy*cr); rot[2] = (float)(cy*sp*cr + sy*sr);
+	rot[3] = (float)(sy*cp); rot[4] = (float)(sy*sp*sr + cy*cr); rot[5] = (float)(sy*sp*cr - cy*sr);
+	rot[6] = (float)(-sp);   rot[7] = (float)(cp*sr);            rot[8] = (float)(cp*cr);
 }
 
-void PointCloudCallbackUnregistered(nature::msg::PointCloud2Ptr rcv_cloud){
-	nature::msg::PointCloud point_cloud;
-	
-	bool converted = sensor_msgs::convertPointCloud2ToPointCloud(*rcv_cloud,point_cloud);
+void OdometryCallback(nature::msg::OdometryPtr rcv_odom){
+	std::lock_guard<std::mutex> lock(pose_mutex);
+	current_pose = *rcv_odom;
+	odom_rcvd = true;
+	recenter_pending = true;
+	pose_buffer.Add(nature::node::seconds_from_header(current_pose.header), current_pose.pose.pose);
+}
 
-	nature::msg::Odometry pose_to_use;
-	double dt = GetPoseToUse(pose_to_use, rcv_cloud);
-	std::vector<std::vector<float>> channel_values;
-	for(int c = 0; c < point_cloud.channels.size(); c++){
-		channel_values.push_back(std::vector<float>());
-	}
-	if (converted && fabs(dt)<time_register_window && odom_rcvd){
-    nature::msg_tf::Quaternion q(pose_to_use.pose.pose.orientation.x, pose_to_use.pose.pose.orientation.y, pose_to_use.pose.pose.orientation.z, current_pose.pose.pose.orientation.w);
-    nature::msg_tf::Matrix3x3 R(q);
-    nature::msg_tf::Vector3 origin(pose_to_use.pose.pose.position.x, pose_to_use.pose.pose.position.y, pose_to_use.pose.pose.position.z);
-		std::vector<nature::msg::Point32> points;
-		for (int p=0;p<point_cloud.points.size();p++){
-      nature::msg_tf::Vector3 v;
-			v = nature::msg_tf::Vector3(point_cloud.points[p].x, point_cloud.points[p].y,point_cloud.points[p].z);
-			//double r = sqrt( pow(v.x()-origin.x(), 2)+pow(v.y()-origin.y(), 2)+pow(v.z()-origin.z(), 2));
-			if (v.x()!=0.0 && v.y()!=0.0 &&!std::isnan(v.x())){
-        nature::msg_tf::Vector3 vp = (R*v) + origin;
-				nature::msg::Point32 tp;
-				tp.x = vp.x();
-				tp.y = vp.y();
-				tp.z = vp.z();
-				float dr2 = CalcLidarPointToRobotDistanceSquared(pose_to_use.pose.pose.position, tp);
-				if ( (tp.z-current_pose.pose.pose.position.z)<overhead_clearance &&
-             		(!cull_lidar_points || dr2 < cull_lidar_points_dist_sqr)
-								 && dr2 > blanking_distance_sqr){
-					points.push_back(tp);
-					for(int c = 0; c < point_cloud.channels.size(); c++){
-						channel_values[c].push_back(point_cloud.channels[c].values[p]);
-					}
-				}
-				
-			}
+/// Integration thread, adds queued clouds to the grid
+void IntegrateClouds(){
+	nature::perception::PoseBuffer scan_poses(200);
+	QueuedCloud queued;
+	while (pipeline_running){
+		bool have_cloud = cloud_queue.Pop(queued, std::chrono::milliseconds(10));
+		nature::perception::ScanFilter filter;
+		bool have_filter = false;
+		bool recenter = false;
+		double x = 0.0, y = 0.0;
+		{
+			std::lock_guard<std::mutex> lock(pose_mutex);
+			if (have_cloud) have_filter = GetCloudFilter(*queued.cloud, lidars[queued.lidar], filter, scan_poses);
+			recenter = recenter_pending;
+			recenter_pending = false;
+			x = current_pose.pose.pose.position.x;
+			y = current_pose.pose.pose.position.y;
 		}
-		point_cloud.points.clear();
-		point_cloud.points = points;
-		for(int c = 0; c < point_cloud.channels.size(); c++){
-			point_cloud.channels[c].values = channel_values[c];
+		if (!have_filter && !recenter) continue;
+		std::lock_guard<std::mutex> lock(grid_mutex);
+		if (recenter && grid.scrolling()) grid.Recenter(x, y);
+		if (have_filter && grid.AddPoints(*queued.cloud, filter)){
+			grid_created = true;
+			// clouds of several lidars arrive out of order, the grid stamp only moves forward
+			// so the consumers never drop its patches as older than the grid
+			scan_trace.ReceiveNewer(queued.cloud->header, queued.received);
 		}
-		grid.AddPoints(point_cloud);
-		grid_created = true;
-	}
-}
-void PointCloudCallback(nature::msg::PointCloud2Ptr rcv_cloud){
-	if (use_registered){
-		PointCloudCallbackRegistered(rcv_cloud);
-	}
-	else{
-		PointCloudCallbackUnregistered(rcv_cloud);
+		queued.cloud.reset();
 	}
 }
 
-void OdometryCallback(nature::msg::OdometryPtr rcv_odom){
-	current_pose = *rcv_odom;
-	odom_rcvd = true;
-	current_pose_list.push_back(current_pose);
-	if (current_pose_list.size()>50) current_pose_list.erase(current_pose_list.begin());
-}
+} // namespace
 
-int main(int argc, char *argv[]) {
+int nature::node::RunPerception(std::shared_ptr<nature::node::NodeProxy> n) {
 
 	grid_created = false;
 
-	auto n = nature::node::init_node(argc, argv, "nature_perception_node");
-	auto pc_sub = n->create_subscription<nature::msg::PointCloud2>("nature/points",2,PointCloudCallback);
     auto odom_sub = n->create_subscription<nature::msg::Odometry>("nature/odometry",10, OdometryCallback);
     auto grid_pub = n->create_publisher<nature::msg::OccupancyGrid>("nature/occupancy_grid", 1);
     auto grid_segmentation_pub = n->create_publisher<nature::msg::OccupancyGrid>("nature/segmentation_grid", 1);
+    auto grid_update_pub = n->create_publisher<nature::msg::OccupancyGridUpdate>("nature/occupancy_grid_updates", 10);
+    auto grid_segmentation_update_pub = n->create_publisher<nature::msg::OccupancyGridUpdate>("nature/segmentation_grid_updates", 10);
+    auto layered_grid_pub = n->create_publisher<nature::msg::LayeredGrid>("nature/layered_grid", 1);
 
     float grid_width, grid_height;
     n->get_parameter("~grid_width", grid_width, 200.0f);
@@ -174,11 +197,14 @@ int main(int argc, char *argv[]) {
 	n->get_parameter("~grid_res", grid_res, 1.0f);
 	n->get_parameter("~grid_llx", grid_llx, -100.0f);
 	n->get_parameter("~grid_lly", grid_lly, -100.0f);
+	double time_register_window;
 	n->get_parameter("~time_register_window", time_register_window, 0.02);
 	n->get_parameter("~warmup_time", warmup_time, 1.0f);
 	n->get_parameter("~slope_threshold", thresh, 1.0f);
 	n->get_parameter("~use_elevation", use_elevation, false);
 	n->get_parameter("~persistent_obstacles", persistent_obstacles, false);
+	double obstacle_decay;
+	n->get_parameter("~obstacle_decay", obstacle_decay, 0.0);
 	n->get_parameter("~use_registered", use_registered, true);
 	n->get_parameter("~grid_dilate", grid_dilate, true);
 	n->get_parameter("~grid_dilate_x", grid_dilate_x, 2.0f);
@@ -190,10 +216,67 @@ int main(int argc, char *argv[]) {
 	n->get_parameter("~stitch_lidar_points", stitch_points, true);
 	bool filter_highest_lidar;
 	n->get_parameter("~filter_highest_lidar", filter_highest_lidar, false);
+	bool voxel_filter;
+	n->get_parameter("~voxel_filter", voxel_filter, false);
+	n->get_parameter("~deskew", deskew, false);
+	n->get_parameter("~deskew_time_field", deskew_time_field, std::string("time"));
+	n->get_parameter("~deskew_time_scale", deskew_time_scale, 1.0);
+	bool publish_grid_updates;
+	n->get_parameter("~publish_grid_updates", publish_grid_updates, false);
+	bool publish_layered_grid;
+	n->get_parameter("~publish_layered_grid", publish_layered_grid, false);
+	bool layered_grid_heights;
+	n->get_parameter("~layered_grid_heights", layered_grid_heights, false);
+	bool terrain_stats;
+	n->get_parameter("~terrain_stats", terrain_stats, false);
+	float full_grid_period;
+	n->get_parameter("~full_grid_period", full_grid_period, 1.0f);
+	int num_threads;
+	n->get_parameter("~num_threads", num_threads, 1);
+	bool scrolling_grid;
+	n->get_parameter("~scrolling_grid", scrolling_grid, false);
+	bool sparse_grid;
+	n->get_parameter("~sparse_grid", sparse_grid, false);
+	std::string map_file;
+	n->get_parameter("~map_file", map_file, std::string(""));
+	float map_save_period;
+	n->get_parameter("~map_save_period", map_save_period, 0.0f);
     float cull_lidar_points_dist;
     n->get_parameter("~cull_lidar", cull_lidar_points, false);
     n->get_parameter("~cull_lidar_dist", cull_lidar_points_dist, 100.0f);
     cull_lidar_points_dist_sqr = cull_lidar_points_dist * cull_lidar_points_dist;
+	int scan_queue_size;
+	n->get_parameter("~scan_queue_size", scan_queue_size, 2);
+	bool drop_oldest_scans;
+	n->get_parameter("~drop_oldest_scans", drop_oldest_scans, true);
+
+	// every lidar feeds the same grid, mounts are [x, y, z, roll, pitch, yaw] per topic
+	std::vector<std::string> points_topics;
+	n->get_parameter("~points_topics", points_topics, std::vector<std::string>(1, "nature/points"));
+	std::vector<double> lidar_mounts;
+	n->get_parameter("~lidar_mounts", lidar_mounts, std::vector<double>(0));
+	std::vector<double> lidar_time_register_windows;
+	n->get_parameter("~lidar_time_register_windows", lidar_time_register_windows, std::vector<double>(0));
+	// the clouds are deserialized and queued on threads of their own, so odometry is not held up behind them
+	int lidar_callback_threads;
+	n->get_parameter("~lidar_callback_threads", lidar_callback_threads, 1);
+	std::shared_ptr<nature::node::CallbackGroup> lidar_group;
+	if (lidar_callback_threads > 0) lidar_group = n->create_callback_group(lidar_callback_threads);
+	cloud_queue.SetCapacity(scan_queue_size*std::max(1, (int)points_topics.size()), drop_oldest_scans);
+	std::vector<std::shared_ptr<nature::node::Subscriber<nature::msg::PointCloud2>>> pc_subs;
+	for (int l=0;l<(int)points_topics.size();l++){
+		LidarInput lidar;
+		lidar.topic = points_topics[l];
+		lidar.time_register_window = l < (int)lidar_time_register_windows.size() ? lidar_time_register_windows[l] : time_register_window;
+		if ((int)lidar_mounts.size() >= 6*(l+1)){
+			const double *m = &lidar_mounts[6*l];
+			for (int k=0;k<3;k++) lidar.origin[k] = (float)m[k];
+			RotationFromRPY(m[3], m[4], m[5], lidar.rot);
+		}
+		lidars.push_back(lidar);
+		pc_subs.push_back(n->create_subscription<nature::msg::PointCloud2>(lidar.topic, 2,
+			[l](nature::msg::PointCloud2Ptr cloud){ PointCloudCallback(l, cloud); }, lidar_group));
+	}
 
 
   bool use_rviz = display == "rviz";
@@ -205,47 +288,151 @@ int main(int argc, char *argv[]) {
     }
 
 	grid.SetSlopeThreshold(thresh);
+	grid.SetSparse(sparse_grid);
 	grid.SetRes(grid_res);
 	grid.SetCorner(grid_llx,grid_lly);
 	grid.SetUseElevation(use_elevation);
 	grid.SetDilation(grid_dilate, grid_dilate_x, grid_dilate_y, grid_dilate_proportion);
 	grid.SetStitchPoints(stitch_points);
 	grid.SetFilterHighest(filter_highest_lidar);
+	grid.SetVoxelFilter(voxel_filter);
+	grid.SetTerrainStats(terrain_stats);
 	grid.SetPersistentObstacles(persistent_obstacles);
+	grid.SetObstacleDecay(obstacle_decay);
+	grid.SetScrolling(scrolling_grid);
+	grid.SetNumThreads(num_threads);
+	if (!map_file.empty() && grid.Load(map_file)){
+		std::cout<<"Loaded elevation grid from "<<map_file<<std::endl;
+		grid_created = true;
+	}
 
 	double start_time = n->get_now_seconds();
-	nature::node::Rate rate(100.0);
-  int nloops = 0;
-	while (nature::node::ok()){
-		double elapsed_time = (n->get_now_seconds()-start_time);
-		if (grid_created && elapsed_time > warmup_time) {
-			nature::msg::OccupancyGrid grd;
-      		grd = grid.GetGrid();
-			grd.header.stamp = n->get_stamp();
-			grid_pub->publish(grd);
-
-			if(grid.has_segmentation()){
-				grd = grid.GetGrid(false, true);
-				grd.header.stamp = n->get_stamp();
-				grid_segmentation_pub->publish(grd);
-			}
 
-			if(use_rviz && nloops % 10 == 0){
-				nature::msg::OccupancyGrid grd_vis = grid.GetGrid( true);
-				grd_vis.header.stamp = n->get_stamp();
-				grid_pub_vis->publish(grd_vis);
-				if(grid.has_segmentation()){
-					grd_vis = grid.GetGrid(true, true);
-					grd_vis.header.stamp = n->get_stamp();
-					grid_segmentation_vis_pub->publish(grd_vis);
+	// publish thread, snapshots are exported under the grid lock and published after releasing it
+	auto publish_grids = [&](){
+		// message buffers are reused between publishes, the grids are published shared so the
+		// stages in the same process get them without a copy, and reused once they let them go
+		boost::shared_ptr<nature::msg::OccupancyGrid> grd;
+		boost::shared_ptr<nature::msg::OccupancyGrid> grd_seg;
+		nature::msg::OccupancyGrid grd_vis;
+		nature::msg::OccupancyGrid grd_vis_seg;
+		boost::shared_ptr<nature::msg::OccupancyGridUpdate> grd_update;
+		boost::shared_ptr<nature::msg::OccupancyGridUpdate> grd_update_seg;
+		boost::shared_ptr<nature::msg::LayeredGrid> grd_layered;
+		double last_full_time = -1.0e9;
+		double last_save_time = start_time;
+		bool vis_pending = false;
+		nature::node::Rate rate(100.0);
+		int nloops = 0;
+		while (pipeline_running){
+			double elapsed_time = (n->get_now_seconds()-start_time);
+			if (grid_created && elapsed_time > warmup_time) {
+				bool send_full = false, send_update = false, send_vis = false, has_seg = false;
+				nature::node::TraceStamp trace;
+				{
+					std::lock_guard<std::mutex> lock(grid_mutex);
+					has_seg = grid.has_segmentation();
+					trace = scan_trace;
+					if (grid.HasChanges()){
+						double now = n->get_now_seconds();
+						send_full = !publish_grid_updates || grid.FullChange() || (now - last_full_time) > full_grid_period;
+						if (send_full){
+							if (publish_layered_grid){
+								grid.GetLayeredGrid(nature::node::reuse_message(grd_layered), layered_grid_heights);
+							}
+							else{
+								grid.GetGrid(nature::node::reuse_message(grd));
+								if (has_seg) grid.GetGrid(nature::node::reuse_message(grd_seg), false, true);
+							}
+							last_full_time = now;
+						}
+						else if (grid.GetGridUpdate(nature::node::reuse_message(grd_update))){
+							send_update = true;
+							if (has_seg) grid.GetGridUpdate(nature::node::reuse_message(grd_update_seg), false, true);
+						}
+						grid.ResetChanges();
+						vis_pending = true;
+					}
+					if (use_rviz && vis_pending && nloops % 10 == 0){
+						grid.GetGrid(grd_vis, true);
+						if (has_seg) grid.GetGrid(grd_vis_seg, true, true);
+						send_vis = true;
+						vis_pending = false;
+					}
+					if (!map_file.empty() && map_save_period > 0.0f && (n->get_now_seconds() - last_save_time) > map_save_period){
+						grid.Save(map_file);
+						last_save_time = n->get_now_seconds();
+					}
 				}
-			}
-			nloops++;
 
+				// stamped with the newest scan in the grid, so the stages after can tell the age of the data
+				ros::Time stamp = nature::node::LatencyTrace::OutputStamp(trace, *n);
+				if (send_full && publish_layered_grid){
+					grd_layered->header.stamp = stamp;
+					layered_grid_pub->publish(grd_layered);
+				}
+				else if (send_full){
+					grd->header.stamp = stamp;
+					grid_pub->publish(grd);
+					if (has_seg){
+						grd_seg->header.stamp = grd->header.stamp;
+						grid_segmentation_pub->publish(grd_seg);
+					}
+				}
+				else if (send_update){
+					grd_update->header.stamp = stamp;
+					grid_update_pub->publish(grd_update);
+					if (has_seg){
+						grd_update_seg->header.stamp = grd_update->header.stamp;
+						grid_segmentation_update_pub->publish(grd_update_seg);
+					}
+				}
+				if (send_vis){
+					grd_vis.header.stamp = stamp;
+					grid_pub_vis->publish(grd_vis);
+					if (has_seg){
+						grd_vis_seg.header.stamp = grd_vis.header.stamp;
+						grid_segmentation_vis_pub->publish(grd_vis_seg);
+					}
+				}
+				if (send_full || send_update) GRID_LATENCY.Record(trace, n->get_now_seconds());
+				nloops++;
+			}
+			rate.sleep();
 		}
+	};
+
+	nature::common::ReplayThread integrate_thread(IntegrateClouds);
+	nature::common::ReplayThread publish_thread(publish_grids);
+
+	double diagnostics_period;
+	n->get_parameter("~diagnostics_period", diagnostics_period, 1.0);
+	auto diagnostics = nature::node::StageDiagnostics::make_shared("perception", diagnostics_period, n);
+	nature::node::Rate rate(100.0);
+	while (n->ok()){
 		n->spin_some();
+		diagnostics->update();
 		rate.sleep();
 	}
 
+	// no more clouds once the lidar threads are stopped
+	pc_subs.clear();
+	lidar_group.reset();
+	pipeline_running = false;
+	cloud_queue.Close();
+	integrate_thread.join();
+	publish_thread.join();
+	if (cloud_queue.NumDropped() > 0){
+		std::cout<<"Perception dropped "<<cloud_queue.NumDropped()<<" point clouds"<<std::endl;
+	}
+
+	if (!map_file.empty() && grid_created) grid.Save(map_file);
+
 	return 0;
-}
\ No newline at end of file
+}
+
+#ifndef NATURE_NODELET
+int main(int argc, char *argv[]){
+  return nature::node::RunPerception(nature::node::init_node(argc, argv, "nature_perception_node"));
+}
+#endif
@@ -1,61 +1,116 @@
 #include "nature/perception/point_cloud_generator.h"
-#include <pcl/point_types.h>
-#include <pcl_conversions/pcl_conversions.h>
+#include <string.h>
+#include <iostream>
 
-// union used to convert floats to bytes
-union dataUnion
-{
-    float f;
-    uint8_t b[sizeof(float)];
-};
+namespace {
 
-void nature::perception::PointCloudGenerator::toROSMsg(const std::vector<nature::utils::vec3> & points, nature::msg::PointCloud2 & out_point_cloud) {
-  pcl::PointCloud<pcl::PointXYZ>::Ptr msg (new pcl::PointCloud<pcl::PointXYZ>);
-  pcl::PointCloud<pcl::PointXYZ> point_cloud;
-  for(const auto & p : points){
-    point_cloud.push_back(pcl::PointXYZ(p.x, p.y, p.z));
+/// Set field k of the message, reusing the storage of the name
+void SetField(nature::msg::PointCloud2 & cloud, size_t k, const char *name, uint32_t offset, uint8_t datatype){
+  nature::msg::PointField &field = cloud.fields[k];
+  field.name = name;
+  field.offset = offset;
+  field.datatype = datatype;
+  field.count = 1;
+}
+
+/// Write value i of a channel at offset of each point, converted to T
+template<class T, class V>
+void WriteChannel(const std::vector<V> & values, uint32_t offset, uint32_t point_step, uint8_t *data){
+  uint8_t *dst = data + offset;
+  for (size_t i = 0; i < values.size(); i++, dst += point_step){
+    T v = (T)values[i];
+    memcpy(dst, &v, sizeof(T));
+  }
+}
+
+/// True if a channel is given and has a value per point
+template<class V>
+bool UseChannel(const std::vector<V> *values, size_t num_points, const char *name){
+  if (values == nullptr) return false;
+  if (values->size() != num_points){
+    std::cerr << "WARNING: The " << name << " channel has " << values->size() << " values for "
+              << num_points << " points, leaving it out of the cloud." << std::endl;
+    return false;
   }
-  pcl::toROSMsg(point_cloud, out_point_cloud);
+  return true;
+}
+
+} // namespace
+
+void nature::perception::PointCloudGenerator::toROSMsg(const std::vector<nature::utils::vec3> & points, nature::msg::PointCloud2 & out_point_cloud) {
+  toROSMsg(points, PointChannels(), out_point_cloud);
 }
 
 void nature::perception::PointCloudGenerator::toROSMsg(const std::vector<nature::utils::vec3> & points, const std::vector<int> & seg_values, nature::msg::PointCloud2 & out_point_cloud) {
-    int num_lidar_points = points.size();
-    out_point_cloud.height = 1;
-    out_point_cloud.width = num_lidar_points;
-    std::vector<nature::msg::PointField> fields(4);
-    fields[0].name = "x";
-    fields[1].name = "y";
-    fields[2].name = "z";
-    fields[3].name = "segmentation";
-    uint32_t offset = 0ul;
-    for (int i = 0; i < fields.size(); i++)
-    {
-        fields[i].offset = offset;
-        fields[i].datatype = nature::msg::PointField::FLOAT32;
-        fields[i].count = 1;
-        offset += 4;
-    }
-    out_point_cloud.fields = fields;
-    out_point_cloud.is_bigendian = false;
-    out_point_cloud.point_step = offset;
-    out_point_cloud.row_step = out_point_cloud.point_step * out_point_cloud.width;
-    out_point_cloud.is_dense = true;
-    std::vector<uint8_t> data;
-    data.reserve(4 * num_lidar_points * sizeof(float));
-    for (int v_i = 0; v_i < points.size(); v_i++)
-    {
-        nature::utils::vec3 v = points[v_i];
-        float seg_value = (float)seg_values[v_i];
-        for(int i = 0; i < 3; i++){
-            dataUnion u;
-            u.f = v[i];
-            for (int j = 0; j < sizeof(float); j++)
-                data.push_back(u.b[j]);
-        }
-        dataUnion u;
-        u.f = seg_value;
-        for (int j = 0; j < sizeof(float); j++)
-            data.push_back(u.b[j]);
+  PointChannels channels;
+  channels.segmentation = &seg_values;
+  toROSMsg(points, channels, out_point_cloud);
+}
+
+void nature::perception::PointCloudGenerator::toROSMsg(const std::vector<nature::utils::vec3> & points, const PointChannels & channels, nature::msg::PointCloud2 & out_point_cloud) {
+  const size_t n = points.size();
+  bool use_segmentation = UseChannel(channels.segmentation, n, "segmentation");
+  bool use_intensity = UseChannel(channels.intensity, n, "intensity");
+  bool use_time = UseChannel(channels.time, n, "time");
+  bool use_ring = UseChannel(channels.ring, n, "ring");
+
+  // x, y, z, then the 4 byte channels and the ring, the point padded to 4 bytes
+  size_t num_fields = 3 + use_segmentation + use_intensity + use_time + use_ring;
+  out_point_cloud.fields.resize(num_fields);
+  size_t k = 0;
+  uint32_t offset = 0;
+  SetField(out_point_cloud, k++, "x", 0, nature::msg::PointField::FLOAT32);
+  SetField(out_point_cloud, k++, "y", 4, nature::msg::PointField::FLOAT32);
+  SetField(out_point_cloud, k++, "z", 8, nature::msg::PointField::FLOAT32);
+  offset = 12;
+  uint32_t segmentation_offset = offset;
+  if (use_segmentation){
+    SetField(out_point_cloud, k++, "segmentation", offset, nature::msg::PointField::FLOAT32);
+    offset += 4;
+  }
+  uint32_t intensity_offset = offset;
+  if (use_intensity){
+    SetField(out_point_cloud, k++, "intensity", offset, nature::msg::PointField::FLOAT32);
+    offset += 4;
+  }
+  uint32_t time_offset = offset;
+  if (use_time){
+    SetField(out_point_cloud, k++, "time", offset, nature::msg::PointField::FLOAT32);
+    offset += 4;
+  }
+  uint32_t ring_offset = offset;
+  if (use_ring){
+    SetField(out_point_cloud, k++, "ring", offset, nature::msg::PointField::UINT16);
+    offset += 4;
+  }
+  const uint32_t point_step = offset;
+
+  out_point_cloud.height = 1;
+  out_point_cloud.width = (uint32_t)n;
+  out_point_cloud.is_bigendian = false;
+  out_point_cloud.point_step = point_step;
+  out_point_cloud.row_step = point_step * out_point_cloud.width;
+  out_point_cloud.is_dense = true;
+  // keeps the capacity of the previous cloud, only grown bytes are zeroed
+  out_point_cloud.data.resize(n * point_step);
+  uint8_t *data = out_point_cloud.data.data();
+
+  // one pass per field, the positions packed 12 bytes at a time
+  uint8_t *dst = data;
+  for (size_t i = 0; i < n; i++, dst += point_step){
+    const float xyz[3] = {points[i].x, points[i].y, points[i].z};
+    memcpy(dst, xyz, sizeof(xyz));
+  }
+  if (use_segmentation) WriteChannel<float>(*channels.segmentation, segmentation_offset, point_step, data);
+  if (use_intensity) WriteChannel<float>(*channels.intensity, intensity_offset, point_step, data);
+  if (use_time) WriteChannel<float>(*channels.time, time_offset, point_step, data);
+  if (use_ring){
+    // the ring with the padding after it
+    const std::vector<uint16_t> &ring = *channels.ring;
+    dst = data + ring_offset;
+    for (size_t i = 0; i < n; i++, dst += point_step){
+      const uint16_t padded[2] = {ring[i], 0};
+      memcpy(dst, padded, sizeof(padded));
     }
-    out_point_cloud.data = data;
-}
\ No newline at end of file
+  }
+}
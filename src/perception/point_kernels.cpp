@@ -0,0 +1,235 @@
+#include "nature/perception/point_kernels.h"
+#include <string.h>
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+#if defined(__SSE2__)
+#include <xmmintrin.h>
+#include <emmintrin.h>
+#endif
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+namespace nature{
+namespace perception{
+
+/// Gate inputs shared by the scalar and vector paths
+struct PointGates {
+  float T[12];
+  float robot[3];
+  float max_z;
+  float min_range_sqr;
+  float max_range_sqr;
+};
+
+/// Scalar kernel for points [k0,k1), comparisons are negated so NaN points gate as in the vector paths
+static int ScalarPoints(const uint8_t *data, int point_step, int k0, int k1, const PointGates &g,
+                        float *out_x, float *out_y, float *out_z, int *out_index, int m){
+  const float *T = g.T;
+  for (int k=k0;k<k1;k++){
+    float p[3];
+    memcpy(p, data + (long)k*point_step, sizeof(p));
+    float x = T[0]*p[0] + T[1]*p[1] + T[2]*p[2] + T[9];
+    float y = T[3]*p[0] + T[4]*p[1] + T[5]*p[2] + T[10];
+    float z = T[6]*p[0] + T[7]*p[1] + T[8]*p[2] + T[11];
+    float dx = g.robot[0] - x;
+    float dy = g.robot[1] - y;
+    float dz = g.robot[2] - z;
+    float dr2 = dx*dx + dy*dy + dz*dz;
+    int keep = !(p[0]==0.0f && p[1]==0.0f) & (p[0]==p[0]) & !(z >= g.max_z) &
+               !(dr2 <= g.min_range_sqr) & !(dr2 >= g.max_range_sqr);
+    out_x[m] = x;
+    out_y[m] = y;
+    out_z[m] = z;
+    out_index[m] = k;
+    m += keep;
+  }
+  return m;
+}
+
+/// Write the lanes of a block selected by mask, in order
+static inline int CompactLanes(int lanes, int mask, int k, const float *x, const float *y, const float *z,
+                               float *out_x, float *out_y, float *out_z, int *out_index, int m){
+  for (int l=0;l<lanes;l++){
+    out_x[m] = x[l];
+    out_y[m] = y[l];
+    out_z[m] = z[l];
+    out_index[m] = k + l;
+    m += (mask >> l) & 1;
+  }
+  return m;
+}
+
+#if defined(__SSE2__)
+/**
+ * Load four 16 byte points as planar x, y, z.
+ * Reads the 4 bytes after the z of the last point, so a following point must exist.
+ */
+static inline void LoadPacked4(const uint8_t *data, __m128 &x, __m128 &y, __m128 &z){
+  const float *p = (const float*)data;
+  __m128 a = _mm_loadu_ps(p), b = _mm_loadu_ps(p + 4), c = _mm_loadu_ps(p + 8), d = _mm_loadu_ps(p + 12);
+  _MM_TRANSPOSE4_PS(a, b, c, d);
+  x = a;
+  y = b;
+  z = c;
+}
+#endif
+
+/// Gather the xyz of lanes points into planar arrays
+static inline void LoadLanes(const uint8_t *data, int point_step, int k, int lanes, float *px, float *py, float *pz){
+  for (int l=0;l<lanes;l++){
+    float p[3];
+    memcpy(p, data + (long)(k + l)*point_step, sizeof(p));
+    px[l] = p[0];
+    py[l] = p[1];
+    pz[l] = p[2];
+  }
+}
+
+#if defined(__AVX2__)
+static const int LANES = 8;
+static int VectorPoints(const uint8_t *data, int point_step, int n, const PointGates &g,
+                        float *out_x, float *out_y, float *out_z, int *out_index, int &m){
+  __m256 t[12];
+  for (int q=0;q<12;q++) t[q] = _mm256_set1_ps(g.T[q]);
+  __m256 rx = _mm256_set1_ps(g.robot[0]), ry = _mm256_set1_ps(g.robot[1]), rz = _mm256_set1_ps(g.robot[2]);
+  __m256 max_z = _mm256_set1_ps(g.max_z);
+  __m256 min_r = _mm256_set1_ps(g.min_range_sqr), max_r = _mm256_set1_ps(g.max_range_sqr);
+  __m256 zero = _mm256_setzero_ps();
+  alignas(32) float px[LANES], py[LANES], pz[LANES], x[LANES], y[LANES], z[LANES];
+  int k = 0;
+  for (;k+LANES<=n;k+=LANES){
+    __m256 vx, vy, vz;
+    if (point_step==16 && k+LANES<n){
+      __m128 x0, y0, z0, x1, y1, z1;
+      LoadPacked4(data + (long)k*16, x0, y0, z0);
+      LoadPacked4(data + (long)(k + 4)*16, x1, y1, z1);
+      vx = _mm256_insertf128_ps(_mm256_castps128_ps256(x0), x1, 1);
+      vy = _mm256_insertf128_ps(_mm256_castps128_ps256(y0), y1, 1);
+      vz = _mm256_insertf128_ps(_mm256_castps128_ps256(z0), z1, 1);
+    }
+    else{
+      LoadLanes(data, point_step, k, LANES, px, py, pz);
+      vx = _mm256_load_ps(px); vy = _mm256_load_ps(py); vz = _mm256_load_ps(pz);
+    }
+    __m256 wx = _mm256_add_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(t[0], vx), _mm256_mul_ps(t[1], vy)), _mm256_mul_ps(t[2], vz)), t[9]);
+    __m256 wy = _mm256_add_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(t[3], vx), _mm256_mul_ps(t[4], vy)), _mm256_mul_ps(t[5], vz)), t[10]);
+    __m256 wz = _mm256_add_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(t[6], vx), _mm256_mul_ps(t[7], vy)), _mm256_mul_ps(t[8], vz)), t[11]);
+    __m256 dx = _mm256_sub_ps(rx, wx), dy = _mm256_sub_ps(ry, wy), dz = _mm256_sub_ps(rz, wz);
+    __m256 dr2 = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy)), _mm256_mul_ps(dz, dz));
+    __m256 origin = _mm256_and_ps(_mm256_cmp_ps(vx, zero, _CMP_EQ_OQ), _mm256_cmp_ps(vy, zero, _CMP_EQ_OQ));
+    __m256 keep = _mm256_andnot_ps(origin, _mm256_cmp_ps(vx, vx, _CMP_EQ_OQ));
+    keep = _mm256_and_ps(keep, _mm256_cmp_ps(wz, max_z, _CMP_NGE_UQ));
+    keep = _mm256_and_ps(keep, _mm256_cmp_ps(dr2, min_r, _CMP_NLE_UQ));
+    keep = _mm256_and_ps(keep, _mm256_cmp_ps(dr2, max_r, _CMP_NGE_UQ));
+    _mm256_store_ps(x, wx);
+    _mm256_store_ps(y, wy);
+    _mm256_store_ps(z, wz);
+    m = CompactLanes(LANES, _mm256_movemask_ps(keep), k, x, y, z, out_x, out_y, out_z, out_index, m);
+  }
+  return k;
+}
+#elif defined(__SSE2__)
+static const int LANES = 4;
+static int VectorPoints(const uint8_t *data, int point_step, int n, const PointGates &g,
+                        float *out_x, float *out_y, float *out_z, int *out_index, int &m){
+  __m128 t[12];
+  for (int q=0;q<12;q++) t[q] = _mm_set1_ps(g.T[q]);
+  __m128 rx = _mm_set1_ps(g.robot[0]), ry = _mm_set1_ps(g.robot[1]), rz = _mm_set1_ps(g.robot[2]);
+  __m128 max_z = _mm_set1_ps(g.max_z);
+  __m128 min_r = _mm_set1_ps(g.min_range_sqr), max_r = _mm_set1_ps(g.max_range_sqr);
+  __m128 zero = _mm_setzero_ps();
+  alignas(16) float px[LANES], py[LANES], pz[LANES], x[LANES], y[LANES], z[LANES];
+  int k = 0;
+  for (;k+LANES<=n;k+=LANES){
+    __m128 vx, vy, vz;
+    if (point_step==16 && k+LANES<n){
+      LoadPacked4(data + (long)k*16, vx, vy, vz);
+    }
+    else{
+      LoadLanes(data, point_step, k, LANES, px, py, pz);
+      vx = _mm_load_ps(px); vy = _mm_load_ps(py); vz = _mm_load_ps(pz);
+    }
+    __m128 wx = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(t[0], vx), _mm_mul_ps(t[1], vy)), _mm_mul_ps(t[2], vz)), t[9]);
+    __m128 wy = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(t[3], vx), _mm_mul_ps(t[4], vy)), _mm_mul_ps(t[5], vz)), t[10]);
+    __m128 wz = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(t[6], vx), _mm_mul_ps(t[7], vy)), _mm_mul_ps(t[8], vz)), t[11]);
+    __m128 dx = _mm_sub_ps(rx, wx), dy = _mm_sub_ps(ry, wy), dz = _mm_sub_ps(rz, wz);
+    __m128 dr2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz));
+    __m128 origin = _mm_and_ps(_mm_cmpeq_ps(vx, zero), _mm_cmpeq_ps(vy, zero));
+    __m128 keep = _mm_andnot_ps(origin, _mm_cmpeq_ps(vx, vx));
+    keep = _mm_and_ps(keep, _mm_cmpnge_ps(wz, max_z));
+    keep = _mm_and_ps(keep, _mm_cmpnle_ps(dr2, min_r));
+    keep = _mm_and_ps(keep, _mm_cmpnge_ps(dr2, max_r));
+    _mm_store_ps(x, wx);
+    _mm_store_ps(y, wy);
+    _mm_store_ps(z, wz);
+    m = CompactLanes(LANES, _mm_movemask_ps(keep), k, x, y, z, out_x, out_y, out_z, out_index, m);
+  }
+  return k;
+}
+#elif defined(__ARM_NEON)
+static const int LANES = 4;
+static int VectorPoints(const uint8_t *data, int point_step, int n, const PointGates &g,
+                        float *out_x, float *out_y, float *out_z, int *out_index, int &m){
+  float32x4_t t[12];
+  for (int q=0;q<12;q++) t[q] = vdupq_n_f32(g.T[q]);
+  float32x4_t rx = vdupq_n_f32(g.robot[0]), ry = vdupq_n_f32(g.robot[1]), rz = vdupq_n_f32(g.robot[2]);
+  float32x4_t max_z = vdupq_n_f32(g.max_z);
+  float32x4_t min_r = vdupq_n_f32(g.min_range_sqr), max_r = vdupq_n_f32(g.max_range_sqr);
+  float32x4_t zero = vdupq_n_f32(0.0f);
+  float px[LANES], py[LANES], pz[LANES], x[LANES], y[LANES], z[LANES];
+  uint32_t lane_keep[LANES];
+  int k = 0;
+  for (;k+LANES<=n;k+=LANES){
+    float32x4_t vx, vy, vz;
+    if (point_step==16 && k+LANES<n){
+      // deinterleave four whole points, reads the 4 bytes after the last z
+      float32x4x4_t p = vld4q_f32((const float*)(data + (long)k*16));
+      vx = p.val[0]; vy = p.val[1]; vz = p.val[2];
+    }
+    else{
+      LoadLanes(data, point_step, k, LANES, px, py, pz);
+      vx = vld1q_f32(px); vy = vld1q_f32(py); vz = vld1q_f32(pz);
+    }
+    float32x4_t wx = vaddq_f32(vaddq_f32(vaddq_f32(vmulq_f32(t[0], vx), vmulq_f32(t[1], vy)), vmulq_f32(t[2], vz)), t[9]);
+    float32x4_t wy = vaddq_f32(vaddq_f32(vaddq_f32(vmulq_f32(t[3], vx), vmulq_f32(t[4], vy)), vmulq_f32(t[5], vz)), t[10]);
+    float32x4_t wz = vaddq_f32(vaddq_f32(vaddq_f32(vmulq_f32(t[6], vx), vmulq_f32(t[7], vy)), vmulq_f32(t[8], vz)), t[11]);
+    float32x4_t dx = vsubq_f32(rx, wx), dy = vsubq_f32(ry, wy), dz = vsubq_f32(rz, wz);
+    float32x4_t dr2 = vaddq_f32(vaddq_f32(vmulq_f32(dx, dx), vmulq_f32(dy, dy)), vmulq_f32(dz, dz));
+    uint32x4_t origin = vandq_u32(vceqq_f32(vx, zero), vceqq_f32(vy, zero));
+    uint32x4_t keep = vbicq_u32(vceqq_f32(vx, vx), origin);
+    keep = vbicq_u32(keep, vcgeq_f32(wz, max_z));
+    keep = vbicq_u32(keep, vcleq_f32(dr2, min_r));
+    keep = vbicq_u32(keep, vcgeq_f32(dr2, max_r));
+    vst1q_f32(x, wx);
+    vst1q_f32(y, wy);
+    vst1q_f32(z, wz);
+    vst1q_u32(lane_keep, keep);
+    int mask = 0;
+    for (int l=0;l<LANES;l++) mask |= (int)(lane_keep[l] & 1u) << l;
+    m = CompactLanes(LANES, mask, k, x, y, z, out_x, out_y, out_z, out_index, m);
+  }
+  return k;
+}
+#endif
+
+int TransformFilterPoints(const uint8_t *data, int point_step, int n, const float T[12], const float robot[3],
+                          float max_z, float min_range_sqr, float max_range_sqr,
+                          float *out_x, float *out_y, float *out_z, int *out_index){
+  PointGates g;
+  memcpy(g.T, T, sizeof(g.T));
+  memcpy(g.robot, robot, sizeof(g.robot));
+  g.max_z = max_z;
+  g.min_range_sqr = min_range_sqr;
+  g.max_range_sqr = max_range_sqr;
+  int m = 0;
+  int k = 0;
+#if defined(__AVX2__) || defined(__SSE2__) || defined(__ARM_NEON)
+  k = VectorPoints(data, point_step, n, g, out_x, out_y, out_z, out_index, m);
+#endif
+  return ScalarPoints(data, point_step, k, n, g, out_x, out_y, out_z, out_index, m);
+}
+
+} // namespace perception
+} // namespace nature
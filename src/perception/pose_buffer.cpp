@@ -0,0 +1,109 @@
+#include "nature/perception/pose_buffer.h"
+#include <math.h>
+
+namespace nature{
+namespace perception{
+
+void PoseSample::GetRotation(float rot[9]) const{
+  float x = quat[0], y = quat[1], z = quat[2], w = quat[3];
+  rot[0] = 1.0f - 2.0f*(y*y + z*z);
+  rot[1] = 2.0f*(x*y - z*w);
+  rot[2] = 2.0f*(x*z + y*w);
+  rot[3] = 2.0f*(x*y + z*w);
+  rot[4] = 1.0f - 2.0f*(x*x + z*z);
+  rot[5] = 2.0f*(y*z - x*w);
+  rot[6] = 2.0f*(x*z - y*w);
+  rot[7] = 2.0f*(y*z + x*w);
+  rot[8] = 1.0f - 2.0f*(x*x + y*y);
+}
+
+PoseBuffer::PoseBuffer(int capacity){
+  capacity_ = capacity > 1 ? capacity : 2;
+  samples_.resize(capacity_);
+  head_ = 0;
+  size_ = 0;
+}
+
+void PoseBuffer::Add(double t, const nature::msg::Pose &pose){
+  if (size_>0 && t<At(size_-1).t) return;
+  PoseSample sample;
+  sample.t = t;
+  sample.pos[0] = pose.position.x;
+  sample.pos[1] = pose.position.y;
+  sample.pos[2] = pose.position.z;
+  float norm = sqrt(pose.orientation.x*pose.orientation.x + pose.orientation.y*pose.orientation.y +
+                    pose.orientation.z*pose.orientation.z + pose.orientation.w*pose.orientation.w);
+  if (norm>0.0f){
+    sample.quat[0] = pose.orientation.x/norm;
+    sample.quat[1] = pose.orientation.y/norm;
+    sample.quat[2] = pose.orientation.z/norm;
+    sample.quat[3] = pose.orientation.w/norm;
+  }
+  if (size_<capacity_){
+    samples_[(head_ + size_) % capacity_] = sample;
+    size_++;
+  }
+  else{
+    samples_[head_] = sample;
+    head_ = (head_ + 1) % capacity_;
+  }
+}
+
+double PoseBuffer::Interpolate(double t, PoseSample &sample) const{
+  if (size_==0) return -1.0;
+  if (t<=At(0).t){
+    sample = At(0);
+    return At(0).t - t;
+  }
+  if (t>=At(size_-1).t){
+    sample = At(size_-1);
+    return t - At(size_-1).t;
+  }
+
+  // first sample newer than t, 0 < hi < size_
+  int lo = 0;
+  int hi = size_-1;
+  while (hi-lo>1){
+    int mid = (lo+hi)/2;
+    if (At(mid).t>t) hi = mid;
+    else lo = mid;
+  }
+  const PoseSample &a = At(lo);
+  const PoseSample &b = At(hi);
+  float s = (float)((t - a.t)/(b.t - a.t));
+
+  sample.t = t;
+  for (int k=0;k<3;k++){
+    sample.pos[k] = a.pos[k] + s*(b.pos[k] - a.pos[k]);
+  }
+
+  // slerp, taking the short way around
+  float cos_theta = a.quat[0]*b.quat[0] + a.quat[1]*b.quat[1] + a.quat[2]*b.quat[2] + a.quat[3]*b.quat[3];
+  float sign = 1.0f;
+  if (cos_theta<0.0f){
+    cos_theta = -cos_theta;
+    sign = -1.0f;
+  }
+  float wa, wb;
+  if (cos_theta>0.9995f){
+    wa = 1.0f - s;
+    wb = s;
+  }
+  else{
+    float theta = acos(cos_theta);
+    float sin_theta = sin(theta);
+    wa = sin((1.0f - s)*theta)/sin_theta;
+    wb = sin(s*theta)/sin_theta;
+  }
+  float norm = 0.0f;
+  for (int k=0;k<4;k++){
+    sample.quat[k] = wa*a.quat[k] + sign*wb*b.quat[k];
+    norm += sample.quat[k]*sample.quat[k];
+  }
+  norm = sqrt(norm);
+  for (int k=0;k<4;k++) sample.quat[k] /= norm;
+  return 0.0;
+}
+
+} // namespace perception
+} // namespace nature
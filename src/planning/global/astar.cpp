@@ -1,5 +1,4 @@
 
-#include <queue>
 #include <limits>
 #include <cmath>
 #include <fstream>
@@ -7,11 +6,19 @@
 #include <algorithm>
 // project includes
 #include "nature/planning/global/astar.h"
-#include "nature/planning/global/astar_cell.h"
+#include "nature/common/morphology.h"
+#include "nature/node/stage_timer.h"
 
 namespace nature {
 namespace planning{
 
+static const int STAGE_ALLOCATE = nature::node::RegisterStage("global.allocate");
+static const int STAGE_DILATE = nature::node::RegisterStage("global.dilate");
+// the solve includes the extraction of the path
+static const int STAGE_SOLVE = nature::node::RegisterStage("global.solve");
+static const int STAGE_EXTRACT = nature::node::RegisterStage("global.extract");
+static const int STAGE_COST_TO_GO = nature::node::RegisterStage("global.cost_to_go");
+
 Astar::Astar(std::shared_ptr<nature::visualization::VisualizerBase> visualizer){
   dfac_ = 0;
   visualizer_ = visualizer;
@@ -24,37 +31,60 @@ Astar::~Astar(){
 std::vector<int> Astar::FoldIndex(int n){
   std::vector<int> c;
 	c.resize(2);
-  c[0] = n%width_;
-  c[1] = (int)floor( (1.0*n)/(1.0*width_) );
+  Coords(n, c[0], c[1]);
   return c;
 }
 
 void Astar::AllocateMap(int h, int w, int init_val){
-  height_ = h;
-  width_ = w;
-  weights_.clear();
-  weights_.resize(height_ * width_, init_val);
-  paths_.clear();
-  paths_.resize(height_ * width_, -1);
+  map_buffer_.assign(h * w, (int8_t)init_val);
+  SetMapView(h, w, map_buffer_.data(), nullptr);
+}
+
+void Astar::SetMapValue(int i, int j, int val_height, int val_seg){
+  weights_[FlattenIndex(i,j)]=val_height+val_seg;
+  dstar_changes_ = dstar_changes_.Union(nature::common::GridRoi(i, j, i+1, j+1));
+  // the next grid view is read whole, over this value
+  view_valid_ = false;
+  if (map_view_ == map_buffer_.data()){
+    map_buffer_[i*height_+j] = (int8_t)val_height;
+    if (cells_ == tiled_cells_.data()) tiled_cells_[FlattenIndex(i,j)] = (int8_t)val_height;
+  }
+}
+
+void Astar::SetMapView(int h, int w, const int8_t *height_data, const int8_t *seg_data){
+  nature::node::ScopedTimer timer(STAGE_ALLOCATE);
+  SetSize(h, w);
+  map_view_ = height_data;
+  seg_view_ = seg_data;
+  view_valid_ = false;
+  dstar_all_changed_ = true;
+  // same size as the last call in steady state, so this doesn't reallocate
+  weights_.resize(nodes_.Size(), 0);
+  bool tiled = layout_ == nature::common::GridLayout::TILED;
+  if (tiled) tiled_cells_.resize(nodes_.Size(), 0);
+  cells_ = tiled ? tiled_cells_.data() : map_view_;
+  // the grid is read in order, the tiled state is written a tile column at a time
+  int n = 0;
   for (int i = 0; i < width_; i++){
-    for (int j = 0; j < height_; j++){
-      if (i == 0 || j == 0 ||
-          i == (width_ - 1) ||
-          j == (height_ - 1)){
-        int n = FlattenIndex(i, j);
-        weights_[n] = 0;
-      }
+    for (int j = 0; j < height_; j++, n++){
+      size_t m = nodes_.Index(i, j);
+      weights_[m] = height_data[n] + (seg_data ? seg_data[n] : 0);
+      if (tiled) tiled_cells_[m] = height_data[n];
     }
   }
-
-	std::vector<float> column;
-	column.resize(height_, 0.0f);
-	map_.resize(width_, column);
 }
 
-void Astar::SetMapValue(int i, int j, int val_height, int val_seg){
-  weights_[FlattenIndex(i,j)]=val_height+val_seg;
-	map_[i][j] = (float)val_height;
+void Astar::RefreshMapView(const nature::common::GridRoi &roi){
+  bool tiled = cells_ == tiled_cells_.data();
+  for (int i = roi.imin; i < roi.imax; i++){
+    int n = i*height_ + roi.jmin;
+    for (int j = roi.jmin; j < roi.jmax; j++, n++){
+      size_t m = nodes_.Index(i, j);
+      weights_[m] = map_view_[n] + (seg_view_ ? seg_view_[n] : 0);
+      if (tiled) tiled_cells_[m] = map_view_[n];
+    }
+  }
+  dstar_changes_ = dstar_changes_.Union(roi);
 }
 
 bool Astar::LineOfSight(std::vector<int> p0, std::vector<int> p1){
@@ -92,16 +122,16 @@ bool Astar::LineOfSight(std::vector<int> p0, std::vector<int> p1){
     while (x0 != x1){
       f = f + dy;
       if (f >= dx ){
-        if (map_[x0+((sx-1)/2)][y0 + ((sy-1)/2)]>0 ){
+        if (MapValue(x0+((sx-1)/2), y0 + ((sy-1)/2))>0 ){
           return false;
         }
         y0 = y0 + sy;
         f = f - dx;
       }
-      if (f != 0 && map_[x0+((sx-1)/2)][y0 + ((sy-1.0f)/2.0f)]>0) {
+      if (f != 0 && MapValue(x0+((sx-1)/2), y0 + ((sy-1)/2))>0) {
         return false;
       }
-      if (dy== 0 && map_[x0 + ((sx-1)/2)][y0]>0 && map_[x0 + ((sx-1)/2)][ y0-1]>0){
+      if (dy== 0 && MapValue(x0 + ((sx-1)/2), y0)>0 && MapValue(x0 + ((sx-1)/2), y0-1)>0){
         return false;
       }
       x0 = x0 + sx;
@@ -111,16 +141,16 @@ bool Astar::LineOfSight(std::vector<int> p0, std::vector<int> p1){
     while (y0 != y1){
       f = f + dx;
       if (f >= dy){
-          if ( map_[x0 + ((sx - 1)/2)][ y0 + ((sy-1)/2)]>0 ){
+          if ( MapValue(x0 + ((sx - 1)/2), y0 + ((sy-1)/2))>0 ){
               return false;
           }
           x0 = x0 + sx;
           f = f - dy;
       }
-      if (f!=0 && map_[x0+((sx-1)/2)][ y0 + ((sy-1)/2)]>0 ){
+      if (f!=0 && MapValue(x0+((sx-1)/2), y0 + ((sy-1)/2))>0 ){
         return false;
       }
-      if (dx==0 && map_[x0][y0+((sy-1)/2)]>0 && map_[x0-1 ][ y0 + ((sy-1)/2)]>0 ){
+      if (dx==0 && MapValue(x0, y0+((sy-1)/2))>0 && MapValue(x0-1, y0 + ((sy-1)/2))>0 ){
         return false;
       }
       y0 = y0 + sy;
@@ -166,68 +196,502 @@ float Astar::Heuristic(int i0, int j0, int i1, int j1) {
 }
 
 bool Astar::Solve() {
-  std::fill(paths_.begin(), paths_.end(),-1);
-  
-  const float INF = std::numeric_limits<float>::infinity();
-
-  AStarCell start_node(start_, 0.);
-  AStarCell goal_node(goal_, 0.);
-
-  float* costs = new float[height_ * width_];
-  for (int i = 0; i < height_ * width_; ++i)
-    costs[i] = INF;
-  costs[start_] = 0.;
+  int ncells = (int)nodes_.Size();
+  if ((int)costs_.size() != ncells){
+    costs_.resize(ncells);
+    paths_.resize(ncells);
+    visited_.assign(ncells, 0);
+    open_.Resize(ncells);
+    search_ = 0;
+  }
+  // costs_ and paths_ of a cell are only valid if it was visited by this search
+  search_++;
+  if (search_ == 0){
+    std::fill(visited_.begin(), visited_.end(), 0);
+    search_ = 1;
+  }
+  open_.Clear();
+  if (connectivity_ == ANY_ANGLE) return SolveAnyAngle();
 
-  std::priority_queue<AStarCell> nodes_to_visit;
-  nodes_to_visit.push(start_node);
+  visited_[start_] = search_;
+  costs_[start_] = 0.0f;
+  paths_[start_] = -1;
+  open_.Push(start_, 0.0f);
 
-  int* nbrs = new int[4];
+  // jump point search needs uniform costs, so it falls back to 8-connected with
+  // segmentation or when the goal is on an obstacle
+  bool jps = connectivity_ == JUMP_POINT && seg_view_ == nullptr && Free(goal_i_, goal_j_);
+  bool eight = connectivity_ != FOUR_CONNECTED;
 
+  int nbrs[4];
   bool solution_found = false;
-  while (!nodes_to_visit.empty()) {
-    // .top() doesn't actually remove the node
-    AStarCell cur = nodes_to_visit.top();
-
-    if (cur == goal_node) {
+  while (!open_.Empty() && !Cancelled()) {
+    int cur = open_.Top();
+    if (cur == goal_) {
       solution_found = true;
       break;
     }
+    open_.Pop();
 
-    nodes_to_visit.pop();
+    if (jps){
+      ExpandJumpPoints(cur);
+      continue;
+    }
+    if (eight){
+      ExpandEight(cur);
+      continue;
+    }
 
     // check bounds and find up to four neighbors
-    nbrs[0] = (cur.idx / width_ > 0) ? (cur.idx - width_) : -1;
-    nbrs[1] = (cur.idx % width_ > 0) ? (cur.idx - 1) : -1;
-    nbrs[2] = (cur.idx / width_ + 1 < height_) ? (cur.idx + width_) : -1;
-    nbrs[3] = (cur.idx % width_ + 1 < width_) ? (cur.idx + 1) : -1;
+    Neighbors(cur, nbrs);
     for (int i = 0; i < 4; ++i) {
-      if (nbrs[i] >= 0) {
-        // the sum of the cost so far and the cost of this move
-        float new_cost = costs[cur.idx] + weights_[nbrs[i]];
-        if (new_cost < costs[nbrs[i]]) {
-          costs[nbrs[i]] = new_cost;
-          float priority = new_cost + Heuristic(nbrs[i] / width_,
-                                                nbrs[i] % width_,
-                                                goal_ / width_,
-                                                goal_ % width_);
-          // paths with lower expected cost are explored first
-          nodes_to_visit.push(AStarCell(nbrs[i], priority));
-          paths_[nbrs[i]] = cur.idx;
-        }
+      int nb = nbrs[i];
+      if (nb < 0) continue;
+      // the sum of the cost so far and the cost of this move
+      float new_cost = costs_[cur] + weights_[nb];
+      if (visited_[nb] != search_ || new_cost < costs_[nb]) {
+        visited_[nb] = search_;
+        costs_[nb] = new_cost;
+        paths_[nb] = cur;
+        // paths with lower expected cost are explored first, a cell
+        // already queued moves to its new priority instead of being queued twice
+        int x, y;
+        Coords(nb, x, y);
+        open_.Push(nb, new_cost + Heuristic(x, y, goal_i_, goal_j_));
       }
     }
   }
 
-  delete[] costs;
-  delete[] nbrs;
-
   if (solution_found){
+    if (jps) FillJumpPath();
     solution_found = ExtractPath();
   }
   return solution_found;
 }
 
+float Astar::Octile(int x0, int y0, int x1, int y1){
+  int dx = std::abs(x1 - x0);
+  int dy = std::abs(y1 - y0);
+  return (float)std::max(dx, dy) + (SQRT2 - 1.0f)*(float)std::min(dx, dy);
+}
+
+void Astar::Relax(int cur, int nb, float move_cost){
+  float new_cost = costs_[cur] + move_cost;
+  if (visited_[nb] != search_ || new_cost < costs_[nb]) {
+    visited_[nb] = search_;
+    costs_[nb] = new_cost;
+    paths_[nb] = cur;
+    int x, y;
+    Coords(nb, x, y);
+    open_.Push(nb, new_cost + Octile(x, y, goal_i_, goal_j_));
+  }
+}
+
+void Astar::ExpandEight(int cur){
+  int x, y;
+  Coords(cur, x, y);
+  for (int dy = -1; dy <= 1; ++dy){
+    for (int dx = -1; dx <= 1; ++dx){
+      if (dx == 0 && dy == 0) continue;
+      int nx = x + dx;
+      int ny = y + dy;
+      if (nx < 0 || nx >= width_ || ny < 0 || ny >= height_) continue;
+      // no cutting the corner of an obstacle
+      if (dx != 0 && dy != 0 && (MapValue(nx, y) > 0 || MapValue(x, ny) > 0)) continue;
+      // moves cost their length plus the cell value, so the octile heuristic is admissible
+      int nb = FlattenIndex(nx, ny);
+      Relax(cur, nb, (dx != 0 && dy != 0 ? SQRT2 : 1.0f) + weights_[nb]);
+    }
+  }
+}
+
+int Astar::Jump(int x, int y, int dx, int dy){
+  // straight and diagonal jumps without corner cutting, see Harabor and Grastien 2011
+  while (true){
+    x += dx;
+    y += dy;
+    if (!Free(x, y)) return -1;
+    if (x == goal_i_ && y == goal_j_) return FlattenIndex(x, y);
+    if (dx != 0 && dy != 0){
+      if (Jump(x, y, dx, 0) >= 0 || Jump(x, y, 0, dy) >= 0) return FlattenIndex(x, y);
+      if (!Free(x + dx, y) || !Free(x, y + dy)) return -1;
+    }
+    else if (dx != 0){
+      if ((Free(x, y - 1) && !Free(x - dx, y - 1)) || (Free(x, y + 1) && !Free(x - dx, y + 1))) return FlattenIndex(x, y);
+    }
+    else{
+      if ((Free(x - 1, y) && !Free(x - 1, y - dy)) || (Free(x + 1, y) && !Free(x + 1, y - dy))) return FlattenIndex(x, y);
+    }
+  }
+}
+
+void Astar::ExpandJumpPoints(int cur){
+  int x, y;
+  Coords(cur, x, y);
+  // directions worth jumping in, pruned by the direction we arrived from
+  int dirs[8][2];
+  int ndirs = 0;
+  int parent = paths_[cur];
+  if (parent < 0){
+    for (int dy = -1; dy <= 1; ++dy){
+      for (int dx = -1; dx <= 1; ++dx){
+        if (dx == 0 && dy == 0) continue;
+        if (dx != 0 && dy != 0 && (!Free(x + dx, y) || !Free(x, y + dy))) continue;
+        dirs[ndirs][0] = dx;
+        dirs[ndirs][1] = dy;
+        ndirs++;
+      }
+    }
+  }
+  else{
+    int px, py;
+    Coords(parent, px, py);
+    int dx = (x > px) - (x < px);
+    int dy = (y > py) - (y < py);
+    if (dx != 0 && dy != 0){
+      bool vertical = Free(x, y + dy);
+      bool horizontal = Free(x + dx, y);
+      if (vertical){ dirs[ndirs][0] = 0; dirs[ndirs][1] = dy; ndirs++; }
+      if (horizontal){ dirs[ndirs][0] = dx; dirs[ndirs][1] = 0; ndirs++; }
+      if (vertical && horizontal){ dirs[ndirs][0] = dx; dirs[ndirs][1] = dy; ndirs++; }
+    }
+    else{
+      // perpendicular moves are kept, they are where the forced neighbors appear
+      int ox = dy != 0 ? 1 : 0;
+      int oy = dx != 0 ? 1 : 0;
+      bool next = Free(x + dx, y + dy);
+      bool side_a = Free(x + ox, y + oy);
+      bool side_b = Free(x - ox, y - oy);
+      if (next){
+        dirs[ndirs][0] = dx; dirs[ndirs][1] = dy; ndirs++;
+        if (side_a){ dirs[ndirs][0] = dx + ox; dirs[ndirs][1] = dy + oy; ndirs++; }
+        if (side_b){ dirs[ndirs][0] = dx - ox; dirs[ndirs][1] = dy - oy; ndirs++; }
+      }
+      if (side_a){ dirs[ndirs][0] = ox; dirs[ndirs][1] = oy; ndirs++; }
+      if (side_b){ dirs[ndirs][0] = -ox; dirs[ndirs][1] = -oy; ndirs++; }
+    }
+  }
+  for (int k = 0; k < ndirs; ++k){
+    int jp = Jump(x, y, dirs[k][0], dirs[k][1]);
+    if (jp < 0) continue;
+    int jx, jy;
+    Coords(jp, jx, jy);
+    Relax(cur, jp, Octile(x, y, jx, jy));
+  }
+}
+
+bool Astar::ClearLine(int a, int b) const {
+  // supercover walk between the cell centers, both cells are checked where the line crosses a corner
+  int x, y, x1, y1;
+  Coords(a, x, y);
+  Coords(b, x1, y1);
+  int dx = std::abs(x1 - x);
+  int dy = std::abs(y1 - y);
+  int sx = x1 > x ? 1 : -1;
+  int sy = y1 > y ? 1 : -1;
+  int err = dx - dy;
+  dx *= 2;
+  dy *= 2;
+  while (true){
+    if (weights_[FlattenIndex(x, y)] != 0) return false;
+    if (x == x1 && y == y1) return true;
+    if (err > 0){
+      x += sx;
+      err -= dy;
+    }
+    else if (err < 0){
+      y += sy;
+      err += dx;
+    }
+    else{
+      if (weights_[FlattenIndex(x + sx, y)] != 0 || weights_[FlattenIndex(x, y + sy)] != 0) return false;
+      x += sx;
+      y += sy;
+      err += dx - dy;
+    }
+  }
+}
+
+void Astar::SetVertex(int s){
+  int p = paths_[s];
+  if (p < 0) return;
+  int x, y, px, py;
+  Coords(s, x, y);
+  Coords(p, px, py);
+  // neighbors are linked by ExpandEight rules, farther parents were assumed visible
+  if (std::abs(px - x) <= 1 && std::abs(py - y) <= 1) return;
+  if (ClearLine(p, s)) return;
+  float best = std::numeric_limits<float>::infinity();
+  int best_parent = -1;
+  for (int dy = -1; dy <= 1; ++dy){
+    for (int dx = -1; dx <= 1; ++dx){
+      if (dx == 0 && dy == 0) continue;
+      int nx = x + dx;
+      int ny = y + dy;
+      if (nx < 0 || nx >= width_ || ny < 0 || ny >= height_) continue;
+      if (dx != 0 && dy != 0 && (MapValue(nx, y) > 0 || MapValue(x, ny) > 0)) continue;
+      int nb = FlattenIndex(nx, ny);
+      if (closed_[nb] != search_) continue;
+      float cost = costs_[nb] + (dx != 0 && dy != 0 ? SQRT2 : 1.0f) + weights_[s];
+      if (cost < best){
+        best = cost;
+        best_parent = nb;
+      }
+    }
+  }
+  // the neighbor s was generated from is closed, so there is always one
+  paths_[s] = best_parent;
+  costs_[s] = best;
+}
+
+bool Astar::SolveAnyAngle(){
+  if (closed_.size() != costs_.size() || search_ == 1) closed_.assign(costs_.size(), 0);
+  visited_[start_] = search_;
+  costs_[start_] = 0.0f;
+  paths_[start_] = -1;
+  open_.Push(start_, Distance(start_, goal_));
+
+  bool solution_found = false;
+  while (!open_.Empty() && !Cancelled()){
+    int cur = open_.Pop();
+    SetVertex(cur);
+    if (cur == goal_){
+      solution_found = true;
+      break;
+    }
+    closed_[cur] = search_;
+    int x, y;
+    Coords(cur, x, y);
+    int parent = paths_[cur];
+    for (int dy = -1; dy <= 1; ++dy){
+      for (int dx = -1; dx <= 1; ++dx){
+        if (dx == 0 && dy == 0) continue;
+        int nx = x + dx;
+        int ny = y + dy;
+        if (nx < 0 || nx >= width_ || ny < 0 || ny >= height_) continue;
+        if (dx != 0 && dy != 0 && (MapValue(nx, y) > 0 || MapValue(x, ny) > 0)) continue;
+        int nb = FlattenIndex(nx, ny);
+        if (closed_[nb] == search_) continue;
+        // lazily assume the grandparent sees nb, SetVertex checks it when nb is expanded.
+        // Cells with a value are only entered by grid moves, which pay the value
+        float new_cost;
+        int new_parent;
+        if (parent >= 0 && weights_[nb] == 0){
+          new_cost = costs_[parent] + Distance(parent, nb);
+          new_parent = parent;
+        }
+        else{
+          new_cost = costs_[cur] + (dx != 0 && dy != 0 ? SQRT2 : 1.0f) + weights_[nb];
+          new_parent = cur;
+        }
+        if (visited_[nb] != search_ || new_cost < costs_[nb]){
+          visited_[nb] = search_;
+          costs_[nb] = new_cost;
+          paths_[nb] = new_parent;
+          open_.Push(nb, new_cost + Distance(nb, goal_));
+        }
+      }
+    }
+  }
+  return solution_found && ExtractAnyAnglePath();
+}
+
+bool Astar::ExtractAnyAnglePath(){
+  nature::node::ScopedTimer timer(STAGE_EXTRACT);
+  // the vertices are the corners of the path, the points between them are filled in one pass
+  path_.clear();
+  for (int n = goal_; n >= 0; n = paths_[n]){
+    path_.push_back(FoldIndex(n));
+  }
+  std::reverse(path_.begin(), path_.end());
+  path_world_.clear();
+  for (size_t k = 0; k + 1 < path_.size(); k++){
+    std::vector<float> p0 = IndexToPoint(path_[k]);
+    std::vector<float> p1 = IndexToPoint(path_[k+1]);
+    float dx = p1[0] - p0[0];
+    float dy = p1[1] - p0[1];
+    int steps = std::max(1, (int)(std::sqrt(dx*dx + dy*dy)/map_res_));
+    for (int m = 0; m < steps; m++){
+      float t = (float)m/steps;
+      path_world_.push_back({p0[0] + t*dx, p0[1] + t*dy});
+    }
+  }
+  if (path_.empty()) return false;
+  path_world_.push_back(IndexToPoint(path_.back()));
+  return true;
+}
+
+void Astar::FillJumpPath(){
+  // paths_ links jump points, fill in the cells between them for ExtractPath
+  jump_chain_.clear();
+  for (int n = goal_; n >= 0; n = paths_[n]){
+    jump_chain_.push_back(n);
+    if (n == start_) break;
+  }
+  for (size_t k = 0; k + 1 < jump_chain_.size(); ++k){
+    int to = jump_chain_[k];
+    int from = jump_chain_[k+1];
+    int x, y, tx, ty;
+    Coords(from, x, y);
+    Coords(to, tx, ty);
+    int prev = from;
+    while (x != tx || y != ty){
+      x += (tx > x) - (tx < x);
+      y += (ty > y) - (ty < y);
+      int n = FlattenIndex(x, y);
+      paths_[n] = prev;
+      prev = n;
+    }
+  }
+}
+
+void Astar::Neighbors(int n, int nbrs[4]){
+  int x, y;
+  Coords(n, x, y);
+  nbrs[0] = (y > 0) ? FlattenIndex(x, y - 1) : -1;
+  nbrs[1] = (x > 0) ? FlattenIndex(x - 1, y) : -1;
+  nbrs[2] = (y + 1 < height_) ? FlattenIndex(x, y + 1) : -1;
+  nbrs[3] = (x + 1 < width_) ? FlattenIndex(x + 1, y) : -1;
+}
+
+Astar::DStarKey Astar::CalculateKey(int n){
+  // the search runs from the goal, so the heuristic is the distance to the start
+  float m = std::min(dstar_g_[n], dstar_rhs_[n]);
+  DStarKey key;
+  int x, y;
+  Coords(n, x, y);
+  key.k1 = m + Heuristic(x, y, start_i_, start_j_) + dstar_km_;
+  key.k2 = m;
+  return key;
+}
+
+void Astar::UpdateVertex(int n){
+  if (n != goal_){
+    int nbrs[4];
+    Neighbors(n, nbrs);
+    float rhs = std::numeric_limits<float>::infinity();
+    for (int i = 0; i < 4; ++i){
+      if (nbrs[i] >= 0) rhs = std::min(rhs, MoveCost(nbrs[i]) + dstar_g_[nbrs[i]]);
+    }
+    dstar_rhs_[n] = rhs;
+  }
+  if (dstar_g_[n] != dstar_rhs_[n]) dstar_open_.Push(n, CalculateKey(n));
+  else dstar_open_.Remove(n);
+}
+
+void Astar::ComputeShortestPath(){
+  int nbrs[4];
+  while (!dstar_open_.Empty() &&
+         (dstar_open_.TopKey() < CalculateKey(start_) || dstar_rhs_[start_] != dstar_g_[start_])){
+    // the queue stays consistent, so the next call picks up where this one stopped
+    if (Cancelled()) return;
+    int u = dstar_open_.Top();
+    DStarKey k_old = dstar_open_.TopKey();
+    DStarKey k_new = CalculateKey(u);
+    if (k_old < k_new){
+      // queued before the start moved
+      dstar_open_.Push(u, k_new);
+    }
+    else if (dstar_g_[u] > dstar_rhs_[u]){
+      dstar_g_[u] = dstar_rhs_[u];
+      dstar_open_.Remove(u);
+      Neighbors(u, nbrs);
+      for (int i = 0; i < 4; ++i){
+        if (nbrs[i] >= 0) UpdateVertex(nbrs[i]);
+      }
+    }
+    else{
+      dstar_g_[u] = std::numeric_limits<float>::infinity();
+      UpdateVertex(u);
+      Neighbors(u, nbrs);
+      for (int i = 0; i < 4; ++i){
+        if (nbrs[i] >= 0) UpdateVertex(nbrs[i]);
+      }
+    }
+  }
+}
+
+void Astar::InitializeIncremental(){
+  int ncells = (int)nodes_.Size();
+  const float INF = std::numeric_limits<float>::infinity();
+  dstar_g_.assign(ncells, INF);
+  dstar_rhs_.assign(ncells, INF);
+  if (dstar_open_.NumIndices() != ncells) dstar_open_.Resize(ncells);
+  dstar_open_.Clear();
+  dstar_km_ = 0.0f;
+  dstar_rhs_[goal_] = 0.0f;
+  dstar_open_.Push(goal_, CalculateKey(goal_));
+  dstar_last_start_ = start_;
+  dstar_goal_ = goal_;
+  dstar_llx_ = llx_;
+  dstar_lly_ = lly_;
+  prev_weights_ = weights_;
+  dstar_changes_ = nature::common::GridRoi();
+  dstar_all_changed_ = false;
+  dstar_valid_ = true;
+}
+
+bool Astar::SolveIncremental(){
+  int ncells = (int)nodes_.Size();
+  if (!dstar_valid_ || (int)dstar_g_.size() != ncells || (int)prev_weights_.size() != ncells ||
+      goal_ != dstar_goal_ || llx_ != dstar_llx_ || lly_ != dstar_lly_){
+    InitializeIncremental();
+  }
+  else{
+    if (start_ != dstar_last_start_){
+      int x, y;
+      Coords(dstar_last_start_, x, y);
+      dstar_km_ += Heuristic(x, y, start_i_, start_j_);
+      dstar_last_start_ = start_;
+    }
+    // a changed cell changes the cost of the moves into it, from each of its neighbors.
+    // Only the cells read from the map since the last search can have changed
+    nature::common::GridRoi roi = dstar_all_changed_ ? nature::common::GridRoi(0, 0, width_, height_) :
+                                                       dstar_changes_.Clamp(width_, height_);
+    int nbrs[4];
+    for (int x = roi.imin; x < roi.imax; ++x){
+      for (int y = roi.jmin; y < roi.jmax; ++y){
+        int n = FlattenIndex(x, y);
+        if (weights_[n] == prev_weights_[n]) continue;
+        prev_weights_[n] = weights_[n];
+        Neighbors(n, nbrs);
+        for (int i = 0; i < 4; ++i){
+          if (nbrs[i] >= 0) UpdateVertex(nbrs[i]);
+        }
+      }
+    }
+    dstar_changes_ = nature::common::GridRoi();
+    dstar_all_changed_ = false;
+  }
+  ComputeShortestPath();
+  if (cancelled_ || dstar_g_[start_] == std::numeric_limits<float>::infinity()) return false;
+
+  // walk down the cost to go, paths_ holds the parent of each cell for ExtractPath
+  if ((int)paths_.size() != ncells) paths_.resize(ncells);
+  int cur = start_;
+  int nbrs[4];
+  for (int steps = 0; cur != goal_; ++steps){
+    if (steps >= ncells) return false;
+    Neighbors(cur, nbrs);
+    int next = -1;
+    float best = std::numeric_limits<float>::infinity();
+    for (int i = 0; i < 4; ++i){
+      if (nbrs[i] < 0) continue;
+      float c = MoveCost(nbrs[i]) + dstar_g_[nbrs[i]];
+      if (c < best){
+        best = c;
+        next = nbrs[i];
+      }
+    }
+    if (next < 0) return false;
+    paths_[next] = cur;
+    cur = next;
+  }
+  return ExtractPath();
+}
+
 bool Astar::ExtractPath(){
+  nature::node::ScopedTimer timer(STAGE_EXTRACT);
   path_.clear();
 	path_world_.clear();
   int path_idx = goal_;
@@ -285,27 +749,23 @@ void Astar::SaveMap(std::string imname){
 }
 
 void Astar::Display(){
-  if (map_.size()==0) return;
-  if (map_[0].size()==0)return;
-  int nx = map_.size();
-  int ny = map_[0].size();
+  if (map_view_==nullptr || width_<=0 || height_<=0) return;
+  int nx = width_;
+  int ny = height_;
 	if(!visualizer_->initialize_display(nx, ny)){
 	  return;
 	}
   nature::utils::vec3 red(255.0f, 0.0f, 0.0f);
   nature::utils::vec3 green(0.0f, 255.0f, 0.0f);
   nature::utils::vec3 yellow(255.0f, 255.0f, 0.0f);
-  for (int i=0;i<nx;i++){
-    for (int j=0;j<ny;j++){
-      if (map_[i][j]>0) visualizer_->draw_point(i,j,red);
-    }
-  }
+  visualizer_->draw_grid(map_view_, nx, ny, red);
 
+  std::vector<nature::utils::ivec2> path_pixels(path_world_.size());
 	for (int i=0;i<path_world_.size();i++){
-		int ix = (int)floor((path_world_[i][0] - llx_) / map_res_);
-		int iy = (int)floor((path_world_[i][1] - lly_) / map_res_);
-    visualizer_->draw_point(ix,iy,yellow);
+		path_pixels[i].x = (int)floor((path_world_[i][0] - llx_) / map_res_);
+		path_pixels[i].y = (int)floor((path_world_[i][1] - lly_) / map_res_);
 	}
+  visualizer_->draw_points(path_pixels, yellow);
 
   std::vector<float> goal = GetCurrentGoal(); 
 
@@ -316,10 +776,68 @@ void Astar::Display(){
   visualizer_->display();
 }
 
+void Astar::SetGridView(nature::msg::OccupancyGrid *grid, nature::msg::OccupancyGrid *grid_segmentation){
+  bool has_segmentation = grid_segmentation->info.height>0 && grid_segmentation->info.width>0 &&
+                          grid_segmentation->data.size()==grid->data.size();
+  SetCornerCoords(grid->info.origin.position.x, grid->info.origin.position.y);
+  SetMapRes(grid->info.resolution);
+  SetSize(grid->info.height, grid->info.width);
+  // a grid in the same place as the last one only has the changed cells read again
+  bool in_place = view_valid_ && changes_given_ && !all_changed_ && width_ == view_width_ && height_ == view_height_ &&
+                  llx_ == view_llx_ && lly_ == view_lly_ && map_res_ == view_res_ && has_segmentation == view_seg_;
+  nature::common::GridRoi changed = in_place ? changed_.Clamp(width_, height_) : nature::common::GridRoi(0, 0, width_, height_);
+  changed_ = nature::common::GridRoi();
+  changes_given_ = false;
+  all_changed_ = false;
+  // dilate, any occupied cell inside the box marks the cell as an obstacle
+  // the grid is read in place, only the dilated copy is stored, in a buffer reused across calls
+  const int8_t *height_data = grid->data.data();
+  if (dfac_>0){
+    nature::node::ScopedTimer timer(STAGE_DILATE);
+    nature::common::GridRoi roi(dfac_, dfac_, width_-dfac_, height_-dfac_);
+    if (!in_place){
+      map_buffer_.assign(grid->data.begin(), grid->data.end());
+    }
+    else if (!changed.Empty()){
+      // the border keeps the grid values, a changed cell moves the dilated cells within dfac_ of it
+      for (int i=changed.imin;i<changed.imax;i++){
+        std::copy(grid->data.begin() + i*height_ + changed.jmin, grid->data.begin() + i*height_ + changed.jmax,
+                  map_buffer_.begin() + i*height_ + changed.jmin);
+      }
+      changed = nature::common::GridRoi(changed.imin-dfac_, changed.jmin-dfac_, changed.imax+dfac_, changed.jmax+dfac_).Clamp(width_, height_);
+      roi = nature::common::GridRoi(std::max(roi.imin, changed.imin), std::max(roi.jmin, changed.jmin),
+                                    std::min(roi.imax, changed.imax), std::min(roi.jmax, changed.jmax));
+    }
+    else roi = nature::common::GridRoi();
+    nature::common::DilateBox(in_place ? grid->data.data() : map_buffer_.data(), map_buffer_.data(), width_, height_, dfac_, dfac_, roi);
+    for (int i=roi.imin;i<roi.imax;i++){
+      for (int j=roi.jmin;j<roi.jmax;j++){
+        int8_t &val = map_buffer_[i*height_+j];
+        val = val>0 ? 100 : 0;
+      }
+    }
+    height_data = map_buffer_.data();
+  }
+  const int8_t *seg_data = has_segmentation ? grid_segmentation->data.data() : nullptr;
+  if (in_place){
+    map_view_ = height_data;
+    seg_view_ = seg_data;
+    cells_ = layout_ == nature::common::GridLayout::TILED ? tiled_cells_.data() : map_view_;
+    RefreshMapView(changed);
+  }
+  else SetMapView(height_, width_, height_data, seg_data);
+  view_valid_ = true;
+  view_width_ = width_;
+  view_height_ = height_;
+  view_llx_ = llx_;
+  view_lly_ = lly_;
+  view_res_ = map_res_;
+  view_seg_ = has_segmentation;
+}
+
 std::vector<std::vector<float> > Astar::PlanPath(nature::msg::OccupancyGrid *grid, nature::msg::OccupancyGrid *grid_segmentation, std::vector<float> goal, std::vector<float> position) {
 	if (grid->info.height<=0 || grid->info.width<=0) return path_world_;
 
-    bool has_segmentation = grid_segmentation->info.height>0 && grid_segmentation->info.width>0;
   SetCornerCoords(grid->info.origin.position.x, grid->info.origin.position.y);
 	SetMapRes(grid->info.resolution);
 
@@ -335,43 +853,18 @@ std::vector<std::vector<float> > Astar::PlanPath(nature::msg::OccupancyGrid *gri
   if (gi[1]<0)gi[1]=0;
   if (gi[1]>=grid->info.height) gi[1] = grid->info.height-1;
 
-	AllocateMap(grid->info.height, grid->info.width, 0);
+	SetSize(grid->info.height, grid->info.width);
 	SetGoal(gi[0], gi[1]);
 	SetStart(si[0], si[1]);
 	std::vector<float> gr;
 	gr = GetCurrentGoal();
-  int n =0;
-	for (int i=0;i<width_;i++){
-		for (int j = 0; j < height_; j++) {
-			SetMapValue(i, j, grid->data[n], has_segmentation ? grid_segmentation->data[n] : 0);
-      n++;
-		}
-	}
-
-  // dilate
-  if (dfac_>0){
-    std::vector<std::vector<float> > dmap = map_;
-    for (int i=dfac_;i<width_-dfac_;i++){
-      for (int j = dfac_; j < height_-dfac_; j++) {
-        int val = 0;
-        for (int ii=i-dfac_;ii<=i+dfac_;ii++){
-          for (int jj=j-dfac_;jj<=j+dfac_;jj++){
-            if (map_[ii][jj]>0) val = 100;
-          }
-        }
-        dmap[i][j] = val;
-      }
-    }
-    for (int i=1;i<width_-1;i++){
-      for (int j = 1; j < height_-1; j++) {
-        SetMapValue(i,j,dmap[i][j], has_segmentation ? grid_segmentation->data[FlattenIndex(i,j)] : 0);
-      }
-    }
-  }
-  
+  SetGridView(grid, grid_segmentation);
 
-	bool solved = Solve();
-	if (!solved) {
+  cancelled_ = false;
+  nature::node::ScopedTimer timer(STAGE_SOLVE);
+	bool solved = incremental_ ? SolveIncremental() : Solve();
+  timer.Stop();
+	if (!solved && !cancelled_) {
 		std::cerr << "WARNING: A* failed to solve map " << std::endl;
 	}
 
@@ -379,5 +872,45 @@ std::vector<std::vector<float> > Astar::PlanPath(nature::msg::OccupancyGrid *gri
 
   return path_world_;
 }
+
+bool Astar::ComputeCostToGo(nature::msg::OccupancyGrid *grid, nature::msg::OccupancyGrid *grid_segmentation, std::vector<float> goal){
+  if (grid->info.height<=0 || grid->info.width<=0) return false;
+  SetGridView(grid, grid_segmentation);
+  std::vector<int> gi = PointToIndex(goal[0], goal[1]);
+  gi[0] = std::max(0, std::min(width_-1, gi[0]));
+  gi[1] = std::max(0, std::min(height_-1, gi[1]));
+
+  nature::node::ScopedTimer timer(STAGE_COST_TO_GO);
+  int ncells = (int)nodes_.Size();
+  cost_to_go_.assign((size_t)height_*width_, std::numeric_limits<float>::infinity());
+  if (open_.NumIndices() != ncells) open_.Resize(ncells);
+  open_.Clear();
+  // searched on the index of the search state, stored column-major like the grid
+  int g = FlattenIndex(gi[0], gi[1]);
+  cost_to_go_[gi[0]*height_ + gi[1]] = 0.0f;
+  open_.Push(g, 0.0f);
+  cancelled_ = false;
+  while (!open_.Empty()){
+    if (Cancelled()) return false;
+    float cv = open_.TopKey();
+    int v = open_.Pop();
+    // moving from u into v costs the value of v
+    float step = map_res_*MoveCost(v);
+    int nbrs[4];
+    Neighbors(v, nbrs);
+    for (int k=0;k<4;k++){
+      int u = nbrs[k];
+      if (u < 0) continue;
+      int ux, uy;
+      Coords(u, ux, uy);
+      float &cu = cost_to_go_[ux*height_ + uy];
+      if (cv + step < cu){
+        cu = cv + step;
+        open_.Push(u, cu);
+      }
+    }
+  }
+  return true;
+}
 } // namespace planning
 } // namespace nature
\ No newline at end of file
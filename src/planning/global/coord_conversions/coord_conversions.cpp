@@ -4,6 +4,7 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <iostream>
+#include <algorithm>
 
 //#include <mavs_core/math/constants.h>
 
@@ -15,10 +16,6 @@ static const double kRadToDeg = 180.0 / 3.1415926535897932384626433832795;
 static const double kDegToRad = 3.1415926535897932384626433832795 / 180.0;
 
 CoordinateConverter::CoordinateConverter(){
-  rot_transpose_.Resize(3,3);
-  rot_transpose_inverse_.Resize(3,3);
-  reference_position_.Resize(3,1);
-  
   //use WGS84 by default
   SetReferenceEllipsoid(23);
 
@@ -36,6 +33,21 @@ void CoordinateConverter::SetReferenceEllipsoid(int ref){
   e2_ = ellipsoid_.GetEccentrictySquared(ref_ellips_);
   e_ = sqrt(e2_);
   one_minus_e2 = 1.0-e2_;
+
+  // the series coefficients of the UTM and ECEF conversions only depend on the ellipsoid
+  double e4 = e2_*e2_;
+  double e6 = e4*e2_;
+  ecc_prime_squared_ = e2_/one_minus_e2;
+  meridian_[0] = 1 - e2_/4 - 3*e4/64 - 5*e6/256;
+  meridian_[1] = 3*e2_/8 + 3*e4/32 + 45*e6/1024;
+  meridian_[2] = 15*e4/256 + 45*e6/1024;
+  meridian_[3] = 35*e6/3072;
+  double e1 = (1-sqrt(one_minus_e2))/(1+sqrt(one_minus_e2));
+  footpoint_[0] = 3*e1/2 - 27*e1*e1*e1/32;
+  footpoint_[1] = 21*e1*e1/16 - 55*e1*e1*e1*e1/32;
+  footpoint_[2] = 151*e1*e1*e1/96;
+  b_ = sqrt(a_*a_*one_minus_e2);
+  ep2_ = (a_*a_ - b_*b_)/(b_*b_);
 }
 
 void CoordinateConverter::SetLocalOrigin(coordinate_system::UTM utm){
@@ -71,26 +83,16 @@ void CoordinateConverter::SetMatrices(){
   double slon = sin(lonrad);
   double clat = cos(latrad);
   double clon = cos(lonrad);
-  math::Matrix R(3,3);
-  reference_position_(0,0) = local_origin_ecef_.x;
-  reference_position_(1,0) = local_origin_ecef_.y;
-  reference_position_(2,0) = local_origin_ecef_.z;
-  R(0,0) = -slat*clon;
-  R(0,1) = -slon;
-  R(0,2) = -clat*clon;
-  R(1,0) = -slat*slon;
-  R(1,1) = clon;
-  R(1,2) = -clat*slon;
-  R(2,0) = clat;
-  R(2,1) = 0.0;
-  R(2,2) = -slat;
+  reference_position_ = math::Vec3(local_origin_ecef_.x, local_origin_ecef_.y, local_origin_ecef_.z);
+  math::Mat3 R(-slat*clon, -slon, -clat*clon,
+               -slat*slon,  clon, -clat*slon,
+                     clat,   0.0,      -slat);
   rot_transpose_ = R.Transpose();
-  rot_transpose_inverse_ = rot_transpose_.Inverse();
 }
 
 
 coordinate_system::ECEF CoordinateConverter::LLA2ECEF(coordinate_system::LLA
-						      lla){
+						      lla) const {
   //From:Department of Defense World Geodetic System1984, p. 4-4
   //see matlab implementation by Michael Kleder on File Exchange
   //BSD 2 clause license
@@ -110,18 +112,20 @@ coordinate_system::ECEF CoordinateConverter::LLA2ECEF(coordinate_system::LLA
 }
   
 coordinate_system::LLA CoordinateConverter::ECEF2LLA(coordinate_system::ECEF
-						     ecef){
+						     ecef) const {
   //WGS84 ellipsoid
   //see matlab implementation by Michael Kleder on File Exchange
   //BSD 2 clause license
-  double a2 = a_*a_;
-  double b = sqrt(a2*one_minus_e2);
-  double b2 = b*b;
-  double ep = sqrt((a2-b2)/b2);
+  double b = b_;
   double p = sqrt(ecef.x*ecef.x+ecef.y*ecef.y);
-  double th = atan2(a_*ecef.z,b*p);
+  // sin and cos of th = atan2(a*z, b*p)
+  double th_y = a_*ecef.z;
+  double th_x = b*p;
+  double th_r = sqrt(th_y*th_y + th_x*th_x);
+  double sth = th_r > 0.0 ? th_y/th_r : 0.0;
+  double cth = th_r > 0.0 ? th_x/th_r : 1.0;
   double lon = atan2(ecef.y, ecef.x);
-  double lat = atan2((ecef.z+ep*ep*b*pow(sin(th),3.0)),(p-e2_*a_*pow(cos(th),3.0)));
+  double lat = atan2((ecef.z+ep2_*b*sth*sth*sth),(p-e2_*a_*cth*cth*cth));
   double slat = sin(lat);
   double N = a_/sqrt(1-e2_*slat*slat);
   double alt = p/cos(lat) - N;
@@ -152,7 +156,7 @@ Department of Defense World Geodetic System
 1984 Technical Report. Part I and II. Washington, DC: Defense Mapping Agency
 */
   
-coordinate_system::UTM CoordinateConverter::LLA2UTM(coordinate_system::LLA lla){
+coordinate_system::UTM CoordinateConverter::LLA2UTM(coordinate_system::LLA lla) const {
   //converts lat/long to UTM coords.  Equations from USGS Bulletin 1532 
   //East Longitudes are positive, West longitudes are negative. 
   //North latitudes are positive, South latitudes are negative
@@ -170,7 +174,7 @@ coordinate_system::UTM CoordinateConverter::LLA2UTM(coordinate_system::LLA lla){
   double k0 = 0.9996;
   
   double LongOrigin;
-  double eccPrimeSquared;
+  double eccPrimeSquared = ecc_prime_squared_;
   double N, T, C, A, M;
   
   //Make sure the longitude is between -180.00 .. 179.9
@@ -196,26 +200,28 @@ coordinate_system::UTM CoordinateConverter::LLA2UTM(coordinate_system::LLA lla){
   LongOrigin = (ZoneNumber - 1)*6 - 180 + 3;  
   LongOriginRad = LongOrigin * kDegToRad; 
 
-  eccPrimeSquared = (eccSquared)/(1-eccSquared);
-  
-  N = a/sqrt(1-eccSquared*sin(LatRad)*sin(LatRad));
-  T = tan(LatRad)*tan(LatRad);
-  C = eccPrimeSquared*cos(LatRad)*cos(LatRad);
-  A = cos(LatRad)*(LongRad-LongOriginRad);
+  // one sin and cos of the latitude, the multiple angles follow from the double angle formulas
+  double slat = sin(LatRad);
+  double clat = cos(LatRad);
+  double tlat = slat/clat;
+  double s2 = 2*slat*clat;
+  double c2 = clat*clat - slat*slat;
+  double s4 = 2*s2*c2;
+  double c4 = c2*c2 - s2*s2;
+  double s6 = s4*c2 + c4*s2;
+
+  N = a/sqrt(1-eccSquared*slat*slat);
+  T = tlat*tlat;
+  C = eccPrimeSquared*clat*clat;
+  A = clat*(LongRad-LongOriginRad);
   
-  M = a*((1 - eccSquared/4 - 3*eccSquared*eccSquared/64	- 
-	  5*eccSquared*eccSquared*eccSquared/256)*LatRad - 
-	 (3*eccSquared/8 + 3*eccSquared*eccSquared/32	
-	  + 45*eccSquared*eccSquared*eccSquared/1024)*sin(2*LatRad)
-	 + (15*eccSquared*eccSquared/256 
-	    + 45*eccSquared*eccSquared*eccSquared/1024)*sin(4*LatRad) 
-	 - (35*eccSquared*eccSquared*eccSquared/3072)*sin(6*LatRad));
+  M = a*(meridian_[0]*LatRad - meridian_[1]*s2 + meridian_[2]*s4 - meridian_[3]*s6);
   
   UTMEasting = (double)(k0*N*(A+(1-T+C)*A*A*A/6
 			      + (5-18*T+T*T+72*C-58*eccPrimeSquared)
 			      *A*A*A*A*A/120)+ 500000.0);
   
-  UTMNorthing = (double)(k0*(M+N*tan(LatRad)*
+  UTMNorthing = (double)(k0*(M+N*tlat*
 			     (A*A/2+(5-T+9*C+4*C*C)*A*A*A*A/24
 			      + (61-58*T+T*T+600*C-330*eccPrimeSquared)
 			      *A*A*A*A*A*A/720)));
@@ -229,7 +235,7 @@ coordinate_system::UTM CoordinateConverter::LLA2UTM(coordinate_system::LLA lla){
   return utm;
 }
 
-char CoordinateConverter::UTMLetterDesignator(double Lat)
+char CoordinateConverter::UTMLetterDesignator(double Lat) const
 {
   //This routine determines the correct UTM letter designator 
   //for the given latitude
@@ -262,7 +268,7 @@ char CoordinateConverter::UTMLetterDesignator(double Lat)
 }
 
 
-coordinate_system::LLA CoordinateConverter::UTM2LLA(coordinate_system::UTM utm){
+coordinate_system::LLA CoordinateConverter::UTM2LLA(coordinate_system::UTM utm) const {
   //converts UTM coords to lat/long.  Equations from USGS Bulletin 1532 
   //East Longitudes are positive, West longitudes are negative. 
   //North latitudes are positive, South latitudes are negative
@@ -274,12 +280,11 @@ coordinate_system::LLA CoordinateConverter::UTM2LLA(coordinate_system::UTM utm){
   double Long;
   double k0 = 0.9996;
   double a = a_;
-  double eccSquared = e2_;;
-  double eccPrimeSquared;
-  double e1 = (1-sqrt(1-eccSquared))/(1+sqrt(1-eccSquared));
+  double eccSquared = e2_;
+  double eccPrimeSquared = ecc_prime_squared_;
   double N1, T1, C1, R1, D, M;
   double LongOrigin;
-  double mu, phi1, phi1Rad;
+  double mu, phi1Rad;
   double x, y;
   int ZoneNumber = utm.zone_num;
   char ZoneLetter = utm.zone_char;
@@ -298,30 +303,37 @@ coordinate_system::LLA CoordinateConverter::UTM2LLA(coordinate_system::UTM utm){
     }
   //+3 puts origin in middle of zone
   LongOrigin = (ZoneNumber - 1)*6 - 180 + 3; 
-  eccPrimeSquared = (eccSquared)/(1-eccSquared);
   
   M = y / k0;
-  mu = M/(a*(1-eccSquared/4-3*eccSquared*eccSquared/
-	     64-5*eccSquared*eccSquared*eccSquared/256));
+  mu = M/(a*meridian_[0]);
   
-  phi1Rad = mu	+ (3*e1/2-27*e1*e1*e1/32)*sin(2*mu) 
-    + (21*e1*e1/16-55*e1*e1*e1*e1/32)*sin(4*mu)
-    +(151*e1*e1*e1/96)*sin(6*mu);
-  phi1 = phi1Rad*kRadToDeg;
+  // multiple angles of mu from one sin and cos
+  double smu = sin(mu);
+  double cmu = cos(mu);
+  double s2 = 2*smu*cmu;
+  double c2 = cmu*cmu - smu*smu;
+  double s4 = 2*s2*c2;
+  double c4 = c2*c2 - s2*s2;
+  double s6 = s4*c2 + c4*s2;
+  phi1Rad = mu + footpoint_[0]*s2 + footpoint_[1]*s4 + footpoint_[2]*s6;
   
-  N1 = a/sqrt(1-eccSquared*sin(phi1Rad)*sin(phi1Rad));
-  T1 = tan(phi1Rad)*tan(phi1Rad);
-  C1 = eccPrimeSquared*cos(phi1Rad)*cos(phi1Rad);
-  R1 = a*(1-eccSquared)/pow(1-eccSquared*sin(phi1Rad)*sin(phi1Rad), 1.5);
+  double sphi = sin(phi1Rad);
+  double cphi = cos(phi1Rad);
+  double tphi = sphi/cphi;
+  double w = 1-eccSquared*sphi*sphi;
+  N1 = a/sqrt(w);
+  T1 = tphi*tphi;
+  C1 = eccPrimeSquared*cphi*cphi;
+  R1 = a*(1-eccSquared)/(w*sqrt(w));
   D = x/(N1*k0);
   
-  Lat = phi1Rad - (N1*tan(phi1Rad)/R1)*
+  Lat = phi1Rad - (N1*tphi/R1)*
     (D*D/2-(5+3*T1+10*C1-4*C1*C1-9*eccPrimeSquared)*D*D*D*D/24
      +(61+90*T1+298*C1+45*T1*T1-252*eccPrimeSquared-3*C1*C1)*D*D*D*D*D*D/720);
   Lat = Lat * kRadToDeg; 
   Long = (D-(1+2*T1+C1)*D*D*D/6
 	  +(5-2*C1+28*T1-3*C1*C1+8*eccPrimeSquared+24*T1*T1)
-	  *D*D*D*D*D/120)/cos(phi1Rad);
+	  *D*D*D*D*D/120)/cphi;
   Long = LongOrigin + Long * kRadToDeg; 
   coordinate_system::LLA lla;
   lla.altitude = utm.altitude;
@@ -331,70 +343,95 @@ coordinate_system::LLA CoordinateConverter::UTM2LLA(coordinate_system::UTM utm){
 }
 
 coordinate_system::ECEF CoordinateConverter::UTM2ECEF(coordinate_system::UTM
-						      utm){
+						      utm) const {
   coordinate_system::LLA lla = UTM2LLA(utm);
   coordinate_system::ECEF ecef = LLA2ECEF(lla);
   return ecef;
 }
   
 coordinate_system::UTM CoordinateConverter::ECEF2UTM(coordinate_system::ECEF
-						     ecef){
+						     ecef) const {
   coordinate_system::LLA lla = ECEF2LLA(ecef);
   coordinate_system::UTM utm = LLA2UTM(lla);
   return utm;
 }
   
 coordinate_system::ENU CoordinateConverter::ECEF2ENU(coordinate_system::ECEF
-						     ecef){
-  math::Matrix p_ecef(3,1),p_ned(3,1);
-  p_ecef(0,0) = ecef.x;
-  p_ecef(1,0) = ecef.y;
-  p_ecef(2,0) = ecef.z;
-  p_ned = rot_transpose_*(p_ecef-reference_position_);
+						     ecef) const {
+  math::Vec3 p_ned = rot_transpose_*(math::Vec3(ecef.x, ecef.y, ecef.z) - reference_position_);
   coordinate_system::ENU enu;
-  enu.x = p_ned(0,0);
-  enu.y = p_ned(1,0);
-  enu.z = -p_ned(2,0);
+  enu.x = p_ned.x;
+  enu.y = p_ned.y;
+  enu.z = -p_ned.z;
   return enu;
 }
   
 coordinate_system::ECEF CoordinateConverter::ENU2ECEF(coordinate_system::ENU
-						      enu){
-  math::Matrix p_ecef(3,1), p_ned(3,1);
-  p_ned(0,0) = enu.x;
-  p_ned(1,0) = enu.y;
-  p_ned(2,0) = -enu.z;
-  p_ecef = rot_transpose_inverse_*p_ned + reference_position_;
+						      enu) const {
+  // the rotation is orthonormal, so its inverse is the transpose
+  math::Vec3 p_ecef = rot_transpose_.TransposeTimes(math::Vec3(enu.x, enu.y, -enu.z)) + reference_position_;
   coordinate_system::ECEF ecef;
-  ecef.x = p_ecef(0,0);
-  ecef.y = p_ecef(1,0);
-  ecef.z = p_ecef(2,0);
+  ecef.x = p_ecef.x;
+  ecef.y = p_ecef.y;
+  ecef.z = p_ecef.z;
   return ecef;
 }
 
-coordinate_system::LLA CoordinateConverter::ENU2LLA(coordinate_system::ENU enu){
+coordinate_system::LLA CoordinateConverter::ENU2LLA(coordinate_system::ENU enu) const {
   coordinate_system::ECEF ecef = ENU2ECEF(enu);
   coordinate_system::LLA lla = ECEF2LLA(ecef);
   return lla;
 }
 
-coordinate_system::ENU CoordinateConverter::LLA2ENU(coordinate_system::LLA lla){
+coordinate_system::ENU CoordinateConverter::LLA2ENU(coordinate_system::LLA lla) const {
   coordinate_system::ECEF ecef = LLA2ECEF(lla);
   coordinate_system::ENU enu = ECEF2ENU(ecef);
   return enu;
 }
 
-coordinate_system::UTM CoordinateConverter::ENU2UTM(coordinate_system::ENU enu){
+coordinate_system::UTM CoordinateConverter::ENU2UTM(coordinate_system::ENU enu) const {
   coordinate_system::ECEF ecef = ENU2ECEF(enu);
   coordinate_system::UTM utm = ECEF2UTM(ecef);
   return utm;
 }
 
-coordinate_system::ENU CoordinateConverter::UTM2ENU(coordinate_system::UTM utm){
+coordinate_system::ENU CoordinateConverter::UTM2ENU(coordinate_system::UTM utm) const {
   coordinate_system::ECEF ecef = UTM2ECEF(utm);
   coordinate_system::ENU enu = ECEF2ENU(ecef);
   return enu;
 }
 
+template <typename In, typename Out, typename Convert>
+static void ConvertBatch(const In *in, Out *out, int n, int num_threads, Convert convert){
+#pragma omp parallel for schedule(static) num_threads(std::max(1, num_threads)) if(num_threads > 1 && n > 1024)
+  for (int i = 0; i < n; i++){
+    out[i] = convert(in[i]);
+  }
+}
+
+void CoordinateConverter::LLA2UTM(const coordinate_system::LLA *lla, coordinate_system::UTM *utm, int n, int num_threads) const {
+  ConvertBatch(lla, utm, n, num_threads, [this](const coordinate_system::LLA &c){ return LLA2UTM(c); });
+}
+
+void CoordinateConverter::UTM2LLA(const coordinate_system::UTM *utm, coordinate_system::LLA *lla, int n, int num_threads) const {
+  ConvertBatch(utm, lla, n, num_threads, [this](const coordinate_system::UTM &c){ return UTM2LLA(c); });
+}
+
+void CoordinateConverter::LLA2ENU(const coordinate_system::LLA *lla, coordinate_system::ENU *enu, int n, int num_threads) const {
+  ConvertBatch(lla, enu, n, num_threads, [this](const coordinate_system::LLA &c){ return LLA2ENU(c); });
+}
+
+void CoordinateConverter::ENU2LLA(const coordinate_system::ENU *enu, coordinate_system::LLA *lla, int n, int num_threads) const {
+  ConvertBatch(enu, lla, n, num_threads, [this](const coordinate_system::ENU &c){ return ENU2LLA(c); });
+}
+
+void CoordinateConverter::UTM2ENU(const coordinate_system::UTM *utm, coordinate_system::ENU *enu, int n, int num_threads) const {
+  ConvertBatch(utm, enu, n, num_threads, [this](const coordinate_system::UTM &c){ return UTM2ENU(c); });
+}
+
+void CoordinateConverter::ENU2UTM(const coordinate_system::ENU *enu, coordinate_system::UTM *utm, int n, int num_threads) const {
+  ConvertBatch(enu, utm, n, num_threads, [this](const coordinate_system::ENU &c){ return ENU2UTM(c); });
+}
+
 } //namespace environment
 } //namespace nature
@@ -27,11 +27,14 @@
 #include "nature/planning/global/coord_conversions/coord_conversions.h"
 // c++ includes
 #include <fstream>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
 
 bool fix_rcvd = false;
-float lat_rcvd = 0.0f;
-float lon_rcvd = 0.0f;
-float alt_rcvd = 0.0f;
+double lat_rcvd = 0.0;
+double lon_rcvd = 0.0;
+double alt_rcvd = 0.0;
 nav_msgs::Odometry current_odom;
 bool odom_rcvd = false;
 
@@ -49,6 +52,174 @@ void OdometryCallback(const nav_msgs::Odometry::ConstPtr& rcv_odom){
     odom_rcvd = true;
 }
 
+/// Largest difference of a transform component still considered the same transform
+static const double kTransformTolerance = 1.0e-6;
+
+/// Largest difference in degrees of the start fix still considered the same start, about 1 cm
+static const double kFixTolerance = 1.0e-7;
+
+bool SameTransform(const geometry_msgs::Transform &a, const geometry_msgs::Transform &b){
+    double d[7] = {a.translation.x - b.translation.x, a.translation.y - b.translation.y, a.translation.z - b.translation.z,
+                   a.rotation.x - b.rotation.x, a.rotation.y - b.rotation.y, a.rotation.z - b.rotation.z, a.rotation.w - b.rotation.w};
+    for (int i = 0; i < 7; i++){
+        if (fabs(d[i]) > kTransformTolerance) return false;
+    }
+    return true;
+}
+
+/**
+ * Read the waypoints converted by a previous run.
+ * The cache only applies to the exact same list of waypoints.
+ * \param file The cache file
+ * \param lat Latitudes of the waypoints
+ * \param lon Longitudes of the waypoints
+ * \param transform Set to the utm->odom transform the cached waypoints were converted with
+ * \param fix Set to the latitude and longitude of the start fix of that run, 0 without a fix topic
+ * \param path Set to the waypoints in odom
+ * \return False if there is no cache for these waypoints
+ */
+bool LoadWaypointCache(const std::string &file, const std::vector<double> &lat, const std::vector<double> &lon,
+                       geometry_msgs::Transform &transform, double fix[2], std::vector< std::vector<double> > &path){
+    std::ifstream fin(file.c_str());
+    if (!fin.is_open()) return false;
+    size_t n = 0;
+    fin >> n;
+    geometry_msgs::Vector3 &t = transform.translation;
+    geometry_msgs::Quaternion &q = transform.rotation;
+    fin >> t.x >> t.y >> t.z >> q.x >> q.y >> q.z >> q.w;
+    fin >> fix[0] >> fix[1];
+    if (!fin || n != lat.size()) return false;
+    path.assign(n, std::vector<double>(2, 0.0));
+    for (size_t i = 0; i < n; i++){
+        double cached_lat, cached_lon;
+        fin >> cached_lat >> cached_lon >> path[i][0] >> path[i][1];
+        // printed with round-trip precision, so the same waypoints read back equal
+        if (!fin || cached_lat != lat[i] || cached_lon != lon[i]) return false;
+    }
+    return true;
+}
+
+void SaveWaypointCache(const std::string &file, const std::vector<double> &lat, const std::vector<double> &lon,
+                       const geometry_msgs::Transform &transform, const double fix[2], const std::vector< std::vector<double> > &path){
+    std::ofstream fout(file.c_str());
+    if (!fout.is_open()){
+        std::cerr<<"WARNING: could not write the waypoint cache "<<file<<std::endl;
+        return;
+    }
+    fout.precision(17);
+    const geometry_msgs::Vector3 &t = transform.translation;
+    const geometry_msgs::Quaternion &q = transform.rotation;
+    fout<<lat.size()<<std::endl;
+    fout<<t.x<<" "<<t.y<<" "<<t.z<<" "<<q.x<<" "<<q.y<<" "<<q.z<<" "<<q.w<<std::endl;
+    fout<<fix[0]<<" "<<fix[1]<<std::endl;
+    for (size_t i = 0; i < path.size(); i++){
+        fout<<lat[i]<<" "<<lon[i]<<" "<<path[i][0]<<" "<<path[i][1]<<std::endl;
+    }
+}
+
+/**
+ * Convert the waypoints to odom and log them to gps_convert_log.txt
+ * \param utm_path The waypoints in UTM
+ * \param transform The utm->odom transform
+ * \return The waypoints in odom
+ */
+std::vector< std::vector<double> > TransformWaypoints(const std::vector< std::vector<double> > &utm_path, const geometry_msgs::TransformStamped &transform){
+    std::ofstream fout;
+    fout.open("gps_convert_log.txt");
+    fout<<"UTM Origin: (" << transform.transform.translation.x <<", "<< transform.transform.translation.y <<")"<<std::endl;
+    fout<<"Waypoints: "<<std::endl;
+    std::vector< std::vector<double> > path = utm_path;
+    for (auto& utm_wp : path ){
+        // pack into ROS Pose msg
+        geometry_msgs::PoseStamped utm_pose, odom_pose;
+        // metadata so TF can transform correctly
+        utm_pose.header.frame_id = "utm";
+        utm_pose.header.stamp = transform.header.stamp;
+        utm_pose.pose.position.x = utm_wp[0]; // UTM
+        utm_pose.pose.position.y = utm_wp[1]; // UTM
+        utm_pose.pose.position.z = 0; // assume 2D waypoints for now
+        utm_pose.pose.orientation.w = 1.0;
+        // apply the transform looked up once for all the waypoints
+        tf2::doTransform(utm_pose, odom_pose, transform);
+        utm_wp[0] = odom_pose.pose.position.x;
+        utm_wp[1] = odom_pose.pose.position.y;
+        // logging
+        fout<<"(" << utm_wp[0] <<", "<< utm_wp[1] << ")" << std::endl;
+    } // end for
+    return path;
+}
+
+/**
+ * Make the path to follow, from 3 meters ahead of the vehicle
+ * through the waypoints at most waypoint_spacing apart.
+ * \param path The waypoints in odom
+ * \param odom The current vehicle odometry
+ * \param waypoint_spacing Distance between the path poses in meters
+ */
+nav_msgs::Path DensifyWaypoints(const std::vector< std::vector<double> > &path, const nav_msgs::Odometry &odom, float waypoint_spacing){
+    nav_msgs::Path ros_path;
+    ros_path.header.frame_id = "odom";
+    // translations of transform
+    float to_veh_x = odom.pose.pose.position.x - path[0][0];
+    float to_veh_y = odom.pose.pose.position.y - path[0][1];
+    // distance to first waypoint
+    float tvm = sqrtf(to_veh_x*to_veh_x  + to_veh_y*to_veh_y);
+    // normalized components
+    float tvx = to_veh_x/tvm;
+    float tvy = to_veh_y/tvm;
+    // initialize x,y to 3 meters away along path to first waypoint   
+    float x = odom.pose.pose.position.x + tvx*3.0f;
+    float y = odom.pose.pose.position.y + tvy*3.0f;
+
+    // ensure waypoints are close enough together
+    int current_waypoint = 0;
+    bool finished = false;
+    int num_loops = 0;
+    while (!finished){
+        if (current_waypoint>=path.size()) break; // end condition
+        
+        // distance to next waypoint from current limit
+        float tx = path[current_waypoint][0] - x;
+        float ty = path[current_waypoint][1] - y;
+        float normt = sqrtf(tx*tx + ty*ty);
+
+        // add waypoint                    
+        nature::msg::PoseStamped pose;
+        pose.pose.position.x = x;
+        pose.pose.position.y = y;
+        pose.pose.position.z = 0.0f;
+        // orientation doesn't matter for waypoints, so leave default orientation
+        pose.pose.orientation.w = 1.0f;
+        pose.pose.orientation.x = 0.0f;
+        pose.pose.orientation.y = 0.0f;
+        pose.pose.orientation.z = 0.0f;
+        ros_path.poses.push_back(pose);
+        // if next waypoint is close enough, skip it
+        if (normt<1.25f*waypoint_spacing){
+            current_waypoint += 1;
+            if (current_waypoint>=path.size())finished = true;
+        }
+        // walk towards next waypoint
+        x += waypoint_spacing*tx/normt;
+        y += waypoint_spacing*ty/normt;
+        // cap waypoints to 1000 tops
+        if (num_loops>1000){
+            finished = true;
+        }
+        num_loops++;
+    }
+    nature::msg::PoseStamped pose;
+    pose.pose.position.x = path.back()[0];
+    pose.pose.position.y = path.back()[1];
+    pose.pose.position.z = 0.0f;
+    pose.pose.orientation.w = 1.0f;
+    pose.pose.orientation.x = 0.0f;
+    pose.pose.orientation.y = 0.0f;
+    pose.pose.orientation.z = 0.0f;
+    ros_path.poses.push_back(pose);
+    return ros_path;
+}
+
 int main(int argc, char **argv){
 
     //auto n = nature::node::init_node(argc,argv,"gps_to_enu_node");
@@ -58,7 +229,13 @@ int main(int argc, char **argv){
     //auto path_pub = n->create_publisher<nature::msg::Path>("nature/enu_waypoints", 10);
     ros::Publisher path_pub = n.advertise<nav_msgs::Path>("/nature/enu_waypoints",10);
 
-    //ros::Subscriber navsat_sub = n.subscribe("/piksi_imu/navsatfix_best_fix", 10, NavSatCallback);
+    // the utm->odom transform is derived from the start fix, with its topic the cache also keys on that fix
+    std::string fix_topic = "";
+    if (ros::param::has("~fix_topic")){
+		ros::param::get("~fix_topic", fix_topic);
+	}
+    ros::Subscriber navsat_sub;
+    if (!fix_topic.empty()) navsat_sub = n.subscribe(fix_topic, 10, NavSatCallback);
 
     ros::Subscriber odometry_sub = n.subscribe("/nature/odometry", 10, OdometryCallback);
 
@@ -85,25 +262,35 @@ int main(int argc, char **argv){
         return 1;
     }
 
-    std::vector< std::vector<double> > path;
-    nature::coordinate_system::CoordinateConverter converter;
-    std::vector<nature::coordinate_system::UTM> utm_waypoints;
-    for (int i=0;i<gps_waypoints_lat.size();i++){
-        nature::coordinate_system::LLA gps_wp;
-        gps_wp.latitude = gps_waypoints_lat[i];
-        gps_wp.longitude = gps_waypoints_lon[i];
-        gps_wp.altitude = 80.0f; // approximate elevation for Starkville, MS
-        nature::coordinate_system::UTM utm_wp = converter.LLA2UTM(gps_wp);
-        utm_waypoints.push_back(utm_wp);
-        std::vector<double> point;
-        point.push_back(utm_wp.x);
-        point.push_back(utm_wp.y);
-        path.push_back(point);
-    }
-    if (path.size()<1){
+    std::string cache_file = "gps_enu_cache.txt";
+    if (ros::param::has("~cache_file")){
+		ros::param::get("~cache_file", cache_file);
+	}
+
+    if (gps_waypoints_lat.size()<1){
         std::cerr<<"ERROR: NO WAYPOINTS WERE GIVEN TO THE GPS TO ENU NODE. EXITING."<<std::endl;
         exit(1);
     }
+
+    // waypoints in odom, from the cache of a previous run with the same waypoints and start fix if there is one,
+    // published right away and converted again and republished if the utm->odom transform turns out different
+    std::vector< std::vector<double> > path;
+    geometry_msgs::Transform cached_transform;
+    double cached_fix[2] = {0.0, 0.0};
+    bool cache_loaded = !cache_file.empty() && LoadWaypointCache(cache_file, gps_waypoints_lat, gps_waypoints_lon, cached_transform, cached_fix, path);
+    bool path_ready = false;
+    bool path_changed = false;
+
+    // wake up on tf updates instead of polling for the transform
+    std::mutex tf_mutex;
+    std::condition_variable tf_cv;
+    bool tf_changed = false;
+    auto tf_listener_handle = tfBuffer._addTransformsChangedListener([&](){
+        std::lock_guard<std::mutex> lock(tf_mutex);
+        tf_changed = true;
+        tf_cv.notify_one();
+    });
+    bool transform_checked = false;
     ros::Rate rate(10.0);
 
 
@@ -116,99 +303,66 @@ int main(int argc, char **argv){
     ros_path.poses.clear();
     while (ros::ok()){
 
-        // skip until transform available
-
-     	if (!tfBuffer.canTransform("odom","utm",ros::Time::now(),ros::Duration(30))){
-     		ROS_WARN("No utm->odom transform!");
-     		continue;
-     	}
-
-        if (odom_rcvd){
-            if (count==0){
+        if (cache_loaded && !path_ready && (fix_topic.empty() || fix_rcvd)){
+            if (fix_topic.empty() || (fabs(lat_rcvd - cached_fix[0]) <= kFixTolerance && fabs(lon_rcvd - cached_fix[1]) <= kFixTolerance)){
+                path_ready = true;
+                path_changed = true;
+            }
+            else{
+                // another start, the transform will differ
+                cache_loaded = false;
+            }
+        }
 
-                // log waypoints to file
-                std::ofstream fout;
-                fout.open("gps_convert_log.txt");
+        if (!transform_checked){
+            if (tfBuffer.canTransform("odom","utm",ros::Time(0))){
                 geometry_msgs::TransformStamped transform = tfBuffer.lookupTransform("odom","utm",ros::Time(0));
-                fout<<"UTM Origin: (" << transform.transform.translation.x <<", "<< transform.transform.translation.y <<")"<<std::endl;
-                fout<<"Waypoints: "<<std::endl;
-                // waypoints are in UTM currently, need to be in odom for next step
-                for (auto& utm_wp : path ){
-                    // pack into ROS Pose msg
-                    geometry_msgs::PoseStamped utm_pose, odom_pose;
-                    // metadata so TF can transform correctly
-                    utm_pose.header.frame_id = "utm";
-                    utm_pose.header.stamp = ros::Time::now();
-                    utm_pose.pose.position.x = utm_wp[0]; // UTM
-                    utm_pose.pose.position.y = utm_wp[1]; // UTM
-                    utm_pose.pose.position.z = 0; // assume 2D waypoints for now
-                    // apply transform
-                    tfBuffer.transform(utm_pose, odom_pose, "odom", ros::Duration(60)); // 1 minute timeout to apply the transform
-                    // this is a repulsive hack, but it minimizes code changes for now
-                    utm_wp[0] = odom_pose.pose.position.x;
-                    utm_wp[1] = odom_pose.pose.position.y;
-                    // logging
-                    fout<<"(" << utm_wp[0] <<", "<< utm_wp[1] << ")" << std::endl;
-                } // end for
-
-                // translations of transform
-                float to_veh_x = current_odom.pose.pose.position.x - path[0][0];
-                float to_veh_y = current_odom.pose.pose.position.y - path[0][1];
-                // distance to first waypoint
-                float tvm = sqrtf(to_veh_x*to_veh_x  + to_veh_y*to_veh_y);
-                // normalized components
-                float tvx = to_veh_x/tvm;
-                float tvy = to_veh_y/tvm;
-                // initialize x,y to 3 meters away along path to first waypoint   
-                float x = current_odom.pose.pose.position.x + tvx*3.0f;
-                float y = current_odom.pose.pose.position.y + tvy*3.0f;
-
-                // ensure waypoints are close enough together
-                int current_waypoint = 0;
-                bool finished = false;
-                int num_loops = 0;
-                while (!finished){
-                    if (current_waypoint>=path.size()) break; // end condition
-                    
-                    // distance to next waypoint from current limit
-                    float tx = path[current_waypoint][0] - x;
-                    float ty = path[current_waypoint][1] - y;
-                    float normt = sqrtf(tx*tx + ty*ty);
-
-                    // add waypoint                    
-                    nature::msg::PoseStamped pose;
-                    pose.pose.position.x = x;
-                    pose.pose.position.y = y;
-                    pose.pose.position.z = 0.0f;
-                    // orientation doesn't matter for waypoints, so leave default orientation
-                    pose.pose.orientation.w = 1.0f;
-                    pose.pose.orientation.x = 0.0f;
-                    pose.pose.orientation.y = 0.0f;
-                    pose.pose.orientation.z = 0.0f;
-                    ros_path.poses.push_back(pose);
-                    // if next waypoint is close enough, skip it
-                    if (normt<1.25f*waypoint_spacing){
-                        current_waypoint += 1;
-                        if (current_waypoint>=path.size())finished = true;
+                if (!path_ready || !SameTransform(transform.transform, cached_transform)){
+                    // convert the waypoints to UTM, they need to be in odom for next step
+                    nature::coordinate_system::CoordinateConverter converter;
+                    std::vector<nature::coordinate_system::LLA> gps_waypoints(gps_waypoints_lat.size());
+                    for (int i=0;i<gps_waypoints_lat.size();i++){
+                        gps_waypoints[i].latitude = gps_waypoints_lat[i];
+                        gps_waypoints[i].longitude = gps_waypoints_lon[i];
+                        gps_waypoints[i].altitude = 80.0f; // approximate elevation for Starkville, MS
                     }
-                    // walk towards next waypoint
-                    x += waypoint_spacing*tx/normt;
-                    y += waypoint_spacing*ty/normt;
-                    // cap waypoints to 1000 tops
-                    if (num_loops>1000){
-                        finished = true;
+                    std::vector<nature::coordinate_system::UTM> utm_waypoints(gps_waypoints.size());
+                    converter.LLA2UTM(gps_waypoints.data(), utm_waypoints.data(), (int)gps_waypoints.size());
+                    std::vector< std::vector<double> > utm_path;
+                    for (int i=0;i<utm_waypoints.size();i++){
+                        const nature::coordinate_system::UTM &utm_wp = utm_waypoints[i];
+                        std::vector<double> point;
+                        point.push_back(utm_wp.x);
+                        point.push_back(utm_wp.y);
+                        utm_path.push_back(point);
                     }
-                    num_loops++;
+                    path = TransformWaypoints(utm_path, transform);
+                    double fix[2] = {lat_rcvd, lon_rcvd};
+                    if (!cache_file.empty()) SaveWaypointCache(cache_file, gps_waypoints_lat, gps_waypoints_lon, transform.transform, fix, path);
+                    path_ready = true;
+                    path_changed = true;
                 }
-                nature::msg::PoseStamped pose;
-                pose.pose.position.x = path.back()[0];
-                pose.pose.position.y = path.back()[1];
-                pose.pose.position.z = 0.0f;
-                pose.pose.orientation.w = 1.0f;
-                pose.pose.orientation.x = 0.0f;
-                pose.pose.orientation.y = 0.0f;
-                pose.pose.orientation.z = 0.0f;
-                ros_path.poses.push_back(pose);
+                transform_checked = true;
+                tfBuffer._removeTransformsChangedListener(tf_listener_handle);
+            }
+            else if (!path_ready){
+                // nothing to publish yet, sleep until tf changes, or briefly while the start fix of the cache is awaited
+                bool fix_pending = cache_loaded && !fix_rcvd;
+                std::unique_lock<std::mutex> lock(tf_mutex);
+                if (!tf_cv.wait_for(lock, fix_pending ? std::chrono::milliseconds(100) : std::chrono::milliseconds(30000), [&](){ return tf_changed; }) && !fix_pending){
+                    ROS_WARN("No utm->odom transform!");
+                }
+                tf_changed = false;
+                lock.unlock();
+                ros::spinOnce();
+                continue;
+            }
+        }
+
+        if (odom_rcvd && path_ready){
+            if (path_changed){
+                ros_path = DensifyWaypoints(path, current_odom, waypoint_spacing);
+                path_changed = false;
             }
 /*
             if (count==0){
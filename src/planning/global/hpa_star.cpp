@@ -0,0 +1,431 @@
+#include <limits>
+#include <cmath>
+#include <iostream>
+#include <algorithm>
+// project includes
+#include "nature/planning/global/hpa_star.h"
+
+namespace nature {
+namespace planning{
+
+static const float HPA_INF = std::numeric_limits<float>::infinity();
+
+HpaStar::HpaStar(){
+
+}
+
+/// floor of a/b for b > 0
+static int FloorDiv(int a, int b){
+  return a >= 0 ? a/b : -((b - 1 - a)/b);
+}
+
+/// move cost and free flag of a cell of the grids, unknown (-1) cells are free
+static inline void CellCost(const int8_t *height_data, const int8_t *seg_data, int d, int &cost, uint8_t &fr){
+  cost = 1 + std::max(0, (int)height_data[d]) + (seg_data ? std::max(0, (int)seg_data[d]) : 0);
+  fr = height_data[d] <= 0;
+}
+
+void HpaStar::Relayout(int w, int h, int ox, int oy, bool keep, const int8_t *height_data, const int8_t *seg_data){
+  int cs = cluster_size_;
+  int dx = ox - origin_x_;
+  int dy = oy - origin_y_;
+  // the cells in both grids keep their costs, a row at a time
+  next_costs_.resize(w*h);
+  next_free_.resize(w*h);
+  for (int y=0;y<h;y++){
+    int oldy = y + dy;
+    int xa = w;
+    int xb = w;
+    if (keep && oldy >= 0 && oldy < height_){
+      xa = std::min(std::max(-dx, 0), w);
+      xb = std::max(std::min(width_ - dx, w), xa);
+      std::copy(costs_.begin() + oldy*width_ + xa + dx, costs_.begin() + oldy*width_ + xb + dx, next_costs_.begin() + y*w + xa);
+      std::copy(free_.begin() + oldy*width_ + xa + dx, free_.begin() + oldy*width_ + xb + dx, next_free_.begin() + y*w + xa);
+    }
+    for (int x=0;x<w;x++){
+      if (x == xa) x = xb;
+      if (x >= w) break;
+      CellCost(height_data, seg_data, x*h + y, next_costs_[y*w + x], next_free_[y*w + x]);
+    }
+  }
+  costs_.swap(next_costs_);
+  free_.swap(next_free_);
+
+  // clusters sit on a lattice fixed in the world, cluster 0 holds the grid corner
+  int first_x = FloorDiv(ox, cs);
+  int first_y = FloorDiv(oy, cs);
+  int ncx = FloorDiv(ox + w - 1, cs) - first_x + 1;
+  int ncy = FloorDiv(oy + h - 1, cs) - first_y + 1;
+  std::vector<Cluster> clusters(ncx*ncy);
+  for (int cy=0;cy<ncy;cy++){
+    for (int cx=0;cx<ncx;cx++){
+      Cluster &c = clusters[cy*ncx + cx];
+      c.x0 = std::max(0, (first_x + cx)*cs - ox);
+      c.y0 = std::max(0, (first_y + cy)*cs - oy);
+      c.x1 = std::min(w, (first_x + cx + 1)*cs - ox);
+      c.y1 = std::min(h, (first_y + cy + 1)*cs - oy);
+      c.dirty = true;
+      if (!keep) continue;
+      int ocx = first_x + cx - first_cluster_x_;
+      int ocy = first_y + cy - first_cluster_y_;
+      if (ocx < 0 || ocy < 0 || ocx >= num_clusters_x_ || ocy >= num_clusters_y_) continue;
+      Cluster &o = clusters_[ocy*num_clusters_x_ + ocx];
+      // kept when whole and off the border in both grids, the portals also read the cells across
+      bool whole = c.x1 - c.x0 == cs && c.y1 - c.y0 == cs && c.x0 > 0 && c.y0 > 0 && c.x1 < w && c.y1 < h;
+      bool was_whole = o.x1 - o.x0 == cs && o.y1 - o.y0 == cs && o.x0 > 0 && o.y0 > 0 && o.x1 < width_ && o.y1 < height_;
+      if (!whole || !was_whole || o.dirty) continue;
+      c.cells.swap(o.cells);
+      c.partners.swap(o.partners);
+      c.dist.swap(o.dist);
+      for (auto & n : c.cells) n = (n % width_ - dx) + (n / width_ - dy)*w;
+      for (auto & n : c.partners) n = (n % width_ - dx) + (n / width_ - dy)*w;
+      c.dirty = false;
+    }
+  }
+  clusters_.swap(clusters);
+  width_ = w;
+  height_ = h;
+  origin_x_ = ox;
+  origin_y_ = oy;
+  first_cluster_x_ = first_x;
+  first_cluster_y_ = first_y;
+  phase_x_ = ox - first_x*cs;
+  phase_y_ = oy - first_y*cs;
+  num_clusters_x_ = ncx;
+  num_clusters_y_ = ncy;
+}
+
+void HpaStar::UpdateCosts(nature::msg::OccupancyGrid *grid, nature::msg::OccupancyGrid *segmentation_grid){
+  int w = grid->info.width;
+  int h = grid->info.height;
+  float res = grid->info.resolution;
+  float llx = grid->info.origin.position.x;
+  float lly = grid->info.origin.position.y;
+  bool has_segmentation = segmentation_grid->data.size() == grid->data.size();
+  const int8_t *height_data = grid->data.data();
+  const int8_t *seg_data = has_segmentation ? segmentation_grid->data.data() : nullptr;
+
+  // the grid corner in world cells, the clusters move with it when it moves by whole cells
+  int ox = (int)std::lround(llx/res);
+  int oy = (int)std::lround(lly/res);
+  bool on_cells = std::fabs(llx/res - ox) < 1e-3f && std::fabs(lly/res - oy) < 1e-3f;
+  bool keep = num_clusters_x_ > 0 && res == res_ && on_cells;
+  bool moved = !keep || w != width_ || h != height_ || ox != origin_x_ || oy != origin_y_;
+  llx_ = llx;
+  lly_ = lly;
+  res_ = res;
+  if (moved) Relayout(w, h, ox, oy, keep, height_data, seg_data);
+
+  // the given regions only hold for a grid that stayed in place
+  nature::common::GridRoi roi(0, 0, width_, height_);
+  if (!moved && changes_given_ && !all_changed_) roi = changed_.Clamp(width_, height_);
+  changed_ = nature::common::GridRoi();
+  changes_given_ = false;
+  all_changed_ = false;
+  // a rebuilt layout read every cell already
+  if (!keep) return;
+
+  for (int x=roi.imin;x<roi.imax;x++){
+    int lx = (x + phase_x_) % cluster_size_;
+    int d = x*height_ + roi.jmin;
+    for (int y=roi.jmin;y<roi.jmax;y++, d++){
+      int cost;
+      uint8_t fr;
+      CellCost(height_data, seg_data, d, cost, fr);
+      int n = CellIndex(x, y);
+      if (cost == costs_[n] && fr == free_[n]) continue;
+      costs_[n] = cost;
+      // on a border the cell also moves the portals of the cluster across
+      if (fr != free_[n]){
+        int ly = (y + phase_y_) % cluster_size_;
+        if (lx == 0 && x > 0) clusters_[ClusterOf(n - 1)].dirty = true;
+        if (lx == cluster_size_ - 1 && x + 1 < width_) clusters_[ClusterOf(n + 1)].dirty = true;
+        if (ly == 0 && y > 0) clusters_[ClusterOf(n - width_)].dirty = true;
+        if (ly == cluster_size_ - 1 && y + 1 < height_) clusters_[ClusterOf(n + width_)].dirty = true;
+      }
+      free_[n] = fr;
+      clusters_[ClusterOf(n)].dirty = true;
+    }
+  }
+}
+
+void HpaStar::AddBorderPortals(Cluster &c, int x, int y, int step_x, int step_y, int out_x, int out_y, int len){
+  // one portal in the middle of each run of open border, one at each end of long runs
+  int run_start = -1;
+  for (int k=0;k<=len;k++){
+    int cx = x + k*step_x;
+    int cy = y + k*step_y;
+    bool open = k < len && Free(cx, cy) && Free(cx + out_x, cy + out_y);
+    if (open){
+      if (run_start < 0) run_start = k;
+      continue;
+    }
+    if (run_start < 0) continue;
+    int run_end = k - 1;
+    int picks[2] = {(run_start + run_end)/2, -1};
+    if (run_end - run_start + 1 >= 6){
+      picks[0] = run_start;
+      picks[1] = run_end;
+    }
+    for (int p=0;p<2;p++){
+      if (picks[p] < 0) continue;
+      int px = x + picks[p]*step_x;
+      int py = y + picks[p]*step_y;
+      c.cells.push_back(CellIndex(px, py));
+      c.partners.push_back(CellIndex(px + out_x, py + out_y));
+    }
+    run_start = -1;
+  }
+}
+
+void HpaStar::FindPortals(Cluster &c){
+  c.cells.clear();
+  c.partners.clear();
+  if (c.x0 > 0) AddBorderPortals(c, c.x0, c.y0, 0, 1, -1, 0, c.y1 - c.y0);
+  if (c.x1 < width_) AddBorderPortals(c, c.x1 - 1, c.y0, 0, 1, 1, 0, c.y1 - c.y0);
+  if (c.y0 > 0) AddBorderPortals(c, c.x0, c.y0, 1, 0, 0, -1, c.x1 - c.x0);
+  if (c.y1 < height_) AddBorderPortals(c, c.x0, c.y1 - 1, 1, 0, 0, 1, c.x1 - c.x0);
+}
+
+void HpaStar::ClusterSearch(const Cluster &c, int source, bool reverse, int target){
+  int ch = c.y1 - c.y0;
+  int size = (c.x1 - c.x0)*ch;
+  local_cost_.assign(size, HPA_INF);
+  local_parent_.assign(size, -1);
+  if (local_open_.NumIndices() < size) local_open_.Resize(cluster_size_*cluster_size_);
+  local_open_.Clear();
+  int sl = (source % width_ - c.x0)*ch + (source / width_ - c.y0);
+  local_cost_[sl] = 0.0f;
+  local_open_.Push(sl, 0.0f);
+  int tl = target < 0 ? -1 : (target % width_ - c.x0)*ch + (target / width_ - c.y0);
+  // with PORTAL_TARGETS the search stops once every portal of the cluster is settled
+  int portals_left = 0;
+  if (target == PORTAL_TARGETS){
+    local_target_.assign(size, 0);
+    for (int n : c.cells){
+      uint8_t &t = local_target_[(n % width_ - c.x0)*ch + (n / width_ - c.y0)];
+      if (!t) portals_left++;
+      t = 1;
+    }
+  }
+  while (!local_open_.Empty()){
+    int u = local_open_.Pop();
+    if (u == tl) break;
+    if (target == PORTAL_TARGETS && local_target_[u] && --portals_left == 0) break;
+    int ux = u / ch;
+    int uy = u % ch;
+    int un = CellIndex(c.x0 + ux, c.y0 + uy);
+    int nbrs[4] = {ux > 0 ? u - ch : -1, ux + 1 < c.x1 - c.x0 ? u + ch : -1,
+                   uy > 0 ? u - 1 : -1, uy + 1 < ch ? u + 1 : -1};
+    for (int i=0;i<4;i++){
+      int v = nbrs[i];
+      if (v < 0) continue;
+      int vn = CellIndex(c.x0 + v / ch, c.y0 + v % ch);
+      // in reverse the move is v to u, entering u
+      float cost = local_cost_[u] + (reverse ? costs_[un] : costs_[vn]);
+      if (cost < local_cost_[v]){
+        local_cost_[v] = cost;
+        local_parent_[v] = un;
+        local_open_.Push(v, cost);
+      }
+    }
+  }
+}
+
+void HpaStar::ComputeInnerEdges(Cluster &c){
+  int k = (int)c.cells.size();
+  c.dist.assign(k*k, HPA_INF);
+  for (int a=0;a<k;a++){
+    ClusterSearch(c, c.cells[a], false, PORTAL_TARGETS);
+    for (int b=0;b<k;b++){
+      c.dist[a*k + b] = LocalCost(c, c.cells[b]);
+    }
+  }
+}
+
+bool HpaStar::RefreshClusters(){
+  num_rebuilt_ = 0;
+  for (auto & c : clusters_){
+    if (!c.dirty) continue;
+    if (cancel_ && cancel_()){
+      cancelled_ = true;
+      break;
+    }
+    FindPortals(c);
+    ComputeInnerEdges(c);
+    c.dirty = false;
+    num_rebuilt_++;
+  }
+  node_base_.resize(clusters_.size() + 1);
+  node_base_[0] = 0;
+  for (size_t c=0;c<clusters_.size();c++){
+    node_base_[c+1] = node_base_[c] + (int)clusters_[c].cells.size();
+  }
+  num_nodes_ = node_base_.back();
+  return !cancelled_;
+}
+
+bool HpaStar::SearchAbstract(int start, int goal){
+  int s_node = num_nodes_;
+  int g_node = num_nodes_ + 1;
+  int total = num_nodes_ + 2;
+  int sc = ClusterOf(start);
+  int gc = ClusterOf(goal);
+  const Cluster &start_cluster = clusters_[sc];
+  const Cluster &goal_cluster = clusters_[gc];
+
+  // connect the start and the goal to the portals of their clusters
+  ClusterSearch(start_cluster, start, false, -1);
+  start_cost_.resize(start_cluster.cells.size());
+  for (size_t k=0;k<start_cluster.cells.size();k++) start_cost_[k] = LocalCost(start_cluster, start_cluster.cells[k]);
+  float direct = sc == gc ? LocalCost(start_cluster, goal) : HPA_INF;
+  ClusterSearch(goal_cluster, goal, true, -1);
+  goal_cost_.resize(goal_cluster.cells.size());
+  for (size_t k=0;k<goal_cluster.cells.size();k++) goal_cost_[k] = LocalCost(goal_cluster, goal_cluster.cells[k]);
+
+  node_cost_.assign(total, HPA_INF);
+  node_parent_.assign(total, -1);
+  if (node_open_.NumIndices() != total) node_open_.Resize(total);
+  node_open_.Clear();
+  int gx = goal % width_;
+  int gy = goal / width_;
+  auto heuristic = [&](int cell){ return (float)(std::abs(cell % width_ - gx) + std::abs(cell / width_ - gy)); };
+  auto relax = [&](int from, int to, int to_cell, float edge){
+    if (edge == HPA_INF) return;
+    float cost = node_cost_[from] + edge;
+    if (cost < node_cost_[to]){
+      node_cost_[to] = cost;
+      node_parent_[to] = from;
+      node_open_.Push(to, cost + heuristic(to_cell));
+    }
+  };
+
+  node_cost_[s_node] = 0.0f;
+  node_open_.Push(s_node, heuristic(start));
+  bool found = false;
+  int pops = 0;
+  while (!node_open_.Empty()){
+    if (cancel_ && ++pops % 1024 == 0 && cancel_()){
+      cancelled_ = true;
+      return false;
+    }
+    int u = node_open_.Pop();
+    if (u == g_node){
+      found = true;
+      break;
+    }
+    if (u == s_node){
+      for (size_t k=0;k<start_cluster.cells.size();k++){
+        relax(u, node_base_[sc] + (int)k, start_cluster.cells[k], start_cost_[k]);
+      }
+      relax(u, g_node, goal, direct);
+      continue;
+    }
+    int c = (int)(std::upper_bound(node_base_.begin(), node_base_.end(), u) - node_base_.begin()) - 1;
+    const Cluster &cl = clusters_[c];
+    int nk = (int)cl.cells.size();
+    int k = u - node_base_[c];
+    for (int b=0;b<nk;b++){
+      if (b != k) relax(u, node_base_[c] + b, cl.cells[b], cl.dist[k*nk + b]);
+    }
+    if (c == gc) relax(u, g_node, goal, goal_cost_[k]);
+    // across the border to the matching portal
+    int cell = cl.cells[k];
+    int partner = cl.partners[k];
+    int pc = ClusterOf(partner);
+    const Cluster &other = clusters_[pc];
+    for (size_t b=0;b<other.cells.size();b++){
+      if (other.cells[b] == partner && other.partners[b] == cell){
+        relax(u, node_base_[pc] + (int)b, partner, (float)costs_[partner]);
+      }
+    }
+  }
+  if (!found) return false;
+
+  abstract_path_.clear();
+  for (int u = g_node; u >= 0; u = node_parent_[u]) abstract_path_.push_back(u);
+  std::reverse(abstract_path_.begin(), abstract_path_.end());
+  return true;
+}
+
+void HpaStar::AppendCell(int n){
+  std::vector<float> point(2);
+  point[0] = (n % width_ + 0.5f)*res_ + llx_;
+  point[1] = (n / width_ + 0.5f)*res_ + lly_;
+  path_world_.push_back(point);
+}
+
+void HpaStar::BuildPath(int start, int goal){
+  auto node_cell = [&](int u){
+    if (u == num_nodes_) return start;
+    if (u == num_nodes_ + 1) return goal;
+    int c = (int)(std::upper_bound(node_base_.begin(), node_base_.end(), u) - node_base_.begin()) - 1;
+    return clusters_[c].cells[u - node_base_[c]];
+  };
+  path_world_.clear();
+  AppendCell(start);
+  int refined = 0;
+  std::vector<int> segment;
+  for (size_t i=1;i<abstract_path_.size();i++){
+    int from = node_cell(abstract_path_[i-1]);
+    int to = node_cell(abstract_path_[i]);
+    if (from == to) continue;
+    int c = ClusterOf(from);
+    if (c != ClusterOf(to)){
+      // a portal crossing, the cells are adjacent
+      AppendCell(to);
+    }
+    else if (refined < refine_clusters_){
+      const Cluster &cl = clusters_[c];
+      ClusterSearch(cl, from, false, to);
+      segment.clear();
+      int ch = cl.y1 - cl.y0;
+      for (int n = to; n != from && n >= 0; n = local_parent_[(n % width_ - cl.x0)*ch + (n / width_ - cl.y0)]){
+        segment.push_back(n);
+      }
+      for (auto it = segment.rbegin(); it != segment.rend(); ++it) AppendCell(*it);
+      refined++;
+    }
+    else{
+      // beyond the refined clusters the path is straight between portals, at the grid spacing
+      float x0 = (from % width_ + 0.5f)*res_ + llx_;
+      float y0 = (from / width_ + 0.5f)*res_ + lly_;
+      float x1 = (to % width_ + 0.5f)*res_ + llx_;
+      float y1 = (to / width_ + 0.5f)*res_ + lly_;
+      float d = sqrtf((x1 - x0)*(x1 - x0) + (y1 - y0)*(y1 - y0));
+      int steps = std::max(1, (int)ceil(d/res_));
+      for (int s=1;s<=steps;s++){
+        std::vector<float> point(2);
+        point[0] = x0 + (x1 - x0)*s/steps;
+        point[1] = y0 + (y1 - y0)*s/steps;
+        path_world_.push_back(point);
+      }
+    }
+  }
+}
+
+std::vector<std::vector<float> > HpaStar::PlanPath(nature::msg::OccupancyGrid *grid, nature::msg::OccupancyGrid *segmentation_grid, std::vector<float> goal, std::vector<float> position){
+  if (grid->info.height<=0 || grid->info.width<=0 || grid->data.size() != grid->info.width*grid->info.height) return path_world_;
+
+  cancelled_ = false;
+  UpdateCosts(grid, segmentation_grid);
+  if (!RefreshClusters()) return path_world_;
+
+  int sx = std::min(std::max((int)((position[0] - llx_)/res_), 0), width_ - 1);
+  int sy = std::min(std::max((int)((position[1] - lly_)/res_), 0), height_ - 1);
+  int gx = std::min(std::max((int)((goal[0] - llx_)/res_), 0), width_ - 1);
+  int gy = std::min(std::max((int)((goal[1] - lly_)/res_), 0), height_ - 1);
+  int start = CellIndex(sx, sy);
+  int goal_cell = CellIndex(gx, gy);
+
+  if (!SearchAbstract(start, goal_cell)){
+    if (cancelled_) return path_world_;
+    std::cerr << "WARNING: HPA* failed to solve map " << std::endl;
+    return path_world_;
+  }
+  BuildPath(start, goal_cell);
+  return path_world_;
+}
+
+} // namespace planning
+} // namespace nature
@@ -10,19 +10,93 @@
  * \date 9/1/2020
  */
 
+// c++ includes
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <limits>
+#include <memory>
+#include <mutex>
 // ros includes
 #include "nature/node/ros_types.h"
 #include "nature/node/node_proxy.h"
+#include "nature/node/stage_diagnostics.h"
+#include "nature/node/pipeline_stages.h"
+#include "nature/node/latency_trace.h"
 // local includes
 #include "nature/nature_utils.h"
+#include "nature/common/bounded_queue.h"
+#include "nature/common/morphology.h"
+#include "nature/common/replay_clock.h"
 #include "nature/planning/global/astar.h"
+#include "nature/planning/global/hpa_star.h"
+#include "nature/planning/global/path_monitor.h"
 #include "nature/visualization/visualization_factory.h"
+
+namespace {
+
 nature::msg::Odometry odom;
 bool odom_rcvd = false;
 nature::msg::OccupancyGrid current_grid;
 nature::msg::OccupancyGrid segmentation_grid;
 nature::msg::Path current_waypoints;
 bool waypoints_rcvd = false;
+bool new_grid_rcvd = false;
+// cells the grid patches changed since the last request, a full grid may change all of them
+nature::common::GridRoi grid_changes;
+bool grid_replaced = true;
+
+// the scan behind the occupancy grid, the path planned on it is stamped with it
+nature::node::TraceStamp grid_trace;
+static const nature::node::LatencyTrace GLOBAL_PATH_LATENCY("global_path");
+
+// Solves run on a planning thread. The main loop hands it a snapshot of the grids,
+// goal and position, and republishes the last completed path while it waits.
+/// a snapshot to solve
+struct PlanRequest {
+  nature::msg::OccupancyGrid grid;
+  nature::msg::OccupancyGrid segmentation_grid;
+  std::vector<float> goal;
+  std::vector<float> position;
+  /// cells changed since the previous request, all of them when replaced
+  nature::common::GridRoi changed;
+  bool replaced = true;
+  double stamp = 0.0;
+  nature::node::TraceStamp trace;
+  bool path = false;
+  bool cost_to_go = false;
+  unsigned int goal_generation = 0;
+  /// with multi-leg planning, the waypoint the goal is and the waypoints after it
+  int first_waypoint = 0;
+  std::vector<std::vector<float>> waypoints;
+};
+/// a leg between two consecutive waypoints, kept until its grid cells change
+struct MissionLeg {
+  std::unique_ptr<nature::planning::Astar> planner;
+  nature::planning::PathMonitor monitor;
+  std::vector<float> from;
+  std::vector<float> to;
+  bool solved = false;
+};
+/// a completed solve
+struct PlanResult {
+  std::vector<std::vector<float>> path;
+  /// the grid the path was solved on, the path monitor compares later grids with it
+  nature::msg::OccupancyGrid grid;
+  std::vector<float> goal;
+  double stamp = 0.0;
+  nature::node::TraceStamp trace;
+  bool fresh = false;
+};
+nature::common::BoundedQueue<PlanRequest> plan_queue(1, true);
+PlanResult plan_result;
+/// guards plan_result
+std::mutex result_mutex;
+/// true from a request being queued until its solve is done
+std::atomic<bool> planner_busy(false);
+std::atomic<bool> planner_running(true);
+/// grows when the goal changes, a solve for an older goal is cancelled
+std::atomic<unsigned int> goal_generation(0);
 
 void OdometryCallback(nature::msg::OdometryPtr rcv_odom)
 {
@@ -33,10 +107,40 @@ void OdometryCallback(nature::msg::OdometryPtr rcv_odom)
 void MapCallback(nature::msg::OccupancyGridPtr rcv_grid)
 {
   current_grid = *rcv_grid;
+  new_grid_rcvd = true;
+  grid_replaced = true;
+  grid_trace.Receive(rcv_grid->header, nature::node::now_seconds());
 }
 
 void SegmentationMapCallback(nature::msg::OccupancyGridPtr rcv_grid){
     segmentation_grid = *rcv_grid;
+    new_grid_rcvd = true;
+    grid_replaced = true;
+}
+
+void LayeredMapCallback(nature::msg::LayeredGridPtr rcv_grid){
+  nature::utils::LayerToOccupancyGrid(*rcv_grid, "occupancy", current_grid);
+  nature::utils::LayerToOccupancyGrid(*rcv_grid, "segmentation", segmentation_grid);
+  new_grid_rcvd = true;
+  grid_replaced = true;
+  grid_trace.Receive(rcv_grid->header, nature::node::now_seconds());
+}
+
+void MapUpdateCallback(nature::msg::OccupancyGridUpdatePtr rcv_update){
+  if (nature::utils::ApplyGridUpdate(current_grid, *rcv_update)){
+    new_grid_rcvd = true;
+    grid_changes = grid_changes.Union(nature::common::GridRoi(rcv_update->x, rcv_update->y,
+        rcv_update->x + rcv_update->width, rcv_update->y + rcv_update->height));
+    grid_trace.Receive(rcv_update->header, nature::node::now_seconds());
+  }
+}
+
+void SegmentationMapUpdateCallback(nature::msg::OccupancyGridUpdatePtr rcv_update){
+  if (nature::utils::ApplyGridUpdate(segmentation_grid, *rcv_update)){
+    new_grid_rcvd = true;
+    grid_changes = grid_changes.Union(nature::common::GridRoi(rcv_update->x, rcv_update->y,
+        rcv_update->x + rcv_update->width, rcv_update->y + rcv_update->height));
+  }
 }
 
 void WaypointCallback(nature::msg::PathPtr rcv_waypoints)
@@ -48,17 +152,23 @@ void WaypointCallback(nature::msg::PathPtr rcv_waypoints)
 
 }
 
-int main(int argc, char *argv[])
+} // namespace
+
+int nature::node::RunGlobalPath(std::shared_ptr<nature::node::NodeProxy> n)
 {
-  auto n = nature::node::init_node(argc, argv, "nature_global_path_node");
 
   auto path_pub = n->create_publisher<nature::msg::Path>("nature/global_path", 10);
   auto waypoint_pub = n->create_publisher<nature::msg::Path>("nature/waypoints", 10);
   auto current_waypoint_pub = n->create_publisher<nature::msg::Int32>("nature/current_waypoint", 10);
   auto dist_to_current_waypoint_pub = n->create_publisher<nature::msg::Float64>("nature/distance_to_current_waypoint", 10);
+  auto cost_to_go_pub = n->create_publisher<nature::msg::LayeredGrid>("nature/cost_to_go", 1);
+  auto path_age_pub = n->create_publisher<nature::msg::Float64>("nature/global_path_age", 10);
   auto odometry_sub = n->create_subscription<nature::msg::Odometry>("nature/odometry", 10, OdometryCallback);
   auto map_sub = n->create_subscription<nature::msg::OccupancyGrid>("nature/occupancy_grid", 10, MapCallback);
   auto segmentation_map_sub = n->create_subscription<nature::msg::OccupancyGrid>("nature/segmentation_grid", 10, SegmentationMapCallback);
+  auto layered_map_sub = n->create_subscription<nature::msg::LayeredGrid>("nature/layered_grid", 10, LayeredMapCallback);
+  auto map_update_sub = n->create_subscription<nature::msg::OccupancyGridUpdate>("nature/occupancy_grid_updates", 10, MapUpdateCallback);
+  auto segmentation_map_update_sub = n->create_subscription<nature::msg::OccupancyGridUpdate>("nature/segmentation_grid_updates", 10, SegmentationMapUpdateCallback);
   auto waypoint_sub = n->create_subscription<nature::msg::Path>("nature/new_waypoints", 10, WaypointCallback);
 
   // ctg, 8-19-2021
@@ -81,7 +191,40 @@ int main(int argc, char *argv[])
 
   n->get_parameter("~goal_dist", goal_dist, 3.0f);
   n->get_parameter("~display", display_type, nature::visualization::default_display);
+  float display_fps;
+  n->get_parameter("~display_fps", display_fps, nature::visualization::default_display_fps);
   n->get_parameter("~global_lookahead", global_lookahead, 50.0f);
+  bool incremental_planning;
+  n->get_parameter("~incremental_planning", incremental_planning, false);
+  int connectivity;
+  n->get_parameter("~connectivity", connectivity, 4);
+  bool jump_point_search;
+  n->get_parameter("~jump_point_search", jump_point_search, false);
+  bool any_angle;
+  n->get_parameter("~any_angle", any_angle, false);
+  // search in 8x8 tiles, faster on large grids
+  bool tiled_grid;
+  n->get_parameter("~tiled_grid", tiled_grid, false);
+  bool hierarchical_planning;
+  n->get_parameter("~hierarchical_planning", hierarchical_planning, false);
+  int hpa_cluster_size;
+  n->get_parameter("~hpa_cluster_size", hpa_cluster_size, 32);
+  int hpa_refine_clusters;
+  n->get_parameter("~hpa_refine_clusters", hpa_refine_clusters, 3);
+  bool replan_on_demand;
+  n->get_parameter("~replan_on_demand", replan_on_demand, true);
+  float path_corridor;
+  n->get_parameter("~path_corridor", path_corridor, 5.0f);
+  float replan_period;
+  n->get_parameter("~replan_period", replan_period, 2.0f);
+  bool publish_cost_to_go;
+  n->get_parameter("~publish_cost_to_go", publish_cost_to_go, false);
+  bool async_planning;
+  n->get_parameter("~async_planning", async_planning, true);
+  bool multi_leg_planning;
+  n->get_parameter("~multi_leg_planning", multi_leg_planning, false);
+  int mission_threads;
+  n->get_parameter("~mission_threads", mission_threads, 4);
   n->get_parameter("/waypoints_x", waypoints_x_list, std::vector<double>(0));
   n->get_parameter("/waypoints_y", waypoints_y_list, std::vector<double>(0));
   
@@ -126,8 +269,139 @@ int main(int argc, char *argv[])
     state_pub->publish(state);
   }
 
-  auto visualizer = nature::visualization::create_visualizer(display_type);
+  auto visualizer = nature::visualization::create_visualizer(display_type, display_fps);
+  auto configure_astar = [&](nature::planning::Astar &planner){
+    planner.SetIncremental(incremental_planning);
+    if (tiled_grid) planner.SetLayout(nature::common::GridLayout::TILED);
+    if (any_angle) planner.SetConnectivity(nature::planning::Astar::ANY_ANGLE);
+    else if (jump_point_search) planner.SetConnectivity(nature::planning::Astar::JUMP_POINT);
+    else if (connectivity==8) planner.SetConnectivity(nature::planning::Astar::EIGHT_CONNECTED);
+  };
   nature::planning::Astar astar_planner(visualizer);
+  configure_astar(astar_planner);
+  nature::planning::HpaStar hpa_planner;
+  hpa_planner.SetClusterSize(hpa_cluster_size);
+  hpa_planner.SetRefineClusters(hpa_refine_clusters);
+
+  // published shared, the local planner in the same process gets it without a copy
+  boost::shared_ptr<nature::msg::LayeredGrid> cost_to_go_msg;
+  std::vector<MissionLeg> mission_legs;
+  auto solve_request = [&](PlanRequest &req){
+    // solves for a goal that has since changed stop early and are dropped
+    unsigned int generation = req.goal_generation;
+    auto superseded = [generation](){ return goal_generation.load() != generation; };
+    astar_planner.SetCancelCheck(superseded);
+    hpa_planner.SetCancelCheck(superseded);
+    // the planners keep their grids between solves and only compare the changed cells
+    std::vector<nature::planning::Astar*> astar_planners(1, &astar_planner);
+    for (auto & leg : mission_legs){
+      if (leg.planner) astar_planners.push_back(leg.planner.get());
+    }
+    if (req.replaced){
+      hpa_planner.SetAllChanged();
+      for (auto planner : astar_planners) planner->SetAllChanged();
+    }
+    else{
+      hpa_planner.AddChangedRegion(req.changed);
+      for (auto planner : astar_planners) planner->AddChangedRegion(req.changed);
+    }
+    if (req.path){
+      // leg 0 runs from the vehicle to the goal, leg k from waypoint k-1 to waypoint k of the request
+      int nlegs = multi_leg_planning ? std::max(1, (int)req.waypoints.size()) : 1;
+      int last_leg = req.first_waypoint + nlegs - 1;
+      if ((int)mission_legs.size() < last_leg) mission_legs.resize(last_leg);
+      std::vector<std::vector<std::vector<float>>> leg_paths(nlegs);
+      std::atomic<bool> cancelled(false);
+#pragma omp parallel for schedule(dynamic) num_threads(std::max(1, mission_threads)) if(nlegs>1)
+      for (int k = 0; k < nlegs; k++){
+        if (k == 0){
+          leg_paths[0] = hierarchical_planning ?
+            hpa_planner.PlanPath(&req.grid, &req.segmentation_grid, req.goal, req.position) :
+            astar_planner.PlanPath(&req.grid, &req.segmentation_grid, req.goal, req.position);
+          // the flag of the other planner is left from an earlier solve
+          if (hierarchical_planning ? hpa_planner.WasCancelled() : astar_planner.WasCancelled()) cancelled = true;
+          continue;
+        }
+        MissionLeg &leg = mission_legs[req.first_waypoint + k - 1];
+        const std::vector<float> &from = req.waypoints[k-1];
+        const std::vector<float> &to = req.waypoints[k];
+        // a cached leg is kept while no cell along it got more occupied
+        if (leg.solved && leg.from == from && leg.to == to && leg.monitor.Valid(&req.grid, to, from)){
+          leg_paths[k] = leg.monitor.GetPath();
+          continue;
+        }
+        if (!leg.planner){
+          leg.planner.reset(new nature::planning::Astar(visualizer));
+          configure_astar(*leg.planner);
+          leg.monitor.SetCorridor(path_corridor);
+          leg.monitor.SetCheckDistance(std::numeric_limits<float>::max());
+        }
+        leg.planner->SetCancelCheck(superseded);
+        std::vector<std::vector<float>> leg_path;
+        // legs leaving the grid stay straight, there is nothing to plan around
+        float ox = req.grid.info.origin.position.x;
+        float oy = req.grid.info.origin.position.y;
+        float ex = ox + req.grid.info.width*req.grid.info.resolution;
+        float ey = oy + req.grid.info.height*req.grid.info.resolution;
+        bool on_grid = from[0]>=ox && from[0]<ex && from[1]>=oy && from[1]<ey &&
+                       to[0]>=ox && to[0]<ex && to[1]>=oy && to[1]<ey;
+        if (on_grid) leg_path = leg.planner->PlanPath(&req.grid, &req.segmentation_grid, to, from);
+        if (!on_grid || leg_path.empty()){
+          leg_path.clear();
+          leg_path.push_back(from);
+          leg_path.push_back(to);
+        }
+        if (leg.planner->WasCancelled()){
+          leg.solved = false;
+          cancelled = true;
+          continue;
+        }
+        leg.monitor.SetPath(&req.grid, leg_path, to);
+        leg.from = from;
+        leg.to = to;
+        leg.solved = true;
+        leg_paths[k] = leg_path;
+      }
+      std::vector<std::vector<float>> solved;
+      for (int k = 0; k < nlegs; k++){
+        solved.insert(solved.end(), leg_paths[k].begin(), leg_paths[k].end());
+      }
+      if (!cancelled){
+        std::lock_guard<std::mutex> lock(result_mutex);
+        plan_result.path.swap(solved);
+        plan_result.grid = req.grid;
+        plan_result.goal = req.goal;
+        plan_result.stamp = req.stamp;
+        plan_result.trace = req.trace;
+        plan_result.fresh = true;
+      }
+    }
+    // one reverse search per grid update gives the local planner the cost to go of every cell
+    // after a path solved by astar_planner it already holds this grid
+    if (req.path && !hierarchical_planning) astar_planner.AddChangedRegion(nature::common::GridRoi());
+    if (req.cost_to_go && astar_planner.ComputeCostToGo(&req.grid, &req.segmentation_grid, req.goal)){
+      const std::vector<float> &ctg = astar_planner.GetCostToGo();
+      nature::msg::LayeredGrid &cost_to_go = nature::node::reuse_message(cost_to_go_msg);
+      cost_to_go.header = req.grid.header;
+      cost_to_go.info = req.grid.info;
+      cost_to_go.float_layers.assign(1, "cost_to_go");
+      cost_to_go.float_data.resize(ctg.size());
+      for (size_t c = 0; c < ctg.size(); c++){
+        cost_to_go.float_data[c] = std::isinf(ctg[c]) ? std::numeric_limits<float>::quiet_NaN() : ctg[c];
+      }
+      cost_to_go_pub->publish(cost_to_go_msg);
+    }
+    planner_busy = false;
+  };
+
+  auto plan_worker = [&](){
+    PlanRequest req;
+    while (planner_running){
+      if (plan_queue.Pop(req, std::chrono::milliseconds(100))) solve_request(req);
+    }
+  };
+  nature::common::ReplayThread planning_thread;
+  if (async_planning) planning_thread = nature::common::ReplayThread(plan_worker);
 
   nature::node::Rate r(20.0f); // Hz
   bool shutdown_condition = false;
@@ -135,8 +409,20 @@ int main(int argc, char *argv[])
   int current_waypoint = 0;
   int shutdown_count = 0;
   bool waypoints_change_once = true;
+  // last solved path, republished while it stays valid
+  nature::planning::PathMonitor path_monitor;
+  path_monitor.SetCorridor(path_corridor);
+  path_monitor.SetCheckDistance(global_lookahead);
+  double last_solve_time = -1.0e9;
+  double path_stamp = 0.0;
+  nature::node::TraceStamp path_trace;
+  std::vector<float> last_goal;
+  bool cost_to_go_needed = publish_cost_to_go;
+  double diagnostics_period;
+  n->get_parameter("~diagnostics_period", diagnostics_period, 1.0);
+  auto diagnostics = nature::node::StageDiagnostics::make_shared("global_path", diagnostics_period, n);
   //while (nature::node::ok() && !goal_reached){
-  while (nature::node::ok()){
+  while (n->ok()){
     state_pub->publish(state);
     if (waypoints_rcvd && waypoints_change_once) {
       // process a new set of waypoints
@@ -156,7 +442,62 @@ int main(int argc, char *argv[])
       pos.push_back(odom.pose.pose.position.x);
       pos.push_back(odom.pose.pose.position.y);
 
-      std::vector<std::vector<float>> path = astar_planner.PlanPath(&current_grid, &segmentation_grid, goal, pos);
+      // solve only when the goal moved, a cell on the next global_lookahead meters of the cached
+      // path got more occupied or the vehicle left its corridor,
+      // and every replan_period so cheaper routes through new cost changes are still found
+      double now = n->get_now_seconds();
+      if (goal != last_goal){
+        goal_generation++;
+        last_goal = goal;
+        cost_to_go_needed = publish_cost_to_go;
+      }
+      if (new_grid_rcvd && publish_cost_to_go) cost_to_go_needed = true;
+      new_grid_rcvd = false;
+      bool solve = !replan_on_demand || now - last_solve_time >= replan_period ||
+                   !path_monitor.Valid(&current_grid, goal, pos);
+      // the planning thread takes one snapshot at a time, the latest one when it is free
+      if ((solve || cost_to_go_needed) && !planner_busy){
+        PlanRequest req;
+        req.grid = current_grid;
+        req.segmentation_grid = segmentation_grid;
+        req.goal = goal;
+        req.position = pos;
+        req.changed = grid_changes;
+        req.replaced = grid_replaced;
+        grid_changes = nature::common::GridRoi();
+        grid_replaced = false;
+        req.stamp = now;
+        req.trace = grid_trace;
+        req.path = solve;
+        req.cost_to_go = cost_to_go_needed;
+        req.goal_generation = goal_generation;
+        if (multi_leg_planning){
+          req.first_waypoint = current_waypoint;
+          for (int w = current_waypoint; w < (int)current_waypoints.poses.size(); w++){
+            req.waypoints.push_back({(float)current_waypoints.poses[w].pose.position.x,
+                                     (float)current_waypoints.poses[w].pose.position.y});
+          }
+        }
+        planner_busy = true;
+        if (async_planning) plan_queue.Push(req);
+        else solve_request(req);
+        if (solve) last_solve_time = now;
+        cost_to_go_needed = false;
+      }
+      {
+        std::lock_guard<std::mutex> lock(result_mutex);
+        if (plan_result.fresh){
+          // patches can land on the current grid while the path is solved
+          path_monitor.SetPath(&plan_result.grid, plan_result.path, plan_result.goal);
+          path_stamp = plan_result.stamp;
+          path_trace = plan_result.trace;
+          plan_result.fresh = false;
+        }
+      }
+      const std::vector<std::vector<float>> &path = path_monitor.GetPath();
+      nature::msg::Float64 path_age;
+      path_age.data = now - path_stamp;
+      path_age_pub->publish(path_age);
 
       nature::msg::Path ros_path;
       //ros_path.header.frame_id = "odom";
@@ -176,7 +517,8 @@ int main(int argc, char *argv[])
       // ctg 8/19/21
       // if not on the last waypoint, add a straight path to the next waypoint to the global path
       // this helps the local planner make smooth transitions between waypoints
-      if (ros_path.poses.size()>1) {
+      // with multi-leg planning the path already goes through all of them
+      if (ros_path.poses.size()>1 && !multi_leg_planning) {
         int cp =current_waypoint;
         while (cp<current_waypoints.poses.size()-1){
           nature::msg::PoseStamped pose;
@@ -192,7 +534,7 @@ int main(int argc, char *argv[])
         }
       }
 
-      ros_path.header.stamp = n->get_stamp();
+      ros_path.header.stamp = nature::node::LatencyTrace::OutputStamp(path_trace, *n);
       nature::node::set_seq(ros_path.header, nl);
 
       for (int i = 0; i < ros_path.poses.size(); i++){
@@ -200,6 +542,7 @@ int main(int argc, char *argv[])
       }
 
       path_pub->publish(ros_path);
+      if (!path.empty()) GLOBAL_PATH_LATENCY.Record(path_trace, n->get_now_seconds());
       waypoint_pub->publish(current_waypoints);
 
 
@@ -240,10 +583,20 @@ int main(int argc, char *argv[])
     //  state_pub->publish(state);
     //}
 
+    diagnostics->update();
     n->spin_some();
     r.sleep();
     nl++;
   }
 
+  planner_running = false;
+  plan_queue.Close();
+  if (planning_thread.joinable()) planning_thread.join();
   return 0;
 }
+
+#ifndef NATURE_NODELET
+int main(int argc, char *argv[]){
+  return nature::node::RunGlobalPath(nature::node::init_node(argc, argv, "nature_global_path_node"));
+}
+#endif
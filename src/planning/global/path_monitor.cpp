@@ -0,0 +1,85 @@
+#include <cmath>
+#include <limits>
+#include <algorithm>
+// project includes
+#include "nature/planning/global/path_monitor.h"
+
+namespace nature {
+namespace planning{
+
+PathMonitor::PathMonitor(){
+
+}
+
+int8_t PathMonitor::GridValue(nature::msg::OccupancyGrid *grid, float x, float y){
+  int w = grid->info.width;
+  int h = grid->info.height;
+  float res = grid->info.resolution;
+  if (res <= 0.0f || grid->data.size() != (size_t)w*h) return 0;
+  int i = (int)std::floor((x - grid->info.origin.position.x)/res);
+  int j = (int)std::floor((y - grid->info.origin.position.y)/res);
+  // unknown (-1) and off-grid cells count as free
+  if (i<0 || i>=w || j<0 || j>=h) return 0;
+  return std::max((int8_t)0, grid->data[i*h + j]);
+}
+
+void PathMonitor::SetPath(nature::msg::OccupancyGrid *grid, const std::vector<std::vector<float> > &path, std::vector<float> goal){
+  path_ = path;
+  goal_ = goal;
+  path_s_.assign(path_.size(), 0.0f);
+  samples_.clear();
+  if (path_.size() < 2) return;
+  // half a cell between samples so no crossed cell is skipped
+  float step = grid->info.resolution > 0.0f ? 0.5f*grid->info.resolution : 0.5f;
+  for (size_t k=0;k+1<path_.size();k++){
+    float dx = path_[k+1][0] - path_[k][0];
+    float dy = path_[k+1][1] - path_[k][1];
+    float len = std::sqrt(dx*dx + dy*dy);
+    path_s_[k+1] = path_s_[k] + len;
+    int ns = std::max(1, (int)std::ceil(len/step));
+    for (int m=(k==0 ? 0 : 1);m<=ns;m++){
+      float t = (float)m/ns;
+      Sample smp;
+      smp.x = path_[k][0] + t*dx;
+      smp.y = path_[k][1] + t*dy;
+      smp.s = path_s_[k] + t*len;
+      smp.value = GridValue(grid, smp.x, smp.y);
+      samples_.push_back(smp);
+    }
+  }
+}
+
+bool PathMonitor::Valid(nature::msg::OccupancyGrid *grid, std::vector<float> goal, std::vector<float> position) const {
+  if (path_.size() < 2 || goal != goal_) return false;
+
+  // closest point of the path to the vehicle, the part behind it is already driven
+  float closest_dist = std::numeric_limits<float>::max();
+  float closest_s = 0.0f;
+  for (size_t k=0;k+1<path_.size();k++){
+    float ax = path_[k][0], ay = path_[k][1];
+    float dx = path_[k+1][0] - ax, dy = path_[k+1][1] - ay;
+    float len2 = dx*dx + dy*dy;
+    float t = len2 > 0.0f ? ((position[0]-ax)*dx + (position[1]-ay)*dy)/len2 : 0.0f;
+    t = std::max(0.0f, std::min(1.0f, t));
+    float ex = ax + t*dx - position[0];
+    float ey = ay + t*dy - position[1];
+    float d = ex*ex + ey*ey;
+    if (d < closest_dist){
+      closest_dist = d;
+      closest_s = path_s_[k] + t*(path_s_[k+1] - path_s_[k]);
+    }
+  }
+  if (closest_dist > corridor_*corridor_) return false;
+
+  float s_end = closest_s + check_distance_;
+  auto first = std::lower_bound(samples_.begin(), samples_.end(), closest_s,
+                                [](const Sample &smp, float s){ return smp.s < s; });
+  for (auto it = first; it != samples_.end() && it->s <= s_end; ++it){
+    int8_t value = GridValue(grid, it->x, it->y);
+    if (value > it->value) return false;
+  }
+  return true;
+}
+
+} // namespace planning
+} // namespace nature
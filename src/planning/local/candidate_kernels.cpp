@@ -0,0 +1,120 @@
+#include "nature/planning/local/candidate_kernels.h"
+#include <math.h>
+#if defined(__AVX__)
+#include <immintrin.h>
+#endif
+#if defined(__SSE2__)
+#include <xmmintrin.h>
+#include <emmintrin.h>
+#endif
+#if defined(__ARM_NEON) && defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+namespace nature{
+namespace planning{
+
+/// Lane operations, the kernels are written once over them with a scalar tail
+#if defined(__AVX__)
+typedef __m256 Lanes;
+static const int LANES = 8;
+static inline Lanes Load(const float *p){ return _mm256_loadu_ps(p); }
+static inline void Store(float *p, Lanes a){ _mm256_storeu_ps(p, a); }
+static inline Lanes Set(float a){ return _mm256_set1_ps(a); }
+static inline Lanes Add(Lanes a, Lanes b){ return _mm256_add_ps(a, b); }
+static inline Lanes Sub(Lanes a, Lanes b){ return _mm256_sub_ps(a, b); }
+static inline Lanes Mul(Lanes a, Lanes b){ return _mm256_mul_ps(a, b); }
+static inline Lanes Div(Lanes a, Lanes b){ return _mm256_div_ps(a, b); }
+static inline Lanes Sqrt(Lanes a){ return _mm256_sqrt_ps(a); }
+static inline Lanes Abs(Lanes a){ return _mm256_andnot_ps(_mm256_set1_ps(-0.0f), a); }
+#elif defined(__SSE2__)
+typedef __m128 Lanes;
+static const int LANES = 4;
+static inline Lanes Load(const float *p){ return _mm_loadu_ps(p); }
+static inline void Store(float *p, Lanes a){ _mm_storeu_ps(p, a); }
+static inline Lanes Set(float a){ return _mm_set1_ps(a); }
+static inline Lanes Add(Lanes a, Lanes b){ return _mm_add_ps(a, b); }
+static inline Lanes Sub(Lanes a, Lanes b){ return _mm_sub_ps(a, b); }
+static inline Lanes Mul(Lanes a, Lanes b){ return _mm_mul_ps(a, b); }
+static inline Lanes Div(Lanes a, Lanes b){ return _mm_div_ps(a, b); }
+static inline Lanes Sqrt(Lanes a){ return _mm_sqrt_ps(a); }
+static inline Lanes Abs(Lanes a){ return _mm_andnot_ps(_mm_set1_ps(-0.0f), a); }
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+typedef float32x4_t Lanes;
+static const int LANES = 4;
+static inline Lanes Load(const float *p){ return vld1q_f32(p); }
+static inline void Store(float *p, Lanes a){ vst1q_f32(p, a); }
+static inline Lanes Set(float a){ return vdupq_n_f32(a); }
+static inline Lanes Add(Lanes a, Lanes b){ return vaddq_f32(a, b); }
+static inline Lanes Sub(Lanes a, Lanes b){ return vsubq_f32(a, b); }
+static inline Lanes Mul(Lanes a, Lanes b){ return vmulq_f32(a, b); }
+static inline Lanes Div(Lanes a, Lanes b){ return vdivq_f32(a, b); }
+static inline Lanes Sqrt(Lanes a){ return vsqrtq_f32(a); }
+static inline Lanes Abs(Lanes a){ return vabsq_f32(a); }
+#else
+typedef float Lanes;
+static const int LANES = 1;
+static inline Lanes Load(const float *p){ return *p; }
+static inline void Store(float *p, Lanes a){ *p = a; }
+static inline Lanes Set(float a){ return a; }
+static inline Lanes Add(Lanes a, Lanes b){ return a + b; }
+static inline Lanes Sub(Lanes a, Lanes b){ return a - b; }
+static inline Lanes Mul(Lanes a, Lanes b){ return a * b; }
+static inline Lanes Div(Lanes a, Lanes b){ return a / b; }
+static inline Lanes Sqrt(Lanes a){ return sqrtf(a); }
+static inline Lanes Abs(Lanes a){ return fabsf(a); }
+#endif
+
+void EvalCubics(int n, const float *const c[4], float s, float *out){
+  // Horner's rule as Polynomial::At, zero higher coefficients give the lower degree values exactly
+  Lanes vs = Set(s);
+  int k = 0;
+  for (;k+LANES<=n;k+=LANES){
+    Lanes y = Add(Load(c[0] + k), Mul(vs, Add(Load(c[1] + k), Mul(vs, Add(Load(c[2] + k), Mul(vs, Load(c[3] + k)))))));
+    Store(out + k, y);
+  }
+  for (;k<n;k++){
+    out[k] = c[0][k] + s*(c[1][k] + s*(c[2][k] + s*c[3][k]));
+  }
+}
+
+void OffsetCurvatures(int n, const float *rho, const float *drho, const float *ddrho, float k0,
+                      float *curvature, float *turn){
+  Lanes one = Set(1.0f), vk0 = Set(k0);
+  int k = 0;
+  for (;k+LANES<=n;k+=LANES){
+    Lanes b = Sub(one, Mul(Load(rho + k), vk0));
+    Lanes sign = Div(b, Abs(b));
+    Lanes d = Load(drho + k);
+    Lanes d2 = Mul(d, d);
+    Lanes A = Sqrt(Add(d2, Mul(b, b)));
+    Lanes kappa = Mul(Div(sign, A), Add(vk0, Div(Add(Mul(b, Load(ddrho + k)), Mul(vk0, d2)), Mul(A, A))));
+    Store(curvature + k, kappa);
+    Store(turn + k, Mul(A, kappa));
+  }
+  for (;k<n;k++){
+    float b = 1.0f - rho[k]*k0;
+    float sign = b / fabsf(b);
+    float d2 = drho[k]*drho[k];
+    float A = sqrtf(d2 + b*b);
+    curvature[k] = (sign / A)*(k0 + (b*ddrho[k] + k0*d2) / (A*A));
+    turn[k] = A*curvature[k];
+  }
+}
+
+void OffsetPoints(int n, const float *rho, float bx, float by, float nx, float ny, float *x, float *y){
+  Lanes vbx = Set(bx), vby = Set(by), vnx = Set(nx), vny = Set(ny);
+  int k = 0;
+  for (;k+LANES<=n;k+=LANES){
+    Lanes r = Load(rho + k);
+    Store(x + k, Add(vbx, Mul(vnx, r)));
+    Store(y + k, Add(vby, Mul(vny, r)));
+  }
+  for (;k<n;k++){
+    x[k] = bx + nx*rho[k];
+    y[k] = by + ny*rho[k];
+  }
+}
+
+} // namespace planning
+} // namespace nature
@@ -1,6 +1,12 @@
 /**
  * \file nature_planner_node.cpp
  * Plan a local trajectory using a global path.
+ *
+ * By default a trajectory is planned for every odometry message. With ~event_driven
+ * a plan only runs when a grid arrives, the centerline changes, the vehicle moved more
+ * than ~replan_distance or turned more than ~replan_heading_degrees, or ~max_plan_period
+ * passed since the last plan. The centerline is only rebuilt when the path it follows
+ * changes, or on each plan when it is trimmed around the vehicle.
  * 
  * \author Chris Goodin
  *
@@ -11,66 +17,158 @@
 // ROS includes
 #include "nature/node/ros_types.h"
 #include "nature/node/node_proxy.h"
+#include "nature/node/stage_diagnostics.h"
+#include "nature/node/pipeline_stages.h"
+#include "nature/node/latency_trace.h"
 // nature includes
 #include "nature/planning/local/spline_planner.h"
 #include "nature/planning/local/spline_plotter.h"
 #include "nature/visualization/visualization_factory.h"
 
+namespace {
+
 nature::msg::Odometry odom;
-nature::msg::OccupancyGrid grid;
-nature::msg::OccupancyGrid segmentation_grid;
+// latest grids, shared with the subscriptions until a patch is applied
+nature::utils::ReceivedGrid received_grid;
+nature::utils::ReceivedGrid received_segmentation_grid;
+// dilated grids, their buffers are kept between cycles
+nature::msg::OccupancyGrid dilated_grid;
+nature::msg::OccupancyGrid dilated_segmentation_grid;
 nature::msg::Path global_path;
 nature::msg::Path waypoints;
+nature::msg::LayeredGrid cost_to_go;
+bool new_cost_to_go_rcvd = false;
 bool odom_rcvd = false;
+bool odom_valid = false;
 bool new_grid_rcvd = false;
 bool new_seg_grid_rcvd = false;
 
+static const int STAGE_CYCLE = nature::node::RegisterStage("local.cycle");
+static const int STAGE_DILATE = nature::node::RegisterStage("local.dilate");
+static const int STAGE_CLEARANCE = nature::node::RegisterStage("local.clearance");
+// the scan behind the occupancy grid, the local path is stamped with it
+nature::node::TraceStamp grid_trace;
+static const nature::node::LatencyTrace LOCAL_PATH_LATENCY("local_path");
+// what changed in the grids since the last cost calculation, patched cells only count when no grid was replaced
+bool grids_replaced = false;
+bool grids_patched = false;
+nature::common::GridRoi patched_cells;
+// hashes of the paths the centerline is built from, republished unchanged paths keep it
+uint64_t global_path_hash = 0;
+uint64_t waypoints_hash = 0;
+bool global_path_changed = false;
+bool waypoints_changed = false;
+
+/// 64 bit FNV-1a of the pose positions
+uint64_t HashPositions(const nature::msg::Path &path){
+  uint64_t hash = 14695981039346656037ULL;
+  for (size_t k = 0; k < path.poses.size(); k++){
+    const double xy[2] = {path.poses[k].pose.position.x, path.poses[k].pose.position.y};
+    const unsigned char *bytes = reinterpret_cast<const unsigned char *>(xy);
+    for (size_t b = 0; b < sizeof(xy); b++){
+      hash ^= bytes[b];
+      hash *= 1099511628211ULL;
+    }
+  }
+  return hash;
+}
+
+void MarkPatched(const nature::msg::OccupancyGridUpdate &update){
+  patched_cells = patched_cells.Union(nature::common::GridRoi(update.x, update.y, update.x + (int)update.width, update.y + (int)update.height));
+  grids_patched = true;
+}
+
 void OdometryCallback(nature::msg::OdometryPtr rcv_odom){
   odom = *rcv_odom;
   odom_rcvd = true;
+  odom_valid = true;
 }
 
 void GridCallback(nature::msg::OccupancyGridPtr rcv_grid){
-  grid = *rcv_grid;
+  received_grid.Set(rcv_grid);
+  grid_trace.Receive(rcv_grid->header, nature::node::now_seconds());
   new_grid_rcvd = true;
+  grids_replaced = true;
 }
 
 void SegmentationGridCallback(nature::msg::OccupancyGridPtr rcv_grid){
-    segmentation_grid = *rcv_grid;
+    received_segmentation_grid.Set(rcv_grid);
     new_seg_grid_rcvd = true;
+    grids_replaced = true;
+}
+
+void LayeredGridCallback(nature::msg::LayeredGridPtr rcv_grid){
+  if (received_grid.SetLayer(*rcv_grid, "occupancy")){
+    new_grid_rcvd = grids_replaced = true;
+    grid_trace.Receive(rcv_grid->header, nature::node::now_seconds());
+  }
+  if (received_segmentation_grid.SetLayer(*rcv_grid, "segmentation")) new_seg_grid_rcvd = grids_replaced = true;
+}
+
+void GridUpdateCallback(nature::msg::OccupancyGridUpdatePtr rcv_update){
+  if (received_grid.ApplyUpdate(*rcv_update)){
+    new_grid_rcvd = true;
+    MarkPatched(*rcv_update);
+    grid_trace.Receive(rcv_update->header, nature::node::now_seconds());
+  }
+}
+
+void SegmentationGridUpdateCallback(nature::msg::OccupancyGridUpdatePtr rcv_update){
+  if (received_segmentation_grid.ApplyUpdate(*rcv_update)){
+    new_seg_grid_rcvd = true;
+    MarkPatched(*rcv_update);
+  }
 }
 
 void PathCallback(nature::msg::PathPtr rcv_path){
   global_path = *rcv_path;
+  uint64_t hash = HashPositions(global_path);
+  if (hash != global_path_hash) global_path_changed = true;
+  global_path_hash = hash;
 }
 
 void WaypointCallback(nature::msg::PathPtr wp_path){
   waypoints = *wp_path;
+  uint64_t hash = HashPositions(waypoints);
+  if (hash != waypoints_hash) waypoints_changed = true;
+  waypoints_hash = hash;
 }
 
-int main(int argc, char *argv[]){
+void CostToGoCallback(nature::msg::LayeredGridPtr rcv_cost_to_go){
+  cost_to_go = *rcv_cost_to_go;
+  new_cost_to_go_rcvd = true;
+}
+
+} // namespace
+
+int nature::node::RunLocalPlanner(std::shared_ptr<nature::node::NodeProxy> n){
 
-  auto n = nature::node::init_node(argc, argv, "nature_planner_node");
 
   // Create publishers and subscribers
   auto path_pub = n->create_publisher<nature::msg::Path>("nature/local_path", 10);
   auto odometry_sub = n->create_subscription<nature::msg::Odometry>("nature/odometry", 10, OdometryCallback);
   auto grid_sub = n->create_subscription<nature::msg::OccupancyGrid>("nature/occupancy_grid", 10, GridCallback);
   auto segmentation_grid_sub = n->create_subscription<nature::msg::OccupancyGrid>("nature/segmentation_grid", 10, SegmentationGridCallback);
+  auto layered_grid_sub = n->create_subscription<nature::msg::LayeredGrid>("nature/layered_grid", 10, LayeredGridCallback);
+  auto grid_update_sub = n->create_subscription<nature::msg::OccupancyGridUpdate>("nature/occupancy_grid_updates", 10, GridUpdateCallback);
+  auto segmentation_grid_update_sub = n->create_subscription<nature::msg::OccupancyGridUpdate>("nature/segmentation_grid_updates", 10, SegmentationGridUpdateCallback);
   auto path_sub = n->create_subscription<nature::msg::Path>("nature/global_path", 10, PathCallback);
   auto wp_sub = n->create_subscription<nature::msg::Path>("nature/waypoints", 10, WaypointCallback);
+  auto cost_to_go_sub = n->create_subscription<nature::msg::LayeredGrid>("nature/cost_to_go", 1, CostToGoCallback);
 
   nature::planning::Planner planner;
   // planner params
   float path_look_ahead, vehicle_width, max_steer_angle, output_path_step, path_int_step, rate;
-  int dilation_factor, num_paths;
+  int dilation_factor, num_paths, lattice_layers, planner_threads;
   float w_c, w_d, w_s, w_r, w_t, cost_vis_text_size, ignore_coll_before_dist;
   bool trim_path, use_global_path, use_blend;
   std::string display, cost_vis;
-  bool keep_good_path;
+  bool keep_good_path, use_cost_to_go, use_clearance;
+  float clearance_margin;
   n->get_parameter("~path_look_ahead", path_look_ahead, 15.0f);
   n->get_parameter("~vehicle_width", vehicle_width, 3.0f);
   n->get_parameter("~num_paths", num_paths, 31);
+  n->get_parameter("~lattice_layers", lattice_layers, 1);
   n->get_parameter("~max_steer_angle", max_steer_angle, 0.43f);
   n->get_parameter("~output_path_step", output_path_step, 0.5f);
   n->get_parameter("~path_integration_step", path_int_step, 0.25f);
@@ -86,9 +184,28 @@ int main(int argc, char *argv[]){
   n->get_parameter("~use_global_path", use_global_path, false);
   n->get_parameter("~keep_good_path", keep_good_path, false);
   n->get_parameter("~use_blend", use_blend, true);
+  n->get_parameter("~use_cost_to_go", use_cost_to_go, false);
+  n->get_parameter("~planner_threads", planner_threads, 1);
+  n->get_parameter("~use_clearance", use_clearance, false);
+  n->get_parameter("~clearance_margin", clearance_margin, 1.0f);
   n->get_parameter("~cost_vis", cost_vis, std::string("final"));
   n->get_parameter("~cost_vis_text_size", cost_vis_text_size, 2.0f);
+  float cost_vis_rate, cost_vis_step, cost_vis_threshold;
+  n->get_parameter("~cost_vis_rate", cost_vis_rate, 10.0f);
+  n->get_parameter("~cost_vis_step", cost_vis_step, 1.0f);
+  n->get_parameter("~cost_vis_threshold", cost_vis_threshold, 0.01f);
+  double diagnostics_period;
+  n->get_parameter("~diagnostics_period", diagnostics_period, 1.0);
   n->get_parameter("~display", display, nature::visualization::default_display);
+  float display_fps;
+  bool event_driven;
+  float replan_distance, replan_heading, max_plan_period;
+  n->get_parameter("~event_driven", event_driven, false);
+  n->get_parameter("~replan_distance", replan_distance, 0.5f);
+  n->get_parameter("~replan_heading_degrees", replan_heading, 5.0f);
+  n->get_parameter("~max_plan_period", max_plan_period, 0.2f);
+  replan_heading = replan_heading * (float)M_PI / 180.0f;
+  n->get_parameter("~display_fps", display_fps, nature::visualization::default_display_fps);
 
   planner.SetArcLengthIntegrationStep(path_int_step);
   planner.SetComfortabilityWeight(w_c);
@@ -98,11 +215,16 @@ int main(int argc, char *argv[]){
   planner.SetSegmentationFactorWeight(w_t);
   planner.SetUseBlend(use_blend);
   planner.SetIgnoreCollBeforeDist(ignore_coll_before_dist);
+  planner.SetNumThreads(planner_threads);
+  planner.SetUseClearance(use_clearance, clearance_margin);
+  // the clearance already accounts for the vehicle width
+  if (use_clearance) dilation_factor = 0;
 
   std::shared_ptr<nature::planning::Plotter> plotter = nature::visualization::create_local_path_plotter(display, cost_vis, n,
                                                                                                           planner.GetComfortabilityWeight(), planner.GetStaticSafetyWeight(),
                                                                                                           planner.GetPathAdherenceWeight(), planner.GetDynamicSafetyWeight(),
-                                                                                                          planner.GetSegmentationWeight(), cost_vis_text_size);
+                                                                                                          planner.GetSegmentationWeight(), cost_vis_text_size,
+                                                                                                          cost_vis_rate, cost_vis_step, cost_vis_threshold, display_fps);
 
   unsigned int loop_count = 0;
   float dt = 1.0f / rate;
@@ -111,36 +233,74 @@ int main(int argc, char *argv[]){
   float path_age = 0.0f;
   float s_old = 0.0f;
   bool old_path_still_good = false;
-  while (nature::node::ok()){
-    double start_secs = n->get_now_seconds();
-    if (global_path.poses.size() > 0 && odom_rcvd && grid.data.size() > 0){
-
-      std::vector<nature::utils::vec2> path_points;
-      if (use_global_path){
-        for (int i = 0; i < global_path.poses.size(); i++){
-          nature::utils::vec2 point(global_path.poses[i].pose.position.x, global_path.poses[i].pose.position.y);
-          path_points.push_back(point);
+  bool dilate_grid = false;
+  bool dilate_seg_grid = false;
+  // the centerline, kept until the path it follows changes
+  nature::planning::Path path;
+  bool centerline_valid = false;
+  // pose and time of the last plan, for the event driven triggers
+  bool planned = false;
+  double last_plan_time = 0.0;
+  nature::utils::vec2 last_plan_position(0.0f, 0.0f);
+  float last_plan_heading = 0.0f;
+  auto diagnostics = nature::node::StageDiagnostics::make_shared("local_planner", diagnostics_period, n);
+  while (n->ok()){
+    nature::node::ScopedTimer cycle_timer(STAGE_CYCLE);
+    // the planner reads the received grids in place, or the dilated copies when dilating
+    const nature::msg::OccupancyGrid &grid = dilation_factor > 0 ? dilated_grid : received_grid.Get();
+    const nature::msg::OccupancyGrid &segmentation_grid = dilation_factor > 0 ? dilated_segmentation_grid : received_segmentation_grid.Get();
+    dilate_grid = dilate_grid || new_grid_rcvd;
+    dilate_seg_grid = dilate_seg_grid || new_seg_grid_rcvd;
+    bool new_cost_to_go = use_cost_to_go && new_cost_to_go_rcvd;
+    if (new_cost_to_go){
+      planner.SetCostToGo(cost_to_go);
+      new_cost_to_go_rcvd = false;
+    }
+    bool centerline_changed = use_global_path ? global_path_changed : waypoints_changed;
+    bool inputs_ready = global_path.poses.size() > 0 && received_grid.Get().data.size() > 0;
+    bool plan_due = odom_rcvd;
+    double now = n->get_now_seconds();
+    if (event_driven && inputs_ready && odom_valid){
+      nature::utils::vec2 position(odom.pose.pose.position.x, odom.pose.pose.position.y);
+      float turn = nature::utils::GetHeadingFromOrientation(odom.pose.pose.orientation) - last_plan_heading;
+      turn = (float)fabs(atan2(sin(turn), cos(turn)));
+      plan_due = !planned || new_grid_rcvd || new_seg_grid_rcvd || new_cost_to_go || centerline_changed ||
+                 nature::utils::length(position - last_plan_position) > replan_distance || turn > replan_heading ||
+                 now - last_plan_time >= max_plan_period;
+    }
+    if (inputs_ready && plan_due){
+
+      // a centerline trimmed around the vehicle moves with it
+      bool new_centerline = !centerline_valid || centerline_changed;
+      if (new_centerline || (trim_path && use_global_path)){
+        std::vector<nature::utils::vec2> path_points;
+        if (use_global_path){
+          for (int i = 0; i < global_path.poses.size(); i++){
+            nature::utils::vec2 point(global_path.poses[i].pose.position.x, global_path.poses[i].pose.position.y);
+            path_points.push_back(point);
+          }
         }
-      }
-      else{
-        for (int i = 0; i < waypoints.poses.size(); i++){
-          nature::utils::vec2 point(waypoints.poses[i].pose.position.x, waypoints.poses[i].pose.position.y);
-          path_points.push_back(point);
+        else{
+          for (int i = 0; i < waypoints.poses.size(); i++){
+            nature::utils::vec2 point(waypoints.poses[i].pose.position.x, waypoints.poses[i].pose.position.y);
+            path_points.push_back(point);
+          }
         }
-      }
 
-      nature::planning::Path path;
-      if (trim_path && use_global_path ){
-        nature::utils::vec2 current_pos(odom.pose.pose.position.x, odom.pose.pose.position.y);
-        path.Init(path_points, current_pos, 1.5f * path_look_ahead);
-      }
-      else{
-        path.Init(path_points);
+        path = nature::planning::Path();
+        if (trim_path && use_global_path ){
+          nature::utils::vec2 current_pos(odom.pose.pose.position.x, odom.pose.pose.position.y);
+          path.Init(path_points, current_pos, 1.5f * path_look_ahead);
+        }
+        else{
+          path.Init(path_points);
+        }
+        path.FixEnd();
+        centerline_valid = true;
+        global_path_changed = waypoints_changed = false;
       }
-      
-
+      // only extends the centerline when the vehicle is behind its start
       path.FixBeginning(odom.pose.pose.position.x, odom.pose.pose.position.y);
-      path.FixEnd();
 
       std::vector<nature::utils::vec2> culled_points = path.GetPoints();
       float s_max = path.GetTotalLength();
@@ -151,11 +311,24 @@ int main(int argc, char *argv[]){
       float s_lookahead = std::min(path_look_ahead, s_max - s);
       float theta = nature::utils::GetHeadingFromOrientation(odom.pose.pose.orientation);
       nature::planning::CurveInfo ci = path.GetCurvatureAndAngle(s);
-      path_age += dt;
+      path_age += event_driven && planned ? (float)(now - last_plan_time) : dt;
+      planned = true;
+      last_plan_time = now;
+      last_plan_position = nature::utils::vec2(odom.pose.pose.position.x, odom.pose.pose.position.y);
+      last_plan_heading = theta;
 
       float ds = s-s_old;
-      if (path_age>1.0f || ds>0.5f*path_look_ahead || !old_path_still_good || !keep_good_path){
-        planner.GeneratePaths(num_paths, s, rho_start, theta - ci.theta, s_lookahead, max_steer_angle, vehicle_width);
+      // candidates kept from another centerline are in its coordinates
+      if (path_age>1.0f || ds>0.5f*path_look_ahead || !old_path_still_good || !keep_good_path || new_centerline){
+        if (lattice_layers > 1){
+          // fans at evenly spaced look aheads up to the full one
+          std::vector<float> s_lookaheads;
+          for (int l = 1; l <= lattice_layers; l++) s_lookaheads.push_back(s_lookahead * l / lattice_layers);
+          planner.GenerateLattice(num_paths, s, rho_start, theta - ci.theta, s_lookaheads, max_steer_angle, vehicle_width);
+        }
+        else{
+          planner.GeneratePaths(num_paths, s, rho_start, theta - ci.theta, s_lookahead, max_steer_angle, vehicle_width);
+        }
         planner.SetCenterline(path);
         path_age = 0.0f;
         s_old = s;
@@ -181,12 +354,37 @@ int main(int argc, char *argv[]){
       float urx = std::max({lf_bounds_x, rf_bounds_x, lr_bounds_x, rr_bounds_x});
       float ury = std::max({lf_bounds_y, rf_bounds_y, lr_bounds_y, rr_bounds_y});
 
-      if (new_grid_rcvd) planner.DilateGrid(grid, dilation_factor, llx, lly, urx, ury);
-      if (new_seg_grid_rcvd) planner.DilateGrid(segmentation_grid, dilation_factor, llx, lly, urx, ury);
+      if (use_clearance && dilate_grid){
+        nature::node::ScopedTimer timer(STAGE_CLEARANCE);
+        planner.SetClearanceGrid(received_grid.Get(), llx, lly, urx, ury);
+        dilate_grid = false;
+      }
+      if (dilation_factor > 0 && dilate_grid){
+        nature::node::ScopedTimer timer(STAGE_DILATE);
+        planner.DilateGrid(received_grid.Get(), dilated_grid, dilation_factor, llx, lly, urx, ury);
+        dilate_grid = false;
+      }
+      if (dilation_factor > 0 && dilate_seg_grid){
+        nature::node::ScopedTimer timer(STAGE_DILATE);
+        planner.DilateGrid(received_segmentation_grid.Get(), dilated_segmentation_grid, dilation_factor, llx, lly, urx, ury);
+        dilate_seg_grid = false;
+      }
       // Note: if grid size gets large, DilateGrid can take a significant amount of time
 
+      // the planner keeps the costs of the cells that did not change, a dilated grid or
+      // the clearance can change outside the patches so those are taken as all new
+      if (!grids_replaced && !grids_patched){
+        planner.MarkGridUnchanged();
+      }
+      else if (!grids_replaced && dilation_factor == 0 && !use_clearance){
+        planner.MarkGridChanged(patched_cells);
+      }
+
       // most of the calculation time spent on this function call
       bool path_found = planner.CalculateCandidateCosts(grid, segmentation_grid, odom);
+      grids_replaced = false;
+      grids_patched = false;
+      patched_cells = nature::common::GridRoi();
       if (!path_found){
         old_path_still_good = false;
       }
@@ -194,12 +392,11 @@ int main(int argc, char *argv[]){
         old_path_still_good = true;
       }
 
-      if (display != "none"){
+      if (display != "none" && plotter->ReadyToDisplay()){
         plotter->AddMap(grid);
         plotter->SetPath(culled_points);
         plotter->AddWaypoints(waypoints);
-        std::vector<nature::planning::Candidate> paths = planner.GetCandidates();
-        plotter->AddCurves(paths);
+        plotter->AddCurves(planner.GetCandidates());
         plotter->Display();
       }
 
@@ -220,9 +417,10 @@ int main(int argc, char *argv[]){
         }
         //local_path.header.frame_id = "odom";
         local_path.header.frame_id = "tracer"; // Editado para Airsim JLV
-        local_path.header.stamp = n->get_stamp();
+        local_path.header.stamp = nature::node::LatencyTrace::OutputStamp(grid_trace, *n);
         nature::node::set_seq(local_path.header, loop_count);
         path_pub->publish(local_path);
+        LOCAL_PATH_LATENCY.Record(grid_trace, n->get_now_seconds());
       }
       else {
         nature::msg::Path local_path;
@@ -231,9 +429,10 @@ int main(int argc, char *argv[]){
         local_path.poses.push_back(pose);
         //local_path.header.frame_id = "odom";
         local_path.header.frame_id = "tracer"; // Editado para Airsim JLV
-        local_path.header.stamp = n->get_stamp();
+        local_path.header.stamp = nature::node::LatencyTrace::OutputStamp(grid_trace, *n);
         nature::node::set_seq(local_path.header, loop_count);
         path_pub->publish(local_path);
+        LOCAL_PATH_LATENCY.Record(grid_trace, n->get_now_seconds());
       }
       odom_rcvd = false;
     }
@@ -251,10 +450,8 @@ int main(int argc, char *argv[]){
     new_grid_rcvd = false;
     new_seg_grid_rcvd = false;
     loop_count++;
-    double end_secs = n->get_now_seconds();
-    if ((end_secs - start_secs) > 2.5 * dt){
-      //std::cout << "WARNING: TANG PLANNER TOOK " << (end_secs - start_secs) << " TO COMPLETE. REQUESTED UPDATE SPEED IS " << dt << std::endl;
-    }
+    cycle_timer.Stop();
+    diagnostics->update();
     elapsed_time += dt;
     n->spin_some();
     rosrate.sleep();
@@ -262,3 +459,9 @@ int main(int argc, char *argv[]){
 
   return 0;
 }
+
+#ifndef NATURE_NODELET
+int main(int argc, char *argv[]){
+  return nature::node::RunLocalPlanner(nature::node::init_node(argc, argv, "nature_planner_node"));
+}
+#endif
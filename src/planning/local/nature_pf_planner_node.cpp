@@ -11,18 +11,23 @@
 // ROS includes
 #include "nature/node/ros_types.h"
 #include "nature/node/node_proxy.h"
+#include "nature/node/latency_trace.h"
 // nature includes
 #include "nature/planning/local/pf_planner.h"
 #include "nature/visualization/visualization_factory.h"
 
 nature::msg::Odometry odom;
-nature::msg::OccupancyGrid grid;
-nature::msg::OccupancyGrid segmentation_grid;
+// latest grids, shared with the subscriptions
+nature::utils::ReceivedGrid grid;
+nature::utils::ReceivedGrid segmentation_grid;
 nature::msg::Path global_path;
 nature::msg::Path waypoints;
 bool odom_rcvd = false;
 bool new_grid_rcvd = false;
 bool new_seg_grid_rcvd = false;
+bool seg_grid_rcvd = false;
+// the scan behind the occupancy grid, the local path is stamped with it
+nature::node::TraceStamp grid_trace;
 
 void OdometryCallback(nature::msg::OdometryPtr rcv_odom){
   odom = *rcv_odom;
@@ -30,13 +35,23 @@ void OdometryCallback(nature::msg::OdometryPtr rcv_odom){
 }
 
 void GridCallback(nature::msg::OccupancyGridPtr rcv_grid){
-  grid = *rcv_grid;
+  grid.Set(rcv_grid);
   new_grid_rcvd = true;
+  grid_trace.Receive(rcv_grid->header, nature::node::now_seconds());
 }
 
 void SegmentationGridCallback(nature::msg::OccupancyGridPtr rcv_grid){
-    segmentation_grid = *rcv_grid;
+    segmentation_grid.Set(rcv_grid);
     new_seg_grid_rcvd = true;
+    seg_grid_rcvd = true;
+}
+
+void LayeredGridCallback(nature::msg::LayeredGridPtr rcv_grid){
+  if (grid.SetLayer(*rcv_grid, "occupancy")){
+    new_grid_rcvd = true;
+    grid_trace.Receive(rcv_grid->header, nature::node::now_seconds());
+  }
+  if (segmentation_grid.SetLayer(*rcv_grid, "segmentation")) new_seg_grid_rcvd = seg_grid_rcvd = true;
 }
 
 void PathCallback(nature::msg::PathPtr rcv_path){
@@ -56,12 +71,13 @@ int main(int argc, char *argv[]){
   auto odometry_sub = n->create_subscription<nature::msg::Odometry>("nature/odometry", 10, OdometryCallback);
   auto grid_sub = n->create_subscription<nature::msg::OccupancyGrid>("nature/occupancy_grid", 10, GridCallback);
   auto segmentation_grid_sub = n->create_subscription<nature::msg::OccupancyGrid>("nature/segmentation_grid", 10, SegmentationGridCallback);
+  auto layered_grid_sub = n->create_subscription<nature::msg::LayeredGrid>("nature/layered_grid", 10, LayeredGridCallback);
   auto path_sub = n->create_subscription<nature::msg::Path>("nature/global_path", 10, PathCallback);
   auto wp_sub = n->create_subscription<nature::msg::Path>("nature/waypoints", 10, WaypointCallback);
 
   // planner params
   float kp, eta, cutoff_dist, inner_cutoff_dist, rate;
-  bool use_global_path;
+  bool use_global_path, gradient_descent;
   int obs_cost_thresh;
   n->get_parameter("~kp", kp, 5.0f);
   n->get_parameter("~eta", eta, 100.0f);
@@ -69,6 +85,7 @@ int main(int argc, char *argv[]){
   n->get_parameter("~cutoff_dist", cutoff_dist, 20.0f);
   n->get_parameter("~inner_cutoff_dist", inner_cutoff_dist, 1.5f);
   n->get_parameter("~use_global_path", use_global_path, false);
+  n->get_parameter("~gradient_descent", gradient_descent, false);
   n->get_parameter("~rate", rate, 50.0f);
 
   nature::planning::PfPlanner planner;
@@ -77,6 +94,7 @@ int main(int argc, char *argv[]){
   planner.SetCutoffDistance(cutoff_dist);
   planner.SetInnerCutoff(inner_cutoff_dist);
   planner.SetObstacleCostThreshold(obs_cost_thresh);
+  planner.SetGradientDescent(gradient_descent);
 
   unsigned int loop_count = 0;
   float dt = 1.0f / rate;
@@ -84,7 +102,7 @@ int main(int argc, char *argv[]){
   nature::node::Rate rosrate(rate);
   while (nature::node::ok()){
     double start_secs = n->get_now_seconds();
-    if (global_path.poses.size() > 0 && odom_rcvd && grid.data.size() > 0){
+    if (global_path.poses.size() > 0 && odom_rcvd && grid.Get().data.size() > 0){
 
       float gx, gy;
       if (use_global_path){
@@ -98,11 +116,12 @@ int main(int argc, char *argv[]){
 
       planner.SetGoal(gx, gy);
 
-      if (new_seg_grid_rcvd) planner.SetSegGrid(segmentation_grid);
-      nature::msg::Path local_path = planner.Plan(grid, odom);
+      // the planner keeps a reference, which a new message replaces
+      if (seg_grid_rcvd) planner.SetSegGrid(segmentation_grid.Get());
+      nature::msg::Path local_path = planner.Plan(grid.Get(), odom);
 
       local_path.header.frame_id = "map";
-      local_path.header.stamp = n->get_stamp();
+      local_path.header.stamp = nature::node::LatencyTrace::OutputStamp(grid_trace, *n);
       nature::node::set_seq(local_path.header, loop_count);
       path_pub->publish(local_path);
       /*}
@@ -126,7 +145,7 @@ int main(int argc, char *argv[]){
       else if (!odom_rcvd){
         //std::cout << "Local planner did not run because vehicle odometry not recieved." << std::endl;
       }
-      else if (grid.data.size() <= 0){
+      else if (grid.Get().data.size() <= 0){
         //std::cout << "Local planner did not run because occupancy grid not recieved." << std::endl;
       }
     }
@@ -1,51 +1,138 @@
 #include "nature/planning/local/pf_planner.h"
 #include <algorithm>
-#include <omp.h>
+#include <limits>
+#include <math.h>
 
 namespace nature {
 namespace planning {
 
+namespace {
+
+/// in place radix-2 transform of n contiguous values, n a power of 2
+/// twiddle holds exp(-2 pi i k/n) for k < n/2
+void Fft(std::complex<double> *a, int n, const std::complex<double> *twiddle, bool inverse){
+	for (int i = 1, j = 0; i < n; i++){
+		int bit = n >> 1;
+		for (; j & bit; bit >>= 1) j ^= bit;
+		j ^= bit;
+		if (i < j) std::swap(a[i], a[j]);
+	}
+	// the products are written out, std::complex checks for infinities on each one
+	double sign = inverse ? -1.0 : 1.0;
+	for (int len = 2; len <= n; len <<= 1){
+		int step = n / len;
+		for (int i = 0; i < n; i += len){
+			for (int k = 0; k < len / 2; k++){
+				double wr = twiddle[k*step].real();
+				double wi = sign*twiddle[k*step].imag();
+				std::complex<double> &u = a[i + k];
+				std::complex<double> &v = a[i + k + len/2];
+				double vr = v.real()*wr - v.imag()*wi;
+				double vi = v.real()*wi + v.imag()*wr;
+				v = std::complex<double>(u.real() - vr, u.imag() - vi);
+				u = std::complex<double>(u.real() + vr, u.imag() + vi);
+			}
+		}
+	}
+}
+
+void Twiddles(int n, std::vector<std::complex<double> > &twiddle){
+	twiddle.resize(n / 2);
+	for (int k = 0; k < n / 2; k++) twiddle[k] = std::polar(1.0, -2.0 * M_PI * k / n);
+}
+
+/**
+ * Transform of an nx by ny column-major array, the inverse is not scaled.
+ * Only the first columns i < used_nx of the input are transformed along j,
+ * the others must be zero on a forward transform and are dropped on an inverse one.
+ */
+void Fft2d(std::vector<std::complex<double> > &a, int nx, int ny, int used_nx, bool inverse){
+	std::vector<std::complex<double> > twiddle_x, twiddle_y, column(nx);
+	Twiddles(nx, twiddle_x);
+	Twiddles(ny, twiddle_y);
+	if (!inverse){
+		for (int i = 0; i < used_nx; i++) Fft(&a[i*ny], ny, twiddle_y.data(), false);
+	}
+	for (int j = 0; j < ny; j++){
+		for (int i = 0; i < nx; i++) column[i] = a[i*ny + j];
+		Fft(column.data(), nx, twiddle_x.data(), inverse);
+		for (int i = 0; i < nx; i++) a[i*ny + j] = column[i];
+	}
+	if (inverse){
+		for (int i = 0; i < used_nx; i++) Fft(&a[i*ny], ny, twiddle_y.data(), true);
+	}
+}
+
+int NextPowerOf2(int n){
+	int p = 1;
+	while (p < n) p <<= 1;
+	return p;
+}
+
+} // namespace
+
 PfPlanner::PfPlanner() {
 	kp_ = 5.0f;
 	eta_ = 100.0f;
 	obs_cutoff_dist_ = 20.0f;
 	inner_cutoff_dist_ = 1.5f;
 	seg_grid_set_ = false;
+	seg_grid_ = NULL;
 	obs_cost_thresh_ = 0;
+	gradient_descent_ = false;
+	field_width_ = 0;
+	field_height_ = 0;
+	field_radius_ = 0;
+	field_x0_ = 0.0f;
+	field_y0_ = 0.0f;
+	field_res_ = 0.0f;
+	field_eta_ = 0.0f;
+	field_cutoff_ = 0.0f;
+	field_grid_width_ = 0;
+	field_grid_height_ = 0;
+	kernel_nx_ = 0;
+	kernel_ny_ = 0;
+	kernel_res_ = 0.0f;
+	kernel_eta_ = 0.0f;
+	kernel_cutoff_ = 0.0f;
 }
 
-nature::msg::Path PfPlanner::Plan(nature::msg::OccupancyGrid grid, nature::msg::Odometry odom){
+nature::msg::Path PfPlanner::Plan(const nature::msg::OccupancyGrid &grid, const nature::msg::Odometry &odom){
 
 	float sx = odom.pose.pose.position.x;
 	float sy = odom.pose.pose.position.y;
 	float gx = goal_x_;
 	float gy = goal_y_;
 
-	// first populate the obstacle list from the current grid
-	std::vector<float> ox, oy;
+	// first mark the obstacles of the current grid
+	const nature::msg::OccupancyGrid *seg_grid = seg_grid_set_ && seg_grid_->info.height==grid.info.height && seg_grid_->info.width==grid.info.width ? seg_grid_ : NULL;
+	obstacle_mask_.assign(grid.info.width * grid.info.height, 0);
+	inner_i_.clear();
+	inner_j_.clear();
+	int radius = (int)ceil(obs_cutoff_dist_ / grid.info.resolution);
 	int ndx = 0;
 	for (int i = 0; i < grid.info.width; i++){
 		float x = grid.info.origin.position.x + (i + 0.5f) * grid.info.resolution;
 		float dx = sx - x;
 		for (int j = 0; j < grid.info.height; j++){
-			float y = grid.info.origin.position.y + (j + 0.5f) * grid.info.resolution;
-			float dy = sy - y;
 			int cost = grid.data[ndx];
-			if (seg_grid_set_ && seg_grid_.info.height==grid.info.height && seg_grid_.info.width==grid.info.width) cost += seg_grid_.data[ndx];
-			//if (grid.data[ndx] > 0){
+			if (seg_grid) cost += seg_grid->data[ndx];
 			if (cost > obs_cost_thresh_){
-				float d = sqrtf(dx * dx + dy * dy);
-				if (d < obs_cutoff_dist_ && d>inner_cutoff_dist_){
-					ox.push_back(x);
-					oy.push_back(y);
-				} // if closer than cutoff distance
+				obstacle_mask_[ndx] = 1;
+				float dy = sy - (grid.info.origin.position.y + (j + 0.5f) * grid.info.resolution);
+				if (sqrtf(dx * dx + dy * dy) <= inner_cutoff_dist_){
+					inner_i_.push_back(i + radius);
+					inner_j_.push_back(j + radius);
+				} // if inside the inner cutoff
 			} // if cell occupied
 			ndx++;
 		} // loop over j
 	} // loop over i
+	UpdateRepulsiveField(grid);
+	RemoveInnerObstacles();
 
 	// run the potential field algorithm
-	PotentialFieldPlanning(grid.info.origin.position.x, grid.info.origin.position.y, grid.info.resolution, sx, sy, gx, gy, ox, oy);
+	PotentialFieldPlanning(grid.info.origin.position.x, grid.info.origin.position.y, grid.info.resolution, sx, sy, gx, gy);
 
 	// copy the result to a path message
 	nature::msg::Path path;
@@ -74,24 +161,239 @@ float PfPlanner::CalcAttractivePotential(float x, float y, float gx, float gy){
 
 	// give a slight preference for staying on the same path, all things being equal
 	float sg = 0.0005f*s;
-#pragma omp parallel for
 	for (int i=0;i<(int)old_rx_.size();i++){
 		float d = Hypot(x - old_rx_[i], y - old_ry_[i]);
 		attract += sg * d;
 	}
+	return attract;
+}
+
+void PfPlanner::UpdateRepulsiveField(const nature::msg::OccupancyGrid &grid){
+	int width = grid.info.width;
+	int height = grid.info.height;
+	float res = grid.info.resolution;
+	float x0 = grid.info.origin.position.x;
+	float y0 = grid.info.origin.position.y;
+	int radius = (int)ceil(obs_cutoff_dist_ / res);
+	// the field only changes with the obstacles and the grid geometry
+	if (obstacle_mask_ == field_mask_ && width == field_grid_width_ && height == field_grid_height_ &&
+	    res == field_res_ && eta_ == field_eta_ && obs_cutoff_dist_ == field_cutoff_ &&
+	    field_x0_ == x0 + (0.5f - radius) * res && field_y0_ == y0 + (0.5f - radius) * res){
+		return;
+	}
+	field_mask_ = obstacle_mask_;
+	field_grid_width_ = width;
+	field_grid_height_ = height;
+	field_res_ = res;
+	field_eta_ = eta_;
+	field_cutoff_ = obs_cutoff_dist_;
+	field_radius_ = radius;
+	field_width_ = width + 2 * radius;
+	field_height_ = height + 2 * radius;
+	field_x0_ = x0 + (0.5f - radius) * res;
+	field_y0_ = y0 + (0.5f - radius) * res;
+
+	// the transform spans the field, so the convolution does not wrap around onto it
+	int nx = NextPowerOf2(field_width_);
+	int ny = NextPowerOf2(field_height_);
+	if (nx != kernel_nx_ || ny != kernel_ny_ || res != kernel_res_ || eta_ != kernel_eta_ || obs_cutoff_dist_ != kernel_cutoff_){
+		kernel_fft_.assign(nx * ny, std::complex<double>(0.0, 0.0));
+		for (int di = -radius; di <= radius; di++){
+			for (int dj = -radius; dj <= radius; dj++){
+				float d = res * sqrtf((float)(di * di + dj * dj));
+				if (d >= obs_cutoff_dist_) continue;
+				kernel_fft_[((di + nx) % nx) * ny + (dj + ny) % ny] = eta_ / (d * d + 0.1f);
+			}
+		}
+		Fft2d(kernel_fft_, nx, ny, nx, false);
+		kernel_nx_ = nx;
+		kernel_ny_ = ny;
+		kernel_res_ = res;
+		kernel_eta_ = eta_;
+		kernel_cutoff_ = obs_cutoff_dist_;
+	}
+
+	fft_buffer_.assign(nx * ny, std::complex<double>(0.0, 0.0));
+	for (int i = 0; i < width; i++){
+		for (int j = 0; j < height; j++){
+			if (obstacle_mask_[i * height + j]) fft_buffer_[(i + radius) * ny + j + radius] = 1.0;
+		}
+	}
+	// the columns past the obstacles are zero and those past the field are not read back
+	Fft2d(fft_buffer_, nx, ny, width + radius, false);
+	for (int k = 0; k < nx * ny; k++){
+		const std::complex<double> &b = fft_buffer_[k];
+		const std::complex<double> &c = kernel_fft_[k];
+		fft_buffer_[k] = std::complex<double>(b.real()*c.real() - b.imag()*c.imag(), b.real()*c.imag() + b.imag()*c.real());
+	}
+	Fft2d(fft_buffer_, nx, ny, field_width_, true);
+	double scale = 1.0 / ((double)nx * ny);
+	field_.resize(field_width_ * field_height_);
+	for (int i = 0; i < field_width_; i++){
+		for (int j = 0; j < field_height_; j++){
+			field_[i * field_height_ + j] = (float)std::max(0.0, fft_buffer_[i * ny + j].real() * scale);
+		}
+	}
+}
+
+void PfPlanner::RemoveInnerObstacles(){
+	if (inner_i_.empty()) return;
+	// the obstacles the vehicle is on are ignored, as the kernel sampled them
+	plan_field_ = field_;
+	for (int k = 0; k < (int)inner_i_.size(); k++){
+		int imin = std::max(0, inner_i_[k] - field_radius_);
+		int imax = std::min(field_width_ - 1, inner_i_[k] + field_radius_);
+		int jmin = std::max(0, inner_j_[k] - field_radius_);
+		int jmax = std::min(field_height_ - 1, inner_j_[k] + field_radius_);
+		for (int i = imin; i <= imax; i++){
+			int di = i - inner_i_[k];
+			float *col = &plan_field_[i * field_height_];
+			for (int j = jmin; j <= jmax; j++){
+				int dj = j - inner_j_[k];
+				float d = field_res_ * sqrtf((float)(di * di + dj * dj));
+				if (d < field_cutoff_) col[j] -= eta_ / (d * d + 0.1f);
+			}
+		}
+	}
 }
 
-float PfPlanner::CalcRepulsivePotential(float x, float y, std::vector<float> ox, std::vector<float> oy){
-	float repul = 0.0f;
+float PfPlanner::FieldAt(int i, int j) const{
+	if (i < 0 || j < 0 || i >= field_width_ || j >= field_height_) return 0.0f;
+	const std::vector<float> &field = inner_i_.empty() ? field_ : plan_field_;
+	return std::max(0.0f, field[i * field_height_ + j]);
+}
 
-	if (ox.size() != oy.size())
-		return repul;
-#pragma omp parallel for
-	for (int i = 0; i < (int)ox.size(); i++){
-		float d = Hypot(x - ox[i], y - oy[i]);
-		repul += eta_ / (d * d + 0.1f);
+float PfPlanner::CalcRepulsivePotential(float x, float y){
+	if (field_res_ <= 0.0f) return 0.0f;
+	float fx = (x - field_x0_) / field_res_;
+	float fy = (y - field_y0_) / field_res_;
+	int i = (int)floor(fx);
+	int j = (int)floor(fy);
+	float tx = fx - i;
+	float ty = fy - j;
+	return (1.0f - tx) * ((1.0f - ty) * FieldAt(i, j) + ty * FieldAt(i, j + 1)) +
+	       tx * ((1.0f - ty) * FieldAt(i + 1, j) + ty * FieldAt(i + 1, j + 1));
+}
+
+void PfPlanner::CalcPotentialGradient(float x, float y, float gx, float gy, float &dudx, float &dudy){
+	// attractive, s*|p-g| and the preference for the old path
+	float s = 0.5f*kp_;
+	float sg = 0.0005f*s;
+	dudx = 0.0f;
+	dudy = 0.0f;
+	float dg = Hypot(x - gx, y - gy);
+	if (dg > 0.0f){
+		dudx += s * (x - gx) / dg;
+		dudy += s * (y - gy) / dg;
+	}
+	for (int i = 0; i < (int)old_rx_.size(); i++){
+		float d = Hypot(x - old_rx_[i], y - old_ry_[i]);
+		if (d <= 0.0f) continue;
+		dudx += sg * (x - old_rx_[i]) / d;
+		dudy += sg * (y - old_ry_[i]) / d;
+	}
+	// repulsive, central differences a cell apart, the bilinear lookup has kinks at the cell edges
+	if (field_res_ <= 0.0f) return;
+	float e = 0.5f * field_res_;
+	dudx += (CalcRepulsivePotential(x + e, y) - CalcRepulsivePotential(x - e, y)) / field_res_;
+	dudy += (CalcRepulsivePotential(x, y + e) - CalcRepulsivePotential(x, y - e)) / field_res_;
+}
+
+void PfPlanner::GradientDescentPlanning(float step, float sx, float sy, float gx, float gy, int max_steps){
+	std::vector<float> px(1, sx), py(1, sy);
+	float xp = sx;
+	float yp = sy;
+	float up = CalcAttractivePotential(xp, yp, gx, gy) + CalcRepulsivePotential(xp, yp);
+	float min_step = 0.05f * step;
+	float h = step;
+	float length = 0.0f;
+	float max_length = max_steps * step;
+	float d = Hypot(gx - xp, gy - yp);
+	// potential at the last local minimum, grid moves are taken until the path gets below it
+	// and they don't go back to the points visited since
+	float escape_level = std::numeric_limits<float>::max();
+	std::vector<float> escape_x, escape_y;
+	while (d >= step && length < max_length){
+		float dudx, dudy;
+		CalcPotentialGradient(xp, yp, gx, gy, dudx, dudy);
+		float g = Hypot(dudx, dudy);
+		// a single obstacle at r gives eta/(r*r+0.1), so the field bounds the distance to the nearest one
+		// and steps stay within half of it, they can't jump over an obstacle
+		float field = CalcRepulsivePotential(xp, yp);
+		float clearance = field > 0.0f ? sqrtf(std::max(0.0f, eta_ / field - 0.1f)) : obs_cutoff_dist_;
+		float max_h = std::max(min_step, std::min(0.5f * clearance, d));
+		h = std::min(2.0f * h, max_h);
+		// backtracking line search, each try is one potential sample
+		float xn = xp, yn = yp, un = up;
+		bool moved = false;
+		if (up >= escape_level || g <= 0.0f) h = 0.0f;
+		for (; h >= min_step; h *= 0.5f){
+			xn = xp - h * dudx / g;
+			yn = yp - h * dudy / g;
+			un = CalcAttractivePotential(xn, yn, gx, gy) + CalcRepulsivePotential(xn, yn);
+			if (un < up - 1.0e-4f * h * g){
+				moved = true;
+				break;
+			}
+		}
+		// no descent along the gradient, in a local minimum of the field,
+		// take the best of the 8 grid moves like the grid mode, even uphill
+		if (!moved){
+			escape_level = std::min(escape_level, up);
+			escape_x.push_back(xp);
+			escape_y.push_back(yp);
+			static const int dirs[8][2] = {{1,0},{1,1},{0,1},{-1,1},{-1,0},{-1,-1},{0,-1},{1,-1}};
+			un = std::numeric_limits<float>::max();
+			for (int m = 0; m < 8; m++){
+				float mx = xp + step * dirs[m][0];
+				float my = yp + step * dirs[m][1];
+				bool visited = false;
+				for (int v = 0; v < (int)escape_x.size() && !visited; v++){
+					visited = Hypot(mx - escape_x[v], my - escape_y[v]) < 0.5f * step;
+				}
+				if (visited) continue;
+				float um = CalcAttractivePotential(mx, my, gx, gy) + CalcRepulsivePotential(mx, my);
+				if (um < un){
+					un = um;
+					xn = mx;
+					yn = my;
+				}
+			}
+			// boxed in by the visited points
+			if (un == std::numeric_limits<float>::max()) break;
+			h = step;
+		}
+		else {
+			escape_level = std::numeric_limits<float>::max();
+			escape_x.clear();
+			escape_y.clear();
+		}
+		length += Hypot(xn - xp, yn - yp);
+		xp = xn;
+		yp = yn;
+		up = un;
+		px.push_back(xp);
+		py.push_back(yp);
+		d = Hypot(gx - xp, gy - yp);
+	}
+
+	// resample at the step of the grid moves, so the path looks the same downstream
+	rx_.assign(1, sx);
+	ry_.assign(1, sy);
+	float carried = 0.0f;
+	for (int k = 1; k < (int)px.size(); k++){
+		float seg = Hypot(px[k] - px[k-1], py[k] - py[k-1]);
+		float t = step - carried;
+		for (; t <= seg; t += step){
+			rx_.push_back(px[k-1] + (px[k] - px[k-1]) * t / seg);
+			ry_.push_back(py[k-1] + (py[k] - py[k-1]) * t / seg);
+		}
+		carried = seg - (t - step);
+	}
+	if (px.size() > 1 && carried > 0.0f){
+		rx_.push_back(px.back());
+		ry_.push_back(py.back());
 	}
-	return repul;
 }
 
 std::vector<std::vector<float>> PfPlanner::GetMotionModel(float step){
@@ -114,7 +416,7 @@ std::vector<std::vector<float>> PfPlanner::GetMotionModel(float step){
 	return motion;
 }
 
-void PfPlanner::PotentialFieldPlanning(float minx, float miny, float reso, float sx, float sy, float gx, float gy, std::vector<float> ox, std::vector<float> oy){
+void PfPlanner::PotentialFieldPlanning(float minx, float miny, float reso, float sx, float sy, float gx, float gy){
 
 	old_rx_ = rx_;
 	old_ry_ = ry_;
@@ -124,6 +426,11 @@ void PfPlanner::PotentialFieldPlanning(float minx, float miny, float reso, float
 	// search path
 	float d = Hypot(sx - gx, sy - gy);
 	float max_steps = floor(std::min((3.0f * d)/reso,(float)(3.0f*obs_cutoff_dist_/reso)));
+	if (gradient_descent_){
+		// the grid moves are reso*reso long along the axes
+		GradientDescentPlanning(reso * reso, sx, sy, gx, gy, (int)max_steps);
+		return;
+	}
 	int ix = (int)floor((sx - minx) / reso);
 	int iy = (int)floor((sy - miny) / reso);
 	int gix = (int)floor((gx - minx) / reso);
@@ -147,7 +454,7 @@ void PfPlanner::PotentialFieldPlanning(float minx, float miny, float reso, float
 			float xx = xp + dx;
 			float yy = yp + dy;
 			float ug = CalcAttractivePotential(xx, yy, gx, gy);
-			float uo = CalcRepulsivePotential(xx, yy, ox, oy);
+			float uo = CalcRepulsivePotential(xx, yy);
 			float p = ug + uo;
 			if (minp > p){
 				minp = p;
@@ -2,14 +2,23 @@
 #include "nature/planning/local/rviz_spline_plotter.h"
 #include <nature/planning/local/spline_path.h>
 #include <sstream>
+#include <algorithm>
+#include <cmath>
 
 namespace nature {
   namespace planning{
 
     RVIZPlotter::RVIZPlotter(std::shared_ptr<nature::visualization::VisualizerBase> visualizer, const std::string & cost_vis,
-                             std::shared_ptr<nature::node::NodeProxy> node, float w_c, float w_s, float w_r, float w_d, float w_t, float cost_vis_text_size_) : Plotter(visualizer), cost_vis_(cost_vis), node_(node),
-                                                                                                                                                      w_c_(w_c), w_s_(w_s), w_r_(w_r), w_d_(w_d), w_t_(w_t), cost_vis_text_size_(cost_vis_text_size_) {
+                             std::shared_ptr<nature::node::NodeProxy> node, float w_c, float w_s, float w_r, float w_d, float w_t, float cost_vis_text_size_,
+                             float publish_rate, float path_step, float text_threshold) : Plotter(visualizer), cost_vis_(cost_vis), node_(node),
+                                                                                                                                                      w_c_(w_c), w_s_(w_s), w_r_(w_r), w_d_(w_d), w_t_(w_t), cost_vis_text_size_(cost_vis_text_size_),
+                                                                                                                                                      path_step_(path_step), text_threshold_(text_threshold) {
       candidate_paths_publisher = node->create_publisher<nature::msg::MarkerArray>("nature/candidate_paths", 1);
+      publish_period_ = publish_rate > 0.0f ? std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<float>(1.0f / publish_rate))
+                                            : std::chrono::steady_clock::duration::zero();
+      last_publish_ = std::chrono::steady_clock::now() - publish_period_;
+      marker_array_.markers.push_back(get_marker_msg(nature::msg::Marker::LINE_LIST, 0, false));
+      marker_array_.markers.push_back(get_marker_msg(nature::msg::Marker::LINE_LIST, 1, true));
     }
 
     nature::msg::Marker RVIZPlotter::get_marker_msg(int type, int id, bool is_blocked) const{
@@ -37,25 +46,67 @@ namespace nature {
       return marker;
     }
 
+    bool RVIZPlotter::ReadyToDisplay() {
+      return std::chrono::steady_clock::now() - last_publish_ >= publish_period_;
+    }
+
+    bool RVIZPlotter::GetTextValues(int j, float *values) const {
+      if (cost_vis_ == "none") return false;
+      values[0] = curves_[j].GetCost();
+      values[1] = w_s_ * curves_[j].GetStaticSafety();
+      values[2] = w_c_ * curves_[j].GetComfortability();
+      values[3] = w_r_ * curves_[j].GetRhoCost();
+      values[4] = w_d_ * curves_[j].GetDynamicSafety();
+      values[5] = w_t_ * curves_[j].GetSegmentationCost();
+      return true;
+    }
+
+    std::string RVIZPlotter::GetText(const float *values) const {
+      std::ostringstream out;
+      out.precision(2);
+      out << std::fixed;
+
+      if(cost_vis_ == "final" || cost_vis_ == "all"){
+        out << values[0];
+      }
+
+      if (cost_vis_ == "components" || cost_vis_ == "all"){
+        static const char *labels[] = { " s: ", " c: ", " r: ", " d: ", " t: " };
+        for (int k = 1; k < NUM_TEXT_VALUES; k++) {
+          if(values[k] > 1e-3) out << labels[k-1] << values[k];
+        }
+      }
+      return out.str();
+    }
+
     void RVIZPlotter::Display(bool save, const std::string & ofname, int nx, int ny) {
       if (!map_set_)return;
+      last_publish_ = std::chrono::steady_clock::now();
 
-      nature::msg::Marker candidate_paths_marker = get_marker_msg(nature::msg::Marker::LINE_LIST, 0, false);
-      nature::msg::Marker blocked_paths_marker = get_marker_msg(nature::msg::Marker::LINE_LIST, 1, true);
+      // the line markers keep their point storage between publishes, the text markers are appended when sent
+      marker_array_.markers.resize(2);
+      nature::msg::Marker &candidate_paths_marker = marker_array_.markers[0];
+      nature::msg::Marker &blocked_paths_marker = marker_array_.markers[1];
+      candidate_paths_marker.header.stamp = node_->get_stamp();
+      blocked_paths_marker.header.stamp = candidate_paths_marker.header.stamp;
+      candidate_paths_marker.points.clear();
+      blocked_paths_marker.points.clear();
 
       float ds = pixdim_;
+      float step = std::max(pixdim_, path_step_);
       Path wp_path(path_);
-      std::vector<nature::utils::vec2> paths_last_points;
+      paths_last_points_.clear();
 
       for (int i = 0; i < curves_.size(); i++) {
         float s0 = curves_[i].GetS0() + ds;
         float s_max = s0 + curves_[i].GetMaxLength() - ds;
         bool hits_obstacle = curves_[i].HitsObstacle();
+        nature::msg::Marker &marker = hits_obstacle ? blocked_paths_marker : candidate_paths_marker;
         nature::utils::vec2 pc1;
 
         while (s0 < s_max){
           float rho0 = curves_[i].At(s0- curves_[i].GetS0());
-          float s1 = s0 + pixdim_;
+          float s1 = std::min(s0 + step, s_max);
           float rho1 = curves_[i].At(s1- curves_[i].GetS0());
           nature::utils::vec2 pc0 = wp_path.ToCartesian(s0, rho0);
           pc1 = wp_path.ToCartesian(s1, rho1);
@@ -70,59 +121,59 @@ namespace nature {
           p1.x = pc1.x;
           p1.y = pc1.y;
           p1.z = 0.0;
-          if(hits_obstacle){
-            blocked_paths_marker.points.push_back(p0);
-            blocked_paths_marker.points.push_back(p1);
-          }else{
-            candidate_paths_marker.points.push_back(p0);
-            candidate_paths_marker.points.push_back(p1);
-          }
-          s0 += pixdim_;
+          marker.points.push_back(p0);
+          marker.points.push_back(p1);
+          s0 += step;
         }
-        paths_last_points.push_back(pc1);
+        paths_last_points_.push_back(pc1);
       }
 
-      candidate_paths_marker.action = candidate_paths_marker.points.empty() > 0 ? nature::msg::Marker::DELETE : nature::msg::Marker::MODIFY;
+      candidate_paths_marker.action = candidate_paths_marker.points.empty() ? nature::msg::Marker::DELETE : nature::msg::Marker::MODIFY;
       blocked_paths_marker.action = blocked_paths_marker.points.empty() ? nature::msg::Marker::DELETE : nature::msg::Marker::MODIFY;
-      nature::msg::MarkerArray marker_array;
-      marker_array.markers.push_back(candidate_paths_marker);
-      marker_array.markers.push_back(blocked_paths_marker);
-
-      if(cost_vis_ != "none"){
-        for(int j = 0; j < curves_.size(); j++){
-          nature::msg::Marker text_marker = get_marker_msg(nature::msg::Marker::TEXT_VIEW_FACING, marker_array.markers.size()+1);
 
-          std::ostringstream out;
-          out.precision(2);
-          out << std::fixed;
-
-          if(cost_vis_ == "final" || cost_vis_ == "all"){
-            out << curves_[j].GetCost();
+      // only the texts whose values or position changed are sent, rviz keeps the others
+      int num_texts = cost_vis_ != "none" ? (int)curves_.size() : 0;
+      float values[NUM_TEXT_VALUES];
+      for(int j = 0; j < num_texts; j++){
+        GetTextValues(j, values);
+        bool is_new = j >= (int)text_markers_.size();
+        bool changed = is_new;
+        if (!is_new) {
+          const float *last = &text_values_[j*NUM_TEXT_VALUES];
+          for (int k = 0; k < NUM_TEXT_VALUES && !changed; k++) {
+            changed = values[k] != last[k] && !(std::fabs(values[k] - last[k]) <= text_threshold_);
           }
+          const nature::msg::Point &position = text_markers_[j].pose.position;
+          float dx = (float)position.x - paths_last_points_[j].x;
+          float dy = (float)position.y - paths_last_points_[j].y;
+          changed = changed || !(dx*dx + dy*dy <= 0.25f*step*step);
+        }
+        if (!changed) continue;
 
-          if (cost_vis_ == "components" || cost_vis_ == "all"){
-            float s = w_s_ * curves_[j].GetStaticSafety();
-            float c = w_c_ * curves_[j].GetComfortability();
-            float r = w_r_ * curves_[j].GetRhoCost();
-            float d = w_d_ * curves_[j].GetDynamicSafety();
-            float t = w_t_ * curves_[j].GetSegmentationCost();
-            if(s > 1e-3) out << " s: " << s;
-            if(c > 1e-3) out << " c: " << c;
-            if(r > 1e-3) out << " r: " << r;
-            if(d > 1e-3) out << " d: " << d;
-            if(t > 1e-3) out << " t: " << t;
-          }
-          text_marker.text = out.str();
-
-          text_marker.pose.position.x = paths_last_points[j].x;
-          text_marker.pose.position.y = paths_last_points[j].y;
-          text_marker.pose.position.z = 0.1;
-          marker_array.markers.push_back(text_marker);
-
+        if (is_new) {
+          text_markers_.push_back(get_marker_msg(nature::msg::Marker::TEXT_VIEW_FACING, j + 3));
+          text_values_.resize(text_markers_.size()*NUM_TEXT_VALUES);
         }
+        nature::msg::Marker &text_marker = text_markers_[j];
+        std::copy(values, values + NUM_TEXT_VALUES, &text_values_[j*NUM_TEXT_VALUES]);
+        text_marker.header.stamp = candidate_paths_marker.header.stamp;
+        text_marker.text = GetText(values);
+        text_marker.pose.position.x = paths_last_points_[j].x;
+        text_marker.pose.position.y = paths_last_points_[j].y;
+        text_marker.pose.position.z = 0.1;
+        marker_array_.markers.push_back(text_marker);
+      }
+      // remove the texts of candidates that are gone
+      for (int j = num_texts; j < (int)text_markers_.size(); j++) {
+        nature::msg::Marker &text_marker = text_markers_[j];
+        text_marker.header.stamp = candidate_paths_marker.header.stamp;
+        text_marker.action = nature::msg::Marker::DELETE;
+        marker_array_.markers.push_back(text_marker);
       }
+      text_markers_.resize(num_texts);
+      text_values_.resize(num_texts*NUM_TEXT_VALUES);
 
-      candidate_paths_publisher->publish(marker_array);
+      candidate_paths_publisher->publish(marker_array_);
 
     }
 
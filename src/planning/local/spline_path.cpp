@@ -1,3 +1,4 @@
+#include <algorithm>
 #include "nature/planning/local/spline_path.h"
 
 namespace nature {
@@ -62,9 +63,11 @@ void Path::CalcAnglesAndCurvature() {
 		curvature_[0] = curvature_[1];
 		curvature_[points_.size() - 1] = curvature_[points_.size() - 2];
 	}
+	cumulative_lengths_.resize(points_.size(),0.0f);
 	for (int i = 0; i < points_.size()-1; i++) {
 		utils::vec2 v1 = points_[i + 1] - points_[i];
 		discrete_lengths_[i] = utils::length(v1);
+		cumulative_lengths_[i+1] = cumulative_lengths_[i] + discrete_lengths_[i];
 	}
 	//angle and arc length
 	for (int i = 1; i < points_.size()-1; i++) {
@@ -96,6 +99,11 @@ float Path::GetTheta(float s){
 	return theta_[seg.id];
 }
 
+float Path::GetTheta(float s, int &segment){
+	segment = ArcSegment(s, segment);
+	return theta_[segment];
+}
+
 PointSegDist Path::PointToSegmentDistance(utils::vec2 P, utils::vec2 Q, utils::vec2 X) {
 	// https ://diego.assencio.com/?index=ec3d5dfdfc0b6a0d147a656f0af332bd
 	utils::vec2 XP = X - P;  
@@ -123,50 +131,36 @@ PointSegDist Path::PointToSegmentDistance(utils::vec2 P, utils::vec2 Q, utils::v
 	return pseg;
 }
 
-SegmentInfo Path::FindSegment(float s) {
-	SegmentInfo segment;
-	/*
-	float cum_dist = 0.0;
-	int wp = 0;
-	segment.id = 0; 
-	while (cum_dist < s && wp < points_.size() - 1) {
-		float d = utils::length(points_[wp] - points_[wp + 1]);
-		if (d + cum_dist >= s) {
-			segment.id = wp;
-			float t = s - cum_dist;
-			utils::vec2 v = points_[wp + 1] - points_[wp];
-			v = v / utils::length(v);
-			segment.point = points_[wp] + v * t; 
-			break;
-		}
-		cum_dist = cum_dist + d;
-		wp = wp + 1;
-	}
-	*/	
-	bool found = false;
-	for (int i=1;i<arc_length_.size();i++){
-		if (arc_length_[i]>s){
-			segment.id = i-1;
-			float t = s - arc_length_[i-1];
-			utils::vec2 v = points_[i] - points_[i-1];
-			v = v / utils::length(v);
-			segment.point = points_[i] + v * t; 
-			found = true;
-			break;
-		}
-	}	
-	if (!found){
-		int i = arc_length_.size()-1;
-		segment.id = i-1;
-		float t = s - arc_length_[i-1];
-		utils::vec2 v = points_[i] - points_[i-1];
-		v = v / utils::length(v);
-		segment.point = points_[i] + v * t; 
+int Path::ArcSegment(float s, int hint) {
+	// arc_length_ never decreases, so the segments past s form a suffix
+	int last = (int)arc_length_.size() - 2;
+	if (hint < 0 || hint > last || (hint > 0 && arc_length_[hint] > s)) {
+		int i = (int)(std::upper_bound(arc_length_.begin() + 1, arc_length_.end(), s) - arc_length_.begin());
+		return std::min(i - 1, last);
 	}
+	while (hint < last && !(arc_length_[hint+1] > s)) hint++;
+	return hint;
+}
 
+SegmentInfo Path::SegmentAt(int id, float s) {
+	SegmentInfo segment;
+	segment.id = id;
+	float t = s - arc_length_[id];
+	utils::vec2 v = points_[id + 1] - points_[id];
+	v = v / utils::length(v);
+	segment.point = points_[id + 1] + v * t;
 	return segment;
 }
 
+SegmentInfo Path::FindSegment(float s) {
+	return SegmentAt(ArcSegment(s, -1), s);
+}
+
+SegmentInfo Path::FindSegment(float s, int &segment) {
+	segment = ArcSegment(s, segment);
+	return SegmentAt(segment, s);
+}
+
 float Path::GetTotalLength() {
 	float cum_dist = 0.0;
 	for (int i = 0; i < points_.size() - 1; i++) {
@@ -226,11 +220,7 @@ utils::vec2 Path::ToSRho(float x, float y) {
 	}
 	
 	float rho = dist_sign*closest;
-	float s = 0.0f;
-	for (int i = 0; i < closest_index; i++) {
-		s += utils::length(points_[i] - points_[i + 1]);
-	}
-
+	float s = cumulative_lengths_[closest_index];
 	s += utils::length(closest_point - points_[closest_index]);
 
 	utils::vec2 sr;
@@ -239,28 +229,51 @@ utils::vec2 Path::ToSRho(float x, float y) {
 	return sr;
 }
 
-utils::vec2 Path::ToCartesian(float s, float rho) {
-	float cumulative_distance = 0.0f;
-	int segment = 0;
-	while (cumulative_distance<s && segment<(points_.size()-1)){
-		float arc_length = discrete_lengths_[segment];
-		if (cumulative_distance+arc_length>s){
-			break;
-		}
-		else{
-			cumulative_distance+=arc_length;
-			segment++;
+int Path::CartesianSegment(float s, int hint) {
+	int last = (int)points_.size() - 2;
+	if (hint < 0 || hint > last || (hint > 0 && CartesianStop(hint - 1, s))) {
+		// the stop condition holds from some segment on, find the first one
+		int lo = 0;
+		int hi = last;
+		while (lo < hi) {
+			int mid = (lo + hi) / 2;
+			if (CartesianStop(mid, s)) hi = mid;
+			else lo = mid + 1;
 		}
+		return lo;
 	}
+	while (hint < last && !CartesianStop(hint, s)) hint++;
+	return hint;
+}
+
+utils::vec2 Path::ToCartesian(float s, float rho) {
+	int segment = -1;
+	return ToCartesian(s, rho, segment);
+}
+
+utils::vec2 Path::ToCartesian(float s, float rho, int &segment) {
+	utils::vec2 point, normal;
+	GetFrame(s, segment, point, normal);
+	return point + normal*rho;
+}
+
+void Path::GetFrame(float s, int &segment, utils::vec2 &point, utils::vec2 &normal) {
+	// past the end the last segment is extended
+	segment = CartesianSegment(s, segment);
+	float cumulative_distance = cumulative_lengths_[segment];
 	utils::vec2 v = points_[segment + 1] - points_[segment];
 	v = v / utils::length(v);
-	utils::vec2 n(-v.y, v.x);
-	utils::vec2 p = points_[segment] + v*(s-cumulative_distance)+n*rho;
-	return p;
+	normal = utils::vec2(-v.y, v.x);
+	point = points_[segment] + v*(s-cumulative_distance);
 }
 
 CurveInfo Path::GetCurvatureAndAngle(float s) {
-	SegmentInfo seg = FindSegment(s);
+	int segment = -1;
+	return GetCurvatureAndAngle(s, segment);
+}
+
+CurveInfo Path::GetCurvatureAndAngle(float s, int &segment) {
+	SegmentInfo seg = FindSegment(s, segment);
 	float d0 = utils::length(seg.point - points_[seg.id]);
 	float d1 = utils::length(seg.point - points_[seg.id + 1]);
 	CurveInfo ca;
@@ -1,8 +1,21 @@
 #include "nature/planning/local/spline_planner.h"
+#include "nature/common/morphology.h"
+#include "nature/common/grid_view.h"
+#include "nature/planning/local/candidate_kernels.h"
+#include "nature/node/stage_timer.h"
 #include <algorithm>
 
 namespace nature {
 namespace planning{
+
+// cost terms are timed per block of candidates
+static const int STAGE_STATIC_SAFETY = nature::node::RegisterStage("local.static_safety");
+static const int STAGE_COMFORT = nature::node::RegisterStage("local.comfortability");
+static const int STAGE_RHO_COST = nature::node::RegisterStage("local.rho_cost");
+static const int STAGE_DYNAMIC_SAFETY = nature::node::RegisterStage("local.dynamic_safety");
+static const int STAGE_BLEND = nature::node::RegisterStage("local.blend");
+static const int STAGE_SELECTION = nature::node::RegisterStage("local.selection");
+
 Planner::Planner() {
 	// planner coefficients and tuneable parameters
 	w_c_ = 0.2f; // comfort
@@ -20,11 +33,39 @@ Planner::Planner() {
 	ds_ = 0.1f;
 	// state variables to track
 	rho_max_ = 1.0f;
+	rho_per_length_ = 1.0f;
 	s_max_ = 0.0f;
 	first_iter_ = true;
 	s_start_ = 0.0f;
 	s_no_coll_before_ = 0.0f;
 	use_blend_ = true;
+	num_lanes_ = 0;
+	num_threads_ = 1;
+	vehicle_width_ = 0.0f;
+	use_clearance_ = false;
+	clearance_margin_ = 1.0f;
+	generation_ = 0;
+	selected_generation_ = -1;
+	selected_index_ = -1;
+	cost_to_go_version_ = 0;
+	cache_generation_ = -1;
+	cache_num_candidates_ = 0;
+	cache_grid_width_ = 0;
+	cache_grid_height_ = 0;
+	cache_grid_llx_ = 0.0f;
+	cache_grid_lly_ = 0.0f;
+	cache_grid_res_ = 0.0f;
+	cache_s_no_coll_before_ = 0.0f;
+	cache_use_clearance_ = false;
+	cache_selected_generation_ = -1;
+	cache_selected_index_ = -1;
+	cache_cost_to_go_version_ = -1;
+	grid_change_known_ = false;
+	grid_all_changed_ = true;
+	sweep_static_ = true;
+	rescore_static_ = false;
+	comfort_valid_ = false;
+	rho_valid_ = false;
 }
 
 std::vector<float> Planner::CalcCoeffs(float rho_start, float theta_start, float s_end, float rho_end) {
@@ -43,26 +84,46 @@ std::vector<float> Planner::CalcCoeffs(float rho_start, float theta_start, float
 }
 
 void Planner::GeneratePaths(int npaths, float s_start, float rho_start, float theta_start, float s_end, float max_steer_angle, float vehicle_width) {
-	if (s_end==0) return;
-	float lane_width = s_end*tan(max_steer_angle);
+	GenerateLattice(npaths, s_start, rho_start, theta_start, std::vector<float>(1, s_end), max_steer_angle, vehicle_width);
+}
+
+void Planner::GenerateLattice(int npaths, float s_start, float rho_start, float theta_start, const std::vector<float> &s_ends, float max_steer_angle, float vehicle_width) {
+	float s_max = 0.0f;
+	for (int l = 0; l < s_ends.size(); l++) s_max = std::max(s_max, s_ends[l]);
+	if (s_max==0) return;
 	candidates_.clear();
-	rho_max_ = lane_width;
-	float drho = 2.0f*lane_width / (npaths);
-	float rho = 0.5f*drho - lane_width;
-	averaging_window_size_ = (int)floor(vehicle_width / drho);
-	while (rho <= (lane_width+1.0E-5f)) {
-		std::vector<float> coeffs = CalcCoeffs(rho_start, theta_start, s_end, rho);
-		Candidate cand(coeffs);
-		cand.SetMaxLength(s_end);
-		cand.SetS0(s_start);
-		candidates_.push_back(cand);
-		rho += drho;
-	}
-	s_max_ = s_end;
+	layers_.clear();
+	// the widest fan bounds the offsets of all of them
+	rho_max_ = s_max*tan(max_steer_angle);
+	rho_per_length_ = (float)tan(max_steer_angle);
+	vehicle_width_ = vehicle_width;
+	generation_++;
+	for (int l = 0; l < s_ends.size(); l++) {
+		float s_end = s_ends[l];
+		if (s_end <= 0.0f) continue;
+		float lane_width = s_end*tan(max_steer_angle);
+		float drho = 2.0f*lane_width / (npaths);
+		float rho = 0.5f*drho - lane_width;
+		LatticeLayer layer;
+		layer.begin = (int)candidates_.size();
+		layer.window = (int)floor(vehicle_width / drho);
+		while (rho <= (lane_width+1.0E-5f)) {
+			std::vector<float> coeffs = CalcCoeffs(rho_start, theta_start, s_end, rho);
+			Candidate cand(coeffs);
+			cand.SetMaxLength(s_end);
+			cand.SetS0(s_start);
+			candidates_.push_back(cand);
+			rho += drho;
+		}
+		layer.end = (int)candidates_.size();
+		layers_.push_back(layer);
+		averaging_window_size_ = layer.window;
+	}
+	s_max_ = s_max;
 	s_start_ = s_start;
 }
 
-CurveInfo Planner::InfoOfCurve(Candidate candidate, float s, CurveInfo base_ca) {
+CurveInfo Planner::InfoOfCurve(const Candidate &candidate, float s, CurveInfo base_ca, int &theta_segment) {
 	CurveInfo ca;
 	float k0 = base_ca.curvature;
 	float rho = candidate.At(s);
@@ -73,36 +134,136 @@ CurveInfo Planner::InfoOfCurve(Candidate candidate, float s, CurveInfo base_ca)
 	float A = (float)sqrt(drds2 + b * b);
 	ca.curvature = (B / A)*(k0 + (b*candidate.SecondDerivativeAt(s)+k0*drds2) / (A*A));
 	// info of path_
-	double tp = path_.GetTheta(s);
+	double tp = path_.GetTheta(s, theta_segment);
 	ca.theta = tp + A*ca.curvature;
 	return ca;
 }
 
-void Planner::CalculateComfortability() {
-	// comfortability and consistency
-	for (int i = 0; i < candidates_.size(); i++) {
-		float s = 0.0f;
-		float comfort = 0.0f;
-		float consistent = 0.0f;
-		candidates_[i].SetMaxCurvature(0.0f);
-		while (s < s_max_) {
-			CurveInfo base_ca = path_.GetCurvatureAndAngle(s_start_ + s);
-			CurveInfo ca = InfoOfCurve(candidates_[i], s, base_ca);
-			if (!first_iter_) {
-				CurveInfo last_ca = InfoOfCurve(last_selected_, s, base_ca);
-				consistent += (float)sqrt(pow(last_ca.theta - ca.theta, 2.0));
-			}
-			comfort += ca.curvature*ca.curvature;
-			if (fabs(ca.curvature) > candidates_[i].GetMaxCurvature())candidates_[i].SetMaxCurvature(fabs(ca.curvature));
-			s += ds_;
+void Planner::SampleCenterline(float s_begin, CenterlineFrames &frames) {
+	frames.s.clear();
+	frames.x.clear();
+	frames.y.clear();
+	frames.nx.clear();
+	frames.ny.clear();
+	frames.curvature.clear();
+	int frame_segment = 0;
+	int curve_segment = 0;
+	for (float s = s_begin; s < s_max_; s += ds_) {
+		utils::vec2 point, normal;
+		path_.GetFrame(s_start_ + s, frame_segment, point, normal);
+		CurveInfo base_ca = path_.GetCurvatureAndAngle(s_start_ + s, curve_segment);
+		frames.s.push_back(s);
+		frames.x.push_back(point.x);
+		frames.y.push_back(point.y);
+		frames.nx.push_back(normal.x);
+		frames.ny.push_back(normal.y);
+		frames.curvature.push_back(base_ca.curvature);
+	}
+}
+
+/// copy the coefficients of p into a lane of planar arrays, the higher powers stay zero
+template <int N>
+static void PackPolynomial(const Polynomial<N> &p, float *lane, int stride) {
+	for (int j = 0; j <= N; j++) lane[j * stride] = p.GetCoefficients()[j];
+}
+
+void Planner::PackCandidates() {
+	int n = (int)candidates_.size();
+	num_lanes_ = n + 1;
+	batch_coeffs_.assign(12 * num_lanes_, 0.0f);
+	batch_length_.resize(n);
+	for (int i = 0; i < n; i++) batch_length_[i] = candidates_[i].GetMaxLength();
+	for (int i = 0; i < num_lanes_; i++) {
+		const Candidate &cand = i < n ? candidates_[i] : last_selected_;
+		PackPolynomial(cand.GetCurve(), batch_coeffs_.data() + i, num_lanes_);
+		PackPolynomial(cand.GetFirstDerivative(), batch_coeffs_.data() + 4 * num_lanes_ + i, num_lanes_);
+		PackPolynomial(cand.GetSecondDerivative(), batch_coeffs_.data() + 8 * num_lanes_ + i, num_lanes_);
+	}
+	batch_rho_.resize(num_lanes_);
+	batch_drho_.resize(num_lanes_);
+	batch_ddrho_.resize(num_lanes_);
+	batch_x_.resize(num_lanes_);
+	batch_y_.resize(num_lanes_);
+	batch_curvature_.resize(num_lanes_);
+	batch_turn_.resize(num_lanes_);
+	batch_comfort_.resize(n);
+	batch_consistent_.resize(n);
+	batch_max_curvature_.resize(n);
+	batch_safety_.resize(n);
+	batch_seg_cost_.resize(n);
+	batch_cost_to_go_.resize(n);
+}
+
+void Planner::BatchCoeffs(int poly, const float *c[4]) const {
+	for (int j = 0; j < 4; j++) c[j] = batch_coeffs_.data() + (4 * poly + j) * num_lanes_;
+}
+
+void Planner::CalculateLastTurn() {
+	// heading of the last selected path relative to the centerline, shared by all the candidates
+	int n = (int)candidates_.size();
+	const float *c[3][4];
+	for (int p = 0; p < 3; p++) BatchCoeffs(p, c[p]);
+	batch_last_turn_.resize(comfort_frames_.s.size());
+	for (int k = 0; k < comfort_frames_.s.size(); k++) {
+		float s = comfort_frames_.s[k];
+		float rho, drho, ddrho, curvature;
+		const float *lc[3][4];
+		for (int p = 0; p < 3; p++) {
+			for (int j = 0; j < 4; j++) lc[p][j] = c[p][j] + n;
 		}
-		float c_tot = a_ * comfort * ds_ + b_*consistent * ds_ / s_max_;
-		candidates_[i].SetComfortability(c_tot);
+		EvalCubics(1, lc[0], s, &rho);
+		EvalCubics(1, lc[1], s, &drho);
+		EvalCubics(1, lc[2], s, &ddrho);
+		OffsetCurvatures(1, &rho, &drho, &ddrho, comfort_frames_.curvature[k], &curvature, &batch_last_turn_[k]);
 	}
 }
 
-void Planner::CalculateDynamicSafety(nature::msg::Odometry odom) {
-	for (int i = 0; i < candidates_.size(); i++) {
+void Planner::CalculateComfortability(int i0, int i1) {
+	// comfortability and consistency, the candidates of the block at once for each sample of the centerline
+	int n = i1 - i0;
+	const float *c[3][4];
+	for (int p = 0; p < 3; p++) {
+		BatchCoeffs(p, c[p]);
+		for (int j = 0; j < 4; j++) c[p][j] += i0;
+	}
+	float *rho = batch_rho_.data() + i0;
+	float *drho = batch_drho_.data() + i0;
+	float *ddrho = batch_ddrho_.data() + i0;
+	float *curvature = batch_curvature_.data() + i0;
+	float *turn = batch_turn_.data() + i0;
+	float *comfort = batch_comfort_.data() + i0;
+	float *consistent = batch_consistent_.data() + i0;
+	float *max_curvature = batch_max_curvature_.data() + i0;
+	const float *length = batch_length_.data() + i0;
+	for (int i = 0; i < n; i++) {
+		comfort[i] = 0.0f;
+		consistent[i] = 0.0f;
+		max_curvature[i] = 0.0f;
+	}
+	for (int k = 0; k < comfort_frames_.s.size(); k++) {
+		float s = comfort_frames_.s[k];
+		EvalCubics(n, c[0], s, rho);
+		EvalCubics(n, c[1], s, drho);
+		EvalCubics(n, c[2], s, ddrho);
+		OffsetCurvatures(n, rho, drho, ddrho, comfort_frames_.curvature[k], curvature, turn);
+		// the heading of the centerline cancels in the difference to the last selected path
+		float last_turn = batch_last_turn_[k];
+		for (int i = 0; i < n; i++) {
+			if (s >= length[i]) continue;
+			comfort[i] += curvature[i]*curvature[i];
+			if (fabs(curvature[i]) > max_curvature[i]) max_curvature[i] = fabs(curvature[i]);
+			if (!first_iter_) consistent[i] += fabs(last_turn - turn[i]);
+		}
+	}
+	for (int i = 0; i < n; i++) {
+		candidates_[i0 + i].SetMaxCurvature(max_curvature[i]);
+		float c_tot = a_ * comfort[i] * ds_ + b_ * consistent[i] * ds_ / length[i];
+		candidates_[i0 + i].SetComfortability(c_tot);
+	}
+}
+
+void Planner::CalculateDynamicSafety(const nature::msg::Odometry &odom, int i0, int i1) {
+	for (int i = i0; i < i1; i++) {
 		float km = candidates_[i].GetMaxCurvature();
 		float vk = (float)sqrt(alpha_max_ / km);
 		float fs = candidates_[i].GetStaticSafety();
@@ -116,54 +277,144 @@ void Planner::DilateGrid(nature::msg::OccupancyGrid &grid, int x, float llx, flo
 	//std::cerr << "Grid Size: " << grid.info.width << ", " << grid.info.height << std::endl;
 	//std::cerr << "Grid Origin: " << grid.info.origin.position.x << ", " << grid.info.origin.position.y << std::endl;
 	//std::cerr << "Grid Resolution: " << grid.info.resolution << std::endl;
-	std::vector<int8_t> new_data = grid.data;
-
+	if (grid.data.size() != grid.info.width*grid.info.height) return;
 	int ix = (int)floor((llx - grid.info.origin.position.x) / grid.info.resolution);
-	if(ix < 0) {ix = 0;}
 	int iy = (int)floor((lly - grid.info.origin.position.y) / grid.info.resolution);
-	if(iy < 0) {iy = 0;}
 	int imax_x = (int)ceil((urx - grid.info.origin.position.x) / grid.info.resolution);
-	if(imax_x > grid.info.width) {imax_x = grid.info.width;}
 	int imax_y = (int)ceil((ury - grid.info.origin.position.y) / grid.info.resolution);
-	if(imax_y > grid.info.height) {imax_x = grid.info.height;}
 	//std::cerr << "Dilate Grid: (" << ix << ", " << iy << ") to (" << imax_x << ", " << imax_y << ")" << std::endl;
 
-	for (int i=ix+x;i<imax_x-x;i++){
-		for (int j=iy+x;j<imax_y-x;j++){
-			int n = i*grid.info.height+j;
-			for (int ii=-x;ii<=x;ii++){
-				for (int jj=-x;jj<=x;jj++){
-					int iii = i+ii;
-					int jjj = j+jj;
-					int nd = iii*grid.info.height+jjj;
-					new_data[n] = std::max(new_data[n],grid.data[nd]);
+	// the roi is clamped to the grid inside DilateBox
+	nature::common::DilateBox(grid.data.data(), grid.data.data(), grid.info.width, grid.info.height, x, x,
+	                          nature::common::GridRoi(ix, iy, imax_x, imax_y));
+}
+
+void Planner::DilateGrid(const nature::msg::OccupancyGrid &grid, nature::msg::OccupancyGrid &dilated, int x, float llx, float lly, float urx, float ury){
+	dilated.header = grid.header;
+	dilated.info = grid.info;
+	if (grid.data.size() != grid.info.width*grid.info.height) {
+		dilated.data = grid.data;
+		return;
+	}
+	int nx = grid.info.width;
+	int ny = grid.info.height;
+	dilated.data.resize(grid.data.size());
+	int ix = (int)floor((llx - grid.info.origin.position.x) / grid.info.resolution);
+	int iy = (int)floor((lly - grid.info.origin.position.y) / grid.info.resolution);
+	int imax_x = (int)ceil((urx - grid.info.origin.position.x) / grid.info.resolution);
+	int imax_y = (int)ceil((ury - grid.info.origin.position.y) / grid.info.resolution);
+	nature::common::GridRoi roi = nature::common::GridRoi(ix, iy, imax_x, imax_y).Clamp(nx, ny);
+	const int8_t *src = grid.data.data();
+	int8_t *dst = dilated.data.data();
+	if (roi.Empty()) {
+		std::copy(src, src + grid.data.size(), dst);
+		return;
+	}
+	// copy around the roi, columns are contiguous
+	std::copy(src, src + (size_t)roi.imin*ny, dst);
+	for (int i = roi.imin; i < roi.imax; i++) {
+		size_t col = (size_t)i*ny;
+		std::copy(src + col, src + col + roi.jmin, dst + col);
+		std::copy(src + col + roi.jmax, src + col + ny, dst + col + roi.jmax);
+	}
+	std::copy(src + (size_t)roi.imax*ny, src + grid.data.size(), dst + (size_t)roi.imax*ny);
+	nature::common::DilateBox(src, dst, nx, ny, x, x, roi);
+}
+
+void Planner::CalculateStaticSafetyAndSegCost(const nature::msg::OccupancyGrid & grid, const nature::msg::OccupancyGrid & grid_seg, int i0, int i1) {
+	bool has_segmentation = grid_seg.info.height>0 && grid_seg.info.width>0;
+	int n = i1 - i0;
+	const float *c[4];
+	BatchCoeffs(0, c);
+	for (int j = 0; j < 4; j++) c[j] += i0;
+	float *rho = batch_rho_.data() + i0;
+	float *x = batch_x_.data() + i0;
+	float *y = batch_y_.data() + i0;
+	const CenterlineFrames &frames = s_no_coll_before_ == 0.0f ? comfort_frames_ : safety_frames_;
+	float *stat_safe = batch_safety_.data() + i0;
+	float *traj_seg_cost = batch_seg_cost_.data() + i0;
+	const float *length = batch_length_.data() + i0;
+	const nature::common::GridIndex cells((int)grid.info.width, (int)grid.info.height);
+	for (int i = 0; i < n; i++) {
+		stat_safe[i] = 0.0f;
+		traj_seg_cost[i] = 0.0f;
+		candidate_cells_[i0 + i].clear();
+		candidate_cell_bounds_[i0 + i] = nature::common::GridRoi();
+	}
+	bool use_clearance = use_clearance_ && !clearance_.empty();
+	float half_width = 0.5f*vehicle_width_;
+	for (int k = 0; k < frames.s.size(); k++) {
+		EvalCubics(n, c, frames.s[k], rho);
+		OffsetPoints(n, rho, frames.x[k], frames.y[k], frames.nx[k], frames.ny[k], x, y);
+		for (int i = 0; i < n; i++) {
+			if (frames.s[k] >= length[i]) continue;
+			if (fabs(rho[i]) > rho_max_)candidates_[i0 + i].SetOutOfBounds(true);
+			int ix = (int)floor((x[i] - grid.info.origin.position.x) / grid.info.resolution);
+			int iy = (int)floor((y[i] - grid.info.origin.position.y) / grid.info.resolution);
+			if (cells.Contains(ix, iy)) {
+				int ndx = (int)cells.Index(ix, iy);
+				if (!use_clearance) stat_safe[i] += grid.data[ndx];
+				traj_seg_cost[i] += (has_segmentation ? grid_seg.data[ndx] : 0.0f);
+				AddCandidateCell(i0 + i, ix, iy, ndx);
+			}
+			if (use_clearance) {
+				// 1 within half the vehicle width of an obstacle, falling to 0 across the margin
+				float clearance;
+				float penalty;
+				if (ClearanceAt(x[i], y[i], clearance)) {
+					penalty = clearance <= half_width ? 1.0f :
+					          (clearance_margin_ > 0.0f ? (half_width + clearance_margin_ - clearance) / clearance_margin_ : 0.0f);
 				}
+				else {
+					// the clearance only covers the grid around the vehicle when it was computed,
+					// past it an occupied cell is still a hit
+					penalty = cells.Contains(ix, iy) && grid.data[cells.Index(ix, iy)] > 0 ? 1.0f : 0.0f;
+				}
+				if (penalty > stat_safe[i]) stat_safe[i] = penalty;
 			}
 		}
 	}
-	grid.data = new_data;
 }
 
-void Planner::CalculateStaticSafetyAndSegCost(const nature::msg::OccupancyGrid & grid, const nature::msg::OccupancyGrid & grid_seg) {
+void Planner::AddCandidateCell(int i, int ix, int iy, int ndx) {
+	// runs of samples in the same cell are kept as one (cell, count) pair
+	std::vector<int> &cells = candidate_cells_[i];
+	if (cells.size() >= 2 && cells[cells.size() - 2] == ndx) {
+		cells.back()++;
+		return;
+	}
+	cells.push_back(ndx);
+	cells.push_back(1);
+	candidate_cell_bounds_[i] = candidate_cell_bounds_[i].Union(nature::common::GridRoi(ix, iy, ix + 1, iy + 1));
+}
+
+void Planner::RescoreStaticSafety(const nature::msg::OccupancyGrid & grid, const nature::msg::OccupancyGrid & grid_seg, int i0, int i1) {
 	bool has_segmentation = grid_seg.info.height>0 && grid_seg.info.width>0;
-	for (int i = 0; i < candidates_.size(); i++) {
-		float s = s_no_coll_before_;
+	for (int i = i0; i < i1; i++) {
+		if (!grid_all_changed_ && !candidate_cell_bounds_[i].Intersects(grid_changed_)) continue;
+		// same sums as the sweep, integer cell values so the order does not matter
+		const std::vector<int> &cells = candidate_cells_[i];
 		float stat_safe = 0.0f;
-		float traj_seg_cost = 0.0;
-		while (s < s_max_) {
-			float rho = candidates_[i].At(s);
-			if (fabs(rho) > rho_max_)candidates_[i].SetOutOfBounds(true);
-			utils::vec2 p = path_.ToCartesian(s_start_ + s, rho);
-			int ix = (int)floor((p.x - grid.info.origin.position.x) / grid.info.resolution);
-			int iy = (int)floor((p.y - grid.info.origin.position.y) / grid.info.resolution);
-			if (ix >= 0 && ix < (int)grid.info.width && iy >= 0 && iy < (int)grid.info.height) {
-				int ndx = ix * grid.info.height + iy;
-				stat_safe += grid.data[ndx];
-				traj_seg_cost += (has_segmentation ? grid_seg.data[ndx] : 0.0f);
-			}
-			s += ds_;
+		float traj_seg_cost = 0.0f;
+		for (int k = 0; k < cells.size(); k += 2) {
+			float count = (float)cells[k + 1];
+			stat_safe += count*grid.data[cells[k]];
+			if (has_segmentation) traj_seg_cost += count*grid_seg.data[cells[k]];
+		}
+		batch_safety_[i] = stat_safe;
+		batch_seg_cost_[i] = traj_seg_cost;
+	}
+}
+
+void Planner::FinishStaticSafety() {
+	bool use_clearance = use_clearance_ && !clearance_.empty();
+	for (int i = 0; i < candidates_.size(); i++) {
+		float stat_safe = batch_safety_[i];
+		if (use_clearance && stat_safe < 1.0f) {
+			candidates_[i].SetHitsObstacle(false);
+			candidates_[i].SetStaticSafety(stat_safe);
 		}
-		if (stat_safe > 0) {
+		else if (stat_safe > 0) {
 			candidates_[i].SetHitsObstacle(true);
 			candidates_[i].SetStaticSafety(1.0f);
 		}
@@ -171,20 +422,64 @@ void Planner::CalculateStaticSafetyAndSegCost(const nature::msg::OccupancyGrid &
 			candidates_[i].SetHitsObstacle(false);
 			candidates_[i].SetStaticSafety(0.0f);
 		}
-		candidates_[i].SetSegmentationCost(traj_seg_cost);
+		candidates_[i].SetSegmentationCost(batch_seg_cost_[i]);
 	}
+}
+
+void Planner::MarkGridChanged(const nature::common::GridRoi &roi) {
+	if (grid_change_known_) grid_changed_ = grid_changed_.Union(roi);
+	else grid_changed_ = roi;
+	grid_change_known_ = true;
+	grid_all_changed_ = false;
+}
+
+void Planner::MarkGridUnchanged() {
+	if (!grid_change_known_) grid_changed_ = nature::common::GridRoi();
+	grid_change_known_ = true;
+	grid_all_changed_ = false;
+}
 
+void Planner::SetClearanceGrid(const nature::msg::OccupancyGrid &grid, float llx, float lly, float urx, float ury){
+	clearance_.clear();
+	if (grid.data.size() != grid.info.width*grid.info.height || grid.info.resolution <= 0.0f) return;
+	// pad the bounds so obstacles just outside them are still seen within the margin
+	float pad = 0.5f*vehicle_width_ + clearance_margin_ + grid.info.resolution;
+	int ix = (int)floor((llx - pad - grid.info.origin.position.x) / grid.info.resolution);
+	int iy = (int)floor((lly - pad - grid.info.origin.position.y) / grid.info.resolution);
+	int imax_x = (int)ceil((urx + pad - grid.info.origin.position.x) / grid.info.resolution);
+	int imax_y = (int)ceil((ury + pad - grid.info.origin.position.y) / grid.info.resolution);
+	nature::common::GridRoi roi = nature::common::GridRoi(ix, iy, imax_x, imax_y).Clamp(grid.info.width, grid.info.height);
+	nature::common::DistanceTransform(grid.data.data(), grid.info.width, grid.info.height, (int8_t)0, roi, clearance_);
+	for (int n = 0; n < clearance_.size(); n++) clearance_[n] = sqrtf(clearance_[n])*grid.info.resolution;
+	clr_llx_ = grid.info.origin.position.x + roi.imin*grid.info.resolution;
+	clr_lly_ = grid.info.origin.position.y + roi.jmin*grid.info.resolution;
+	clr_res_ = grid.info.resolution;
+	clr_width_ = roi.imax - roi.imin;
+	clr_height_ = roi.jmax - roi.jmin;
+}
+
+bool Planner::ClearanceAt(float x, float y, float &clearance) const {
+	int ix = (int)floor((x - clr_llx_) / clr_res_);
+	int iy = (int)floor((y - clr_lly_) / clr_res_);
+	if (ix < 0 || ix >= clr_width_ || iy < 0 || iy >= clr_height_) return false;
+	clearance = clearance_[ix * clr_height_ + iy];
+	return true;
+}
+
+void Planner::BlendStaticSafety() {
 	// now blend
 	if(use_blend_){
 		std::vector<float> fs;
 		std::vector<float> fseg;
 		fs.resize(candidates_.size(),0.0f);
 		fseg.resize(candidates_.size(),0.0f);
-		for (int i = 0; i < candidates_.size(); i++) {
+		for (int l = 0; l < layers_.size(); l++) {
+		const LatticeLayer &layer = layers_[l];
+		for (int i = layer.begin; i < layer.end; i++) {
 		float fcount = 0.0f;
-		for (int k = -averaging_window_size_; k <= averaging_window_size_; k++) {
+		for (int k = -layer.window; k <= layer.window; k++) {
 			int ndx = i + k;
-			if (ndx >= 0 && ndx < candidates_.size()) {
+			if (ndx >= layer.begin && ndx < layer.end) {
 			fs[i] += candidates_[ndx].GetStaticSafety();
 			fseg[i] += candidates_[ndx].GetSegmentationCost();
 			fcount += 1.0f;
@@ -193,6 +488,7 @@ void Planner::CalculateStaticSafetyAndSegCost(const nature::msg::OccupancyGrid &
 		fs[i] = fs[i] / fcount;
 		fseg[i] = fseg[i] / fcount;
 		}
+		}
 		for (int i = 0; i < candidates_.size(); i++) {
 		candidates_[i].SetStaticSafety(fs[i]);
 		candidates_[i].SetSegmentationCost(fseg[i]);
@@ -200,27 +496,147 @@ void Planner::CalculateStaticSafetyAndSegCost(const nature::msg::OccupancyGrid &
 	}
 }
 
-void Planner::CalculateRhoCost() {
-	for (int i = 0; i < candidates_.size(); i++) {
-		float rho_final = candidates_[i].At(s_max_);
-		float rho_cost = (float)fabs(rho_final / rho_max_);
+void Planner::SetCostToGo(const nature::msg::LayeredGrid &cost_to_go){
+	cost_to_go_version_++;
+	size_t ncells = (size_t)cost_to_go.info.width*cost_to_go.info.height;
+	for (size_t k = 0; k < cost_to_go.float_layers.size(); k++) {
+		if (cost_to_go.float_layers[k] != "cost_to_go" || cost_to_go.float_data.size() < (k+1)*ncells) continue;
+		cost_to_go_.assign(cost_to_go.float_data.begin() + k*ncells, cost_to_go.float_data.begin() + (k+1)*ncells);
+		ctg_llx_ = cost_to_go.info.origin.position.x;
+		ctg_lly_ = cost_to_go.info.origin.position.y;
+		ctg_res_ = cost_to_go.info.resolution;
+		ctg_width_ = cost_to_go.info.width;
+		ctg_height_ = cost_to_go.info.height;
+		return;
+	}
+	std::cerr << "WARNING: NO cost_to_go LAYER IN THE COST TO GO GRID." << std::endl;
+	cost_to_go_.clear();
+}
+
+float Planner::CostToGoAt(utils::vec2 p) const {
+	int ix = (int)floor((p.x - ctg_llx_) / ctg_res_);
+	int iy = (int)floor((p.y - ctg_lly_) / ctg_res_);
+	if (ix < 0 || ix >= ctg_width_ || iy < 0 || iy >= ctg_height_) {
+		return std::numeric_limits<float>::quiet_NaN();
+	}
+	return cost_to_go_[ix * ctg_height_ + iy];
+}
+
+void Planner::CalculateRhoCost(int i0, int i1) {
+	bool use_cost_to_go = !cost_to_go_.empty();
+	for (int i = i0; i < i1; i++) {
+		float s_end = batch_length_[i];
+		float rho_final = candidates_[i].At(s_end);
+		if (use_cost_to_go) {
+			utils::vec2 p = path_.ToCartesian(s_start_ + s_end, rho_final);
+			batch_cost_to_go_[i] = CostToGoAt(p);
+		}
+		// against the width of its own fan, which grows with the look ahead, so the fans of a lattice
+		// compare per meter and the short ones aren't favored
+		float rho_cost = (float)fabs(rho_final / (rho_per_length_*candidates_[i].GetMaxLength()));
 		candidates_[i].SetRhoCost(rho_cost);
 	}
 }
 
+void Planner::NormalizeCostToGo() {
+	if (cost_to_go_.empty() || candidates_.empty()) return;
+	// scaled so the weight w_r means the same as for the offset, which stays if a candidate ends outside the field
+	float cmin = std::numeric_limits<float>::max();
+	float cmax = -std::numeric_limits<float>::max();
+	for (int i = 0; i < candidates_.size(); i++) {
+		if (std::isnan(batch_cost_to_go_[i])) return;
+		cmin = std::min(cmin, batch_cost_to_go_[i]);
+		cmax = std::max(cmax, batch_cost_to_go_[i]);
+	}
+	float range = cmax - cmin;
+	for (int i = 0; i < candidates_.size(); i++) {
+		candidates_[i].SetRhoCost(range > 0.0f ? (batch_cost_to_go_[i] - cmin) / range : 0.0f);
+	}
+}
+
+void Planner::CalculateCandidateBlock(const nature::msg::OccupancyGrid & grid, const nature::msg::OccupancyGrid & segmentation_grid, int i0, int i1) {
+	if (sweep_static_ || rescore_static_) {
+		nature::node::ScopedTimer timer(STAGE_STATIC_SAFETY);
+		if (sweep_static_) CalculateStaticSafetyAndSegCost(grid, segmentation_grid, i0, i1);
+		else RescoreStaticSafety(grid, segmentation_grid, i0, i1);
+	}
+	if (!comfort_valid_) {
+		nature::node::ScopedTimer timer(STAGE_COMFORT);
+		CalculateComfortability(i0, i1);
+	}
+	if (!rho_valid_) {
+		nature::node::ScopedTimer timer(STAGE_RHO_COST);
+		CalculateRhoCost(i0, i1);
+	}
+}
+
 float Planner::GetTotalCostOfCandidate(int i) {
 	float cost = w_c_ * candidates_[i].GetComfortability() + w_s_ * candidates_[i].GetStaticSafety() + w_r_ * candidates_[i].GetRhoCost() + w_d_*candidates_[i].GetDynamicSafety() * w_t_*candidates_[i].GetSegmentationCost();
   	candidates_[i].SetCost(cost);
 	return cost;
 }
 
-bool Planner::CalculateCandidateCosts(nature::msg::OccupancyGrid grid, nature::msg::OccupancyGrid segmentation_grid, nature::msg::Odometry odom) {
+bool Planner::CalculateCandidateCosts(const nature::msg::OccupancyGrid &grid, const nature::msg::OccupancyGrid &segmentation_grid, const nature::msg::Odometry &odom) {
+	// terms are kept while the candidates are unchanged, static safety is swept again when the grid
+	// geometry changes and is re-scored from the cached cells of the candidates crossing changed cells
+	bool use_clearance = use_clearance_ && !clearance_.empty();
+	bool same_candidates = cache_generation_ == generation_ && cache_num_candidates_ == (int)candidates_.size();
+	sweep_static_ = !same_candidates || cache_grid_width_ != grid.info.width || cache_grid_height_ != grid.info.height ||
+	                cache_grid_llx_ != grid.info.origin.position.x || cache_grid_lly_ != grid.info.origin.position.y ||
+	                cache_grid_res_ != grid.info.resolution || cache_s_no_coll_before_ != s_no_coll_before_ ||
+	                cache_use_clearance_ != use_clearance || (use_clearance && (grid_all_changed_ || !grid_changed_.Empty()));
+	rescore_static_ = !sweep_static_ && (grid_all_changed_ || !grid_changed_.Empty());
+	comfort_valid_ = same_candidates && cache_selected_generation_ == selected_generation_ && cache_selected_index_ == selected_index_;
+	rho_valid_ = same_candidates && cache_cost_to_go_version_ == cost_to_go_version_;
+
+	// the centerline and the candidate polynomials are shared by all the cost passes,
+	// the last lane holds the selected candidate so is packed again when it changes
+	if (!comfort_valid_) PackCandidates();
+	if (!same_candidates) {
+		SampleCenterline(0.0f, comfort_frames_);
+		candidate_cells_.resize(candidates_.size());
+		candidate_cell_bounds_.resize(candidates_.size());
+	}
+	if (sweep_static_ && s_no_coll_before_ != 0.0f) SampleCenterline(s_no_coll_before_, safety_frames_);
+	if (!comfort_valid_) CalculateLastTurn();
+
+	// the candidates are independent until the blend, each block only writes its own candidates
+	// and scratch lanes so the result does not depend on the number of threads
+	int ncand = (int)candidates_.size();
+	int nblocks = (ncand + CANDIDATE_BLOCK - 1) / CANDIDATE_BLOCK;
+#pragma omp parallel for schedule(static) num_threads(num_threads_) if(num_threads_ > 1 && nblocks > 1)
+	for (int b = 0; b < nblocks; b++) {
+		CalculateCandidateBlock(grid, segmentation_grid, b * CANDIDATE_BLOCK, std::min(ncand, (b + 1) * CANDIDATE_BLOCK));
+	}
+
+	{
+		nature::node::ScopedTimer timer(STAGE_BLEND);
+		FinishStaticSafety();
+		BlendStaticSafety();
+		if (!rho_valid_) NormalizeCostToGo();
+	}
+	{
+		nature::node::ScopedTimer timer(STAGE_DYNAMIC_SAFETY);
+		CalculateDynamicSafety(odom, 0, ncand);
+	}
 
-	CalculateStaticSafetyAndSegCost(grid, segmentation_grid);
-	CalculateComfortability();
-	CalculateRhoCost();
-	CalculateDynamicSafety(odom);
+	cache_generation_ = generation_;
+	cache_num_candidates_ = ncand;
+	cache_grid_width_ = grid.info.width;
+	cache_grid_height_ = grid.info.height;
+	cache_grid_llx_ = grid.info.origin.position.x;
+	cache_grid_lly_ = grid.info.origin.position.y;
+	cache_grid_res_ = grid.info.resolution;
+	cache_s_no_coll_before_ = s_no_coll_before_;
+	cache_use_clearance_ = use_clearance;
+	cache_selected_generation_ = selected_generation_;
+	cache_selected_index_ = selected_index_;
+	cache_cost_to_go_version_ = cost_to_go_version_;
+	grid_change_known_ = false;
+	grid_all_changed_ = true;
+	grid_changed_ = nature::common::GridRoi();
 
+	nature::node::ScopedTimer timer(STAGE_SELECTION);
 	int lowest_index = -1;
 	float lowest_cost = std::numeric_limits<float>::max();
 	for (int i = 0; i < candidates_.size(); i++) {
@@ -245,6 +661,8 @@ bool Planner::CalculateCandidateCosts(nature::msg::OccupancyGrid grid, nature::m
 	}
 	candidates_[lowest_index].SetRank(1);
 	last_selected_ = candidates_[lowest_index];
+	selected_generation_ = generation_;
+	selected_index_ = lowest_index;
 	first_iter_ = false;
 	return true;
 }
@@ -262,7 +680,8 @@ float Planner::GetAngleAt(float s) {
 	float theta = 0.0f;
 	if (!first_iter_) {
 		CurveInfo base_ca = path_.GetCurvatureAndAngle(s);
-		CurveInfo ca = InfoOfCurve(last_selected_, s, base_ca);
+		int theta_segment = -1;
+		CurveInfo ca = InfoOfCurve(last_selected_, s, base_ca, theta_segment);
 		theta = ca.theta;
 	}
 	return theta;
@@ -16,11 +16,12 @@ Plotter::Plotter(std::shared_ptr<nature::visualization::VisualizerBase> visualiz
 	y_lo_ = -128.0f;
 	y_hi_ = 128.0f;
 	map_set_ = false;
+	grid_ = NULL;
   visualizer_ = visualizer;
 }
 
-void Plotter::AddMap(nature::msg::OccupancyGrid grid){
-	grid_ = grid;
+void Plotter::AddMap(const nature::msg::OccupancyGrid &grid){
+	grid_ = &grid;
 	x_lo_ = grid.info.origin.position.x;
 	y_lo_ = grid.info.origin.position.y;
 	if (grid.info.width!=nx_ || grid.info.height!=ny_){
@@ -47,7 +48,7 @@ void Plotter::AddWaypoints(nature::msg::Path waypoints){
 	}
 }
 
-void Plotter::AddCurves(std::vector<Candidate> curves) {
+void Plotter::AddCurves(const std::vector<Candidate> &curves) {
 	curves_ = curves;
 }
 
@@ -79,20 +80,9 @@ void Plotter::Display(bool save, const std::string & ofname, int nx, int ny) {
 	nature::utils::vec3 blue(0.0f, 0.0f, 255.0f);
 	nature::utils::vec3 purple(255.0f, 0.0f, 255.0f);
 
-	// Add the occupancy grid
-	for (int i = 0; i < nx_; i++) {
-		float x = x_lo_ + (i + 0.5f)*pixdim_;
-		int idx = (int)floor((x - grid_.info.origin.position.x) / grid_.info.resolution);
-		for (int j = 0; j < ny_; j++) {
-			float y = y_lo_ + (j + 0.5f)*pixdim_;
-			int idy = (int)floor((y - grid_.info.origin.position.y) / grid_.info.resolution);
-			if (idx >= 0 && idx < (int)grid_.info.width && idy >= 0 && idy <= (int)grid_.info.height) {
-				int n = idx * grid_.info.height + idy;
-				if (grid_.data[n] > 0) {
-          visualizer_->draw_point(i,j,red);
-				}
-			}
-		}
+	// Add the occupancy grid, the image has one pixel per cell
+	if (grid_->data.size() >= (size_t)nx_*ny_) {
+		visualizer_->draw_grid(grid_->data.data(), nx_, ny_, red);
 	}
 
 	// plot waypoints
@@ -0,0 +1,403 @@
+#include "nature/simulation/lidar_simulator.h"
+#include "nature/CImg.h"
+#include <math.h>
+#include <algorithm>
+#include <iostream>
+#include <limits>
+
+namespace nature {
+namespace simulation {
+
+namespace {
+
+/// Heightmap cells per side of a block of the block grid
+const int BLOCK = 8;
+const float FAR = std::numeric_limits<float>::max();
+
+/**
+ * Clip the ray (ox,oy) + t*(dx,dy) to the box [x0,x1] x [y0,y1]
+ * \param t0 Start of the segment, clipped
+ * \param t1 End of the segment, clipped
+ * \return False if the segment misses the box
+ */
+bool ClipToBox(float ox, float oy, float dx, float dy, float x0, float y0, float x1, float y1, float &t0, float &t1){
+  const float o[2] = {ox, oy};
+  const float d[2] = {dx, dy};
+  const float lo[2] = {x0, y0};
+  const float hi[2] = {x1, y1};
+  for (int k = 0; k < 2; k++){
+    if (d[k] == 0.0f){
+      if (o[k] < lo[k] || o[k] > hi[k]) return false;
+      continue;
+    }
+    float ta = (lo[k] - o[k])/d[k];
+    float tb = (hi[k] - o[k])/d[k];
+    if (ta > tb) std::swap(ta, tb);
+    t0 = std::max(t0, ta);
+    t1 = std::min(t1, tb);
+  }
+  return t0 <= t1;
+}
+
+/**
+ * Visit the cells of an ni by nj grid crossed by the segment [t0,t1] of a ray,
+ * in order, with 2D DDA. The segment must lie in the grid.
+ * \param visit Called with the cell (i,j) and the span [ta,tb] of the ray in it,
+ * returns true to stop
+ */
+template<class Visit>
+void WalkGrid(float ox, float oy, float dx, float dy, float t0, float t1,
+              float x0, float y0, float size, int ni, int nj, Visit visit){
+  int i = std::min(ni - 1, std::max(0, (int)floorf((ox + dx*t0 - x0)/size)));
+  int j = std::min(nj - 1, std::max(0, (int)floorf((oy + dy*t0 - y0)/size)));
+  const int si = dx > 0.0f ? 1 : -1;
+  const int sj = dy > 0.0f ? 1 : -1;
+  const float tdi = dx != 0.0f ? size/fabsf(dx) : FAR;
+  const float tdj = dy != 0.0f ? size/fabsf(dy) : FAR;
+  float tmi = dx != 0.0f ? (x0 + (i + (si > 0 ? 1 : 0))*size - ox)/dx : FAR;
+  float tmj = dy != 0.0f ? (y0 + (j + (sj > 0 ? 1 : 0))*size - oy)/dy : FAR;
+  float t = t0;
+  while (true){
+    float te = std::min(t1, std::min(tmi, tmj));
+    if (visit(i, j, t, te) || te >= t1) return;
+    if (tmi < tmj){
+      i += si;
+      tmi += tdi;
+    }
+    else {
+      j += sj;
+      tmj += tdj;
+    }
+    if (i < 0 || i >= ni || j < 0 || j >= nj) return;
+    t = te;
+  }
+}
+
+} // namespace
+
+SimulatedWorld::SimulatedWorld(){
+  base_height_ = 0.0f;
+  nx_ = 0;
+  ny_ = 0;
+  res_ = 1.0f;
+  llx_ = 0.0f;
+  lly_ = 0.0f;
+  nbx_ = 0;
+  nby_ = 0;
+  bins_x_ = 0;
+  bins_y_ = 0;
+  bin_size_ = 1.0f;
+  bin_llx_ = 0.0f;
+  bin_lly_ = 0.0f;
+}
+
+void SimulatedWorld::SetHeightmap(const std::vector<float> &heights, int nx, int ny, float res, float llx, float lly){
+  if (nx < 2 || ny < 2 || heights.size() != (size_t)nx*ny){
+    std::cerr << "WARNING: The heightmap must have at least 2x2 samples, using flat ground." << std::endl;
+    heights_.clear();
+    nx_ = 0;
+    ny_ = 0;
+    return;
+  }
+  heights_ = heights;
+  nx_ = nx;
+  ny_ = ny;
+  res_ = res;
+  llx_ = llx;
+  lly_ = lly;
+}
+
+bool SimulatedWorld::LoadHeightmap(const std::string &file, float res, float llx, float lly, float scale){
+  cimg_library::CImg<float> img;
+  try {
+    img.load(file.c_str());
+  }
+  catch (const cimg_library::CImgException &e){
+    std::cerr << "WARNING: Could not read the heightmap " << file << ", " << e.what() << std::endl;
+    return false;
+  }
+  int nx = img.width();
+  int ny = img.height();
+  std::vector<float> heights((size_t)nx*ny);
+  for (int i = 0; i < nx; i++){
+    for (int j = 0; j < ny; j++){
+      // the first image row is the north edge
+      heights[(size_t)i*ny + j] = base_height_ + scale*img(i, ny - 1 - j);
+    }
+  }
+  SetHeightmap(heights, nx, ny, res, llx, lly);
+  return nx_ > 0;
+}
+
+void SimulatedWorld::AddCylinder(float x, float y, float radius, float height){
+  Cylinder c;
+  c.x = x;
+  c.y = y;
+  c.radius = radius;
+  c.height = height;
+  c.top = height;
+  cylinders_.push_back(c);
+}
+
+void SimulatedWorld::Build(float bin_size){
+  // highest sample of each block, counting the samples on its edges
+  nbx_ = nx_ > 1 ? (nx_ - 2)/BLOCK + 1 : 0;
+  nby_ = ny_ > 1 ? (ny_ - 2)/BLOCK + 1 : 0;
+  block_max_.assign((size_t)nbx_*nby_, -FAR);
+  for (int bi = 0; bi < nbx_; bi++){
+    for (int bj = 0; bj < nby_; bj++){
+      float hmax = -FAR;
+      int imax = std::min(nx_ - 1, (bi + 1)*BLOCK);
+      int jmax = std::min(ny_ - 1, (bj + 1)*BLOCK);
+      for (int i = bi*BLOCK; i <= imax; i++){
+        const float *col = &heights_[(size_t)i*ny_];
+        for (int j = bj*BLOCK; j <= jmax; j++) hmax = std::max(hmax, col[j]);
+      }
+      block_max_[(size_t)bi*nby_ + bj] = hmax;
+    }
+  }
+
+  bin_start_.clear();
+  bin_items_.clear();
+  bins_x_ = 0;
+  bins_y_ = 0;
+  if (cylinders_.empty()) return;
+  // the cylinders stand on the ground under their centers and reach down through it
+  float x0 = FAR, y0 = FAR, x1 = -FAR, y1 = -FAR;
+  for (Cylinder &c : cylinders_){
+    c.top = GroundHeight(c.x, c.y) + c.height;
+    x0 = std::min(x0, c.x - c.radius);
+    y0 = std::min(y0, c.y - c.radius);
+    x1 = std::max(x1, c.x + c.radius);
+    y1 = std::max(y1, c.y + c.radius);
+  }
+  bin_size_ = std::max(bin_size, 1.0e-3f);
+  bin_llx_ = x0;
+  bin_lly_ = y0;
+  bins_x_ = std::max(1, (int)ceilf((x1 - x0)/bin_size_));
+  bins_y_ = std::max(1, (int)ceilf((y1 - y0)/bin_size_));
+  // counting sort of the cylinders into every bin their bounding square overlaps
+  std::vector<int> count((size_t)bins_x_*bins_y_ + 1, 0);
+  for (int pass = 0; pass < 2; pass++){
+    for (int k = 0; k < (int)cylinders_.size(); k++){
+      const Cylinder &c = cylinders_[k];
+      int i0 = std::max(0, (int)floorf((c.x - c.radius - x0)/bin_size_));
+      int i1 = std::min(bins_x_ - 1, (int)floorf((c.x + c.radius - x0)/bin_size_));
+      int j0 = std::max(0, (int)floorf((c.y - c.radius - y0)/bin_size_));
+      int j1 = std::min(bins_y_ - 1, (int)floorf((c.y + c.radius - y0)/bin_size_));
+      for (int i = i0; i <= i1; i++){
+        for (int j = j0; j <= j1; j++){
+          int b = i*bins_y_ + j;
+          if (pass == 0) count[b + 1]++;
+          else bin_items_[count[b]++] = k;
+        }
+      }
+    }
+    if (pass == 0){
+      for (size_t b = 1; b < count.size(); b++) count[b] += count[b - 1];
+      bin_start_ = count;
+      bin_items_.resize(count.back());
+    }
+  }
+}
+
+float SimulatedWorld::SampleHeight(float u, float v) const {
+  u = std::min((float)(nx_ - 1), std::max(0.0f, u));
+  v = std::min((float)(ny_ - 1), std::max(0.0f, v));
+  int i = std::min(nx_ - 2, (int)u);
+  int j = std::min(ny_ - 2, (int)v);
+  float fu = u - i;
+  float fv = v - j;
+  const float *c0 = &heights_[(size_t)i*ny_ + j];
+  const float *c1 = c0 + ny_;
+  return (1.0f - fu)*((1.0f - fv)*c0[0] + fv*c0[1]) + fu*((1.0f - fv)*c1[0] + fv*c1[1]);
+}
+
+float SimulatedWorld::GroundHeight(float x, float y) const {
+  if (nx_ == 0) return base_height_;
+  float u = (x - llx_)/res_;
+  float v = (y - lly_)/res_;
+  if (u < 0.0f || v < 0.0f || u > nx_ - 1 || v > ny_ - 1) return base_height_;
+  return SampleHeight(u, v);
+}
+
+bool SimulatedWorld::RaycastHeightmap(const nature::utils::vec3 &o, const nature::utils::vec3 &d, float t0, float t1, float &t) const {
+  const float block_size = BLOCK*res_;
+  bool hit = false;
+  auto ground_gap = [&](float s){
+    return o.z + d.z*s - SampleHeight((o.x + d.x*s - llx_)/res_, (o.y + d.y*s - lly_)/res_);
+  };
+  WalkGrid(o.x, o.y, d.x, d.y, t0, t1, llx_, lly_, block_size, nbx_, nby_,
+           [&](int bi, int bj, float ba, float bb){
+    // the ray is straight, so it is lowest in the block at one end of its span
+    if (std::min(o.z + d.z*ba, o.z + d.z*bb) > block_max_[(size_t)bi*nby_ + bj]) return false;
+    float bx0 = llx_ + bi*block_size;
+    float by0 = lly_ + bj*block_size;
+    int ni = std::min(BLOCK, nx_ - 1 - bi*BLOCK);
+    int nj = std::min(BLOCK, ny_ - 1 - bj*BLOCK);
+    WalkGrid(o.x, o.y, d.x, d.y, ba, bb, bx0, by0, res_, ni, nj,
+             [&](int, int, float ca, float cb){
+      float fa = ground_gap(ca);
+      if (fa <= 0.0f){
+        t = ca;
+        hit = true;
+        return true;
+      }
+      float fb = ground_gap(cb);
+      if (fb > 0.0f) return false;
+      // regula falsi on the bilinear ground, which is smooth within the cell
+      for (int k = 0; k < 4; k++){
+        float s = ca + (cb - ca)*fa/(fa - fb);
+        float fs = ground_gap(s);
+        if (fs > 0.0f){
+          ca = s;
+          fa = fs;
+        }
+        else {
+          cb = s;
+          fb = fs;
+        }
+      }
+      t = ca + (cb - ca)*fa/(fa - fb);
+      hit = true;
+      return true;
+    });
+    return hit;
+  });
+  return hit;
+}
+
+bool SimulatedWorld::RaycastGround(const nature::utils::vec3 &o, const nature::utils::vec3 &d, float &t_max) const {
+  // the flat ground outside the heightmap
+  float t_flat = FAR;
+  if (o.z <= base_height_) t_flat = 0.0f;
+  else if (d.z < 0.0f) t_flat = (base_height_ - o.z)/d.z;
+
+  float t0 = 0.0f;
+  float t1 = t_max;
+  if (nx_ == 0 || !ClipToBox(o.x, o.y, d.x, d.y, llx_, lly_, llx_ + (nx_ - 1)*res_, lly_ + (ny_ - 1)*res_, t0, t1)){
+    if (t_flat > t_max) return false;
+    t_max = t_flat;
+    return true;
+  }
+  if (t_flat < t0){
+    t_max = t_flat;
+    return true;
+  }
+  float t;
+  if (RaycastHeightmap(o, d, t0, t1, t)){
+    t_max = t;
+    return true;
+  }
+  if (t_flat > t1 && t_flat <= t_max){
+    t_max = t_flat;
+    return true;
+  }
+  return false;
+}
+
+bool SimulatedWorld::RaycastCylinders(const nature::utils::vec3 &o, const nature::utils::vec3 &d, float &t_max) const {
+  if (bins_x_ == 0) return false;
+  float t0 = 0.0f;
+  float t1 = t_max;
+  if (!ClipToBox(o.x, o.y, d.x, d.y, bin_llx_, bin_lly_, bin_llx_ + bins_x_*bin_size_, bin_lly_ + bins_y_*bin_size_, t0, t1)) return false;
+  const float a = d.x*d.x + d.y*d.y;
+  bool hit = false;
+  WalkGrid(o.x, o.y, d.x, d.y, t0, t1, bin_llx_, bin_lly_, bin_size_, bins_x_, bins_y_,
+           [&](int i, int j, float, float te){
+    int b = i*bins_y_ + j;
+    for (int k = bin_start_[b]; k < bin_start_[b + 1]; k++){
+      const Cylinder &c = cylinders_[bin_items_[k]];
+      float px = o.x - c.x;
+      float py = o.y - c.y;
+      float cc = px*px + py*py - c.radius*c.radius;
+      // span of the ray inside the infinite cylinder
+      float t_in, t_out;
+      if (a < 1.0e-12f){
+        if (cc > 0.0f) continue;
+        t_in = 0.0f;
+        t_out = FAR;
+      }
+      else {
+        float bh = px*d.x + py*d.y;
+        float disc = bh*bh - a*cc;
+        if (disc < 0.0f) continue;
+        float sq = sqrtf(disc);
+        t_in = std::max(0.0f, (-bh - sq)/a);
+        t_out = (-bh + sq)/a;
+      }
+      if (t_out < t_in || t_in >= t_max) continue;
+      if (o.z + d.z*t_in <= c.top){
+        // the side, or the origin is inside
+        t_max = t_in;
+        hit = true;
+      }
+      else if (d.z < 0.0f){
+        // the ray enters above the top and may come down through it
+        float t_cap = (c.top - o.z)/d.z;
+        if (t_cap <= t_out && t_cap < t_max){
+          t_max = t_cap;
+          hit = true;
+        }
+      }
+    }
+    // a hit within this bin is nearer than anything in the bins after it
+    return hit && t_max <= te;
+  });
+  return hit;
+}
+
+bool SimulatedWorld::Raycast(const nature::utils::vec3 &o, const nature::utils::vec3 &d, float max_range, float &t) const {
+  float t_max = max_range;
+  bool hit = RaycastGround(o, d, t_max);
+  hit = RaycastCylinders(o, d, t_max) || hit;
+  t = t_max;
+  return hit;
+}
+
+SimulatedLidar::SimulatedLidar(int channels, float min_elevation, float max_elevation, int horizontal_steps, float max_range){
+  channels_ = std::max(1, channels);
+  horizontal_steps_ = std::max(1, horizontal_steps);
+  max_range_ = max_range;
+  beam_dirs_.resize((size_t)channels_*horizontal_steps_);
+  const float deg = (float)M_PI/180.0f;
+  for (int h = 0; h < horizontal_steps_; h++){
+    float az = 2.0f*(float)M_PI*h/horizontal_steps_;
+    for (int c = 0; c < channels_; c++){
+      float el = channels_ > 1 ? min_elevation + (max_elevation - min_elevation)*c/(channels_ - 1) : min_elevation;
+      el *= deg;
+      beam_dirs_[(size_t)h*channels_ + c] = nature::utils::vec3(cosf(el)*cosf(az), cosf(el)*sinf(az), sinf(el));
+    }
+  }
+  ranges_.resize(beam_dirs_.size());
+}
+
+void SimulatedLidar::Scan(const SimulatedWorld &world, const nature::utils::vec3 &origin, float yaw,
+                          std::vector<nature::utils::vec3> &points, int num_threads, std::vector<uint16_t> *rings){
+  const float cy = cosf(yaw);
+  const float sy = sinf(yaw);
+  const int n = (int)beam_dirs_.size();
+#pragma omp parallel for schedule(dynamic, 256) num_threads(std::max(1, num_threads)) if(num_threads > 1)
+  for (int k = 0; k < n; k++){
+    const nature::utils::vec3 &b = beam_dirs_[k];
+    nature::utils::vec3 d(cy*b.x - sy*b.y, sy*b.x + cy*b.y, b.z);
+    float t;
+    ranges_[k] = world.Raycast(origin, d, max_range_, t) ? t : -1.0f;
+  }
+  points.clear();
+  points.reserve(n);
+  if (rings){
+    rings->clear();
+    rings->reserve(n);
+  }
+  for (int k = 0; k < n; k++){
+    float t = ranges_[k];
+    if (t < 0.0f) continue;
+    const nature::utils::vec3 &b = beam_dirs_[k];
+    points.push_back(nature::utils::vec3(origin.x + t*(cy*b.x - sy*b.y), origin.y + t*(sy*b.x + cy*b.y), origin.z + t*b.z));
+    if (rings) rings->push_back((uint16_t)(k % channels_));
+  }
+}
+
+} // namespace simulation
+} // namespace nature
@@ -0,0 +1,268 @@
+/**
+ * \file nature_replay_node.cpp
+ *
+ * Replays recorded point clouds, odometry and waypoints through the perception,
+ * global path, local planner and control stages as fast as they run.
+ * The stages are the ones of the nodes and nodelets, started in this process
+ * on a replay clock: their threads take turns in replayed time, woken by their
+ * node rates and by the recorded messages fed to them in the order of their stamps,
+ * so the same bag and parameters always give the same outputs. /clock follows
+ * the replayed time. At the end the count and a hash of the outputs of each stage
+ * are printed, two runs with equal hashes planned and drove the same.
+ *
+ * The stages read their parameters from ~perception/..., ~global/..., ~local/...
+ * and ~control/..., with the defaults of their nodes except the display, which
+ * is off unless set. The clouds are replayed on ~perception/points_topics.
+ *
+ * Parameters:
+ *   ~bag                    the recorded bag, with nature/odometry and optionally nature/new_waypoints
+ *   ~publish_clock          publish the replayed time on /clock, default true
+ *   ~connect_wait           wall seconds given to the topics of the stages to connect before the replay, default 2
+ *   ~tail                   replayed seconds the stages keep running after the last message, default 1
+ *
+ * \date 10/14/2026
+ */
+// c++ includes
+#include <stdint.h>
+#include <stdlib.h>
+#include <iostream>
+#include <iomanip>
+#include <chrono>
+#include <string>
+#include <vector>
+// ros includes
+#include <rosbag/bag.h>
+#include <rosbag/view.h>
+#include "nature/node/ros_types.h"
+#include "nature/node/node_proxy.h"
+#include "nature/node/clock_publisher.h"
+#include "nature/node/pipeline_stages.h"
+// nature includes
+#include "nature/common/replay_clock.h"
+
+namespace {
+
+/// 64 bit FNV-1a, bit exact so any change of an output changes its hash
+struct Hash {
+  uint64_t value = 14695981039346656037ULL;
+  void Add(const void *data, size_t size){
+    const unsigned char *bytes = static_cast<const unsigned char *>(data);
+    for (size_t k = 0; k < size; k++){
+      value ^= bytes[k];
+      value *= 1099511628211ULL;
+    }
+  }
+  void Add(double x){ Add(&x, sizeof(x)); }
+  void Add(const nature::msg::Path &path){
+    for (size_t k = 0; k < path.poses.size(); k++){
+      Add(path.poses[k].pose.position.x);
+      Add(path.poses[k].pose.position.y);
+    }
+  }
+};
+
+/// outputs of one stage of the replay
+struct StageStats {
+  std::string name;
+  int count = 0;
+  Hash hash;
+};
+
+typedef std::chrono::steady_clock Clock;
+
+double SecondsSince(Clock::time_point start){
+  return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+/// the waypoints nature_path_manager_node would send
+nature::msg::Path WaypointsFromParams(std::shared_ptr<nature::node::NodeProxy> n){
+  std::vector<double> waypoints_x, waypoints_y;
+  n->get_parameter("/waypoints_x", waypoints_x, std::vector<double>(0));
+  n->get_parameter("/waypoints_y", waypoints_y, std::vector<double>(0));
+  nature::msg::Path waypoints;
+  for (size_t i = 0; i < std::min(waypoints_x.size(), waypoints_y.size()); i++){
+    nature::msg::PoseStamped pose;
+    pose.pose.position.x = waypoints_x[i];
+    pose.pose.position.y = waypoints_y[i];
+    pose.pose.orientation.w = 1.0;
+    waypoints.poses.push_back(pose);
+  }
+  return waypoints;
+}
+
+/// bags list topics with or without the leading slash
+bool IsTopic(const std::string &topic, const std::string &name){
+  return topic == name || (topic[0] == '/' && topic.substr(1) == name) || (name[0] == '/' && name.substr(1) == topic);
+}
+
+} // namespace
+
+int main(int argc, char *argv[]){
+  auto n = nature::node::init_node(argc, argv, "nature_replay_node");
+
+  std::string bag_file;
+  bool publish_clock;
+  double connect_wait, tail;
+  std::vector<std::string> points_topics;
+  n->get_parameter("~bag", bag_file, std::string(""));
+  n->get_parameter("~publish_clock", publish_clock, true);
+  n->get_parameter("~connect_wait", connect_wait, 2.0);
+  n->get_parameter("~tail", tail, 1.0);
+  n->get_parameter("~perception/points_topics", points_topics, std::vector<std::string>(1, "nature/points"));
+  if (bag_file.empty()){
+    std::cerr << "WARNING: nature_replay_node needs a bag in ~bag" << std::endl;
+    return 1;
+  }
+  const std::string odometry_topic = "nature/odometry";
+  const std::string waypoints_topic = "nature/new_waypoints";
+
+  rosbag::Bag bag;
+  try {
+    bag.open(bag_file, rosbag::bagmode::Read);
+  }
+  catch (const rosbag::BagException &e){
+    std::cerr << "WARNING: could not open " << bag_file << ", " << e.what() << std::endl;
+    return 1;
+  }
+  std::vector<std::string> topics = points_topics;
+  topics.push_back(odometry_topic);
+  topics.push_back(waypoints_topic);
+  for (size_t k = 0, num_topics = topics.size(); k < num_topics; k++){
+    topics.push_back(topics[k][0] == '/' ? topics[k].substr(1) : "/" + topics[k]);
+  }
+  rosbag::View view(bag, rosbag::TopicQuery(topics));
+  if (view.size() == 0){
+    std::cerr << "WARNING: " << bag_file << " has none of the replayed topics" << std::endl;
+    return 1;
+  }
+  double first_stamp = view.getBeginTime().toSec();
+  double last_stamp = view.getEndTime().toSec();
+
+  // the stages would open windows of their own otherwise
+  const char *stage_names[] = {"perception", "global", "local", "control"};
+  for (int s = 0; s < 4; s++){
+    ros::NodeHandle stage_node(std::string("~") + stage_names[s]);
+    if (!stage_node.hasParam("display")) stage_node.setParam("display", "none");
+  }
+
+  // the recorded messages go to the stages, their outputs come back to the global queue of this node
+  auto odometry_pub = n->create_publisher<nature::msg::Odometry>(odometry_topic, 10);
+  auto waypoints_pub = n->create_publisher<nature::msg::Path>(waypoints_topic, 10);
+  std::vector<std::shared_ptr<nature::node::Publisher<nature::msg::PointCloud2>>> points_pubs;
+  for (size_t k = 0; k < points_topics.size(); k++){
+    points_pubs.push_back(n->create_publisher<nature::msg::PointCloud2>(points_topics[k], 2));
+  }
+  std::shared_ptr<nature::node::ClockPublisher> clock_pub;
+  if (publish_clock) clock_pub = nature::node::ClockPublisher::make_shared("clock", 1, n);
+
+  StageStats grid_stats, global_stats, local_stats, control_stats;
+  grid_stats.name = "perception.grids";
+  global_stats.name = "global.paths";
+  local_stats.name = "local.paths";
+  control_stats.name = "control.commands";
+  auto grid_sub = n->create_subscription<nature::msg::OccupancyGrid>("nature/occupancy_grid", 10,
+    [&grid_stats](nature::msg::OccupancyGridPtr grid){
+      grid_stats.count++;
+      grid_stats.hash.Add(grid->data.data(), grid->data.size());
+    });
+  auto grid_update_sub = n->create_subscription<nature::msg::OccupancyGridUpdate>("nature/occupancy_grid_updates", 10,
+    [&grid_stats](nature::msg::OccupancyGridUpdatePtr update){
+      grid_stats.count++;
+      int32_t window[4] = {update->x, update->y, (int32_t)update->width, (int32_t)update->height};
+      grid_stats.hash.Add(window, sizeof(window));
+      grid_stats.hash.Add(update->data.data(), update->data.size());
+    });
+  auto global_path_sub = n->create_subscription<nature::msg::Path>("nature/global_path", 10,
+    [&global_stats](nature::msg::PathPtr path){
+      global_stats.count++;
+      global_stats.hash.Add(*path);
+    });
+  auto local_path_sub = n->create_subscription<nature::msg::Path>("nature/local_path", 10,
+    [&local_stats](nature::msg::PathPtr path){
+      local_stats.count++;
+      local_stats.hash.Add(*path);
+    });
+  auto command_sub = n->create_subscription<nature::msg::Twist>("nature/cmd_vel", 10,
+    [&control_stats](nature::msg::TwistPtr dc){
+      control_stats.count++;
+      control_stats.hash.Add(dc->linear.x);
+      control_stats.hash.Add(dc->linear.y);
+      control_stats.hash.Add(dc->angular.z);
+    });
+
+  // the stages run as nodelets of this process, each with its own queue and private namespace
+  nature::common::ReplayClock clock(first_stamp);
+  std::vector<std::shared_ptr<nature::node::NodeProxy>> stages;
+  for (int s = 0; s < 4; s++){
+    stages.push_back(std::make_shared<nature::node::NodeProxy>(stage_names[s], ros::NodeHandle(),
+                                                               ros::NodeHandle(std::string("~") + stage_names[s])));
+  }
+  int (*const runs[])(std::shared_ptr<nature::node::NodeProxy>) = {
+    nature::node::RunPerception, nature::node::RunGlobalPath, nature::node::RunLocalPlanner, nature::node::RunControl};
+  std::vector<nature::common::ReplayThread> threads;
+  for (int s = 0; s < 4; s++){
+    std::shared_ptr<nature::node::NodeProxy> stage = stages[s];
+    int (*run)(std::shared_ptr<nature::node::NodeProxy>) = runs[s];
+    threads.push_back(nature::common::ReplayThread([stage, run](){ run(stage); }));
+  }
+
+  // the stages create their topics before they first wait, the connections in the process
+  // are made by the master in wall time and must be up before any message is replayed
+  clock.RunUntil(first_stamp);
+  ros::WallDuration(connect_wait).sleep();
+  nature::msg::Path waypoints = WaypointsFromParams(n);
+  if (!waypoints.poses.empty()) waypoints_pub->publish(waypoints);
+
+  Clock::time_point replay_start = Clock::now();
+  int num_messages = 0;
+  for (rosbag::View::iterator it = view.begin(); it != view.end() && n->ok(); ++it){
+    const rosbag::MessageInstance &m = *it;
+    clock.RunUntil(m.getTime().toSec());
+    n->spin_some();
+    if (clock_pub) clock_pub->publish(m.getTime().toSec());
+    if (IsTopic(m.getTopic(), odometry_topic)){
+      boost::shared_ptr<nature::msg::Odometry> odom = m.instantiate<nature::msg::Odometry>();
+      if (odom) odometry_pub->publish(odom);
+    }
+    else if (IsTopic(m.getTopic(), waypoints_topic)){
+      boost::shared_ptr<nature::msg::Path> recorded_waypoints = m.instantiate<nature::msg::Path>();
+      if (recorded_waypoints) waypoints_pub->publish(recorded_waypoints);
+    }
+    else {
+      boost::shared_ptr<nature::msg::PointCloud2> cloud = m.instantiate<nature::msg::PointCloud2>();
+      for (size_t k = 0; cloud && k < points_topics.size(); k++){
+        if (IsTopic(m.getTopic(), points_topics[k])) points_pubs[k]->publish(cloud);
+      }
+    }
+    num_messages++;
+  }
+  clock.RunUntil(last_stamp + tail);
+  double wall = SecondsSince(replay_start);
+  bag.close();
+
+  for (size_t s = 0; s < stages.size(); s++) stages[s]->shutdown();
+  if (!clock.RunUntilLeft()){
+    // the stages still hold the clock, they cannot be joined
+    std::cerr << "WARNING: the stages did not stop at the end of the replay" << std::endl;
+    exit(1);
+  }
+  for (size_t s = 0; s < threads.size(); s++) threads[s].join();
+  n->spin_some();
+
+  double replayed = last_stamp - first_stamp;
+  std::cout << "Replayed " << num_messages << " messages, " << replayed << " s of " << bag_file << " in " << wall << " s wall, "
+            << (wall > 0.0 ? replayed / wall : 0.0) << "x real time" << std::endl;
+  std::cout << std::left << std::setw(20) << "stage" << std::right << std::setw(10) << "count" << "  hash" << std::endl;
+  Hash combined;
+  const StageStats *stats[] = {&grid_stats, &global_stats, &local_stats, &control_stats};
+  for (int s = 0; s < 4; s++){
+    const StageStats &st = *stats[s];
+    std::ios::fmtflags flags = std::cout.flags();
+    std::cout << std::left << std::setw(20) << st.name << std::right << std::setw(10) << st.count
+              << "  " << std::hex << std::setw(16) << std::setfill('0') << st.hash.value << std::setfill(' ') << std::endl;
+    std::cout.flags(flags);
+    combined.Add(&st.hash.value, sizeof(st.hash.value));
+  }
+  std::cout << "output hash " << std::hex << std::setw(16) << std::setfill('0') << combined.value << std::dec << std::setfill(' ') << std::endl;
+  return 0;
+}
@@ -1,9 +1,50 @@
+/**
+ * \file nature_sim_test_node.cpp
+ *
+ * Headless simulator to drive and load test the stack without an external simulator.
+ * A kinematic bicycle follows the throttle, brake and steering of nature/cmd_vel,
+ * and a spinning multi-beam lidar is raycast against the ground and the cylinders
+ * of /obstacles_x, /obstacles_y and /obstacles_r (config/map_obstacles.yaml).
+ * The points are published in the odom frame on nature/points, the pose on
+ * nature/odometry and nature/veh.
+ * With use_sim_time the node owns /clock and steps as fast as it can, or at
+ * ~real_time_factor times real time, without it the steps follow the wall clock.
+ *
+ * Parameters:
+ *   ~start_x, ~start_y, ~start_yaw        initial pose, default -55, 0, 0
+ *   ~vehicle_speed                        speed at full throttle in m/s, default 5
+ *   ~speed_time_constant                  seconds to approach the throttle speed, default 1
+ *   ~max_decel                            deceleration at full brake in m/s^2, default 6
+ *   ~vehicle_wheelbase                    default 2.6
+ *   ~vehicle_max_steer_angle_degrees      steering angle of a full command, default 25
+ *   ~heightmap_file                       grayscale PGM, PPM or BMP of the ground heights, north up, flat ground if empty
+ *   ~heightmap_res, ~heightmap_llx, ~heightmap_lly  meters per pixel and lower-left corner, default 1, -100, -100
+ *   ~heightmap_scale                      meters per gray level, default 0.05
+ *   ~obstacle_height                      height of the cylinders in meters, default 2
+ *   ~lidar_channels                       beams, default 64
+ *   ~lidar_min_elevation, ~lidar_max_elevation  degrees, default -25, 15
+ *   ~lidar_horizontal_steps               azimuths of a turn, default 1800
+ *   ~lidar_max_range                      meters, default 120
+ *   ~lidar_height                         above the ground in meters, default 1.8
+ *   ~lidar_rate                           scans a second, default 10
+ *   ~lidar_threads                        threads casting the rays, default 1
+ *   ~real_time_factor                     with use_sim_time, most sim seconds per wall second, 0 for as fast as possible
+ *
+ * \date 10/14/2026
+ */
+// c++ includes
+#include <math.h>
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <thread>
 //ros includes
 #include "nature/node/ros_types.h"
 #include "nature/node/node_proxy.h"
 #include "nature/node/clock_publisher.h"
 // point cloud includes
 #include "nature/perception/point_cloud_generator.h"
+#include "nature/simulation/lidar_simulator.h"
 
 nature::msg::Twist twist;
 void TwistCallback(nature::msg::TwistPtr rcv_msg){
@@ -12,6 +53,32 @@ void TwistCallback(nature::msg::TwistPtr rcv_msg){
 	twist.angular.z = rcv_msg->angular.z; // steering
 }
 
+/// Kinematic bicycle driven by normalized throttle, brake and steering
+struct Vehicle {
+  float x;
+  float y;
+  float yaw;
+  float speed;
+
+  /**
+   * Advance the vehicle by a step
+   * \param cmd The throttle in linear.x [0,1], brake magnitude in linear.y [-1,1], steering in angular.z [-1,1]
+   */
+  void Step(const nature::msg::Twist &cmd, float dt, float max_speed, float time_constant,
+            float max_decel, float wheelbase, float max_steer){
+    float throttle = std::min(1.0f, std::max(0.0f, (float)cmd.linear.x));
+    float brake = std::min(1.0f, (float)fabs(cmd.linear.y));
+    float steer = max_steer*std::min(1.0f, std::max(-1.0f, (float)cmd.angular.z));
+    // the speed relaxes to the throttle speed, the brake works against it
+    float accel = (throttle*max_speed - speed)/std::max(time_constant, dt) - brake*max_decel;
+    if (throttle <= 0.0f) accel = std::min(accel, 0.0f);
+    speed = std::max(0.0f, speed + accel*dt);
+    yaw += speed*tanf(steer)/wheelbase*dt;
+    x += speed*cosf(yaw)*dt;
+    y += speed*sinf(yaw)*dt;
+  }
+};
+
 int main(int argc, char **argv){
 
   auto n = nature::node::init_node(argc,argv,"nature_simulation_test_node");
@@ -30,51 +97,81 @@ int main(int argc, char **argv){
 	if (use_sim_time){
     clock_pub = nature::node::ClockPublisher::make_shared("clock", 1, n);
 	}
+  float real_time_factor;
+  n->get_parameter("~real_time_factor", real_time_factor, 0.0f);
+
+  Vehicle veh;
+  float max_speed, time_constant, max_decel, wheelbase, max_steer_degrees;
+  n->get_parameter("~start_x", veh.x, -55.0f);
+  n->get_parameter("~start_y", veh.y, 0.0f);
+  n->get_parameter("~start_yaw", veh.yaw, 0.0f);
+  veh.speed = 0.0f;
+  n->get_parameter("~vehicle_speed", max_speed, 5.0f);
+  n->get_parameter("~speed_time_constant", time_constant, 1.0f);
+  n->get_parameter("~max_decel", max_decel, 6.0f);
+  n->get_parameter("~vehicle_wheelbase", wheelbase, 2.6f);
+  n->get_parameter("~vehicle_max_steer_angle_degrees", max_steer_degrees, 25.0f);
+  float max_steer = max_steer_degrees*(float)M_PI/180.0f;
+
+  // the world
+  nature::simulation::SimulatedWorld world;
+  std::string heightmap_file;
+  float heightmap_res, heightmap_llx, heightmap_lly, heightmap_scale, obstacle_height;
+  n->get_parameter("~heightmap_file", heightmap_file, std::string(""));
+  n->get_parameter("~heightmap_res", heightmap_res, 1.0f);
+  n->get_parameter("~heightmap_llx", heightmap_llx, -100.0f);
+  n->get_parameter("~heightmap_lly", heightmap_lly, -100.0f);
+  n->get_parameter("~heightmap_scale", heightmap_scale, 0.05f);
+  n->get_parameter("~obstacle_height", obstacle_height, 2.0f);
+  if (!heightmap_file.empty()){
+    world.LoadHeightmap(heightmap_file, heightmap_res, heightmap_llx, heightmap_lly, heightmap_scale);
+  }
+  std::vector<double> obs_x_list, obs_y_list, obs_r_list;
+  n->get_parameter("/obstacles_x", obs_x_list, std::vector<double>(0));
+  n->get_parameter("/obstacles_y", obs_y_list, std::vector<double>(0));
+  n->get_parameter("/obstacles_r", obs_r_list, std::vector<double>(0));
+  if (!(obs_x_list.size()==obs_y_list.size() && obs_x_list.size()==obs_r_list.size())){
+    std::cerr<<"WARNING: The list of obstacle position and radius did not match in the input file, simulating no obstacles."<<std::endl;
+  }
+  else {
+    for (size_t i = 0; i < obs_x_list.size(); i++){
+      world.AddCylinder((float)obs_x_list[i], (float)obs_y_list[i], (float)obs_r_list[i], obstacle_height);
+    }
+  }
+  world.Build();
+
+  // the lidar
+  int lidar_channels, lidar_horizontal_steps, lidar_threads;
+  float lidar_min_elevation, lidar_max_elevation, lidar_max_range, lidar_height, lidar_rate;
+  n->get_parameter("~lidar_channels", lidar_channels, 64);
+  n->get_parameter("~lidar_min_elevation", lidar_min_elevation, -25.0f);
+  n->get_parameter("~lidar_max_elevation", lidar_max_elevation, 15.0f);
+  n->get_parameter("~lidar_horizontal_steps", lidar_horizontal_steps, 1800);
+  n->get_parameter("~lidar_max_range", lidar_max_range, 120.0f);
+  n->get_parameter("~lidar_height", lidar_height, 1.8f);
+  n->get_parameter("~lidar_rate", lidar_rate, 10.0f);
+  n->get_parameter("~lidar_threads", lidar_threads, 1);
+  nature::simulation::SimulatedLidar lidar(lidar_channels, lidar_min_elevation, lidar_max_elevation,
+                                           lidar_horizontal_steps, lidar_max_range);
 
 	// create and populate the odometry message that will be published
 	nature::msg::Odometry odom_msg;
 	odom_msg.header.frame_id = "odom";
   nature::node::set_seq(odom_msg.header, 0);
-	odom_msg.pose.pose.position.x = -55.0;
-	odom_msg.pose.pose.position.y = 0.0;
-	odom_msg.pose.pose.position.z = 1.0;
-	odom_msg.pose.pose.orientation.w = 1.0;
 	odom_msg.pose.pose.orientation.x = 0.0;
 	odom_msg.pose.pose.orientation.y = 0.0;
-	odom_msg.pose.pose.orientation.z = 0.0;
-	odom_msg.twist.twist.linear.x = 0.0;
-	odom_msg.twist.twist.linear.y = 0.0;
 	odom_msg.twist.twist.linear.z = 0.0;
 	odom_msg.twist.twist.angular.x = 0.0;
 	odom_msg.twist.twist.angular.y = 0.0;
-	odom_msg.twist.twist.angular.z = 0.0;
 
-	// create and populate the point cloud message that will be published
   nature::msg::PointCloud2 pc2;
-	std::vector<nature::utils::vec3> points {
-	  nature::utils::vec3(50.0, 0.0, 0.0),
-    nature::utils::vec3(15.1, 7.8, 5.0),
-    nature::utils::vec3(15.1, 7.8, 1.0),
-    nature::utils::vec3(14.5, 8.5, 7.0),
-    nature::utils::vec3(14.5, 8.5, 1.0),
-    nature::utils::vec3(14.6, 8.2, 4.5),
-    nature::utils::vec3(14.6, 8.2, 1.5),
-    nature::utils::vec3(15.1, -7.8, 0.0),
-    nature::utils::vec3(14.5, -8.5, 0.0),
-    nature::utils::vec3(14.6, -8.2, 0.1)
-	};
-    std::vector<int> seg_values = {
-            0,
-            0,
-            0,
-            0,
-            0,
-            0,
-            0,
-            1,
-            1,
-            1
-    };
+  pc2.header.frame_id = "odom";
+  nature::node::set_seq(pc2.header, 0);
+  std::vector<nature::utils::vec3> points;
+  std::vector<uint16_t> rings;
+  nature::perception::PointCloudGenerator::PointChannels channels;
+  channels.ring = &rings;
+
 	std::vector<double> veh_data = {0.0, -50.0, 1.8, 5.0, 0.0, 0.0, 0.0, 0.0, 0.0};
 	nature::msg::Float64MultiArray mpc_data_msg;
 	mpc_data_msg.layout.dim.push_back(std_msgs::MultiArrayDimension());
@@ -82,25 +179,32 @@ int main(int argc, char **argv){
 	mpc_data_msg.layout.dim[0].stride = 1;
 	mpc_data_msg.layout.dim[0].label = "x";
 
-  nature::perception::PointCloudGenerator::toROSMsg(points, seg_values,pc2);
-  pc2.header.frame_id = "odom";
-  nature::node::set_seq(pc2.header, 0);
-
-	//odometry published at 100 Hz, point clout at 10 Hz
+	//odometry published at 100 Hz, point cloud at lidar_rate
 	double dt = 0.01;
 	nature::node::Rate rate(1.0/dt);
+  int steps_per_scan = std::max(1, (int)lround(1.0/(std::max(lidar_rate, 1.0e-3f)*dt)));
 
 	// variables for tracking time if "use_sim_time" is on
 	double elapsed_time = 0.0;
 	int nloops = 0;
-	float desired_speed = 5.0f;
+  std::chrono::steady_clock::time_point wall_start = std::chrono::steady_clock::now();
 	// ros simulation loop
 	while (nature::node::ok()) {
 
+    float prev_yaw = veh.yaw;
+    veh.Step(twist, (float)dt, max_speed, time_constant, max_decel, wheelbase, max_steer);
+    float ground = world.GroundHeight(veh.x, veh.y);
+
 		// publish the odometry message
 		odom_msg.header.stamp = n->get_stamp();
-		odom_msg.pose.pose.position.x += twist.linear.x*desired_speed*dt;
-		odom_msg.twist.twist.linear.x = desired_speed*twist.linear.x;
+		odom_msg.pose.pose.position.x = veh.x;
+		odom_msg.pose.pose.position.y = veh.y;
+		odom_msg.pose.pose.position.z = ground;
+		odom_msg.pose.pose.orientation.w = cos(0.5*veh.yaw);
+		odom_msg.pose.pose.orientation.z = sin(0.5*veh.yaw);
+		odom_msg.twist.twist.linear.x = veh.speed*cos(veh.yaw);
+		odom_msg.twist.twist.linear.y = veh.speed*sin(veh.yaw);
+		odom_msg.twist.twist.angular.z = (veh.yaw - prev_yaw)/dt;
 		odom_pub->publish(odom_msg);
 		veh_data[1] = odom_msg.pose.pose.position.x;
 		veh_data[2] = odom_msg.pose.pose.position.y;
@@ -111,23 +215,30 @@ int main(int argc, char **argv){
 		mpc_state_pub->publish(mpc_data_msg);
 		nature::node::inc_seq(odom_msg.header);
 
-		
-		if (nloops%10==0){
-			// publish the point cloud at 10 Hz
+		if (nloops%steps_per_scan==0){
+			// a whole turn from the current pose, the points registered to odom
+      nature::utils::vec3 origin(veh.x, veh.y, ground + lidar_height);
+      lidar.Scan(world, origin, veh.yaw, points, lidar_threads, &rings);
+      // packed into the buffer of the previous scan
+      nature::perception::PointCloudGenerator::toROSMsg(points, channels, pc2);
 			pc2.header.stamp = n->get_stamp();
 			lidar_pub->publish(pc2);
 			nature::node::inc_seq(pc2.header);
 		}
-			
+
 		// update and publish time if necessary
 		if (use_sim_time ){
       clock_pub->publish(elapsed_time);
 			elapsed_time += dt;
+      if (real_time_factor > 0.0f){
+        std::this_thread::sleep_until(wall_start + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+          std::chrono::duration<double>(elapsed_time/real_time_factor)));
+      }
 		}
 		else {
 			rate.sleep();
 		}
-		
+
 		n->spin_some();
 		nloops++;
 	} //while ros OK
@@ -135,4 +246,3 @@ int main(int argc, char **argv){
 
 	return 0;
 }
-
@@ -1,41 +1,145 @@
 #include "nature/visualization/image_visualizer.h"
+#include <algorithm>
+#include <chrono>
+#include <iostream>
 
 namespace nature {
   namespace visualization {
 
+    ImageVisualizer::ImageVisualizer(float max_fps) : max_fps_(max_fps) {
+      image_ = std::make_shared<Image>();
+    }
+
+    ImageVisualizer::~ImageVisualizer() {
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stop_ = true;
+      }
+      frame_ready_.notify_one();
+      if (render_thread_.joinable()) render_thread_.join();
+    }
 
     bool ImageVisualizer::initialize_display(int nx, int ny) {
-      disp_.resize(nx, ny);
-      image_ = cimg_library::CImg<float>();
-      image_.assign(nx, ny, 1, 3, 0.0f);
+      if (!render_thread_.joinable()) {
+        render_thread_ = std::thread(&ImageVisualizer::RenderLoop, this);
+      }
+      // reuses the storage when the size is unchanged
+      image_->assign(nx, ny, 1, 3);
+      image_->fill(0.0f);
       return true;
     }
 
     void ImageVisualizer::draw_point(const int x0, const int y0, const nature::utils::vec3 &color) {
-      image_.draw_point(x0,y0, (float *)&color);
+      image_->draw_point(x0,y0, (float *)&color);
     }
 
     void ImageVisualizer::draw_line(const int x0, const int y0, const int x1, const int y1,
                                     const nature::utils::vec3 &color) {
-      image_.draw_line(x0, y0, x1, y1, (float *)&color);
+      image_->draw_line(x0, y0, x1, y1, (float *)&color);
+    }
+
+    void ImageVisualizer::draw_grid(const int8_t *cells, int nx, int ny, const nature::utils::vec3 &color) {
+      const int w = image_->width();
+      const int h = image_->height();
+      const int ni = std::min(nx, w);
+      const int nj = std::min(ny, h);
+      const size_t plane = (size_t)w*h;
+      float *r = image_->data();
+      float *g = r + plane;
+      float *b = g + plane;
+      // row by row so the image planes are written in order, the grid columns are read strided
+      for (int j = 0; j < nj; j++) {
+        const int8_t *cell = cells + j;
+        float *r_row = r + (size_t)j*w;
+        float *g_row = g + (size_t)j*w;
+        float *b_row = b + (size_t)j*w;
+        for (int i = 0; i < ni; i++) {
+          bool occupied = cell[(size_t)i*ny] > 0;
+          r_row[i] = occupied ? color.x : r_row[i];
+          g_row[i] = occupied ? color.y : g_row[i];
+          b_row[i] = occupied ? color.z : b_row[i];
+        }
+      }
+    }
+
+    void ImageVisualizer::draw_points(const std::vector<nature::utils::ivec2> &points, const nature::utils::vec3 &color) {
+      const int w = image_->width();
+      const int h = image_->height();
+      const size_t plane = (size_t)w*h;
+      float *r = image_->data();
+      for (size_t k = 0; k < points.size(); k++) {
+        const nature::utils::ivec2 &pt = points[k];
+        if (pt.x < 0 || pt.x >= w || pt.y < 0 || pt.y >= h) continue;
+        size_t p = (size_t)pt.y*w + pt.x;
+        r[p] = color.x;
+        r[p + plane] = color.y;
+        r[p + 2*plane] = color.z;
+      }
     }
 
     void ImageVisualizer::display() {
-      auto img = image_.get_mirror('y');
-      disp_ = img;
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        std::swap(image_, frame_);
+        fresh_ = true;
+      }
+      frame_ready_.notify_one();
+      // the previous frame is drawn over next unless the render thread is still showing it
+      if (!image_ || image_.use_count() > 1) image_ = std::make_shared<Image>();
+    }
+
+    void ImageVisualizer::RenderLoop() {
+      std::chrono::steady_clock::time_point next_frame = std::chrono::steady_clock::now();
+      while (true) {
+        std::shared_ptr<const Image> frame;
+        {
+          std::unique_lock<std::mutex> lock(mutex_);
+          frame_ready_.wait(lock, [this]{ return fresh_ || stop_; });
+          if (stop_) break;
+          frame = frame_;
+          fresh_ = false;
+        }
+        Image img = frame->get_mirror('y');
+        frame.reset();
+        try {
+          if (disp_.is_empty()) {
+            disp_.assign(img);
+          }
+          else {
+            if (disp_.width() != img.width() || disp_.height() != img.height()) disp_.resize(img, false);
+            disp_.display(img);
+          }
+        }
+        catch (const cimg_library::CImgDisplayException &e) {
+          std::cerr << "WARNING: Image display stopped, " << e.what() << std::endl;
+          return;
+        }
+        if (max_fps_ > 0.0f) {
+          next_frame += std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<float>(1.0f/max_fps_));
+          std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+          if (next_frame < now) next_frame = now;
+          else std::this_thread::sleep_until(next_frame);
+        }
+      }
+    }
+
+    std::shared_ptr<const ImageVisualizer::Image> ImageVisualizer::SavedFrame() {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (frame_) return frame_;
+      return image_;
     }
 
     void ImageVisualizer::save(const std::string &file_name) {
-      image_.save(file_name.c_str());
+      SavedFrame()->save(file_name.c_str());
     }
 
     void ImageVisualizer::save(const std::string &file_name, int nx, int ny) {
-      auto img = image_.get_resize(nx,ny);
+      auto img = SavedFrame()->get_resize(nx,ny);
       img.save(file_name.c_str());
     }
 
     void ImageVisualizer::draw_circle(const int x0, const int y0, int radius, const nature::utils::vec3 &color) {
-      image_.draw_circle(x0, y0, radius, (float *)&color);
+      image_->draw_circle(x0, y0, radius, (float *)&color);
     }
   }
-}
\ No newline at end of file
+}